@@ -0,0 +1,11 @@
+// Call-heavy benchmark: naive recursive Fibonacci
+int fibonacci(int n) {
+    if (n <= 1) {
+        return n;
+    }
+    return fibonacci(n - 1) + fibonacci(n - 2);
+}
+
+int main() {
+    return fibonacci(38) / 1000;
+}
@@ -0,0 +1,65 @@
+#!/bin/sh
+# Build an executable from a generated program of many small files (5000
+# by default) spread over nested directories, given to leancc as the
+# directory, once with io_uring and once with the thread pool. Reports
+# the best time of several runs and the system calls spent loading, and
+# checks that both builds behave the same.
+#
+# Usage: bench/files.sh <leancc> [files] [runs]
+
+LEANCC=${1:-build/leancc}
+FILES=${2:-5000}
+RUNS=${3:-3}
+TMP=${TMPDIR:-/tmp}/leancc-files.$$
+mkdir -p "$TMP/src"
+trap 'rm -rf "$TMP"' EXIT
+
+# main.c calls one function from each of the other files
+awk -v n="$FILES" -v dir="$TMP/src" 'BEGIN {
+    main = dir "/main.c";
+    print "int main() {" > main;
+    print "    int s = 0;" > main;
+    for (i = 1; i < n; i++) {
+        sub_dir = dir "/d" int(i / 100);
+        if (sub_dir != last_dir) system("mkdir -p " sub_dir);
+        last_dir = sub_dir;
+        file = sub_dir "/f" i ".c";
+        print "int f" i "(int a) {" > file;
+        print "    if (a > " i ") { return a - " i "; }" > file;
+        print "    return a + " i % 13 ";" > file;
+        print "}" > file;
+        close(file);
+        print "    s = s + f" i "(s / 3) / 1000;" > main;
+    }
+    print "    return s / 1000;" > main;
+    print "}" > main;
+}'
+
+# Wall-clock seconds for one run of a command
+run_time() {
+    start=$(date +%s.%N)
+    "$@" || return 1
+    end=$(date +%s.%N)
+    awk "BEGIN { printf \"%.3f\", $end - $start }"
+}
+
+printf "%-14s %10s %14s\n" "loader" "seconds" "system calls"
+for loader in io_uring threads; do
+    flag=
+    [ "$loader" = threads ] && flag=-fno-io-uring
+    best=
+    i=0
+    while [ "$i" -lt "$RUNS" ]; do
+        t=$(run_time "$LEANCC" $flag "$TMP/src" -o "$TMP/$loader") || exit 1
+        if [ -z "$best" ] || awk "BEGIN { exit !($t < $best) }"; then
+            best=$t
+        fi
+        i=$((i + 1))
+    done
+    calls=$("$LEANCC" $flag --stats "$TMP/src" -o "$TMP/$loader" 2>&1 |
+            sed -n 's/.*load: .* in \([0-9]*\) system calls.*/\1/p')
+    "$TMP/$loader"
+    echo $? > "$TMP/$loader.exit"
+    printf "%-14s %10s %14s\n" "$loader" "$best" "$calls"
+done
+cmp -s "$TMP/io_uring.exit" "$TMP/threads.exit" || { echo "exit codes differ"; exit 1; }
@@ -0,0 +1,78 @@
+#!/bin/sh
+# Compile a generated program of many units (200 by default) that each
+# include every one of a set of headers (100 by default), which include
+# each other as well, to assembly. Run once with '#ifndef X' guards, which
+# leancc detects and then skips the header without reading it again, and
+# once with the same guards spelled '#if !defined(X)', which it does not
+# detect, so every repeated include runs through the header's tokens to
+# its #endif. Reports the best time of several runs and what the
+# preprocessor did, and checks that both builds write the same assembly.
+#
+# Usage: bench/headers.sh <leancc> [units] [headers] [runs]
+
+LEANCC=${1:-build/leancc}
+LEANCC=$(cd "$(dirname "$LEANCC")" && pwd)/$(basename "$LEANCC")
+UNITS=${2:-200}
+HEADERS=${3:-100}
+RUNS=${4:-3}
+TMP=${TMPDIR:-/tmp}/leancc-headers.$$
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+
+# generate <directory> <guard opening line, with X for the macro>
+generate() {
+    mkdir -p "$1/src" "$1/out"
+    awk -v units="$UNITS" -v headers="$HEADERS" -v dir="$1/src" -v open="$2" 'BEGIN {
+        for (h = 0; h < headers; h++) {
+            file = dir "/h" h ".h";
+            guard = open;
+            sub(/X/, "H" h "_H", guard);
+            print guard > file;
+            print "#define H" h "_H" > file;
+            for (i = 0; i < h; i++) print "#include \"h" i ".h\"" > file;
+            for (i = 0; i < 20; i++) print "#define V" h "_" i "(a) ((a) * " i + 1 " + " h ")" > file;
+            print "#endif" > file;
+            close(file);
+        }
+        for (u = 0; u < units; u++) {
+            file = dir "/u" u ".c";
+            for (h = headers - 1; h >= 0; h--) print "#include \"h" h ".h\"" > file;
+            print "int u" u "(int a) {" > file;
+            print "    return V" u % headers "_3(a) + V0_" u % 20 "(a);" > file;
+            print "}" > file;
+            close(file);
+        }
+    }'
+}
+generate "$TMP/ifndef" "#ifndef X"
+generate "$TMP/if" "#if !defined(X)"
+
+# Wall-clock seconds for one run of a command
+run_time() {
+    start=$(date +%s.%N)
+    "$@" || return 1
+    end=$(date +%s.%N)
+    awk "BEGIN { printf \"%.3f\", $end - $start }"
+}
+
+printf "%-18s %10s %10s %10s %10s\n" "guards" "seconds" "includes" "skipped" "read"
+for guards in ifndef if; do
+    best=
+    i=0
+    while [ "$i" -lt "$RUNS" ]; do
+        t=$(cd "$TMP/$guards/out" && run_time "$LEANCC" -S "$TMP/$guards/src") || exit 1
+        if [ -z "$best" ] || awk "BEGIN { exit !($t < $best) }"; then
+            best=$t
+        fi
+        i=$((i + 1))
+    done
+    counts=$(cd "$TMP/$guards/out" && "$LEANCC" -S --stats "$TMP/$guards/src" 2>&1 |
+             awk '/: preprocess: / { n += $3; s += $5; r += $15 } END { print n, s, r }')
+    set -- $counts
+    label="#ifndef X"
+    [ "$guards" = if ] && label="#if !defined(X)"
+    printf "%-18s %10s %10s %10s %10s\n" "$label" "$best" "$1" "$2" "$3"
+done
+for out in "$TMP/ifndef/out"/*.s; do
+    cmp -s "$out" "$TMP/if/out/$(basename "$out")" || { echo "$(basename "$out") differs"; exit 1; }
+done
@@ -0,0 +1,22 @@
+// Loop benchmark: invariant expressions, induction variable products and
+// multiplications and divisions by powers of two
+int width = 0;
+int scale = 0;
+
+int main() {
+    width = 3000;
+    scale = 7;
+    int total = 0;
+    int row = 0;
+    while (row < 20000) {
+        int col = 0;
+        while (col < width) {
+            int index = row * width + col;
+            int offset = scale * width + scale / 2;
+            total = total + index / 16 + col * offset - (total / 4) * 8;
+            col = col + 1;
+        }
+        row = row + 1;
+    }
+    return total / 1000;
+}
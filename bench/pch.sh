@@ -0,0 +1,88 @@
+#!/bin/sh
+# Compile a generated program of many units (200 by default) to assembly,
+# one leancc process per unit as a build system runs it. Every unit
+# includes the same generated prelude: a header of function-like macros
+# (4000 by default) wrapping the calls of an API, spread over a few
+# headers that it includes. Run once reading the prelude in each process,
+# and once starting each process from the prelude precompiled with
+# --emit-pch. Reports the best time of several runs, and checks that both
+# builds write the same assembly.
+#
+# Usage: bench/pch.sh <leancc> [units] [macros] [runs]
+
+LEANCC=${1:-build/leancc}
+LEANCC=$(cd "$(dirname "$LEANCC")" && pwd)/$(basename "$LEANCC")
+UNITS=${2:-200}
+MACROS=${3:-4000}
+RUNS=${4:-3}
+TMP=${TMPDIR:-/tmp}/leancc-pch.$$
+mkdir -p "$TMP/src" "$TMP/include" "$TMP/header" "$TMP/pch"
+trap 'rm -rf "$TMP"' EXIT
+
+awk -v units="$UNITS" -v macros="$MACROS" -v src="$TMP/src" -v inc="$TMP/include" 'BEGIN {
+    parts = 8;
+    prelude = inc "/prelude.h";
+    print "#ifndef PRELUDE_H" > prelude;
+    print "#define PRELUDE_H" > prelude;
+    for (p = 0; p < parts; p++) {
+        print "#include \"api" p ".h\"" > prelude;
+        file = inc "/api" p ".h";
+        print "#ifndef API" p "_H" > file;
+        print "#define API" p "_H" > file;
+        for (m = p; m < macros; m += parts) {
+            print "#define api_" m "(a, b) api_call(" m ", (a) + " m % 7 ", (b) * " m % 5 + 1 ")" > file;
+        }
+        print "#endif" > file;
+        close(file);
+    }
+    print "#define API_VERSION 3" > prelude;
+    print "#endif" > prelude;
+    close(prelude);
+    for (u = 0; u < units; u++) {
+        file = src "/u" u ".c";
+        print "#include \"prelude.h\"" > file;
+        print "int u" u "(int a) {" > file;
+        print "    return api_" u % macros "(a, API_VERSION) + api_" (u * 7) % macros "(a, 1);" > file;
+        print "}" > file;
+        close(file);
+    }
+}'
+
+# Wall-clock seconds for one run of a command
+run_time() {
+    start=$(date +%s.%N)
+    "$@" || return 1
+    end=$(date +%s.%N)
+    awk "BEGIN { printf \"%.3f\", $end - $start }"
+}
+
+# build <output directory> [leancc flags...]: one process per unit
+build() {
+    out=$1
+    shift
+    for src in "$TMP/src"/*.c; do
+        "$LEANCC" -S -I "$TMP/include" "$@" "$src" -o "$out/$(basename "$src" .c).s" || return 1
+    done
+}
+
+"$LEANCC" -I "$TMP/include" --emit-pch "$TMP/include/prelude.h" -o "$TMP/prelude.pch" || exit 1
+printf "%-18s %10s\n" "prelude" "seconds"
+for mode in header pch; do
+    flags=
+    [ "$mode" = pch ] && flags="--include-pch $TMP/prelude.pch"
+    best=
+    i=0
+    while [ "$i" -lt "$RUNS" ]; do
+        t=$(run_time build "$TMP/$mode" $flags) || exit 1
+        if [ -z "$best" ] || awk "BEGIN { exit !($t < $best) }"; then
+            best=$t
+        fi
+        i=$((i + 1))
+    done
+    label="#include"
+    [ "$mode" = pch ] && label="--include-pch"
+    printf "%-18s %10s\n" "$label" "$best"
+done
+for out in "$TMP/header"/*.s; do
+    cmp -s "$out" "$TMP/pch/$(basename "$out")" || { echo "$(basename "$out") differs"; exit 1; }
+done
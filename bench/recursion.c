@@ -0,0 +1,39 @@
+// Self-recursive functions in tail and accumulator form, deep enough to
+// overflow the stack unless they run as loops
+int seed = 0;
+
+int sum_to(int n) {
+    if (n == 0) {
+        return 0;
+    }
+    return n + sum_to(n - 1);
+}
+
+int power(int base, int exp) {
+    if (exp == 0) {
+        return 1;
+    }
+    return base * power(base, exp - 1);
+}
+
+int collatz_steps(int n, int steps) {
+    if (n == 1) {
+        return steps;
+    }
+    int half = n / 2;
+    if (half * 2 == n) {
+        return collatz_steps(half, steps + 1);
+    }
+    return collatz_steps(3 * n + 1, steps + 1);
+}
+
+int main() {
+    seed = 1;
+    int total = sum_to(seed * 50000000) + power(seed * 3, 100000000);
+    int n = 1;
+    while (n < 300000) {
+        total = total + collatz_steps(n, 0);
+        n = n + seed;
+    }
+    return total / 1000;
+}
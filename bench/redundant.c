@@ -0,0 +1,14 @@
+// Redundancy benchmark: a hot loop that recomputes the same expressions
+int main() {
+    int total = 0;
+    int i = 0;
+    while (i < 100000000) {
+        int a = (i + 3) * (i + 5);
+        int b = (i + 5) * (i + 3);
+        int c = (i + 3) * 7 + (i + 5) * 7;
+        int unused = a * b - c;
+        total = total + a - b + c;
+        i = i + 1;
+    }
+    return total;
+}
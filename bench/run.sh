@@ -0,0 +1,32 @@
+#!/bin/sh
+# Time each benchmark program built by leancc, without the loop optimizations
+# (-fno-licm -fno-strength-reduce), without the SSA optimizations (-fno-gvn
+# -fno-dce), and without register allocation (-fno-regalloc keeps every value
+# on the stack).
+#
+# Usage: bench/run.sh <leancc>
+
+LEANCC=${1:-build/leancc}
+TMP=${TMPDIR:-/tmp}/leancc-bench.$$
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+
+# Wall-clock seconds for one run of a program
+run_time() {
+    start=$(date +%s.%N)
+    "$@" >/dev/null
+    end=$(date +%s.%N)
+    awk "BEGIN { printf \"%.3f\", $end - $start }"
+}
+
+printf "%-16s %12s %12s %12s %12s\n" "benchmark" "optimized" "no-loop-opt" "no-gvn-dce" "stack-only"
+for src in "$(dirname "$0")"/*.c; do
+    name=$(basename "$src" .c)
+    "$LEANCC" "$src" -o "$TMP/$name" || exit 1
+    "$LEANCC" -fno-licm -fno-strength-reduce "$src" -o "$TMP/$name.noloop" || exit 1
+    "$LEANCC" -fno-gvn -fno-dce "$src" -o "$TMP/$name.nossa" || exit 1
+    "$LEANCC" -fno-regalloc "$src" -o "$TMP/$name.naive" || exit 1
+    printf "%-16s %11ss %11ss %11ss %11ss\n" "$name" "$(run_time "$TMP/$name")" \
+        "$(run_time "$TMP/$name.noloop")" "$(run_time "$TMP/$name.nossa")" \
+        "$(run_time "$TMP/$name.naive")"
+done
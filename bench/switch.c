@@ -0,0 +1,349 @@
+// Dispatch-heavy benchmark: a 256-way switch over every byte value, as
+// in a bytecode interpreter, and a sparse switch where most values miss
+int step(int op, int acc) {
+    switch (op) {
+        case 0: acc = acc + 1; break;
+        case 1: acc = acc - 3; break;
+        case 2: acc = acc * 3 + 2; break;
+        case 3: acc = acc / 2 + 15; break;
+        case 4: acc = acc + 5; break;
+        case 5: acc = acc - 15; break;
+        case 6: acc = acc * 3 + 6; break;
+        case 7: acc = acc / 2 + 35; break;
+        case 8: acc = acc + 9; break;
+        case 9: acc = acc - 27; break;
+        case 10: acc = acc * 3 + 10; break;
+        case 11: acc = acc / 2 + 55; break;
+        case 12: acc = acc + 13; break;
+        case 13: acc = acc - 39; break;
+        case 14: acc = acc * 3 + 14; break;
+        case 15: acc = acc / 2 + 75; break;
+        case 16: acc = acc + 17; break;
+        case 17: acc = acc - 51; break;
+        case 18: acc = acc * 3 + 18; break;
+        case 19: acc = acc / 2 + 95; break;
+        case 20: acc = acc + 21; break;
+        case 21: acc = acc - 63; break;
+        case 22: acc = acc * 3 + 22; break;
+        case 23: acc = acc / 2 + 115; break;
+        case 24: acc = acc + 25; break;
+        case 25: acc = acc - 75; break;
+        case 26: acc = acc * 3 + 26; break;
+        case 27: acc = acc / 2 + 135; break;
+        case 28: acc = acc + 29; break;
+        case 29: acc = acc - 87; break;
+        case 30: acc = acc * 3 + 30; break;
+        case 31: acc = acc / 2 + 155; break;
+        case 32: acc = acc + 33; break;
+        case 33: acc = acc - 99; break;
+        case 34: acc = acc * 3 + 34; break;
+        case 35: acc = acc / 2 + 175; break;
+        case 36: acc = acc + 37; break;
+        case 37: acc = acc - 111; break;
+        case 38: acc = acc * 3 + 38; break;
+        case 39: acc = acc / 2 + 195; break;
+        case 40: acc = acc + 41; break;
+        case 41: acc = acc - 123; break;
+        case 42: acc = acc * 3 + 42; break;
+        case 43: acc = acc / 2 + 215; break;
+        case 44: acc = acc + 45; break;
+        case 45: acc = acc - 135; break;
+        case 46: acc = acc * 3 + 46; break;
+        case 47: acc = acc / 2 + 235; break;
+        case 48: acc = acc + 49; break;
+        case 49: acc = acc - 147; break;
+        case 50: acc = acc * 3 + 50; break;
+        case 51: acc = acc / 2 + 255; break;
+        case 52: acc = acc + 53; break;
+        case 53: acc = acc - 159; break;
+        case 54: acc = acc * 3 + 54; break;
+        case 55: acc = acc / 2 + 275; break;
+        case 56: acc = acc + 57; break;
+        case 57: acc = acc - 171; break;
+        case 58: acc = acc * 3 + 58; break;
+        case 59: acc = acc / 2 + 295; break;
+        case 60: acc = acc + 61; break;
+        case 61: acc = acc - 183; break;
+        case 62: acc = acc * 3 + 62; break;
+        case 63: acc = acc / 2 + 315; break;
+        case 64: acc = acc + 65; break;
+        case 65: acc = acc - 195; break;
+        case 66: acc = acc * 3 + 66; break;
+        case 67: acc = acc / 2 + 335; break;
+        case 68: acc = acc + 69; break;
+        case 69: acc = acc - 207; break;
+        case 70: acc = acc * 3 + 70; break;
+        case 71: acc = acc / 2 + 355; break;
+        case 72: acc = acc + 73; break;
+        case 73: acc = acc - 219; break;
+        case 74: acc = acc * 3 + 74; break;
+        case 75: acc = acc / 2 + 375; break;
+        case 76: acc = acc + 77; break;
+        case 77: acc = acc - 231; break;
+        case 78: acc = acc * 3 + 78; break;
+        case 79: acc = acc / 2 + 395; break;
+        case 80: acc = acc + 81; break;
+        case 81: acc = acc - 243; break;
+        case 82: acc = acc * 3 + 82; break;
+        case 83: acc = acc / 2 + 415; break;
+        case 84: acc = acc + 85; break;
+        case 85: acc = acc - 255; break;
+        case 86: acc = acc * 3 + 86; break;
+        case 87: acc = acc / 2 + 435; break;
+        case 88: acc = acc + 89; break;
+        case 89: acc = acc - 267; break;
+        case 90: acc = acc * 3 + 90; break;
+        case 91: acc = acc / 2 + 455; break;
+        case 92: acc = acc + 93; break;
+        case 93: acc = acc - 279; break;
+        case 94: acc = acc * 3 + 94; break;
+        case 95: acc = acc / 2 + 475; break;
+        case 96: acc = acc + 97; break;
+        case 97: acc = acc - 291; break;
+        case 98: acc = acc * 3 + 98; break;
+        case 99: acc = acc / 2 + 495; break;
+        case 100: acc = acc + 101; break;
+        case 101: acc = acc - 303; break;
+        case 102: acc = acc * 3 + 102; break;
+        case 103: acc = acc / 2 + 515; break;
+        case 104: acc = acc + 105; break;
+        case 105: acc = acc - 315; break;
+        case 106: acc = acc * 3 + 106; break;
+        case 107: acc = acc / 2 + 535; break;
+        case 108: acc = acc + 109; break;
+        case 109: acc = acc - 327; break;
+        case 110: acc = acc * 3 + 110; break;
+        case 111: acc = acc / 2 + 555; break;
+        case 112: acc = acc + 113; break;
+        case 113: acc = acc - 339; break;
+        case 114: acc = acc * 3 + 114; break;
+        case 115: acc = acc / 2 + 575; break;
+        case 116: acc = acc + 117; break;
+        case 117: acc = acc - 351; break;
+        case 118: acc = acc * 3 + 118; break;
+        case 119: acc = acc / 2 + 595; break;
+        case 120: acc = acc + 121; break;
+        case 121: acc = acc - 363; break;
+        case 122: acc = acc * 3 + 122; break;
+        case 123: acc = acc / 2 + 615; break;
+        case 124: acc = acc + 125; break;
+        case 125: acc = acc - 375; break;
+        case 126: acc = acc * 3 + 126; break;
+        case 127: acc = acc / 2 + 635; break;
+        case 128: acc = acc + 129; break;
+        case 129: acc = acc - 387; break;
+        case 130: acc = acc * 3 + 130; break;
+        case 131: acc = acc / 2 + 655; break;
+        case 132: acc = acc + 133; break;
+        case 133: acc = acc - 399; break;
+        case 134: acc = acc * 3 + 134; break;
+        case 135: acc = acc / 2 + 675; break;
+        case 136: acc = acc + 137; break;
+        case 137: acc = acc - 411; break;
+        case 138: acc = acc * 3 + 138; break;
+        case 139: acc = acc / 2 + 695; break;
+        case 140: acc = acc + 141; break;
+        case 141: acc = acc - 423; break;
+        case 142: acc = acc * 3 + 142; break;
+        case 143: acc = acc / 2 + 715; break;
+        case 144: acc = acc + 145; break;
+        case 145: acc = acc - 435; break;
+        case 146: acc = acc * 3 + 146; break;
+        case 147: acc = acc / 2 + 735; break;
+        case 148: acc = acc + 149; break;
+        case 149: acc = acc - 447; break;
+        case 150: acc = acc * 3 + 150; break;
+        case 151: acc = acc / 2 + 755; break;
+        case 152: acc = acc + 153; break;
+        case 153: acc = acc - 459; break;
+        case 154: acc = acc * 3 + 154; break;
+        case 155: acc = acc / 2 + 775; break;
+        case 156: acc = acc + 157; break;
+        case 157: acc = acc - 471; break;
+        case 158: acc = acc * 3 + 158; break;
+        case 159: acc = acc / 2 + 795; break;
+        case 160: acc = acc + 161; break;
+        case 161: acc = acc - 483; break;
+        case 162: acc = acc * 3 + 162; break;
+        case 163: acc = acc / 2 + 815; break;
+        case 164: acc = acc + 165; break;
+        case 165: acc = acc - 495; break;
+        case 166: acc = acc * 3 + 166; break;
+        case 167: acc = acc / 2 + 835; break;
+        case 168: acc = acc + 169; break;
+        case 169: acc = acc - 507; break;
+        case 170: acc = acc * 3 + 170; break;
+        case 171: acc = acc / 2 + 855; break;
+        case 172: acc = acc + 173; break;
+        case 173: acc = acc - 519; break;
+        case 174: acc = acc * 3 + 174; break;
+        case 175: acc = acc / 2 + 875; break;
+        case 176: acc = acc + 177; break;
+        case 177: acc = acc - 531; break;
+        case 178: acc = acc * 3 + 178; break;
+        case 179: acc = acc / 2 + 895; break;
+        case 180: acc = acc + 181; break;
+        case 181: acc = acc - 543; break;
+        case 182: acc = acc * 3 + 182; break;
+        case 183: acc = acc / 2 + 915; break;
+        case 184: acc = acc + 185; break;
+        case 185: acc = acc - 555; break;
+        case 186: acc = acc * 3 + 186; break;
+        case 187: acc = acc / 2 + 935; break;
+        case 188: acc = acc + 189; break;
+        case 189: acc = acc - 567; break;
+        case 190: acc = acc * 3 + 190; break;
+        case 191: acc = acc / 2 + 955; break;
+        case 192: acc = acc + 193; break;
+        case 193: acc = acc - 579; break;
+        case 194: acc = acc * 3 + 194; break;
+        case 195: acc = acc / 2 + 975; break;
+        case 196: acc = acc + 197; break;
+        case 197: acc = acc - 591; break;
+        case 198: acc = acc * 3 + 198; break;
+        case 199: acc = acc / 2 + 995; break;
+        case 200: acc = acc + 201; break;
+        case 201: acc = acc - 603; break;
+        case 202: acc = acc * 3 + 202; break;
+        case 203: acc = acc / 2 + 1015; break;
+        case 204: acc = acc + 205; break;
+        case 205: acc = acc - 615; break;
+        case 206: acc = acc * 3 + 206; break;
+        case 207: acc = acc / 2 + 1035; break;
+        case 208: acc = acc + 209; break;
+        case 209: acc = acc - 627; break;
+        case 210: acc = acc * 3 + 210; break;
+        case 211: acc = acc / 2 + 1055; break;
+        case 212: acc = acc + 213; break;
+        case 213: acc = acc - 639; break;
+        case 214: acc = acc * 3 + 214; break;
+        case 215: acc = acc / 2 + 1075; break;
+        case 216: acc = acc + 217; break;
+        case 217: acc = acc - 651; break;
+        case 218: acc = acc * 3 + 218; break;
+        case 219: acc = acc / 2 + 1095; break;
+        case 220: acc = acc + 221; break;
+        case 221: acc = acc - 663; break;
+        case 222: acc = acc * 3 + 222; break;
+        case 223: acc = acc / 2 + 1115; break;
+        case 224: acc = acc + 225; break;
+        case 225: acc = acc - 675; break;
+        case 226: acc = acc * 3 + 226; break;
+        case 227: acc = acc / 2 + 1135; break;
+        case 228: acc = acc + 229; break;
+        case 229: acc = acc - 687; break;
+        case 230: acc = acc * 3 + 230; break;
+        case 231: acc = acc / 2 + 1155; break;
+        case 232: acc = acc + 233; break;
+        case 233: acc = acc - 699; break;
+        case 234: acc = acc * 3 + 234; break;
+        case 235: acc = acc / 2 + 1175; break;
+        case 236: acc = acc + 237; break;
+        case 237: acc = acc - 711; break;
+        case 238: acc = acc * 3 + 238; break;
+        case 239: acc = acc / 2 + 1195; break;
+        case 240: acc = acc + 241; break;
+        case 241: acc = acc - 723; break;
+        case 242: acc = acc * 3 + 242; break;
+        case 243: acc = acc / 2 + 1215; break;
+        case 244: acc = acc + 245; break;
+        case 245: acc = acc - 735; break;
+        case 246: acc = acc * 3 + 246; break;
+        case 247: acc = acc / 2 + 1235; break;
+        case 248: acc = acc + 249; break;
+        case 249: acc = acc - 747; break;
+        case 250: acc = acc * 3 + 250; break;
+        case 251: acc = acc / 2 + 1255; break;
+        case 252: acc = acc + 253; break;
+        case 253: acc = acc - 759; break;
+        case 254: acc = acc * 3 + 254; break;
+        case 255: acc = acc / 2 + 1275; break;
+    }
+    return acc;
+}
+
+int sparse(int x) {
+    switch (x) {
+        case 0: return 1;
+        case 978: return 2;
+        case 1958: return 3;
+        case 2940: return 4;
+        case 3924: return 5;
+        case 4910: return 6;
+        case 5898: return 7;
+        case 6888: return 8;
+        case 7880: return 9;
+        case 8874: return 10;
+        case 9870: return 11;
+        case 10868: return 12;
+        case 11868: return 13;
+        case 12870: return 14;
+        case 13874: return 15;
+        case 14880: return 16;
+        case 15888: return 17;
+        case 16898: return 18;
+        case 17910: return 19;
+        case 18924: return 20;
+        case 19940: return 21;
+        case 20958: return 22;
+        case 21978: return 23;
+        case 23000: return 24;
+        case 24024: return 25;
+        case 25050: return 26;
+        case 26078: return 27;
+        case 27108: return 28;
+        case 28140: return 29;
+        case 29174: return 30;
+        case 30210: return 31;
+        case 31248: return 32;
+        case 32288: return 33;
+        case 33330: return 34;
+        case 34374: return 35;
+        case 35420: return 36;
+        case 36468: return 37;
+        case 37518: return 38;
+        case 38570: return 39;
+        case 39624: return 40;
+        case 40680: return 41;
+        case 41738: return 42;
+        case 42798: return 43;
+        case 43860: return 44;
+        case 44924: return 45;
+        case 45990: return 46;
+        case 47058: return 47;
+        case 48128: return 48;
+        case 49200: return 49;
+        case 50274: return 50;
+        case 51350: return 51;
+        case 52428: return 52;
+        case 53508: return 53;
+        case 54590: return 54;
+        case 55674: return 55;
+        case 56760: return 56;
+        case 57848: return 57;
+        case 58938: return 58;
+        case 60030: return 59;
+        case 61124: return 60;
+        case 62220: return 61;
+        case 63318: return 62;
+        case 64418: return 63;
+        case 65520: return 64;
+    }
+    return 0;
+}
+
+int main() {
+    int acc = 0;
+    int hits = 0;
+    int x = 1;
+    int i = 0;
+    while (i < 20000000) {
+        x = x * 75 + 74;
+        x = x - (x / 65537) * 65537;
+        acc = step(x - (x / 256) * 256, acc);
+        acc = acc - (acc / 1000003) * 1000003;
+        hits = hits + sparse(x);
+        i = i + 1;
+    }
+    return acc + hits;
+}
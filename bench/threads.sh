@@ -0,0 +1,60 @@
+#!/bin/sh
+# Compile a generated unit of many functions (50000 by default) to assembly
+# with 1, 2, 4, ... 64 worker threads, best of several runs each, and check
+# that every thread count writes the same bytes. The functions call lower-
+# numbered ones, so the call graph gives the scheduler a deep dependency
+# order to follow, and every hundredth pair is mutually recursive.
+#
+# Usage: bench/threads.sh <leancc> [functions] [runs]
+
+LEANCC=${1:-build/leancc}
+FUNCTIONS=${2:-50000}
+RUNS=${3:-3}
+TMP=${TMPDIR:-/tmp}/leancc-threads.$$
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+
+awk -v n="$FUNCTIONS" 'BEGIN {
+    srand(1);
+    for (i = 0; i < n; i++) {
+        print "int f" i "(int a, int b) {";
+        print "    int s = 0;";
+        print "    int k = 0;";
+        print "    while (k < a) {";
+        print "        s = s + k * 8 + b * 3;";
+        if (i > 0) print "        s = s + f" int(rand() * i) "(k, s / 4);";
+        print "        k = k + 1;";
+        print "    }";
+        if (i % 100 == 1) print "    if (a > 0) { s = s + f" i + 1 "(a - 1, b); }";
+        if (i % 100 == 2) print "    if (b > 0) { s = s + f" i - 1 "(a, b - 1); }";
+        print "    if (s > b * 2) { return s / 2 + " i % 7 "; }";
+        if (i > 1) print "    return s + f" int(rand() * i) "(b, a) * 2;";
+        else print "    return s + a;";
+        print "}";
+    }
+}' > "$TMP/unit.c"
+
+# Wall-clock seconds for one run of a command
+run_time() {
+    start=$(date +%s.%N)
+    "$@" || return 1
+    end=$(date +%s.%N)
+    awk "BEGIN { printf \"%.3f\", $end - $start }"
+}
+
+printf "%-8s %10s %8s\n" "threads" "seconds" "speedup"
+base=
+for threads in 1 2 4 8 16 32 64; do
+    best=
+    i=0
+    while [ "$i" -lt "$RUNS" ]; do
+        t=$(run_time "$LEANCC" -S -fthreads=$threads "$TMP/unit.c" -o "$TMP/unit.$threads.s") || exit 1
+        if [ -z "$best" ] || awk "BEGIN { exit !($t < $best) }"; then
+            best=$t
+        fi
+        i=$((i + 1))
+    done
+    [ -n "$base" ] || base=$best
+    cmp -s "$TMP/unit.1.s" "$TMP/unit.$threads.s" || { echo "output differs with $threads threads"; exit 1; }
+    printf "%-8s %10s %7.2fx\n" "$threads" "$best" "$(awk "BEGIN { print $base / $best }")"
+done
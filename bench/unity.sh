@@ -0,0 +1,96 @@
+#!/bin/sh
+# Build an executable from a generated program of many units (1000 by
+# default) in one leancc process, once unit by unit and once with
+# -funity. Every unit runs a loop over two small helpers defined in
+# another file, which only -funity can inline; the units themselves are
+# too large to inline into main. Reports the best build
+# and run time of several runs and what the batch shared and recycled,
+# and checks that both programs exit the same way.
+#
+# Usage: bench/unity.sh <leancc> [units] [runs]
+
+LEANCC=${1:-build/leancc}
+UNITS=${2:-1000}
+RUNS=${3:-3}
+TMP=${TMPDIR:-/tmp}/leancc-unity.$$
+mkdir -p "$TMP/src"
+trap 'rm -rf "$TMP"' EXIT
+
+awk -v n="$UNITS" -v dir="$TMP/src" 'BEGIN {
+    lib = dir "/lib.c";
+    print "int mix(int a, int b) {" > lib;
+    print "    return a + b * 3 - a / 8;" > lib;
+    print "}" > lib;
+    print "int clamp_add(int a, int b) {" > lib;
+    print "    if (a + b > 1000) { return 1000; }" > lib;
+    print "    return a + b;" > lib;
+    print "}" > lib;
+    close(lib);
+    for (i = 0; i < n; i++) {
+        file = dir "/u" i ".c";
+        print "int u" i "(int a) {" > file;
+        print "    int s = " i ";" > file;
+        print "    int k = 0;" > file;
+        print "    while (k < 50) {" > file;
+        print "        s = mix(s, clamp_add(a, k));" > file;
+        print "        if (s > " 5000 + i " ) {" > file;
+        print "            s = s / 2 + mix(k, " i % 7 ");" > file;
+        print "        }" > file;
+        print "        if (s < " i % 50 ") {" > file;
+        print "            s = clamp_add(s, " i % 13 ") * 3;" > file;
+        print "        }" > file;
+        print "        k = k + 1;" > file;
+        print "    }" > file;
+        print "    return s;" > file;
+        print "}" > file;
+        close(file);
+    }
+    main = dir "/main.c";
+    print "int main() {" > main;
+    print "    int s = 0;" > main;
+    print "    int r = 0;" > main;
+    print "    while (r < 100) {" > main;
+    for (i = 0; i < n; i++) print "        s = s + u" i "(r);" > main;
+    print "        r = r + 1;" > main;
+    print "    }" > main;
+    print "    return s / 1024;" > main;
+    print "}" > main;
+    close(main);
+}'
+
+# Wall-clock seconds for one run of a command
+run_time() {
+    start=$(date +%s.%N)
+    "$@" >/dev/null 2>&1
+    end=$(date +%s.%N)
+    awk "BEGIN { printf \"%.3f\", $end - $start }"
+}
+
+# best <command...>: the least of RUNS timings
+best() {
+    low=
+    i=0
+    while [ "$i" -lt "$RUNS" ]; do
+        t=$(run_time "$@")
+        if [ -z "$low" ] || awk "BEGIN { exit !($t < $low) }"; then
+            low=$t
+        fi
+        i=$((i + 1))
+    done
+    echo "$low"
+}
+
+printf "%-12s %10s %10s %8s\n" "build" "compile" "run" "exit"
+for mode in units unity; do
+    flags=
+    [ "$mode" = unity ] && flags=-funity
+    "$LEANCC" $flags "$TMP/src" -o "$TMP/$mode" || exit 1
+    compile=$(best "$LEANCC" $flags "$TMP/src" -o "$TMP/$mode")
+    run=$(best "$TMP/$mode")
+    "$TMP/$mode"
+    status=$?
+    printf "%-12s %10s %10s %8s\n" "$mode" "$compile" "$run" "$status"
+    eval "status_$mode=$status"
+done
+"$LEANCC" --stats "$TMP/src" -o "$TMP/units" 2>&1 | grep '^memory: '
+[ "$status_units" = "$status_unity" ] || { echo "exit codes differ"; exit 1; }
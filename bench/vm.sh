@@ -0,0 +1,42 @@
+#!/bin/sh
+# Time main() of every test program in the bytecode VM (--run), in tiered
+# mode (--tiered, VM plus native code for hot functions) and in the
+# tree-walking evaluator (--run=tree), best of several runs each. Calls to
+# pure functions are kept (-fno-const-eval) so there is work left to run.
+#
+# Usage: bench/vm.sh <leancc> [runs]
+
+LEANCC=${1:-build/leancc}
+RUNS=${2:-5}
+
+# Fastest time in microseconds that leancc reports for one program
+best_time() {
+    best=
+    i=0
+    while [ "$i" -lt "$RUNS" ]; do
+        us=$("$LEANCC" -fno-const-eval --stats "$@" 2>&1 >/dev/null |
+             sed -n 's/.*: run: .*(\([0-9.]*\) us)$/\1/p')
+        [ -n "$us" ] || { echo "-"; return; }
+        if [ -z "$best" ] || awk "BEGIN { exit !($us < $best) }"; then
+            best=$us
+        fi
+        i=$((i + 1))
+    done
+    echo "$best"
+}
+
+printf "%-20s %12s %12s %12s %8s\n" "program" "vm (us)" "tiered (us)" "tree (us)" "speedup"
+dir=$(dirname "$0")/../tests
+for src in "$dir"/*.c; do
+    grep -q "main *(" "$src" || continue
+    name=$(basename "$src" .c)
+    vm=$(best_time --run "$src")
+    tiered=$(best_time --tiered "$src")
+    tree=$(best_time --run=tree "$src")
+    if [ "$vm" = - ] || [ "$tree" = - ]; then
+        speedup=-
+    else
+        speedup=$(awk "BEGIN { printf \"%.1fx\", $tree / ($vm > 0 ? $vm : 0.1) }")
+    fi
+    printf "%-20s %12s %12s %12s %8s\n" "$name" "$vm" "$tiered" "$tree" "$speedup"
+done
@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for short-lived compiler data (IR, machine code).
+// Everything allocated from an arena is released at once by arena_free().
+// Chunks of the default size go back to a pool shared by the whole
+// process rather than to malloc, and the next arena to need one takes it
+// from there: the units of a batch, and the functions of a unit, run on
+// recycled memory.
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct Arena {
+    ArenaChunk* chunks;
+    size_t chunk_size;
+} Arena;
+
+void arena_init(Arena* arena, size_t chunk_size);   // 0 for the default, 64 KiB
+void arena_free(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size);      // Zero-initialized
+char* arena_strdup(Arena* arena, const char* text);
+
+typedef struct {
+    size_t allocated;     // Chunks from malloc
+    size_t recycled;      // Chunks taken from the pool instead
+    size_t pooled;        // In the pool now
+} ArenaStats;
+
+void arena_stats(ArenaStats* stats);
+
+#endif // ARENA_H
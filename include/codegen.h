@@ -0,0 +1,152 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "leancc.h"
+#include "ir.h"
+#include "arena.h"
+#include "object.h"
+
+// x86-64 general purpose registers, numbered by their hardware encoding
+typedef enum {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+    REG_COUNT
+} Reg;
+
+#define REG_BIT(r) (1u << (r))
+
+// Registers reserved as scratch by instruction selection; never allocated
+#define SCRATCH_REGS    (REG_BIT(REG_RAX) | REG_BIT(REG_R10) | REG_BIT(REG_R11))
+#define CALLEE_SAVED    (REG_BIT(REG_RBX) | REG_BIT(REG_R12) | REG_BIT(REG_R13) | \
+                         REG_BIT(REG_R14) | REG_BIT(REG_R15))
+#define CALLER_SAVED    (REG_BIT(REG_RCX) | REG_BIT(REG_RDX) | REG_BIT(REG_RSI) | \
+                         REG_BIT(REG_RDI) | REG_BIT(REG_R8) | REG_BIT(REG_R9))
+
+extern const Reg ARG_REGS[6];
+
+// Where register allocation placed a vreg
+typedef enum {
+    LOC_NONE,       // Never defined or used
+    LOC_REG,        // Lives in a physical register for its whole interval
+    LOC_STACK,      // Spilled to a frame slot
+    LOC_CONST       // Single-definition constant, used as an immediate
+} LocationKind;
+
+typedef struct {
+    LocationKind kind;
+    Reg reg;
+    int slot;
+    int64_t imm;
+} Location;
+
+typedef struct {
+    Location* locations;          // Indexed by vreg
+    int spill_slots;
+    unsigned used_callee_saved;   // Mask of callee-saved registers written
+    int intervals;                // Statistics
+    int spilled;
+} RegAllocResult;
+
+// Linear-scan register allocation over one IR function (regalloc.c).
+// With spill_all the allocator sends every interval to the stack.
+bool regalloc_run(const IRFunction* fn, bool spill_all, RegAllocResult* result);
+void regalloc_free(RegAllocResult* result);
+
+// Machine instructions, two-operand form: op src, dst
+typedef enum {
+    MOP_LABEL,      // Defines label imm of the function
+    MOP_MOV,
+    MOP_ADD,
+    MOP_SUB,
+    MOP_IMUL,
+    MOP_SHL,        // Shift counts are immediates or cl
+    MOP_SAR,
+    MOP_SHR,
+    MOP_CQO,
+    MOP_IDIV,       // Divides rdx:rax by src
+    MOP_CMP,        // Flags from dst - src
+    MOP_TEST,
+    MOP_SETCC,      // Sets the low byte of dst from condition cc
+    MOP_MOVZX8,     // Zero-extends the low byte of src into dst
+    MOP_JMP,
+    MOP_JCC,
+    MOP_CALL,
+    MOP_RET,
+    MOP_PUSH,
+    MOP_POP,
+    MOP_LEA,
+    MOP_TABLE_JUMP, // Jumps through the entry at index rax of jump table dst; clobbers r11
+    MOP_TABLE_ENTRY // 32-bit offset of label dst from jump table label src
+} MOpcode;
+
+// Condition codes in hardware encoding order
+typedef enum {
+    CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+} CondCode;
+
+typedef enum {
+    MO_NONE,
+    MO_REG,
+    MO_IMM,
+    MO_MEM,         // [reg + disp]
+    MO_GLOBAL,      // [rip + symbol]
+    MO_LABEL,       // Branch target within the function
+    MO_FUNC         // Call target
+} MOperandKind;
+
+typedef struct {
+    MOperandKind kind;
+    Reg reg;
+    int32_t disp;
+    int64_t imm;
+    const char* symbol;
+} MOperand;
+
+typedef struct {
+    MOpcode op;
+    CondCode cc;
+    MOperand dst;
+    MOperand src;
+} MInst;
+
+typedef struct {
+    const char* name;
+    MInst* code;
+    size_t count;
+    size_t capacity;
+    int label_count;
+    int frame_size;
+} MFunction;
+
+typedef struct {
+    bool regalloc;                // false: spill every vreg (naive baseline)
+    size_t threads;               // Workers for codegen_run(); 0 for one per processor
+} CodeGenOptions;
+
+struct CodeGen {
+    const IR* ir;
+    CodeGenOptions options;
+    MFunction* functions;
+    size_t function_count;
+    Error error;
+};
+
+// Backend interface
+CodeGen* codegen_create(const IR* ir, const CodeGenOptions* options);
+void codegen_destroy(CodeGen* cg);
+// Every function of the module, on up to options.threads workers
+bool codegen_run(CodeGen* cg);
+// One function on its own, for compiling on demand; the caller frees
+// mf->code. fn must already be out of SSA form.
+bool codegen_function(CodeGen* cg, const IRFunction* fn, MFunction* mf);
+bool codegen_emit_asm(const CodeGen* cg, FILE* out);
+
+// Machine code encoding (encode.c)
+bool encode_function(const MFunction* mf, ObjectFile* obj, uint64_t* start);
+bool codegen_emit_object(const CodeGen* cg, ObjectFile* obj);
+
+#endif // CODEGEN_H
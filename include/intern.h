@@ -0,0 +1,20 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+// Process-wide string interning, for the names in the AST and the IR.
+// Equal strings intern to the same pointer, which stays valid until the
+// process exits, so the units of a batch share one copy of every name and
+// nothing that holds a name has to copy or free it. Looking up a name that
+// is already interned takes no lock; any thread may call these.
+const char* intern(const char* text);   // NULL when out of memory
+
+typedef struct {
+    size_t strings;
+    size_t bytes;         // Their text, terminators included
+} InternStats;
+
+void intern_stats(InternStats* stats);
+
+#endif // INTERN_H
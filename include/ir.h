@@ -0,0 +1,338 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "leancc.h"
+#include "parser.h"
+#include "arena.h"
+
+// Three-address IR over an unbounded set of virtual registers (vregs).
+// Each function is a list of basic blocks; every block ends in exactly
+// one terminator (IR_JUMP, IR_BRANCH, IR_SWITCH or IR_RET).
+//
+// Lowering produces SSA form: every vreg has one definition, and IR_PHI
+// instructions at the top of a block merge values from its predecessors.
+// ir_destruct_ssa() turns phis back into copies before code generation.
+
+typedef enum {
+    IR_CONST,         // dst = imm
+    IR_COPY,          // dst = a
+    IR_PARAM,         // dst = incoming parameter number imm (entry block only)
+    IR_ADD,           // dst = a + b
+    IR_SUB,           // dst = a - b
+    IR_MUL,           // dst = a * b
+    IR_DIV,           // dst = a / b (truncating, signed)
+    IR_SHL,           // dst = a << b
+    IR_SAR,           // dst = a >> b (arithmetic)
+    IR_SHR,           // dst = a >> b (logical)
+    IR_EQ,            // dst = a == b
+    IR_NE,            // dst = a != b
+    IR_LT,            // dst = a < b
+    IR_GT,            // dst = a > b
+    IR_LE,            // dst = a <= b
+    IR_GE,            // dst = a >= b
+    IR_LOAD_GLOBAL,   // dst = [symbol]
+    IR_STORE_GLOBAL,  // [symbol] = a
+    IR_CALL,          // dst = symbol(args...)
+    IR_JUMP,          // goto target
+    IR_BRANCH,        // if (a) goto target else goto target_else
+    IR_SWITCH,        // goto the target of the case equal to a, else target
+    IR_RET,           // return a
+    IR_PHI            // dst = args[i] when entered from preds[i]
+} IROpcode;
+
+#define IR_NO_VREG (-1)
+
+struct IRBlock;
+
+typedef struct {
+    int64_t value;
+    struct IRBlock* target;
+} IRCase;
+
+typedef struct IRInstr {
+    IROpcode op;
+    int dst;
+    int a;
+    int b;
+    int64_t imm;
+    const char* symbol;           // Callee or global name, interned from the AST
+    int* args;                    // Call arguments, or phi operands by predecessor
+    size_t arg_count;
+    struct IRBlock* target;
+    struct IRBlock* target_else;
+    IRCase* cases;                // Switch cases by increasing value; target is the default
+    size_t case_count;
+    struct IRBlock** succs;       // Switch successors: the default, then each other
+    size_t succ_count;            // case target once, in case order
+    int line;                     // Source position of a call, or of the condition
+                                  // of a branch (for remarks and profiles)
+    int column;
+    struct IRInstr* prev;
+    struct IRInstr* next;
+} IRInstr;
+
+typedef struct IRBlock {
+    int id;
+    IRInstr* first;
+    IRInstr* last;
+    struct IRBlock** preds;       // Phi operands follow this order
+    size_t pred_count;
+    size_t pred_capacity;
+} IRBlock;
+
+typedef struct IRFunction {
+    const char* name;
+    const char* file;             // Its source when not the unit's (-funity), for remarks
+    size_t param_count;
+    int vreg_count;
+    IRBlock** blocks;             // blocks[0] is the entry block
+    size_t block_count;
+    size_t block_capacity;
+    int next_block_id;
+    bool out_of_ssa;              // Since ir_destruct_ssa(); no longer inlined
+    Arena arena;                  // Owns instructions and blocks
+} IRFunction;
+
+typedef struct IRGlobal {
+    const char* name;
+    int64_t init;
+} IRGlobal;
+
+struct IR {
+    IRFunction** functions;
+    size_t function_count;
+    size_t function_capacity;
+    IRGlobal* globals;
+    size_t global_count;
+    size_t global_capacity;
+    Arena arena;                  // Owns global names
+};
+
+// Module construction
+IR* ir_create(void);
+void ir_destroy(IR* ir);
+IRFunction* ir_add_function(IR* ir, const char* name, size_t param_count);
+bool ir_add_global(IR* ir, const char* name, int64_t init);
+const IRGlobal* ir_find_global(const IR* ir, const char* name);
+const IRFunction* ir_find_function(const IR* ir, const char* name);
+
+// Function construction
+IRBlock* ir_block_create(IRFunction* fn);
+IRInstr* ir_instr_create(IRFunction* fn, IROpcode op);
+int ir_new_vreg(IRFunction* fn);
+void ir_append(IRBlock* block, IRInstr* instr);
+void ir_insert_before(IRBlock* block, IRInstr* before, IRInstr* instr);
+void ir_remove(IRBlock* block, IRInstr* instr);
+bool ir_add_pred(IRFunction* fn, IRBlock* block, IRBlock* pred);
+void ir_remove_pred(IRBlock* block, size_t index);   // Drops phi operands too
+IRInstr* ir_phi_create(IRFunction* fn, IRBlock* block);   // After existing phis
+IRInstr* ir_first_non_phi(const IRBlock* block);
+
+// Switches. ir_switch_create() leaves case_count cases for the caller to
+// fill in; ir_switch_update() sorts them and recomputes succs, and must
+// follow any change to the targets.
+IRInstr* ir_switch_create(IRFunction* fn, size_t case_count);
+void ir_switch_update(IRInstr* sw);
+IRBlock* ir_switch_target(const IRInstr* sw, int64_t value);
+
+// Partition sorted, distinct case values into clusters: runs dense enough
+// for a jump table, and single values to compare against. clusters needs
+// room for count entries; returns how many were filled. Shared by native
+// code and bytecode so both dispatch the same way.
+typedef struct {
+    size_t first;                 // Values first..last
+    size_t last;
+    bool table;
+} IRSwitchCluster;
+size_t ir_switch_clusters(const int64_t* values, size_t count, IRSwitchCluster* clusters);
+
+// Send the edges of terminator term that lead to from to to instead; the
+// caller fixes up predecessor lists
+void ir_retarget(IRInstr* term, IRBlock* from, IRBlock* to);
+// Replace the terminator of block with a jump to target, which need not
+// be one of its successors
+bool ir_make_jump(IRFunction* fn, IRBlock* block, IRBlock* target);
+
+// Analysis helpers
+bool ir_is_terminator(IROpcode op);
+bool ir_has_side_effects(IROpcode op);
+bool ir_is_conditional(IROpcode op);                 // A branch or a switch
+size_t ir_successor_count(const IRBlock* block);     // Distinct blocks it can go to
+IRBlock* ir_successor(const IRBlock* block, size_t i);
+void ir_remove_unreachable(IRFunction* fn);
+size_t ir_instr_count(const IRFunction* fn);
+
+// Operand access: calls read args[], phis read args[] by predecessor, and
+// everything else reads a and b. Returns the number of operands.
+size_t ir_operands(IRInstr* instr, int** out, size_t max);
+
+// Rewrite every operand v to forward[v], following chains; forward[v] == v
+// marks a vreg that is not replaced
+int ir_resolve_forward(int* forward, int v);
+void ir_replace_vregs(IRFunction* fn, int* forward);
+
+// Dominator trees (cfg.c). Blocks are named by their index in fn->blocks.
+typedef struct {
+    size_t count;           // Blocks, plus the virtual exit for post-dominators
+    int* index;             // Block id -> index
+    int* idom;              // Immediate (post-)dominator; -1 at the root and
+                            // for blocks the walk never reaches
+    int* order;             // Reachable blocks in reverse postorder
+    size_t order_count;
+    int* child_start;       // Tree children of b: children[child_start[b]..child_start[b+1])
+    int* children;
+} DomTree;
+
+bool ir_dominators(const IRFunction* fn, DomTree* tree);
+// Post-dominators over the reverse CFG; index block_count is a virtual
+// exit that every returning block flows into
+bool ir_post_dominators(const IRFunction* fn, DomTree* tree);
+bool dom_tree_dominates(const DomTree* tree, int a, int b);
+void dom_tree_free(DomTree* tree);
+
+// Natural loops (loop.c). Blocks are named by their index in fn->blocks.
+typedef struct {
+    int header;
+    int preheader;          // Only block entering the loop from outside, if
+                            // its only successor is the header; else -1
+    int parent;             // Innermost enclosing loop, or -1
+    int depth;              // 1 for an outermost loop
+    int* blocks;            // The header and body, in reverse postorder
+    size_t block_count;
+} Loop;
+
+typedef struct {
+    Loop* loops;            // Enclosing loops before the loops they contain
+    size_t count;
+    int* innermost;         // Block -> innermost loop containing it, or -1
+} LoopForest;
+
+bool ir_find_loops(const IRFunction* fn, const DomTree* dom, LoopForest* forest);
+bool loop_contains(const LoopForest* forest, int loop, int block);
+void loop_forest_free(LoopForest* forest);
+// Give every loop that can have one a preheader
+bool ir_insert_preheaders(IRFunction* fn, size_t* inserted);
+
+// Call graph over the functions defined in a module (callgraph.c)
+typedef struct {
+    const IR* ir;
+    size_t count;           // Functions, indexed like ir->functions
+    int* edge_start;        // Callees of f: edges[edge_start[f]..edge_start[f+1])
+    int* edges;
+    int* scc;               // Strongly connected component of each function
+    size_t scc_count;
+    int* order;             // Functions bottom-up: callees before their callers
+    bool* recursive;        // In a cycle of calls, possibly of length one
+    int* names;             // Open-addressing index from name to function
+    size_t name_capacity;
+} CallGraph;
+
+bool call_graph_build(const IR* ir, CallGraph* graph);
+int call_graph_find(const CallGraph* graph, const char* name);   // -1 if undefined
+void call_graph_free(CallGraph* graph);
+
+// SSA maintenance and destruction (ssa.c)
+size_t ir_remove_trivial_phis(IRFunction* fn);
+bool ir_destruct_ssa(IRFunction* fn);
+
+// Scalar optimizations on SSA form. Each returns false only when out of
+// memory and adds what it removed to the counters.
+bool ir_gvn(IRFunction* fn, size_t* removed);                      // gvn.c
+bool ir_dce(IRFunction* fn, size_t* removed, size_t* branches);    // dce.c
+// Constants propagated along the edges that can execute; constant
+// branches become jumps and blocks nothing reaches are deleted (sccp.c)
+bool ir_sccp(IRFunction* fn, size_t* constants, size_t* branches, size_t* blocks);
+// Jump threading and merging of straight-line blocks (simplify.c)
+bool ir_simplify_cfg(IRFunction* fn, size_t* merged, size_t* threaded);
+bool ir_licm(IRFunction* fn, size_t* loops, size_t* preheaders, size_t* hoisted);   // licm.c
+// Induction variable multiplications to additions, and multiplications
+// and divisions by powers of two to shifts (strength.c)
+bool ir_reduce_strength(IRFunction* fn, size_t* reduced, size_t* shifts);
+
+// Turn self tail calls into loops, with an accumulator for returns of
+// the form x + f(...) or x * f(...) (tailcall.c)
+bool ir_eliminate_tail_calls(IRFunction* fn, size_t* self_calls, size_t* eliminated,
+                             size_t* accumulated);
+
+// Execution counts from a run in the interpreter, for profile-guided
+// decisions (profile.c). Branches are identified by the source position
+// of their condition, which is unique within a unit and survives inlining.
+// Lookups are binary searches, once ir_profile_sort() has ordered the
+// counts.
+typedef struct {
+    const char* function;         // Interned
+    uint64_t calls;
+} IRCallCount;
+
+typedef struct {
+    int line;
+    int column;
+    uint64_t taken;               // Times the condition held
+    uint64_t not_taken;
+} IRBranchCount;
+
+typedef struct {
+    IRCallCount* calls;
+    size_t call_count;
+    IRBranchCount* branches;
+    size_t branch_count;
+    uint64_t hot_calls;           // Callees called at least this often are hot
+} IRProfile;
+
+void ir_profile_sort(IRProfile* profile);
+uint64_t ir_profile_calls(const IRProfile* profile, const char* function);   // function interned
+const IRBranchCount* ir_profile_branch(const IRProfile* profile, int line, int column);
+
+// Order blocks so that each profiled branch falls through to the
+// successor it took more often (profile.c)
+bool ir_layout_blocks(IRFunction* fn, const IRProfile* profile, size_t* branches, size_t* likely);
+
+// Pass pipeline (passes.c)
+typedef struct {
+    bool tail_calls;
+    bool inline_calls;
+    size_t inline_threshold;    // Largest callee cost that is inlined
+    bool sccp;
+    bool simplify_cfg;
+    bool gvn;
+    bool licm;
+    bool strength_reduce;
+    bool dce;
+    FILE* stats;            // Per-function statistics and timing, or NULL
+    FILE* remarks;          // Inlining decisions, or NULL
+    bool remark_inlined;    // -Rpass=inline
+    bool remark_missed;     // -Rpass-missed=inline
+    const char* unit;       // Prefix for the statistics lines and remarks
+    const IRProfile* profile;   // Counts from the interpreter tier, or NULL
+    size_t threads;         // Workers for the per-function passes; 0 for one per processor
+} IROptOptions;
+
+// Inline the calls in fn whose callees are small enough (inline.c). The
+// callees must already be in their final optimized form.
+bool ir_inline_calls(IR* ir, IRFunction* fn, const CallGraph* graph,
+                     const IROptOptions* options, size_t* sites, size_t* inlined);
+
+// The functions are optimized on up to options->threads workers, callees
+// before their callers; the result does not depend on how many there are
+bool ir_optimize(IR* ir, const IROptOptions* options);
+// The same one function at a time, for the JIT: ir_optimize_start()
+// eliminates tail calls everywhere and builds graph when inlining, then
+// each function is optimized once every callee it may inline has been.
+// call_graph_free() releases graph either way.
+bool ir_optimize_start(IR* ir, CallGraph* graph, const IROptOptions* options);
+bool ir_optimize_function(IR* ir, IRFunction* fn, const CallGraph* graph,
+                          const IROptOptions* options);
+bool ir_finalize(IR* ir, size_t threads);   // Leave SSA form for the backend
+
+// Lowering from the AST (lower.c)
+IR* ir_lower(const ASTNode* program, Error* error);
+
+// Debug output
+const char* ir_opcode_name(IROpcode op);
+void ir_print(FILE* out, const IR* ir);
+
+#endif // IR_H
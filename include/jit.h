@@ -0,0 +1,61 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "leancc.h"
+#include "ir.h"
+#include "codegen.h"
+
+// In-memory compilation to x86-64. Every function starts out as a small
+// stub in executable memory; the first call through it optimizes the
+// function if the JIT does, selects instructions, allocates registers and
+// encodes it, then points the stub and every call already aimed at it to
+// the new code. Functions that are never called are never compiled, and
+// only optimized when something that calls them may inline them. Code
+// pages are writable or executable, never both at once.
+
+typedef struct JIT JIT;
+
+typedef struct {
+    size_t functions;
+    size_t compiled;          // Functions called at least once
+    size_t code_bytes;
+    size_t patched;           // Call sites redirected from a stub to code
+    double compile_us;        // Spent compiling on demand
+} JITStats;
+
+JIT* jit_create(const CodeGenOptions* options);
+void jit_destroy(JIT* jit);
+
+// Add a unit in SSA form; the JIT takes ownership of ir. Globals are
+// private to their unit, as with the builtin linker. Without optimize the
+// unit is optimized already; with it, each function is optimized on its
+// first call, after the functions it may inline.
+bool jit_add_unit(JIT* jit, IR* ir, const IROptOptions* optimize, Error* error);
+
+// Map memory and write the stubs. When a function is defined twice, *unit
+// is the unit of the second definition.
+bool jit_link(JIT* jit, Error* error, size_t* unit);
+
+// Call a function without parameters, such as main. A function's calls
+// are checked when it is compiled: when one is undefined, *unit is its
+// unit and error has its position.
+bool jit_run(JIT* jit, const char* name, int64_t* result, Error* error, size_t* unit);
+
+// For a host that calls functions itself (tier.c). jit_call() passes at
+// most JIT_MAX_ARGS arguments.
+#define JIT_MAX_ARGS 16
+
+int jit_find(const JIT* jit, const char* name);
+size_t jit_param_count(const JIT* jit, int function);
+bool jit_compile(JIT* jit, int function, Error* error);
+bool jit_call(JIT* jit, int function, const int64_t* args, int64_t* result, Error* error);
+
+// Every unit's globals, one after another in jit_add_unit() order
+int64_t* jit_globals(JIT* jit, size_t* count);
+
+void jit_stats(const JIT* jit, JITStats* stats);
+
+#endif // JIT_H
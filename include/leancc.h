@@ -2,6 +2,7 @@
 #define LEANCC_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 // Compiler version
 #define LEANCC_VERSION_MAJOR 0
@@ -30,8 +31,79 @@ typedef struct {
     int column;
 } Error;
 
-// Main compiler interface
-int compile_file(const char* input_file, const char* output_file);
+// What compile_file() writes to output_file
+typedef enum {
+    OUTPUT_EXECUTABLE,    // Static ELF executable from the builtin linker
+    OUTPUT_ASSEMBLY,      // x86-64 assembly text (-S or a .s output name)
+    OUTPUT_OBJECT         // ELF64 relocatable object (-c), encoded in-process
+} OutputKind;
+
+// How run_files() executes a program instead of compiling it
+typedef enum {
+    RUN_NONE,
+    RUN_VM,               // --run: compile to bytecode and interpret it
+    RUN_TREE,             // --run=tree: walk the AST (the baseline for the VM)
+    RUN_JIT,              // --jit: compile to memory on demand and call main()
+    RUN_TIERED            // --tiered: interpret, then compile hot functions
+} RunMode;
+
+typedef struct {
+    OutputKind output_kind;
+    bool regalloc;        // false with -fno-regalloc: every value lives on the stack
+    bool dump_ir;         // --dump-ir: print the IR to stdout
+    bool fold;            // false with -fno-fold: skip constant folding
+    bool const_eval;      // false with -fno-const-eval: keep calls to pure functions
+    size_t const_eval_steps;  // -fconst-eval-steps=N: budget per evaluated call
+    size_t const_eval_depth;  // -fconst-eval-depth=N: call nesting limit
+    bool hash_cons;       // false with -fno-hash-cons: keep identical subexpressions apart
+    bool tail_calls;      // false with -fno-tail-calls: keep self tail calls
+    bool inline_calls;    // false with -fno-inline: never inline functions
+    size_t inline_threshold;  // -finline-threshold=N: largest callee inlined
+    bool remark_inline;   // -Rpass=inline: report each call that was inlined
+    bool remark_inline_missed;  // -Rpass-missed=inline: and each that was not
+    bool sccp;            // false with -fno-sccp: skip constant propagation
+    bool simplify_cfg;    // false with -fno-simplify-cfg: keep empty and split blocks
+    bool gvn;             // false with -fno-gvn: skip global value numbering
+    bool licm;            // false with -fno-licm: leave loop invariants in place
+    bool strength_reduce; // false with -fno-strength-reduce: keep multiplications
+    bool dce;             // false with -fno-dce: skip dead code elimination
+    bool prune_unreachable;   // false with -fno-prune-unreachable: compile every function of an executable
+    bool unity;           // -funity: compile every source as part of one unit
+    size_t threads;       // -fthreads=N: workers for optimization and code generation;
+                          // 0 (the default) for one per processor
+    bool io_uring;        // false with -fno-io-uring: read inputs on a thread pool instead
+    const char* const* include_paths;   // -I: where #include looks, in order
+    size_t include_path_count;
+    const char* const* defines;         // -D: NAME or NAME=value, defined before each unit
+    size_t define_count;
+    const char* include_pch;  // --include-pch: precompiled header every unit starts from
+    const struct Pch* pch;    // include_pch, once compile_files() or run_files() has mapped it
+    bool stats;           // --stats: report what each pass did on stderr
+    RunMode run;          // --run or --jit: execute main() in-process, see run_files()
+    size_t tier_threshold;    // -ftier-threshold=N: calls plus loop iterations before promotion
+} CompileOptions;
+
+void compile_options_init(CompileOptions* options);
+
+// Main compiler interface; options may be NULL for the defaults
+int compile_file(const char* input_file, const char* output_file, const CompileOptions* options);
+
+// Compile several inputs. Executables link every input (.c sources and
+// leancc .o files) into output_file. The inputs are read in one batch and
+// parsed as they arrive, on up to options->threads workers. With -S or -c each input gets its own
+// output; output_file must then be NULL when there is more than one, unless
+// options->unity merges them into one. A NULL output_file selects a.out,
+// a.s or a.o.
+int compile_files(const char* const* input_files, size_t count, const char* output_file,
+                  const CompileOptions* options);
+
+// Run the program made of the given sources and return the exit code of
+// its main(), or 1 when it cannot be compiled or traps
+int run_files(const char* const* input_files, size_t count, const CompileOptions* options);
+
+// Precompile a header, preprocessed with the -I and -D options, for
+// include_pch. A NULL output_file selects the header's path plus ".pch".
+int emit_pch(const char* header, const char* output_file, const CompileOptions* options);
 
 const char* get_version_string(void);
 
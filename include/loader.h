@@ -0,0 +1,51 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Batch loading of input files. Opens, sizes and reads for many files go
+// to the kernel together through io_uring, a window of files at a time,
+// so a build of thousands of small files does not pay for four blocking
+// system calls each. Where io_uring is unavailable (old kernels, seccomp
+// filters) a pool of threads reads the files instead. Either way files
+// are handed out as they complete, and callers parse one while the rest
+// are still being read.
+
+typedef enum {
+    LOADER_IO_URING,
+    LOADER_THREADS
+} LoaderBackend;
+
+typedef struct {
+    LoaderBackend backend;
+    size_t files;
+    size_t bytes;
+    size_t syscalls;          // io_uring_enter() calls, or open, fstat, read and close calls
+} LoaderStats;
+
+typedef struct Loader Loader;
+
+// Start reading paths; they must stay valid until loader_destroy(). With
+// force_threads the thread pool is used even where io_uring works.
+Loader* loader_start(const char* const* paths, size_t count, bool force_threads);
+
+// Wait for another file to finish loading and return its index, or
+// SIZE_MAX once every file has been handed out. Safe to call from
+// several threads at once.
+size_t loader_next(Loader* loader);
+
+// The contents of a file loader_next() returned, NUL-terminated, which the
+// caller now owns; NULL if it could not be read. opened tells whether it
+// got as far as being opened.
+char* loader_take(Loader* loader, size_t index, size_t* size, bool* opened);
+
+void loader_stats(Loader* loader, LoaderStats* stats);
+void loader_destroy(Loader* loader);   // Waits for reads in flight
+
+// Every *.c file under directory, recursively, in strcmp() order of their
+// paths. Symbolic links to directories are not followed. The caller frees
+// each path and the array.
+bool loader_find_sources(const char* directory, char*** paths, size_t* count);
+
+#endif // LOADER_H
@@ -0,0 +1,80 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// In-memory relocatable object: machine code and data plus the symbols and
+// relocations needed to place them. Produced by the x86-64 encoder and
+// serialized as ELF64 by elf_write_object().
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+bool buffer_append(ByteBuffer* buffer, const void* bytes, size_t size);
+bool buffer_reserve(ByteBuffer* buffer, size_t size);
+void buffer_free(ByteBuffer* buffer);
+
+typedef enum {
+    OBJ_SECTION_UNDEF,     // Referenced but not defined here
+    OBJ_SECTION_TEXT,
+    OBJ_SECTION_DATA
+} ObjSection;
+
+typedef struct {
+    char* name;
+    ObjSection section;
+    uint64_t value;        // Offset within its section
+    uint64_t size;
+    bool is_function;
+} ObjSymbol;
+
+typedef enum {
+    RELOC_PC32,            // S + A - P, 32-bit (data references)
+    RELOC_PLT32            // L + A - P, 32-bit (calls)
+} RelocType;
+
+typedef struct {
+    uint64_t offset;       // Patch location within .text
+    size_t symbol;         // Index into symbols
+    RelocType type;
+    int64_t addend;
+} ObjReloc;
+
+typedef struct ObjectFile {
+    ByteBuffer text;
+    ByteBuffer data;
+    ObjSymbol* symbols;
+    size_t symbol_count;
+    size_t symbol_capacity;
+    ObjReloc* relocs;
+    size_t reloc_count;
+    size_t reloc_capacity;
+    size_t* symbol_index;  // Open-addressing hash of symbol names
+    size_t index_capacity;
+} ObjectFile;
+
+#define OBJ_NO_SYMBOL ((size_t)-1)
+
+void object_init(ObjectFile* obj);
+void object_free(ObjectFile* obj);
+size_t object_find_symbol(const ObjectFile* obj, const char* name);
+size_t object_symbol(ObjectFile* obj, const char* name);   // Find or add as undefined
+bool object_add_reloc(ObjectFile* obj, uint64_t offset, size_t symbol, RelocType type, int64_t addend);
+
+// ELF64 serialization (elf.c). The reader accepts the subset of ELF that
+// elf_write_object() produces: .text, .data, .symtab and .rela.text.
+bool elf_write_object(const ObjectFile* obj, FILE* out);
+bool elf_read_object(const unsigned char* bytes, size_t size, ObjectFile* obj);
+
+// Static linking into an ELF64 executable (link.c). Entry is a small
+// _start that calls main and exits with its return value.
+bool link_executable(const ObjectFile* const* objects, size_t count,
+                     const char* output_file, char* error, size_t error_size);
+
+#endif // OBJECT_H
@@ -0,0 +1,112 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "parser.h"
+
+// AST-level optimizations, run between parsing and IR lowering
+
+// Evaluate op on two constants with leancc's 64-bit wrapping semantics.
+// Returns false when the result is not a compile-time constant: division
+// by zero and INT64_MIN / -1 are left to trap at run time.
+bool fold_binary(BinaryOp op, int64_t left, int64_t right, int64_t* out);
+
+// Value of an expression built only from literals and foldable operators
+bool ast_constant_value(const ASTNode* node, int64_t* out);
+
+// True when evaluating node cannot call or assign anything
+bool ast_is_pure(const ASTNode* node);
+
+size_t ast_count_nodes(const ASTNode* node);
+
+typedef struct {
+    size_t nodes_before;
+    size_t nodes_after;
+    size_t folded;          // Operations replaced by a constant
+    size_t simplified;      // Identities applied (x+0, x*1, x*0, ...)
+} FoldStats;
+
+// Constant folding and algebraic simplification over NODE_BINARY_OP,
+// in place. stats may be NULL.
+void fold_program(ASTNode* program, FoldStats* stats);
+
+typedef struct {
+    size_t expressions;     // Pure expression nodes, counting every occurrence
+    size_t shared;          // ... replaced by an identical node and freed
+} HashConsStats;
+
+// Share identical pure subexpressions (numbers, variable reads and
+// arithmetic on them) within straight-line code, turning each function's
+// expressions into a DAG; ASTNode.refs counts the extra parents. Runs
+// after every pass that rewrites the AST in place. stats may be NULL.
+bool hash_cons_program(ASTNode* program, HashConsStats* stats);
+
+typedef struct {
+    size_t functions;       // Defined, over all units
+    size_t reachable;       // ... called, directly or not, from a root
+    size_t skipped;         // ... the rest, freed without further processing
+} ReachStats;
+
+// Keep only the functions reachable through calls from the roots (function
+// names; calls in global initializers are roots too) in the programs of
+// the units linked together, and free the others before any later pass
+// sees them. Calls are matched to definitions by name across units.
+// stats may be NULL.
+bool prune_unreachable(ASTNode* const* programs, size_t count, const char* const* roots,
+                       size_t root_count, ReachStats* stats);
+
+typedef struct {
+    size_t units;
+    size_t functions;
+    size_t globals;
+    size_t external_calls;  // Calls into another unit, local from now on
+} UnityStats;
+
+// Move the top-level declarations of the programs of several units, each
+// resolved on its own, into one new program, in order, and leave theirs
+// empty. A table of every unit's functions and globals stands in for the
+// linker: a name defined by two units, or a call into another unit that
+// does not fit what it calls, fails with error set and *unit the index of
+// the unit it is in; names[] are the units' for the message. NULL with
+// error->code ERROR_NONE means out of memory. stats may be NULL.
+ASTNode* unity_merge(ASTNode* const* programs, size_t count, const char* const* names, Error* error,
+                     size_t* unit, UnityStats* stats);
+
+// Tree-walking evaluator over the AST, with leancc's run-time semantics
+typedef struct Evaluator Evaluator;
+
+typedef enum {
+    EVAL_OK,
+    EVAL_STEP_LIMIT,       // Ran out of steps (possibly an infinite loop)
+    EVAL_DEPTH_LIMIT,      // Calls nested too deeply
+    EVAL_TRAP,             // Division by zero or overflow
+    EVAL_UNSUPPORTED       // Unknown function, arity mismatch, bad lvalue
+} EvalStatus;
+
+typedef struct {
+    size_t max_steps;        // Per evaluator_call(): AST nodes visited
+    size_t max_depth;        // Per evaluator_call(): nested calls
+    size_t max_total_steps;  // Per const_eval_program() run
+} EvalLimits;
+
+Evaluator* evaluator_create(const ASTNode* program);
+void evaluator_destroy(Evaluator* ev);
+EvalStatus evaluator_call(Evaluator* ev, const char* name, const int64_t* args, size_t arg_count,
+                          const EvalLimits* limits, int64_t* result);
+size_t evaluator_steps(const Evaluator* ev);   // Steps taken by the last call
+
+typedef struct {
+    size_t functions;
+    size_t pure_functions;
+    size_t attempted;        // Calls with constant arguments to pure functions
+    size_t replaced;         // ... replaced by their value
+    size_t over_budget;      // ... given up on by a step or depth limit
+    size_t steps;
+} ConstEvalStats;
+
+void const_eval_limits_init(EvalLimits* limits);
+
+// Purity analysis, then replace every call to a pure function with
+// constant arguments by its value. stats may be NULL.
+bool const_eval_program(ASTNode* program, const EvalLimits* limits, ConstEvalStats* stats);
+
+#endif // OPTIMIZE_H
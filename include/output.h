@@ -0,0 +1,49 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+// Buffered output. Diagnostics, assembly and objects are formatted into
+// memory through an ordinary FILE* and reach the kernel in as few writev()
+// calls as possible: one per output file, and one for the diagnostics of
+// a whole run, merged in input order. stderr itself is unbuffered, so
+// printing to it directly costs a system call per fprintf().
+
+typedef struct {
+    FILE* stream;         // open_memstream(); NULL if that failed
+    char* data;           // Owned by the stream, valid after fflush()
+    size_t size;
+} OutputBuffer;
+
+// The buffer must not move while it is open: the stream writes through
+// pointers to data and size
+bool output_open(OutputBuffer* buffer);
+void output_close(OutputBuffer* buffer);   // Drops anything not flushed
+
+// Write the contents of count buffers to fd in order, with one writev()
+// unless the kernel takes less, and empty them
+bool output_flush(OutputBuffer* buffers, size_t count, int fd);
+
+// Replace path with the contents of buffer
+bool output_write_file(OutputBuffer* buffer, const char* path, unsigned mode);
+
+// writev() every byte, resuming after short writes and signals
+bool output_writev(int fd, struct iovec* iov, int count);
+
+// Where diagnostics go on this thread: the stream of the buffer last set,
+// or stderr while none is. The driver sets one buffer per input file so
+// files compiled at the same time do not interleave their messages.
+FILE* diagnostics(void);
+void diagnostics_set(OutputBuffer* buffer);   // NULL for stderr
+
+typedef struct {
+    size_t writes;        // writev() calls, over all threads
+    size_t bytes;
+} OutputStats;
+
+void output_stats(OutputStats* stats);
+
+#endif // OUTPUT_H
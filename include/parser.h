@@ -16,9 +16,14 @@ typedef enum {
     TOKEN_IF,
     TOKEN_ELSE,
     TOKEN_WHILE,
+    TOKEN_SWITCH,
+    TOKEN_CASE,
+    TOKEN_DEFAULT,
+    TOKEN_BREAK,
     // Identifiers and literals
     TOKEN_IDENTIFIER,
     TOKEN_NUMBER,
+    TOKEN_HEADER_NAME,   // "file" or <file>, only right after #include
     // Single-character tokens
     TOKEN_LPAREN,    // (
     TOKEN_RPAREN,    // )
@@ -27,6 +32,7 @@ typedef enum {
     TOKEN_SEMICOLON, // ;
     TOKEN_COMMA,     // ,
     TOKEN_ASSIGN,    // =
+    TOKEN_COLON,     // :
     // Operators
     TOKEN_PLUS,      // +
     TOKEN_MINUS,     // -
@@ -37,15 +43,55 @@ typedef enum {
     TOKEN_LT,        // <
     TOKEN_GT,        // >
     TOKEN_LTE,       // <=
-    TOKEN_GTE        // >=
+    TOKEN_GTE,       // >=
+    // The rest of C's punctuators, which the lexer knows but the parser
+    // does not accept yet
+    TOKEN_LBRACKET,  // [
+    TOKEN_RBRACKET,  // ]
+    TOKEN_QUESTION,  // ?
+    TOKEN_TILDE,     // ~
+    TOKEN_BANG,      // !
+    TOKEN_PERCENT,   // %
+    TOKEN_AMP,       // &
+    TOKEN_PIPE,      // |
+    TOKEN_CARET,     // ^
+    TOKEN_SHL,       // <<
+    TOKEN_SHR,       // >>
+    TOKEN_AND_AND,   // &&
+    TOKEN_OR_OR,     // ||
+    TOKEN_INCREMENT, // ++
+    TOKEN_DECREMENT, // --
+    TOKEN_ARROW,     // ->
+    TOKEN_DOT,       // .
+    TOKEN_ELLIPSIS,  // ...
+    TOKEN_PLUS_ASSIGN,    // +=
+    TOKEN_MINUS_ASSIGN,   // -=
+    TOKEN_STAR_ASSIGN,    // *=
+    TOKEN_SLASH_ASSIGN,   // /=
+    TOKEN_PERCENT_ASSIGN, // %=
+    TOKEN_AMP_ASSIGN,     // &=
+    TOKEN_PIPE_ASSIGN,    // |=
+    TOKEN_CARET_ASSIGN,   // ^=
+    TOKEN_SHL_ASSIGN,     // <<=
+    TOKEN_SHR_ASSIGN,     // >>=
+    TOKEN_HASH,      // #
+    TOKEN_HASH_HASH, // ##
+    TOKEN_TYPE_COUNT
 } TokenType;
 
+// Token flags
+#define TOKEN_LINE_START    0x01   // First on its line, so a '#' starts a directive
+#define TOKEN_SPACE_BEFORE  0x02   // After whitespace or a comment
+#define TOKEN_NO_EXPAND     0x04   // Named a macro while it was being expanded; never expands
+
 // Token structure
 typedef struct {
     TokenType type;
-    char* text;
+    char* text;           // TOKEN_ERROR: the message; TOKEN_HEADER_NAME: the name with its delimiters
     int line;
     int column;
+    uint8_t flags;
+    const char* file;     // The header it came from; NULL for the unit's own source
     union {
         int64_t number;
         char* identifier;
@@ -94,7 +140,11 @@ typedef enum {
     NODE_ASSIGNMENT,
     NODE_CALL,
     NODE_IF_STMT,
-    NODE_WHILE_STMT
+    NODE_WHILE_STMT,
+    NODE_SWITCH_STMT,
+    NODE_CASE,
+    NODE_BREAK,
+    NODE_ERROR                    // Stands in for a statement or declaration that failed to parse
 } NodeType;
 
 // Symbol types
@@ -105,7 +155,7 @@ typedef enum {
 
 // Symbol structure
 typedef struct Symbol {
-    char* name;
+    const char* name;     // Interned
     SymbolType type;
     struct Symbol* next;
 } Symbol;
@@ -116,17 +166,35 @@ typedef struct Scope {
     struct Scope* parent;
 } Scope;
 
-// AST node structure
+// What a name in the AST stands for, bound once by resolve_program()
+typedef enum {
+    REF_NONE,                     // Not resolved yet
+    REF_LOCAL,                    // Frame slot: parameters first, then declarations
+    REF_GLOBAL,                   // The unit's globals, in declaration order
+    REF_FUNCTION,                 // The unit's functions, in definition order
+    REF_EXTERNAL                  // A function defined in another unit
+} RefKind;
+
+typedef struct {
+    RefKind kind;
+    int index;                    // Dense within its kind
+} NameRef;
+
+// AST node structure. Names are interned (see intern.h): nodes share
+// them and never free them.
 typedef struct ASTNode {
     NodeType type;
     int line;
     int column;
+    unsigned refs;                // Parents beyond the first, once hash-consed
     union {
         struct {
-            char* name;
-            struct ASTNode* params;
-            int param_count;
+            const char* name;
+            const char** params;  // Parameter names, in declaration order
+            size_t param_count;
             struct ASTNode* body;
+            size_t slot_count;    // Parameters plus declarations, once resolved
+            const char* file;     // Its source, once merged by -funity; NULL before
         } function;
         struct {
             struct ASTNode** statements;
@@ -155,19 +223,24 @@ typedef struct ASTNode {
             struct ASTNode* operand;
         } unary;
         struct {
-            char* name;
+            const char* name;
+            bool is_declaration;  // 'int x;' rather than a use of x
+            NameRef ref;
         } variable;
         struct {
             int64_t value;
         } number;
         struct {
-            char* name;
+            const char* name;
             struct ASTNode* value;
+            bool is_declaration;  // 'int x = ...;' rather than 'x = ...'
+            NameRef ref;
         } assignment;
         struct {
-            char* name;
+            const char* name;
             struct ASTNode** args;
             size_t arg_count;
+            NameRef ref;
         } call;
         struct {
             struct ASTNode* condition;
@@ -178,20 +251,43 @@ typedef struct ASTNode {
             struct ASTNode* condition;
             struct ASTNode* body;
         } while_stmt_node;
+        struct {
+            struct ASTNode* value;
+            struct ASTNode* body;         // NODE_BLOCK; its NODE_CASE statements are the labels
+        } switch_stmt_node;
+        struct {
+            int64_t value;
+            bool is_default;
+        } case_label;
     } data;
 } ASTNode;
 
-// Parser structure
-typedef struct Parser {
-    const char* source;
-    size_t source_length;
-    size_t position;
-    int current_char;
+// A parse error, at the token it was found at
+typedef struct {
+    const char* file;     // NULL for the unit's own source
     int line;
     int column;
+    char message[128];
+} ParseDiagnostic;
+
+// Errors kept per parse; parsing stops at the one after the last
+#define PARSER_MAX_DIAGNOSTICS 50
+
+// Parser structure
+typedef struct Parser {
+    struct Preprocessor* preprocessor;   // Where the tokens come from
     Token current;
-    const char* error;
+    Token lookahead[2];    // Read past current, not consumed yet
+    size_t lookahead_count;
+    size_t consumed;       // Tokens made current so far
+    const char* error;     // The first error's message, NULL while there is none
+    ParseDiagnostic diagnostics[PARSER_MAX_DIAGNOSTICS];  // Every error, in source order
+    size_t diagnostic_count;
+    bool panicking;        // Skipping to the next statement; errors until then are cascades
+    bool truncated;        // Gave up after PARSER_MAX_DIAGNOSTICS errors
     Scope* current_scope;  // Current scope for symbol resolution
+    int breakable;         // Enclosing loops and switches, for break
+    const struct Pch* pch; // Its declarations start the program
 } Parser;
 
 // Symbol table functions
@@ -201,10 +297,54 @@ Symbol* create_symbol(const char* name, SymbolType type);
 Symbol* scope_find(Scope* scope, const char* name);
 bool scope_add(Scope* scope, Symbol* symbol);
 
-// Parser interface
-struct Parser* parser_create(const char* source);
+// Lexer state over one NUL-terminated source
+typedef struct {
+    const char* source;
+    size_t length;
+    size_t position;
+    int line;
+    int column;
+    const char* file;      // Stamped on every token
+    struct Arena* arena;   // Holds identifiers, header names and error messages
+    int directive;         // How much of '# include' the last tokens were
+} Lexer;
+
+// Lexer interface (lexer.c). lex_token() returns the token at the lexer's
+// position and advances past it; a malformed token comes back as
+// TOKEN_ERROR with its message, for the caller to report.
+void lexer_init(Lexer* lexer, const char* source, size_t length, const char* file, struct Arena* arena);
+Token lex_token(Lexer* lexer);
+const char* token_spelling(TokenType type);   // "+=", "while", ... or NULL
+
+// Parser interface. The source is preprocessed on the way in: path
+// locates the headers it includes with "...", and options may be NULL
+// for no search paths or predefined macros. With a precompiled header in
+// options, the global scope starts with the header's globals.
+struct PreprocessOptions;
+struct Parser* parser_create(const char* source, const char* path, const struct PreprocessOptions* options);
 void parser_destroy(struct Parser* parser);
+
+// Parse the whole unit. A statement or declaration that fails to parse is
+// reported, replaced by a NODE_ERROR, and parsing resumes after it, so one
+// pass reports every error. The program is only fit to compile when
+// diagnostic_count is 0; NULL means out of memory. The declarations of a
+// precompiled header come first.
 ASTNode* parse(struct Parser* parser);
+
+// Write the global scope and the top-level declarations of program, as
+// parse() left them, to a precompiled header
+struct PchWriter;
+void parser_save(const struct Parser* parser, const ASTNode* program, struct PchWriter* writer);
+
+// Record an error at line:column and skip until the parser resynchronizes,
+// dropping the errors found meanwhile
+void parser_report(struct Parser* parser, int line, int column, const char* format, ...);
+
+// Record an error at line:column of file (NULL for the unit's own source).
+// Without resync the parser goes on as it was: preprocessor errors leave
+// the token stream intact.
+void parser_report_in(struct Parser* parser, const char* file, int line, int column, bool resync,
+                      const char* format, ...);
 void ast_destroy(ASTNode* node);
 
 #endif // PARSER_H
@@ -0,0 +1,79 @@
+#ifndef PCH_H
+#define PCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Precompiled headers. A snapshot keeps what preprocessing and parsing a
+// header left behind: the macro table, the global scope and the top-level
+// definitions. A unit then starts from that state instead of reading the
+// header. The file is mapped rather than read. Every string in it is
+// stored once, in a table that the restored macros point into, and the
+// rest is arrays of 64-bit words that the modules which wrote them decode
+// in place. A snapshot is only used while each file it was made from
+// still hashes to what it did then, under the same -I and -D options.
+
+// Who writes and reads what, in file order
+typedef enum {
+    PCH_MACROS,           // preprocess.c: macros, and the headers' guards and #pragma once
+    PCH_GLOBALS,          // parser.c: names in the global scope
+    PCH_DECLARATIONS,     // parser.c: the top-level AST
+    PCH_SECTION_COUNT
+} PchSection;
+
+// FNV-1a, continuing from hash; start with PCH_HASH_INIT
+#define PCH_HASH_INIT 0xcbf29ce484222325ULL
+uint64_t pch_hash(const void* data, size_t size, uint64_t hash);
+
+// Builds a snapshot: its sections, and the files it depends on
+typedef struct PchWriter PchWriter;
+
+PchWriter* pch_writer_create(void);
+void pch_writer_destroy(PchWriter* writer);
+
+// Append a word, or a string (NULL allowed), to a section. Running out of
+// memory is remembered and reported by pch_writer_finish().
+void pch_put(PchWriter* writer, PchSection section, uint64_t word);
+void pch_put_string(PchWriter* writer, PchSection section, const char* text);
+void pch_writer_fail(PchWriter* writer);   // A writing module ran out of memory
+
+// A file the snapshot depends on, hashed when it is written
+void pch_add_dependency(PchWriter* writer, const char* path);
+
+// Write the snapshot to path, made under the options that hash to
+// configuration. On failure error says why.
+bool pch_writer_finish(PchWriter* writer, const char* path, uint64_t configuration, char* error,
+                       size_t error_size);
+
+// A snapshot mapped for reading
+typedef struct Pch Pch;
+
+// Map the snapshot at path and check it against its dependencies and
+// configuration. NULL, with error saying why, when it cannot be used.
+Pch* pch_open(const char* path, uint64_t configuration, char* error, size_t error_size);
+void pch_close(Pch* pch);   // Strings read from it go with it
+
+typedef struct {
+    size_t bytes;         // Mapped
+    size_t strings;
+    size_t dependencies;  // Files hashed to validate it
+} PchStats;
+
+void pch_stats(const Pch* pch, PchStats* stats);
+
+// A cursor over one section. Reading past its end, or a string that is
+// not in the table, gives 0 or NULL and sets failed.
+typedef struct {
+    const Pch* pch;
+    const uint64_t* words;
+    size_t count;
+    size_t index;
+    bool failed;
+} PchReader;
+
+void pch_reader(const Pch* pch, PchSection section, PchReader* reader);
+uint64_t pch_get(PchReader* reader);
+const char* pch_get_string(PchReader* reader);   // In the mapping; NULL if it was NULL
+
+#endif // PCH_H
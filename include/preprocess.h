@@ -0,0 +1,55 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include "parser.h"
+
+// Token-level preprocessor between the lexer and the parser: #define and
+// #undef of object- and function-like macros, #include with search paths,
+// and conditional compilation. Headers are read and lexed once per process
+// and kept as token arrays; the macros they define are per unit, so each
+// unit expands them afresh. A header whose whole text is wrapped in
+// '#ifndef X ... #endif', or that says '#pragma once', is not opened or
+// even looked at again once X is defined, or once it was included.
+// A unit can also start from a precompiled header's macros (pch.h).
+
+struct Pch;
+struct PchWriter;
+
+typedef struct PreprocessOptions {
+    const char* const* include_paths;   // -I, searched in order
+    size_t include_path_count;
+    const char* const* defines;         // -D: NAME or NAME=value
+    size_t define_count;
+    const struct Pch* pch;              // Its macros replace the -D ones, which it was made with
+} PreprocessOptions;
+
+typedef struct {
+    size_t includes;          // #include directives run
+    size_t skipped;           // Of those, headers skipped by their guard or #pragma once
+    size_t cached;            // Headers entered that were lexed before
+    size_t read;              // Headers read and lexed for this unit
+    size_t expansions;        // Macro invocations replaced
+    size_t precompiled;       // Macros restored from a precompiled header
+} PreprocessStats;
+
+typedef struct Preprocessor Preprocessor;
+
+// Preprocess source, the unit at path (which locates the headers it
+// includes with "..."). Errors go to parser's diagnostics; options may be
+// NULL. NULL means out of memory.
+Preprocessor* preprocess_create(struct Parser* parser, const char* source, const char* path,
+                                const PreprocessOptions* options);
+
+// The next token for the parser, macros expanded and directives run.
+// Identifiers and texts stay valid until preprocess_destroy().
+Token preprocess_token(Preprocessor* pp);
+
+void preprocess_stats(const Preprocessor* pp, PreprocessStats* stats);
+
+// Write the macros defined at the end of the unit to a precompiled header,
+// with the headers this process has read, which it then depends on, and
+// their guards and #pragma once
+void preprocess_save(const Preprocessor* pp, struct PchWriter* writer);
+void preprocess_destroy(Preprocessor* pp);
+
+#endif // PREPROCESS_H
@@ -0,0 +1,32 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "leancc.h"
+#include "parser.h"
+
+// Name resolution, run once right after parsing. Every variable read,
+// assignment and call is bound to a NameRef, and every function learns its
+// frame size, so the passes after it index arrays instead of searching by
+// name. Locals follow leancc's scoping: a declaration is visible from the
+// end of its statement (the initializer still sees the previous binding)
+// to the end of the function, shadowing earlier ones. Globals are visible
+// in every function, wherever they are declared.
+
+typedef struct {
+    size_t functions;
+    size_t globals;
+    size_t slots;            // Frame slots, over all functions
+    size_t locals;           // Names bound to a local
+    size_t global_refs;      // ... to a global
+    size_t calls;            // Calls bound to a function of this unit
+    size_t external_calls;   // ... or left to the linker
+} ResolveStats;
+
+// Bind every name in program. Undefined variables, redefinitions,
+// duplicate parameters and calls with the wrong number of arguments to a
+// function of this unit are reported in error. stats may be NULL.
+bool resolve_program(ASTNode* program, Error* error, ResolveStats* stats);
+
+#endif // RESOLVE_H
@@ -0,0 +1,41 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Work-stealing scheduler for the per-function stages of the backend.
+// Each worker has its own deque: it pushes the tasks it makes ready and
+// takes them back from the bottom, and a worker that runs dry steals from
+// the top of another's. A task becomes ready once every task it waits for
+// has finished, so callers can run bottom-up over a call graph.
+
+// Run task on behalf of worker (0..workers-1); false stops the schedule
+typedef bool (*TaskRun)(void* context, size_t task, size_t worker);
+
+typedef struct {
+    size_t count;           // Tasks 0..count-1
+    const int* waits;       // How many tasks each one waits for; NULL if none wait
+    const int* next_start;  // Tasks that t releases: next[next_start[t]..next_start[t+1]],
+    const int* next;        // one entry per task it waited for
+    TaskRun run;
+    void* context;
+} TaskGraph;
+
+typedef struct {
+    size_t workers;         // Threads that took part, the calling one included
+    size_t steals;          // Tasks taken from another worker's deque
+} ScheduleStats;
+
+// Workers for threads == 0: one per online processor
+size_t schedule_default_threads(void);
+
+// The number of workers a run over count tasks will ask for
+size_t schedule_workers(size_t threads, size_t count);
+
+// Run every task on up to threads workers, the calling thread being one
+// of them. Returns false if a task failed or a dependency cycle
+// left tasks that never became ready.
+bool schedule_run(const TaskGraph* graph, size_t threads, ScheduleStats* stats);
+
+#endif // SCHEDULE_H
@@ -0,0 +1,60 @@
+#ifndef TIER_H
+#define TIER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "leancc.h"
+#include "parser.h"
+#include "ir.h"
+#include "codegen.h"
+#include "vm.h"
+
+// Tiered execution. Programs start in the bytecode interpreter, which
+// counts calls, loop iterations and branch outcomes per function. When a
+// function's calls plus loop iterations reach the threshold, every unit is
+// lowered and takes the counts gathered so far, and the function is
+// optimized with them - hot callees are inlined more eagerly, cold ones
+// less, and blocks are laid out along the likelier path - and compiled to
+// native code, where its next call goes. Functions called from native code
+// are optimized and compiled the same way on demand.
+// A running interpreted call stays interpreted until it returns.
+
+typedef struct Tier Tier;
+
+typedef struct {
+    uint64_t threshold;       // Calls plus loop iterations before promotion
+    IROptOptions optimize;    // .unit and .profile are set for each unit
+    CodeGenOptions codegen;
+    FILE* log;                // One line per promotion, or NULL
+} TierOptions;
+
+typedef struct {
+    size_t functions;
+    size_t promoted;          // Reached the threshold in the interpreter
+    size_t compiled;          // Promoted, or compiled when first called from native code
+    size_t calls;             // Interpreted calls
+    double interpreter_us;
+    double compile_us;        // Lowering, optimizing and compiling
+    double native_us;
+} TierStats;
+
+Tier* tier_create(const TierOptions* options);
+void tier_destroy(Tier* tier);
+
+// Add a parsed unit, which must outlive the Tier; name prefixes its
+// statistics lines
+bool tier_add_unit(Tier* tier, const ASTNode* unit, const char* name, Error* error);
+
+// Resolve calls between units. When a function is undefined, *unit is the
+// unit that calls it.
+bool tier_link(Tier* tier, Error* error, size_t* unit);
+
+// Call a function without parameters, such as main. error is set when the
+// status is VM_NATIVE_FAILED, which also stands for a missing function.
+VMStatus tier_run(Tier* tier, const char* name, int64_t* result, VMStats* stats, Error* error);
+
+void tier_stats(const Tier* tier, TierStats* stats);
+
+#endif // TIER_H
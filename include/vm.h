@@ -0,0 +1,183 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "leancc.h"
+#include "parser.h"
+
+// Register bytecode for running programs without a native toolchain.
+// Each function works on a window of 64-bit registers: parameters first,
+// then one register per local declaration, then expression temporaries.
+// A call evaluates its arguments into consecutive temporaries, which
+// become the first registers of the callee's window.
+
+typedef enum {
+    BC_MOV,           // r[a] = r[b]
+    BC_LOADK,         // r[a] = k
+    BC_LOADG,         // r[a] = globals[b]
+    BC_STOREG,        // globals[a] = r[b]
+    BC_ADD,           // r[a] = r[b] op r[c], for ADD through GE
+    BC_SUB,
+    BC_MUL,
+    BC_DIV,
+    BC_EQ,
+    BC_NE,
+    BC_LT,
+    BC_GT,
+    BC_LE,
+    BC_GE,
+    BC_ADDK,          // r[a] = r[b] op k, for ADDK through GEK
+    BC_SUBK,
+    BC_MULK,
+    BC_DIVK,
+    BC_EQK,
+    BC_NEK,
+    BC_LTK,
+    BC_GTK,
+    BC_LEK,
+    BC_GEK,
+    BC_JMP,           // goto c
+    BC_JZ,            // if (r[a] == 0) goto c
+    BC_JNZ,           // if (r[a] != 0) goto c
+    BC_JEQ,           // if (r[a] op r[b]) goto c, for JEQ through JGE
+    BC_JNE,
+    BC_JLT,
+    BC_JGT,
+    BC_JLE,
+    BC_JGE,
+    BC_JEQK,          // if (r[a] op k) goto c, for JEQK through JGEK
+    BC_JNEK,
+    BC_JLTK,
+    BC_JGTK,
+    BC_JLEK,
+    BC_JGEK,
+    BC_SWITCH,        // goto code[pc + 1 + r[a] - k].c if r[a] - k < b (unsigned), else
+                      // goto c; the table is the b BC_JMPs that follow
+    BC_CALL,          // r[a] = functions[b](r[c], r[c+1], ...)
+    BC_TAILCALL,      // return functions[b](r[c], r[c+1], ...), reusing the frame
+    BC_RET,           // return r[a]
+    BC_RETK,          // return k
+    BC_OPCODE_COUNT
+} BCOpcode;
+
+typedef struct {
+    uint8_t op;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+    int64_t k;
+} BCInstr;
+
+// A conditional jump compiled from an if or while condition, so counts
+// gathered while running can be tied back to the source
+typedef struct {
+    size_t pc;
+    int line;                 // Of the condition
+    int column;
+    bool jumps_if_true;       // Taken means the condition held
+} BCBranch;
+
+typedef struct {
+    const char* name;
+    size_t param_count;
+    int frame_size;           // Registers in the window
+    BCInstr* code;
+    size_t code_count;
+    BCBranch* branches;
+    size_t branch_count;
+    size_t unit;              // In bytecode_add_unit() order
+} BCFunction;
+
+// A called name, resolved to a function index by bytecode_link()
+typedef struct {
+    const char* name;
+    size_t unit;              // Calling unit, in bytecode_add_unit() order
+    int line;                 // First call from it, for diagnostics
+    int column;
+} BCCallee;
+
+typedef struct BCProgram {
+    BCFunction* functions;
+    size_t function_count;
+    size_t function_capacity;
+    int64_t* globals;         // Initial values of every unit's globals
+    size_t global_count;
+    size_t global_capacity;
+    BCCallee* callees;        // Call operands b index this until linked
+    size_t callee_count;
+    size_t callee_capacity;
+    size_t unit_count;
+    bool linked;
+    size_t fused;
+    int* slots;               // Open-addressing index from name to function index + 1
+    size_t slot_capacity;
+} BCProgram;
+
+typedef struct {
+    size_t instructions;      // Emitted, after fusion
+    size_t fused;             // Pairs combined into one superinstruction
+} BCStats;
+
+// Compile translation units one at a time, then resolve calls between
+// them. Globals are private to their unit, as in compiled code. When
+// linking fails, *unit is the unit whose call could not be resolved.
+BCProgram* bytecode_create(void);
+void bytecode_destroy(BCProgram* program);
+bool bytecode_add_unit(BCProgram* program, const ASTNode* unit, Error* error);
+bool bytecode_link(BCProgram* program, Error* error, size_t* unit);
+const BCFunction* bytecode_find_function(const BCProgram* program, const char* name);
+void bytecode_stats(const BCProgram* program, BCStats* stats);
+void bytecode_print(FILE* out, const BCProgram* program);
+
+// Interpreter (vm.c)
+typedef struct VM VM;
+
+typedef enum {
+    VM_OK,
+    VM_TRAP,                  // Division by zero or overflow
+    VM_STACK_OVERFLOW,        // Out of registers or call frames
+    VM_NO_MEMORY,
+    VM_NATIVE_FAILED          // Promoting or calling a function failed
+} VMStatus;
+
+typedef struct {
+    size_t calls;
+    const char* function;     // Where a trap or overflow happened
+} VMStats;
+
+// Tiered execution (tier.c) has the interpreter count calls, loop
+// iterations and branch outcomes per function; once a function turns hot,
+// promote() may compile it, and calls to it go to call() from then on.
+typedef struct {
+    uint64_t calls;
+    uint64_t back_edges;      // Backward jumps taken: loop iterations
+    uint64_t* taken;          // Per instruction, for conditional jumps
+    uint64_t* not_taken;
+    bool native;              // Calls go to VMTier.call
+    bool pinned;              // Stays interpreted
+} VMProfile;
+
+typedef struct VMTier {
+    VMProfile* profiles;      // Indexed like program->functions
+    uint64_t threshold;       // Calls plus back edges that make a function hot
+    int64_t* globals;         // Shared with native code; may move on promotion
+    // Either set native or pinned; false on failure
+    bool (*promote)(struct VMTier* tier, size_t function);
+    bool (*call)(struct VMTier* tier, size_t function, const int64_t* args, int64_t* result);
+} VMTier;
+
+// The register and frame stacks are allocated once, by vm_create(), and
+// reused by every run
+VM* vm_create(void);
+void vm_destroy(VM* vm);
+
+// Call a function without parameters, such as main. Without a tier each
+// run starts from the initial values of the globals; with one, globals
+// live in tier->globals.
+VMStatus vm_run(VM* vm, const BCProgram* program, const BCFunction* entry, VMTier* tier,
+                int64_t* result, VMStats* stats);
+
+#endif // VM_H
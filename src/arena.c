@@ -0,0 +1,105 @@
+#include "arena.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_DEFAULT_CHUNK (64 * 1024)
+#define ARENA_POOL_LIMIT 256    // Chunks kept for reuse: 16 MiB
+
+struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t used;
+    size_t size;
+    _Alignas(ARENA_ALIGNMENT) unsigned char data[];
+};
+
+// Freed chunks of the default size, for the next arena that needs one
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static ArenaChunk* pool;            // Under pool_lock, like the counts
+static size_t pool_count;
+static size_t pool_recycled;
+static _Atomic size_t allocated;
+
+static ArenaChunk* take_chunk(size_t capacity) {
+    ArenaChunk* chunk = NULL;
+    if (capacity == ARENA_DEFAULT_CHUNK) {
+        pthread_mutex_lock(&pool_lock);
+        chunk = pool;
+        if (chunk) {
+            pool = chunk->next;
+            pool_count--;
+            pool_recycled++;
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+    if (!chunk) {
+        chunk = malloc(sizeof(ArenaChunk) + capacity);
+        if (!chunk) return NULL;
+        atomic_fetch_add_explicit(&allocated, 1, memory_order_relaxed);
+    }
+    chunk->used = 0;
+    chunk->size = capacity;
+    return chunk;
+}
+
+void arena_init(Arena* arena, size_t chunk_size) {
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK;
+}
+
+void arena_free(Arena* arena) {
+    ArenaChunk* chunk = arena->chunks;
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        bool kept = false;
+        if (chunk->size == ARENA_DEFAULT_CHUNK) {
+            pthread_mutex_lock(&pool_lock);
+            if (pool_count < ARENA_POOL_LIMIT) {
+                chunk->next = pool;
+                pool = chunk;
+                pool_count++;
+                kept = true;
+            }
+            pthread_mutex_unlock(&pool_lock);
+        }
+        if (!kept) free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    ArenaChunk* chunk = arena->chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        // Oversized requests get a dedicated chunk
+        chunk = take_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+        if (!chunk) return NULL;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    void* result = chunk->data + chunk->used;
+    chunk->used += size;
+    memset(result, 0, size);
+    return result;
+}
+
+char* arena_strdup(Arena* arena, const char* text) {
+    size_t len = strlen(text);
+    char* copy = arena_alloc(arena, len + 1);
+    if (copy) memcpy(copy, text, len + 1);
+    return copy;
+}
+
+void arena_stats(ArenaStats* stats) {
+    pthread_mutex_lock(&pool_lock);
+    stats->allocated = atomic_load_explicit(&allocated, memory_order_relaxed);
+    stats->recycled = pool_recycled;
+    stats->pooled = pool_count;
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,879 @@
+#include "vm.h"
+#include "optimize.h"
+#include "ir.h"
+#include "intern.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Compilation from the AST to register bytecode. Every local gets a
+// register of its own - the frame slot resolve_program() bound it to - so
+// reading a variable costs nothing; expression temporaries are allocated
+// as a stack above the locals. A peephole pass then fuses
+// common pairs (a constant and its use, a comparison and its branch, a
+// result and the copy out of it) into single instructions.
+
+typedef struct {
+    BCProgram* program;
+    Error* error;
+    size_t global_base;         // This unit's first global in program->globals
+    int* callees;               // Callee of each REF_FUNCTION, then of each REF_EXTERNAL, or -1
+    size_t callee_capacity;
+    size_t function_count;      // This unit's functions, which come first in callees
+    int temp_base;              // First temporary: after every local
+    int temp_top;
+    int frame_size;
+    BCInstr* code;
+    size_t count;
+    size_t capacity;
+    BCBranch* branches;
+    size_t branch_count;
+    size_t branch_capacity;
+    int* breaks;                // Jumps out of the enclosing loops and switches
+    size_t break_count;
+    size_t break_capacity;
+} BCCompiler;
+
+static void bc_error(BCCompiler* c, const ASTNode* node, const char* format, ...) {
+    if (c->error->code != ERROR_NONE) return;
+    c->error->code = ERROR_SEMANTIC;
+    c->error->line = node ? node->line : 0;
+    c->error->column = node ? node->column : 0;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(c->error->message, sizeof(c->error->message), format, args);
+    va_end(args);
+}
+
+static bool failed(const BCCompiler* c) {
+    return c->error->code != ERROR_NONE;
+}
+
+static int emit(BCCompiler* c, BCOpcode op, int a, int b, int cc, int64_t k) {
+    if (failed(c)) return -1;
+    if (c->count >= c->capacity) {
+        size_t capacity = c->capacity ? c->capacity * 2 : 64;
+        BCInstr* code = realloc(c->code, capacity * sizeof(BCInstr));
+        if (!code) {
+            bc_error(c, NULL, "Out of memory");
+            return -1;
+        }
+        c->code = code;
+        c->capacity = capacity;
+    }
+    c->code[c->count] = (BCInstr){ .op = (uint8_t)op, .a = a, .b = b, .c = cc, .k = k };
+    return (int)c->count++;
+}
+
+static void patch(BCCompiler* c, int jump) {
+    if (jump >= 0) c->code[jump].c = (int)c->count;
+}
+
+static void add_break(BCCompiler* c, int jump) {
+    if (jump < 0) return;
+    if (c->break_count >= c->break_capacity) {
+        size_t capacity = c->break_capacity ? c->break_capacity * 2 : 8;
+        int* breaks = realloc(c->breaks, capacity * sizeof(int));
+        if (!breaks) {
+            bc_error(c, NULL, "Out of memory");
+            return;
+        }
+        c->breaks = breaks;
+        c->break_capacity = capacity;
+    }
+    c->breaks[c->break_count++] = jump;
+}
+
+// Send the breaks added since first to the next instruction
+static void patch_breaks(BCCompiler* c, size_t first) {
+    for (size_t i = first; i < c->break_count; i++) patch(c, c->breaks[i]);
+    c->break_count = first;
+}
+
+static int push_temp(BCCompiler* c) {
+    int reg = c->temp_top++;
+    if (c->temp_top > c->frame_size) c->frame_size = c->temp_top;
+    return reg;
+}
+
+static int global_index(const BCCompiler* c, NameRef ref) {
+    return (int)(c->global_base + (size_t)ref.index);
+}
+
+// The program's callee for a call, added on the first call to it from this unit
+static int callee_index(BCCompiler* c, const ASTNode* call) {
+    BCProgram* program = c->program;
+    NameRef ref = call->data.call.ref;
+    size_t key = (size_t)ref.index + (ref.kind == REF_EXTERNAL ? c->function_count : 0);
+    if (key >= c->callee_capacity) {
+        size_t capacity = c->callee_capacity ? c->callee_capacity : 16;
+        while (capacity <= key) capacity *= 2;
+        int* callees = realloc(c->callees, capacity * sizeof(int));
+        if (!callees) {
+            bc_error(c, call, "Out of memory");
+            return -1;
+        }
+        for (size_t i = c->callee_capacity; i < capacity; i++) callees[i] = -1;
+        c->callees = callees;
+        c->callee_capacity = capacity;
+    }
+    if (c->callees[key] >= 0) return c->callees[key];
+
+    const char* name = intern(call->data.call.name);
+    if (!name) {
+        bc_error(c, call, "Out of memory");
+        return -1;
+    }
+    if (program->callee_count >= program->callee_capacity) {
+        size_t capacity = program->callee_capacity ? program->callee_capacity * 2 : 16;
+        BCCallee* callees = realloc(program->callees, capacity * sizeof(BCCallee));
+        if (!callees) {
+            bc_error(c, call, "Out of memory");
+            return -1;
+        }
+        program->callees = callees;
+        program->callee_capacity = capacity;
+    }
+    BCCallee* callee = &program->callees[program->callee_count];
+    callee->name = name;
+    callee->unit = program->unit_count;
+    callee->line = call->line;
+    callee->column = call->column;
+    c->callees[key] = (int)program->callee_count;
+    return (int)program->callee_count++;
+}
+
+// Whether evaluating node can change a local
+static bool assigns(const ASTNode* node) {
+    if (!node) return false;
+    switch (node->type) {
+        case NODE_ASSIGNMENT:
+            return true;
+        case NODE_BINARY_OP:
+            return assigns(node->data.binary.left) || assigns(node->data.binary.right);
+        case NODE_CALL:
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                if (assigns(node->data.call.args[i])) return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+static BCOpcode binary_opcode(BinaryOp op) {
+    switch (op) {
+        case OP_ADD:           return BC_ADD;
+        case OP_SUBTRACT:      return BC_SUB;
+        case OP_MULTIPLY:      return BC_MUL;
+        case OP_DIVIDE:        return BC_DIV;
+        case OP_EQUALS:        return BC_EQ;
+        case OP_NOT_EQUALS:    return BC_NE;
+        case OP_LESS:          return BC_LT;
+        case OP_GREATER:       return BC_GT;
+        case OP_LESS_EQUAL:    return BC_LE;
+        case OP_GREATER_EQUAL: return BC_GE;
+        default:               return BC_OPCODE_COUNT;
+    }
+}
+
+static void compile_expression(BCCompiler* c, const ASTNode* node, int dst);
+
+// A register holding the value of node: the variable's own register when
+// nothing evaluated before its use can assign it, otherwise a temporary
+static int compile_operand(BCCompiler* c, const ASTNode* node, bool direct) {
+    if (direct && node->type == NODE_VARIABLE && node->data.variable.ref.kind == REF_LOCAL) {
+        return node->data.variable.ref.index;
+    }
+    int reg = push_temp(c);
+    compile_expression(c, node, reg);
+    return reg;
+}
+
+// Arguments go to consecutive temporaries, the callee's first registers
+static int compile_arguments(BCCompiler* c, const ASTNode* call) {
+    size_t count = call->data.call.arg_count;
+    int base = c->temp_top;
+    for (size_t i = 0; i < count; i++) push_temp(c);
+    for (size_t i = 0; i < count; i++) compile_expression(c, call->data.call.args[i], base + (int)i);
+    return base;
+}
+
+// dst < 0 discards the value
+static void compile_assignment(BCCompiler* c, const ASTNode* node, int dst) {
+    NameRef ref = node->data.assignment.ref;
+    int reg;
+    if (ref.kind == REF_LOCAL) {
+        reg = ref.index;
+        compile_expression(c, node->data.assignment.value, reg);
+    } else {
+        int saved = c->temp_top;
+        reg = dst >= 0 ? dst : push_temp(c);
+        compile_expression(c, node->data.assignment.value, reg);
+        emit(c, BC_STOREG, global_index(c, ref), reg, 0, 0);
+        c->temp_top = saved;
+        return;
+    }
+    if (dst >= 0 && dst != reg) emit(c, BC_MOV, dst, reg, 0, 0);
+}
+
+static void compile_expression(BCCompiler* c, const ASTNode* node, int dst) {
+    if (failed(c)) return;
+    int saved = c->temp_top;
+
+    switch (node->type) {
+        case NODE_NUMBER:
+            emit(c, BC_LOADK, dst, 0, 0, node->data.number.value);
+            break;
+
+        case NODE_VARIABLE: {
+            NameRef ref = node->data.variable.ref;
+            if (ref.kind == REF_LOCAL) {
+                if (ref.index != dst) emit(c, BC_MOV, dst, ref.index, 0, 0);
+                break;
+            }
+            emit(c, BC_LOADG, dst, global_index(c, ref), 0, 0);
+            break;
+        }
+
+        case NODE_ASSIGNMENT:
+            compile_assignment(c, node, dst);
+            break;
+
+        case NODE_BINARY_OP: {
+            BCOpcode op = binary_opcode(node->data.binary.op);
+            if (op == BC_OPCODE_COUNT) {
+                bc_error(c, node, "Invalid assignment target");
+                break;
+            }
+            int left = compile_operand(c, node->data.binary.left, !assigns(node->data.binary.right));
+            int right = compile_operand(c, node->data.binary.right, true);
+            emit(c, op, dst, left, right, 0);
+            break;
+        }
+
+        case NODE_CALL: {
+            int callee = callee_index(c, node);
+            int base = compile_arguments(c, node);
+            emit(c, BC_CALL, dst, callee, base, (int64_t)node->data.call.arg_count);
+            break;
+        }
+
+        default:
+            bc_error(c, node, "Unsupported expression");
+            break;
+    }
+    c->temp_top = saved;
+}
+
+// Jump to the returned instruction's target when condition equals when
+static int compile_branch(BCCompiler* c, const ASTNode* condition, bool when) {
+    int saved = c->temp_top;
+    int reg = compile_operand(c, condition, true);
+    c->temp_top = saved;
+    int jump = emit(c, when ? BC_JNZ : BC_JZ, reg, 0, -1, 0);
+    if (jump < 0) return jump;
+
+    if (c->branch_count >= c->branch_capacity) {
+        size_t capacity = c->branch_capacity ? c->branch_capacity * 2 : 8;
+        BCBranch* branches = realloc(c->branches, capacity * sizeof(BCBranch));
+        if (!branches) {
+            bc_error(c, condition, "Out of memory");
+            return -1;
+        }
+        c->branches = branches;
+        c->branch_capacity = capacity;
+    }
+    c->branches[c->branch_count++] = (BCBranch){ .pc = (size_t)jump, .line = condition->line,
+                                                 .column = condition->column,
+                                                 .jumps_if_true = when };
+    return jump;
+}
+
+static void compile_statement(BCCompiler* c, const ASTNode* node);
+
+// Switch dispatch follows the clusters of ir_switch_clusters(), as native
+// code does: a table is a BC_SWITCH, a lone case a BC_JEQK, and a tree of
+// BC_JGEKs picks the cluster. Jumps to the label at statement i of the
+// body are emitted with c = -2 - i and resolved once the body is in place.
+#define LINEAR_CLUSTERS 3
+
+typedef struct {
+    int64_t value;
+    size_t statement;           // Of its label in the body
+} BCCase;
+
+static int label_ref(size_t statement) {
+    return -2 - (int)statement;
+}
+
+static void compile_dispatch(BCCompiler* c, int reg, const BCCase* cases,
+                             const IRSwitchCluster* clusters, size_t lo, size_t hi,
+                             int default_ref, bool jump_to_default) {
+    if (hi - lo <= LINEAR_CLUSTERS) {
+        for (size_t k = lo; k < hi; k++) {
+            const IRSwitchCluster* cluster = &clusters[k];
+            if (!cluster->table) {
+                const BCCase* single = &cases[cluster->first];
+                emit(c, BC_JEQK, reg, 0, label_ref(single->statement), single->value);
+                continue;
+            }
+            int64_t low = cases[cluster->first].value;
+            int slots = (int)((uint64_t)cases[cluster->last].value - (uint64_t)low + 1);
+            bool last = k + 1 == hi;
+            int table = emit(c, BC_SWITCH, reg, slots, last ? default_ref : -1, low);
+            size_t next = cluster->first;
+            for (int slot = 0; slot < slots; slot++) {
+                int target = default_ref;
+                if ((uint64_t)cases[next].value - (uint64_t)low == (uint64_t)slot) {
+                    target = label_ref(cases[next++].statement);
+                }
+                emit(c, BC_JMP, 0, 0, target, 0);
+            }
+            if (last) return;
+            patch(c, table);
+        }
+        if (jump_to_default) emit(c, BC_JMP, 0, 0, default_ref, 0);
+        return;
+    }
+
+    size_t mid = lo + (hi - lo) / 2;
+    int upper = emit(c, BC_JGEK, reg, 0, -1, cases[clusters[mid].first].value);
+    compile_dispatch(c, reg, cases, clusters, lo, mid, default_ref, true);
+    patch(c, upper);
+    compile_dispatch(c, reg, cases, clusters, mid, hi, default_ref, jump_to_default);
+}
+
+static int compare_bc_cases(const void* a, const void* b) {
+    int64_t x = ((const BCCase*)a)->value;
+    int64_t y = ((const BCCase*)b)->value;
+    return (x > y) - (x < y);
+}
+
+static void compile_switch(BCCompiler* c, const ASTNode* node) {
+    const ASTNode* body = node->data.switch_stmt_node.body;
+    size_t n = body->data.block.count;
+    BCCase* cases = malloc((n + 1) * sizeof(BCCase));
+    int64_t* values = malloc((n + 1) * sizeof(int64_t));
+    IRSwitchCluster* clusters = malloc((n + 1) * sizeof(IRSwitchCluster));
+    int* label_pcs = malloc((n + 1) * sizeof(int));
+    if (!cases || !values || !clusters || !label_pcs) {
+        bc_error(c, node, "Out of memory");
+        goto done;
+    }
+
+    // Without a default, unmatched values go to the end, statement n
+    size_t count = 0;
+    size_t default_statement = n;
+    for (size_t i = 0; i < n; i++) {
+        const ASTNode* statement = body->data.block.statements[i];
+        if (statement->type != NODE_CASE) continue;
+        if (statement->data.case_label.is_default) {
+            default_statement = i;
+        } else {
+            cases[count++] = (BCCase){ statement->data.case_label.value, i };
+        }
+    }
+    qsort(cases, count, sizeof(BCCase), compare_bc_cases);
+    for (size_t i = 0; i < count; i++) values[i] = cases[i].value;
+    size_t cluster_count = ir_switch_clusters(values, count, clusters);
+
+    int saved = c->temp_top;
+    int reg = compile_operand(c, node->data.switch_stmt_node.value, true);
+    c->temp_top = saved;
+    size_t dispatch = c->count;
+    compile_dispatch(c, reg, cases, clusters, 0, cluster_count, label_ref(default_statement),
+                     default_statement != 0);
+    size_t dispatch_end = c->count;
+
+    size_t first_break = c->break_count;
+    for (size_t i = 0; i < n; i++) {
+        const ASTNode* statement = body->data.block.statements[i];
+        label_pcs[i] = (int)c->count;
+        if (statement->type != NODE_CASE) compile_statement(c, statement);
+    }
+    label_pcs[n] = (int)c->count;
+    patch_breaks(c, first_break);
+    if (failed(c)) goto done;
+
+    for (size_t pc = dispatch; pc < dispatch_end; pc++) {
+        BCInstr* in = &c->code[pc];
+        if (in->c <= label_ref(0)) in->c = label_pcs[-2 - in->c];
+    }
+
+done:
+    free(cases);
+    free(values);
+    free(clusters);
+    free(label_pcs);
+}
+
+static void compile_statement(BCCompiler* c, const ASTNode* node) {
+    if (!node || failed(c)) return;
+    int saved = c->temp_top;
+
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (size_t i = 0; i < node->data.block.count; i++) {
+                compile_statement(c, node->data.block.statements[i]);
+            }
+            break;
+
+        case NODE_RETURN: {
+            const ASTNode* expr = node->data.ret.expr;
+            if (expr->type == NODE_CALL) {
+                int callee = callee_index(c, expr);
+                int base = compile_arguments(c, expr);
+                emit(c, BC_TAILCALL, 0, callee, base, (int64_t)expr->data.call.arg_count);
+                break;
+            }
+            emit(c, BC_RET, compile_operand(c, expr, true), 0, 0, 0);
+            break;
+        }
+
+        case NODE_IF_STMT: {
+            int skip = compile_branch(c, node->data.if_stmt_node.condition, false);
+            compile_statement(c, node->data.if_stmt_node.then_branch);
+            if (node->data.if_stmt_node.else_branch) {
+                int end = emit(c, BC_JMP, 0, 0, -1, 0);
+                patch(c, skip);
+                compile_statement(c, node->data.if_stmt_node.else_branch);
+                patch(c, end);
+            } else {
+                patch(c, skip);
+            }
+            break;
+        }
+
+        case NODE_WHILE_STMT: {
+            // The condition sits after the body, so each iteration takes
+            // one branch
+            size_t first_break = c->break_count;
+            int enter = emit(c, BC_JMP, 0, 0, -1, 0);
+            int body = (int)c->count;
+            compile_statement(c, node->data.while_stmt_node.body);
+            patch(c, enter);
+            int loop = compile_branch(c, node->data.while_stmt_node.condition, true);
+            if (loop >= 0) c->code[loop].c = body;
+            patch_breaks(c, first_break);
+            break;
+        }
+
+        case NODE_SWITCH_STMT:
+            compile_switch(c, node);
+            break;
+
+        case NODE_BREAK:
+            add_break(c, emit(c, BC_JMP, 0, 0, -1, 0));
+            break;
+
+        case NODE_VARIABLE:
+            if (node->data.variable.is_declaration) {
+                // Uninitialized locals start out as zero, as in compiled code
+                emit(c, BC_LOADK, node->data.variable.ref.index, 0, 0, 0);
+            }
+            break;
+
+        case NODE_ASSIGNMENT:
+            compile_assignment(c, node, -1);
+            break;
+
+        default:
+            // Expression statement; the value is discarded
+            compile_expression(c, node, push_temp(c));
+            break;
+    }
+    c->temp_top = saved;
+}
+
+static bool is_jump(uint8_t op) {
+    return op == BC_JMP || op == BC_JZ || op == BC_JNZ || (op >= BC_JEQ && op <= BC_SWITCH);
+}
+
+static bool writes_a(uint8_t op) {
+    return op == BC_MOV || op == BC_LOADK || op == BC_LOADG || op == BC_CALL ||
+           (op >= BC_ADD && op <= BC_GEK);
+}
+
+static bool is_compare(uint8_t op) {
+    return (op >= BC_EQ && op <= BC_GE) || (op >= BC_EQK && op <= BC_GEK);
+}
+
+// The comparison with its operands swapped: a < b is b > a
+static uint8_t swap_compare(uint8_t op) {
+    switch (op) {
+        case BC_LT: return BC_GT;
+        case BC_GT: return BC_LT;
+        case BC_LE: return BC_GE;
+        case BC_GE: return BC_LE;
+        default:    return op;
+    }
+}
+
+// The comparison that is true exactly when op is false
+static uint8_t negate_compare(uint8_t op) {
+    static const uint8_t negated[] = { BC_NE, BC_EQ, BC_GE, BC_LE, BC_GT, BC_LT };
+    if (op >= BC_EQ && op <= BC_GE) return negated[op - BC_EQ];
+    return (uint8_t)(negated[op - BC_EQK] - BC_EQ + BC_EQK);
+}
+
+// Combine prev with the instruction after it, when prev only computes a
+// temporary that next is the sole reader of
+static bool fuse(BCInstr* prev, const BCInstr* next, int temp_base) {
+    if (!writes_a(prev->op) || prev->a < temp_base) return false;
+    int t = prev->a;
+
+    if (next->op == BC_MOV && next->b == t) {
+        prev->a = next->a;
+        return true;
+    }
+    if (prev->op == BC_LOADK) {
+        if (next->op == BC_RET && next->a == t) {
+            *prev = (BCInstr){ .op = BC_RETK, .k = prev->k };
+            return true;
+        }
+        if (next->op < BC_ADD || next->op > BC_GE || next->b == next->c) return false;
+        if (next->c == t) {
+            *prev = (BCInstr){ .op = (uint8_t)(next->op - BC_ADD + BC_ADDK), .a = next->a,
+                               .b = next->b, .k = prev->k };
+            return true;
+        }
+        bool commutes = next->op == BC_ADD || next->op == BC_MUL || is_compare(next->op);
+        if (next->b == t && commutes) {
+            uint8_t op = swap_compare(next->op);
+            *prev = (BCInstr){ .op = (uint8_t)(op - BC_ADD + BC_ADDK), .a = next->a,
+                               .b = next->c, .k = prev->k };
+            return true;
+        }
+        return false;
+    }
+    if (is_compare(prev->op) && (next->op == BC_JZ || next->op == BC_JNZ) && next->a == t) {
+        uint8_t op = next->op == BC_JZ ? negate_compare(prev->op) : prev->op;
+        bool constant = op >= BC_EQK;
+        prev->op = (uint8_t)(op - (constant ? BC_EQK : BC_EQ) + (constant ? BC_JEQK : BC_JEQ));
+        prev->a = prev->b;
+        prev->b = prev->c;
+        prev->c = next->c;
+        return true;
+    }
+    return false;
+}
+
+// Fuse pairs in place and remap jump targets. The second instruction of a
+// pair must not be a jump target, or jumps would skip its first half.
+static bool fuse_pairs(BCCompiler* c, size_t* fused) {
+    size_t count = c->count;
+    bool* target = calloc(count + 1, sizeof(bool));
+    size_t* map = malloc((count + 1) * sizeof(size_t));
+    if (!target || !map) {
+        free(target);
+        free(map);
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (is_jump(c->code[i].op)) target[c->code[i].c] = true;
+    }
+
+    size_t out = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (out > 0 && !target[i] && fuse(&c->code[out - 1], &c->code[i], c->temp_base)) {
+            map[i] = out - 1;
+            (*fused)++;
+            continue;
+        }
+        c->code[out] = c->code[i];
+        map[i] = out++;
+    }
+    map[count] = out;
+    for (size_t i = 0; i < out; i++) {
+        if (is_jump(c->code[i].op)) c->code[i].c = (int)map[c->code[i].c];
+    }
+    for (size_t i = 0; i < c->branch_count; i++) c->branches[i].pc = map[c->branches[i].pc];
+    c->count = out;
+    free(target);
+    free(map);
+    return true;
+}
+
+// Where name is in program->slots, or the empty slot it would take. Names
+// are interned, so they compare by pointer.
+static size_t function_slot(const BCProgram* program, const char* name) {
+    size_t mask = program->slot_capacity - 1;
+    size_t slot = (size_t)(((uint64_t)(uintptr_t)name * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+    while (program->slots[slot] && program->functions[program->slots[slot] - 1].name != name) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static int function_index(const BCProgram* program, const char* name) {
+    if (!program->slot_capacity) return -1;
+    return program->slots[function_slot(program, name)] - 1;
+}
+
+// Room in the index for one more function, keeping it at most half full
+static bool reserve_slot(BCProgram* program) {
+    if ((program->function_count + 1) * 2 <= program->slot_capacity) return true;
+    size_t capacity = program->slot_capacity ? program->slot_capacity * 2 : 64;
+    int* slots = calloc(capacity, sizeof(int));
+    if (!slots) return false;
+    free(program->slots);
+    program->slots = slots;
+    program->slot_capacity = capacity;
+    for (size_t i = 0; i < program->function_count; i++) {
+        program->slots[function_slot(program, program->functions[i].name)] = (int)i + 1;
+    }
+    return true;
+}
+
+static bool add_function(BCCompiler* c, const ASTNode* node) {
+    BCProgram* program = c->program;
+    const char* name = intern(node->data.function.name);
+    if (!name || !reserve_slot(program)) {
+        bc_error(c, node, "Out of memory");
+        return false;
+    }
+    if (function_index(program, name) >= 0) {
+        bc_error(c, node, "Redefinition of function '%s'", name);
+        return false;
+    }
+    if (program->function_count >= program->function_capacity) {
+        size_t capacity = program->function_capacity ? program->function_capacity * 2 : 16;
+        BCFunction* functions = realloc(program->functions, capacity * sizeof(BCFunction));
+        if (!functions) {
+            bc_error(c, node, "Out of memory");
+            return false;
+        }
+        program->functions = functions;
+        program->function_capacity = capacity;
+    }
+
+    size_t params = node->data.function.param_count;
+    c->temp_base = (int)node->data.function.slot_count;
+    c->temp_top = c->temp_base;
+    c->frame_size = c->temp_base;
+    c->code = NULL;
+    c->count = 0;
+    c->capacity = 0;
+    c->branches = NULL;
+    c->branch_count = 0;
+    c->branch_capacity = 0;
+
+    compile_statement(c, node->data.function.body);
+    // Falling off the end returns 0 (as main() does in C)
+    emit(c, BC_RETK, 0, 0, 0, 0);
+    if (!failed(c) && !fuse_pairs(c, &program->fused)) bc_error(c, node, "Out of memory");
+
+    BCFunction* fn = &program->functions[program->function_count];
+    fn->name = name;
+    fn->param_count = params;
+    fn->frame_size = c->frame_size;
+    fn->code = c->code;
+    fn->code_count = c->count;
+    fn->branches = c->branches;
+    fn->branch_count = c->branch_count;
+    fn->unit = program->unit_count;
+    if (failed(c)) {
+        free(c->code);
+        free(c->branches);
+        bc_error(c, node, "Out of memory");
+        return false;
+    }
+    program->slots[function_slot(program, name)] = (int)++program->function_count;
+    return true;
+}
+
+static bool add_global(BCCompiler* c, const ASTNode* node) {
+    BCProgram* program = c->program;
+    const char* name;
+    int64_t init = 0;
+    if (node->type == NODE_ASSIGNMENT) {
+        name = node->data.assignment.name;
+        if (!ast_constant_value(node->data.assignment.value, &init)) {
+            bc_error(c, node, "Initializer of global '%s' is not a constant", name);
+            return false;
+        }
+    } else {
+        name = node->data.variable.name;
+    }
+    if (program->global_count >= program->global_capacity) {
+        size_t capacity = program->global_capacity ? program->global_capacity * 2 : 16;
+        int64_t* globals = realloc(program->globals, capacity * sizeof(int64_t));
+        if (!globals) {
+            bc_error(c, node, "Out of memory");
+            return false;
+        }
+        program->globals = globals;
+        program->global_capacity = capacity;
+    }
+    program->globals[program->global_count++] = init;
+    return true;
+}
+
+BCProgram* bytecode_create(void) {
+    return calloc(1, sizeof(BCProgram));
+}
+
+void bytecode_destroy(BCProgram* program) {
+    if (!program) return;
+    for (size_t i = 0; i < program->function_count; i++) {
+        free(program->functions[i].code);
+        free(program->functions[i].branches);
+    }
+    free(program->functions);
+    free(program->globals);
+    free(program->callees);
+    free(program->slots);
+    free(program);
+}
+
+bool bytecode_add_unit(BCProgram* program, const ASTNode* unit, Error* error) {
+    BCCompiler c = { .program = program, .error = error, .global_base = program->global_count };
+    size_t count = unit->data.block.count;
+
+    // Globals first, so functions can refer to ones declared after them
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; i++) {
+        const ASTNode* node = unit->data.block.statements[i];
+        if (node->type != NODE_FUNCTION) ok = add_global(&c, node);
+        else c.function_count++;
+    }
+    for (size_t i = 0; i < count && ok; i++) {
+        const ASTNode* node = unit->data.block.statements[i];
+        if (node->type == NODE_FUNCTION) ok = add_function(&c, node);
+    }
+    free(c.callees);
+    free(c.breaks);
+    program->unit_count++;
+    return ok;
+}
+
+static bool link_error(Error* error, const BCCallee* callee, size_t* unit, const char* format, ...) {
+    error->code = ERROR_SEMANTIC;
+    error->line = callee ? callee->line : 0;
+    error->column = callee ? callee->column : 0;
+    if (callee) *unit = callee->unit;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+    return false;
+}
+
+bool bytecode_link(BCProgram* program, Error* error, size_t* unit) {
+    int* resolved = malloc((program->callee_count + 1) * sizeof(int));
+    if (!resolved) return link_error(error, NULL, unit, "Out of memory");
+    for (size_t i = 0; i < program->callee_count; i++) {
+        resolved[i] = function_index(program, program->callees[i].name);
+    }
+
+    bool ok = true;
+    for (size_t f = 0; f < program->function_count && ok; f++) {
+        BCFunction* fn = &program->functions[f];
+        for (size_t i = 0; i < fn->code_count && ok; i++) {
+            BCInstr* instr = &fn->code[i];
+            if (instr->op != BC_CALL && instr->op != BC_TAILCALL) continue;
+            const BCCallee* callee = &program->callees[instr->b];
+            if (resolved[instr->b] < 0) {
+                ok = link_error(error, callee, unit, "Undefined function '%s'", callee->name);
+                break;
+            }
+            const BCFunction* target = &program->functions[resolved[instr->b]];
+            if ((int64_t)target->param_count != instr->k) {
+                ok = link_error(error, callee, unit, "Function '%s' takes %zu arguments, called with %lld",
+                                callee->name, target->param_count, (long long)instr->k);
+                break;
+            }
+            instr->b = resolved[instr->b];
+        }
+    }
+    free(resolved);
+    program->linked = ok;
+    return ok;
+}
+
+const BCFunction* bytecode_find_function(const BCProgram* program, const char* name) {
+    name = intern(name);
+    int index = name ? function_index(program, name) : -1;
+    return index >= 0 ? &program->functions[index] : NULL;
+}
+
+void bytecode_stats(const BCProgram* program, BCStats* stats) {
+    stats->instructions = 0;
+    for (size_t i = 0; i < program->function_count; i++) {
+        stats->instructions += program->functions[i].code_count;
+    }
+    stats->fused = program->fused;
+}
+
+static const char* opcode_name(uint8_t op) {
+    static const char* const names[BC_OPCODE_COUNT] = {
+        "mov", "loadk", "loadg", "storeg",
+        "add", "sub", "mul", "div", "eq", "ne", "lt", "gt", "le", "ge",
+        "addk", "subk", "mulk", "divk", "eqk", "nek", "ltk", "gtk", "lek", "gek",
+        "jmp", "jz", "jnz",
+        "jeq", "jne", "jlt", "jgt", "jle", "jge",
+        "jeqk", "jnek", "jltk", "jgtk", "jlek", "jgek", "switch",
+        "call", "tailcall", "ret", "retk"
+    };
+    return op < BC_OPCODE_COUNT ? names[op] : "?";
+}
+
+void bytecode_print(FILE* out, const BCProgram* program) {
+    for (size_t f = 0; f < program->function_count; f++) {
+        const BCFunction* fn = &program->functions[f];
+        fprintf(out, "%s: %zu params, %d registers\n", fn->name, fn->param_count, fn->frame_size);
+        for (size_t i = 0; i < fn->code_count; i++) {
+            const BCInstr* in = &fn->code[i];
+            fprintf(out, "  %4zu  %-8s ", i, opcode_name(in->op));
+            switch (in->op) {
+                case BC_MOV:
+                    fprintf(out, "r%d, r%d\n", in->a, in->b);
+                    break;
+                case BC_LOADK:
+                    fprintf(out, "r%d, %lld\n", in->a, (long long)in->k);
+                    break;
+                case BC_LOADG:
+                    fprintf(out, "r%d, g%d\n", in->a, in->b);
+                    break;
+                case BC_STOREG:
+                    fprintf(out, "g%d, r%d\n", in->a, in->b);
+                    break;
+                case BC_JMP:
+                    fprintf(out, "%d\n", in->c);
+                    break;
+                case BC_JZ:
+                case BC_JNZ:
+                    fprintf(out, "r%d, %d\n", in->a, in->c);
+                    break;
+                case BC_CALL:
+                case BC_TAILCALL: {
+                    const char* name = program->linked ? program->functions[in->b].name
+                                                       : program->callees[in->b].name;
+                    fprintf(out, "r%d, %s(r%d..%lld)\n", in->a, name, in->c, (long long)in->k);
+                    break;
+                }
+                case BC_RET:
+                    fprintf(out, "r%d\n", in->a);
+                    break;
+                case BC_RETK:
+                    fprintf(out, "%lld\n", (long long)in->k);
+                    break;
+                case BC_SWITCH:
+                    fprintf(out, "r%d - %lld < %d, %d\n", in->a, (long long)in->k, in->b, in->c);
+                    break;
+                default:
+                    if (in->op >= BC_JEQK) {
+                        fprintf(out, "r%d, %lld, %d\n", in->a, (long long)in->k, in->c);
+                    } else if (in->op >= BC_JEQ) {
+                        fprintf(out, "r%d, r%d, %d\n", in->a, in->b, in->c);
+                    } else if (in->op >= BC_ADDK) {
+                        fprintf(out, "r%d, r%d, %lld\n", in->a, in->b, (long long)in->k);
+                    } else {
+                        fprintf(out, "r%d, r%d, r%d\n", in->a, in->b, in->c);
+                    }
+                    break;
+            }
+        }
+    }
+}
@@ -0,0 +1,177 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Call graph of the functions defined in one module, with its strongly
+// connected components (Tarjan's algorithm, run iteratively so deep call
+// chains cannot overflow the stack).
+
+static size_t hash_name(const char* name) {
+    size_t h = 1469598103934665603ULL;
+    for (const char* c = name; *c; c++) {
+        h ^= (unsigned char)*c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+int call_graph_find(const CallGraph* graph, const char* name) {
+    if (graph->name_capacity == 0) return -1;
+    size_t mask = graph->name_capacity - 1;
+    for (size_t slot = hash_name(name) & mask; graph->names[slot] >= 0; slot = (slot + 1) & mask) {
+        int f = graph->names[slot];
+        if (strcmp(graph->ir->functions[f]->name, name) == 0) return f;
+    }
+    return -1;
+}
+
+static bool index_names(CallGraph* graph) {
+    size_t capacity = 16;
+    while (capacity < graph->count * 2) capacity *= 2;
+    graph->names = malloc(capacity * sizeof(int));
+    if (!graph->names) return false;
+    graph->name_capacity = capacity;
+    for (size_t i = 0; i < capacity; i++) graph->names[i] = -1;
+
+    for (size_t f = 0; f < graph->count; f++) {
+        size_t slot = hash_name(graph->ir->functions[f]->name) & (capacity - 1);
+        while (graph->names[slot] >= 0) slot = (slot + 1) & (capacity - 1);
+        graph->names[slot] = (int)f;
+    }
+    return true;
+}
+
+static bool collect_edges(CallGraph* graph) {
+    const IR* ir = graph->ir;
+    size_t capacity = 16, used = 0;
+    graph->edge_start = calloc(graph->count + 1, sizeof(int));
+    graph->edges = malloc(capacity * sizeof(int));
+    if (!graph->edge_start || !graph->edges) return false;
+
+    for (size_t f = 0; f < graph->count; f++) {
+        const IRFunction* fn = ir->functions[f];
+        graph->edge_start[f] = (int)used;
+        for (size_t b = 0; b < fn->block_count; b++) {
+            for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+                if (instr->op != IR_CALL) continue;
+                int callee = call_graph_find(graph, instr->symbol);
+                if (callee < 0) continue;
+
+                // One edge per callee is enough
+                bool seen = false;
+                for (size_t e = graph->edge_start[f]; e < used && !seen; e++) {
+                    seen = graph->edges[e] == callee;
+                }
+                if (seen) continue;
+                if (used >= capacity) {
+                    capacity *= 2;
+                    int* edges = realloc(graph->edges, capacity * sizeof(int));
+                    if (!edges) return false;
+                    graph->edges = edges;
+                }
+                graph->edges[used++] = callee;
+            }
+        }
+    }
+    graph->edge_start[graph->count] = (int)used;
+    return true;
+}
+
+// Components are numbered as they complete, which is bottom-up: a
+// component's callees outside it always get smaller numbers
+static bool find_components(CallGraph* graph) {
+    size_t count = graph->count;
+    int* number = malloc((count + 1) * sizeof(int));
+    int* low = malloc((count + 1) * sizeof(int));
+    int* stack = malloc((count + 1) * sizeof(int));
+    int* call_stack = malloc((count + 1) * sizeof(int));
+    int* next_edge = malloc((count + 1) * sizeof(int));
+    bool* on_stack = calloc(count + 1, sizeof(bool));
+    graph->scc = malloc((count + 1) * sizeof(int));
+    graph->order = malloc((count + 1) * sizeof(int));
+    graph->recursive = calloc(count + 1, sizeof(bool));
+    bool ok = number && low && stack && call_stack && next_edge && on_stack &&
+              graph->scc && graph->order && graph->recursive;
+    if (!ok) goto done;
+
+    for (size_t f = 0; f < count; f++) number[f] = -1;
+    int counter = 0;
+    size_t top = 0, order_count = 0;
+
+    for (size_t root = 0; root < count; root++) {
+        if (number[root] >= 0) continue;
+        size_t depth = 0;
+        call_stack[depth++] = (int)root;
+        number[root] = low[root] = counter++;
+        next_edge[root] = graph->edge_start[root];
+        stack[top++] = (int)root;
+        on_stack[root] = true;
+
+        while (depth > 0) {
+            int f = call_stack[depth - 1];
+            if (next_edge[f] < graph->edge_start[f + 1]) {
+                int callee = graph->edges[next_edge[f]++];
+                if (callee == f) graph->recursive[f] = true;
+                if (number[callee] < 0) {
+                    number[callee] = low[callee] = counter++;
+                    next_edge[callee] = graph->edge_start[callee];
+                    stack[top++] = callee;
+                    on_stack[callee] = true;
+                    call_stack[depth++] = callee;
+                } else if (on_stack[callee] && number[callee] < low[f]) {
+                    low[f] = number[callee];
+                }
+                continue;
+            }
+
+            depth--;
+            if (depth > 0) {
+                int parent = call_stack[depth - 1];
+                if (low[f] < low[parent]) low[parent] = low[f];
+            }
+            if (low[f] != number[f]) continue;
+
+            // f is the root of a component
+            size_t first = order_count;
+            int member;
+            do {
+                member = stack[--top];
+                on_stack[member] = false;
+                graph->scc[member] = (int)graph->scc_count;
+                graph->order[order_count++] = member;
+            } while (member != f);
+            if (order_count - first > 1) {
+                for (size_t i = first; i < order_count; i++) graph->recursive[graph->order[i]] = true;
+            }
+            graph->scc_count++;
+        }
+    }
+
+done:
+    free(number);
+    free(low);
+    free(stack);
+    free(call_stack);
+    free(next_edge);
+    free(on_stack);
+    return ok;
+}
+
+bool call_graph_build(const IR* ir, CallGraph* graph) {
+    memset(graph, 0, sizeof(*graph));
+    graph->ir = ir;
+    graph->count = ir->function_count;
+    if (index_names(graph) && collect_edges(graph) && find_components(graph)) return true;
+    call_graph_free(graph);
+    return false;
+}
+
+void call_graph_free(CallGraph* graph) {
+    free(graph->names);
+    free(graph->edge_start);
+    free(graph->edges);
+    free(graph->scc);
+    free(graph->order);
+    free(graph->recursive);
+    memset(graph, 0, sizeof(*graph));
+}
@@ -0,0 +1,233 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Dominator and post-dominator trees, computed with the iterative
+// algorithm of Cooper, Harvey and Kennedy ("A Simple, Fast Dominance
+// Algorithm") over a graph in compressed adjacency form.
+
+typedef struct {
+    size_t count;
+    int* succ_start;        // Successors of n: succs[succ_start[n]..succ_start[n+1])
+    int* succs;
+    int* pred_start;
+    int* preds;
+} Graph;
+
+static void graph_free(Graph* graph) {
+    free(graph->succ_start);
+    free(graph->succs);
+    free(graph->pred_start);
+    free(graph->preds);
+}
+
+// Build adjacency arrays from an edge list
+static bool graph_build(Graph* graph, size_t count, const int* from, const int* to, size_t edges) {
+    graph->count = count;
+    graph->succ_start = calloc(count + 1, sizeof(int));
+    graph->pred_start = calloc(count + 1, sizeof(int));
+    graph->succs = malloc((edges + 1) * sizeof(int));
+    graph->preds = malloc((edges + 1) * sizeof(int));
+    int* fill = calloc(count + 1, sizeof(int));
+    if (!graph->succ_start || !graph->pred_start || !graph->succs || !graph->preds || !fill) {
+        free(fill);
+        return false;
+    }
+
+    for (size_t e = 0; e < edges; e++) {
+        graph->succ_start[from[e] + 1]++;
+        graph->pred_start[to[e] + 1]++;
+    }
+    for (size_t n = 0; n < count; n++) {
+        graph->succ_start[n + 1] += graph->succ_start[n];
+        graph->pred_start[n + 1] += graph->pred_start[n];
+    }
+    for (size_t e = 0; e < edges; e++) {
+        graph->succs[graph->succ_start[from[e]] + fill[from[e]]++] = to[e];
+    }
+    memset(fill, 0, (count + 1) * sizeof(int));
+    for (size_t e = 0; e < edges; e++) {
+        graph->preds[graph->pred_start[to[e]] + fill[to[e]]++] = from[e];
+    }
+    free(fill);
+    return true;
+}
+
+static int intersect(const int* idom, const int* rpo_number, int a, int b) {
+    while (a != b) {
+        while (rpo_number[a] > rpo_number[b]) a = idom[a];
+        while (rpo_number[b] > rpo_number[a]) b = idom[b];
+    }
+    return a;
+}
+
+static bool compute_tree(const Graph* graph, int root, DomTree* tree) {
+    size_t count = graph->count;
+    tree->count = count;
+    tree->idom = malloc(count * sizeof(int));
+    tree->order = malloc(count * sizeof(int));
+    tree->child_start = calloc(count + 1, sizeof(int));
+    tree->children = malloc((count + 1) * sizeof(int));
+    int* rpo_number = malloc(count * sizeof(int));
+    int* stack = malloc(count * sizeof(int));
+    int* next_edge = calloc(count, sizeof(int));
+    bool* visited = calloc(count, sizeof(bool));
+    bool ok = false;
+    if (!tree->idom || !tree->order || !tree->child_start || !tree->children ||
+        !rpo_number || !stack || !next_edge || !visited) {
+        goto done;
+    }
+
+    // Postorder by iterative depth-first search, then reverse it
+    size_t post_count = 0;
+    size_t top = 0;
+    stack[top++] = root;
+    visited[root] = true;
+    while (top > 0) {
+        int n = stack[top - 1];
+        int edge = graph->succ_start[n] + next_edge[n];
+        if (edge < graph->succ_start[n + 1]) {
+            next_edge[n]++;
+            int s = graph->succs[edge];
+            if (!visited[s]) {
+                visited[s] = true;
+                stack[top++] = s;
+            }
+        } else {
+            tree->order[post_count++] = n;
+            top--;
+        }
+    }
+    for (size_t i = 0; i < post_count / 2; i++) {
+        int t = tree->order[i];
+        tree->order[i] = tree->order[post_count - 1 - i];
+        tree->order[post_count - 1 - i] = t;
+    }
+    tree->order_count = post_count;
+
+    for (size_t n = 0; n < count; n++) {
+        tree->idom[n] = -1;
+        rpo_number[n] = -1;
+    }
+    for (size_t i = 0; i < post_count; i++) rpo_number[tree->order[i]] = (int)i;
+
+    // Iterate to a fixed point; the root temporarily dominates itself
+    tree->idom[root] = root;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < post_count; i++) {
+            int n = tree->order[i];
+            int new_idom = -1;
+            for (int e = graph->pred_start[n]; e < graph->pred_start[n + 1]; e++) {
+                int p = graph->preds[e];
+                if (tree->idom[p] < 0) continue;
+                new_idom = new_idom < 0 ? p : intersect(tree->idom, rpo_number, p, new_idom);
+            }
+            if (new_idom != tree->idom[n]) {
+                tree->idom[n] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    tree->idom[root] = -1;
+
+    // Children lists, ordered by reverse postorder
+    for (size_t n = 0; n < count; n++) {
+        if (tree->idom[n] >= 0) tree->child_start[tree->idom[n] + 1]++;
+    }
+    for (size_t n = 0; n < count; n++) tree->child_start[n + 1] += tree->child_start[n];
+    memset(next_edge, 0, count * sizeof(int));
+    for (size_t i = 0; i < post_count; i++) {
+        int n = tree->order[i];
+        int parent = tree->idom[n];
+        if (parent >= 0) tree->children[tree->child_start[parent] + next_edge[parent]++] = n;
+    }
+    ok = true;
+
+done:
+    free(rpo_number);
+    free(stack);
+    free(next_edge);
+    free(visited);
+    return ok;
+}
+
+static bool index_blocks(const IRFunction* fn, DomTree* tree) {
+    memset(tree, 0, sizeof(*tree));
+    tree->index = malloc((fn->next_block_id + 1) * sizeof(int));
+    if (!tree->index) return false;
+    for (size_t b = 0; b < fn->block_count; b++) tree->index[fn->blocks[b]->id] = (int)b;
+    return true;
+}
+
+// Collect CFG edges as index pairs; reverse swaps their direction and adds
+// an edge from every returning block to the virtual exit
+static bool build_cfg(const IRFunction* fn, const DomTree* tree, bool reverse, Graph* graph) {
+    size_t count = fn->block_count + (reverse ? 1 : 0);
+    size_t capacity = fn->block_count + 1;
+    for (size_t b = 0; b < fn->block_count; b++) capacity += ir_successor_count(fn->blocks[b]);
+    int* from = malloc(capacity * sizeof(int));
+    int* to = malloc(capacity * sizeof(int));
+    if (!from || !to) {
+        free(from);
+        free(to);
+        return false;
+    }
+
+    size_t edges = 0;
+    for (size_t b = 0; b < fn->block_count; b++) {
+        size_t n = ir_successor_count(fn->blocks[b]);
+        for (size_t s = 0; s < n; s++) {
+            from[edges] = (int)b;
+            to[edges] = tree->index[ir_successor(fn->blocks[b], s)->id];
+            edges++;
+        }
+        if (reverse && n == 0) {
+            from[edges] = (int)b;
+            to[edges] = (int)fn->block_count;
+            edges++;
+        }
+    }
+
+    bool ok = reverse ? graph_build(graph, count, to, from, edges)
+                      : graph_build(graph, count, from, to, edges);
+    free(from);
+    free(to);
+    return ok;
+}
+
+bool ir_dominators(const IRFunction* fn, DomTree* tree) {
+    Graph graph = {0};
+    bool ok = index_blocks(fn, tree) && build_cfg(fn, tree, false, &graph) &&
+              compute_tree(&graph, 0, tree);
+    graph_free(&graph);
+    if (!ok) dom_tree_free(tree);
+    return ok;
+}
+
+bool ir_post_dominators(const IRFunction* fn, DomTree* tree) {
+    Graph graph = {0};
+    bool ok = index_blocks(fn, tree) && build_cfg(fn, tree, true, &graph) &&
+              compute_tree(&graph, (int)fn->block_count, tree);
+    graph_free(&graph);
+    if (!ok) dom_tree_free(tree);
+    return ok;
+}
+
+bool dom_tree_dominates(const DomTree* tree, int a, int b) {
+    while (b >= 0) {
+        if (b == a) return true;
+        b = tree->idom[b];
+    }
+    return false;
+}
+
+void dom_tree_free(DomTree* tree) {
+    free(tree->index);
+    free(tree->idom);
+    free(tree->order);
+    free(tree->child_start);
+    free(tree->children);
+    memset(tree, 0, sizeof(*tree));
+}
@@ -0,0 +1,892 @@
+#include "codegen.h"
+#include "schedule.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+// x86-64 System V backend: instruction selection from IR onto the locations
+// chosen by the register allocator, frame construction, and AT&T assembly
+// output.
+
+const Reg ARG_REGS[6] = { REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9 };
+
+typedef struct {
+    CodeGen* cg;
+    const IRFunction* fn;
+    MFunction* mf;
+    RegAllocResult ra;
+    int* block_label;           // Indexed by block id
+    int* use_count;             // Indexed by vreg
+    Reg saved[REG_COUNT];
+    int saved_count;
+    bool failed;
+} FunctionContext;
+
+typedef struct {
+    MOperand dst;
+    MOperand src;
+} Move;
+
+static void codegen_error(CodeGen* cg, const char* format, ...) {
+    if (cg->error.code != ERROR_NONE) return;
+    cg->error.code = ERROR_CODEGEN;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(cg->error.message, sizeof(cg->error.message), format, args);
+    va_end(args);
+}
+
+// Operand constructors
+static MOperand op_reg(Reg reg) {
+    MOperand op = { .kind = MO_REG, .reg = reg };
+    return op;
+}
+
+static MOperand op_imm(int64_t value) {
+    MOperand op = { .kind = MO_IMM, .imm = value };
+    return op;
+}
+
+static MOperand op_mem(Reg base, int32_t disp) {
+    MOperand op = { .kind = MO_MEM, .reg = base, .disp = disp };
+    return op;
+}
+
+static MOperand op_label(int label) {
+    MOperand op = { .kind = MO_LABEL, .imm = label };
+    return op;
+}
+
+static bool fits_imm32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static bool is_memory(MOperand op) {
+    return op.kind == MO_MEM || op.kind == MO_GLOBAL;
+}
+
+static bool same_location(MOperand a, MOperand b) {
+    if (a.kind != b.kind) return false;
+    switch (a.kind) {
+        case MO_REG:    return a.reg == b.reg;
+        case MO_MEM:    return a.reg == b.reg && a.disp == b.disp;
+        case MO_GLOBAL: return strcmp(a.symbol, b.symbol) == 0;
+        default:        return false;
+    }
+}
+
+static void emit(FunctionContext* ctx, MOpcode op, MOperand dst, MOperand src) {
+    MFunction* mf = ctx->mf;
+    if (mf->count >= mf->capacity) {
+        size_t new_capacity = mf->capacity == 0 ? 64 : mf->capacity * 2;
+        MInst* new_code = realloc(mf->code, new_capacity * sizeof(MInst));
+        if (!new_code) {
+            ctx->failed = true;
+            return;
+        }
+        mf->code = new_code;
+        mf->capacity = new_capacity;
+    }
+    MInst* inst = &mf->code[mf->count++];
+    memset(inst, 0, sizeof(*inst));
+    inst->op = op;
+    inst->dst = dst;
+    inst->src = src;
+}
+
+static void emit_cc(FunctionContext* ctx, MOpcode op, CondCode cc, MOperand dst) {
+    MOperand none = { .kind = MO_NONE };
+    emit(ctx, op, dst, none);
+    ctx->mf->code[ctx->mf->count - 1].cc = cc;
+}
+
+static void emit0(FunctionContext* ctx, MOpcode op) {
+    MOperand none = { .kind = MO_NONE };
+    emit(ctx, op, none, none);
+}
+
+static int32_t slot_disp(const FunctionContext* ctx, int slot) {
+    return -8 * ctx->saved_count - 8 * (slot + 1);
+}
+
+static MOperand location(const FunctionContext* ctx, int vreg) {
+    const Location* loc = &ctx->ra.locations[vreg];
+    switch (loc->kind) {
+        case LOC_REG:   return op_reg(loc->reg);
+        case LOC_STACK: return op_mem(REG_RBP, slot_disp(ctx, loc->slot));
+        case LOC_CONST: return op_imm(loc->imm);
+        default:        return op_reg(REG_R11);   // Dead value; any scratch will do
+    }
+}
+
+// A move between any two operand kinds, going through r10 when x86 has
+// no direct form
+static void emit_move(FunctionContext* ctx, MOperand dst, MOperand src) {
+    if (same_location(dst, src)) return;
+    if (src.kind == MO_IMM && !fits_imm32(src.imm) && dst.kind != MO_REG) {
+        emit(ctx, MOP_MOV, op_reg(REG_R10), src);
+        src = op_reg(REG_R10);
+    } else if (is_memory(src) && is_memory(dst)) {
+        emit(ctx, MOP_MOV, op_reg(REG_R10), src);
+        src = op_reg(REG_R10);
+    }
+    emit(ctx, MOP_MOV, dst, src);
+}
+
+// Sequentialize a set of simultaneous moves. Each destination appears at
+// most once; cycles are broken through r11.
+static void emit_parallel_move(FunctionContext* ctx, Move* moves, size_t count) {
+    size_t pending = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!same_location(moves[i].dst, moves[i].src)) moves[pending++] = moves[i];
+    }
+
+    while (pending > 0) {
+        bool progress = false;
+        for (size_t i = 0; i < pending; i++) {
+            bool blocked = false;
+            for (size_t j = 0; j < pending; j++) {
+                if (j != i && same_location(moves[j].src, moves[i].dst)) {
+                    blocked = true;
+                    break;
+                }
+            }
+            if (blocked) continue;
+
+            emit_move(ctx, moves[i].dst, moves[i].src);
+            moves[i] = moves[--pending];
+            progress = true;
+            break;
+        }
+
+        if (!progress) {
+            // Every destination is still needed as a source: park one in r11
+            MOperand parked = moves[0].dst;
+            emit_move(ctx, op_reg(REG_R11), parked);
+            for (size_t j = 0; j < pending; j++) {
+                if (same_location(moves[j].src, parked)) moves[j].src = op_reg(REG_R11);
+            }
+        }
+    }
+}
+
+static CondCode condition_code(IROpcode op) {
+    switch (op) {
+        case IR_EQ: return CC_E;
+        case IR_NE: return CC_NE;
+        case IR_LT: return CC_L;
+        case IR_GT: return CC_G;
+        case IR_LE: return CC_LE;
+        default:    return CC_GE;
+    }
+}
+
+static bool is_compare(IROpcode op) {
+    return op >= IR_EQ && op <= IR_GE;
+}
+
+static CondCode invert_condition(CondCode cc) {
+    return (CondCode)(cc ^ 1);
+}
+
+// Set flags from a - b
+static void emit_compare(FunctionContext* ctx, int a, int b) {
+    MOperand left = location(ctx, a);
+    MOperand right = location(ctx, b);
+    if (right.kind == MO_IMM && !fits_imm32(right.imm)) {
+        emit(ctx, MOP_MOV, op_reg(REG_R10), right);
+        right = op_reg(REG_R10);
+    }
+    if (left.kind == MO_IMM || (is_memory(left) && is_memory(right))) {
+        emit(ctx, MOP_MOV, op_reg(REG_R11), left);
+        left = op_reg(REG_R11);
+    }
+    emit(ctx, MOP_CMP, left, right);
+}
+
+static void select_arithmetic(FunctionContext* ctx, const IRInstr* instr) {
+    MOpcode op = instr->op == IR_ADD ? MOP_ADD : instr->op == IR_SUB ? MOP_SUB : MOP_IMUL;
+    bool commutative = op != MOP_SUB;
+    MOperand a = location(ctx, instr->a);
+    MOperand b = location(ctx, instr->b);
+    MOperand d = location(ctx, instr->dst);
+
+    if (a.kind == MO_IMM && !fits_imm32(a.imm)) {
+        emit(ctx, MOP_MOV, op_reg(REG_R10), a);
+        a = op_reg(REG_R10);
+    }
+    if (b.kind == MO_IMM && !fits_imm32(b.imm)) {
+        emit(ctx, MOP_MOV, op_reg(REG_RAX), b);
+        b = op_reg(REG_RAX);
+    }
+
+    if (d.kind == MO_REG) {
+        if (same_location(d, b) && !same_location(d, a)) {
+            if (commutative) {
+                emit(ctx, op, d, a);
+                return;
+            }
+            emit(ctx, MOP_MOV, op_reg(REG_R11), b);
+            b = op_reg(REG_R11);
+        }
+        emit_move(ctx, d, a);
+        emit(ctx, op, d, b);
+        return;
+    }
+
+    emit_move(ctx, op_reg(REG_R11), a);
+    emit(ctx, op, op_reg(REG_R11), b);
+    emit_move(ctx, d, op_reg(REG_R11));
+}
+
+static void select_divide(FunctionContext* ctx, const IRInstr* instr) {
+    MOperand b = location(ctx, instr->b);
+    emit_move(ctx, op_reg(REG_RAX), location(ctx, instr->a));
+    if (b.kind == MO_IMM || (b.kind == MO_REG && b.reg == REG_RDX)) {
+        emit_move(ctx, op_reg(REG_R11), b);
+        b = op_reg(REG_R11);
+    }
+    emit0(ctx, MOP_CQO);
+    MOperand none = { .kind = MO_NONE };
+    emit(ctx, MOP_IDIV, none, b);
+    emit_move(ctx, location(ctx, instr->dst), op_reg(REG_RAX));
+}
+
+// A count that is not a constant goes through cl; register allocation
+// keeps rcx free across such shifts
+static void select_shift(FunctionContext* ctx, const IRInstr* instr) {
+    MOpcode op = instr->op == IR_SHL ? MOP_SHL : instr->op == IR_SAR ? MOP_SAR : MOP_SHR;
+    MOperand count = location(ctx, instr->b);
+    MOperand d = location(ctx, instr->dst);
+
+    if (count.kind == MO_IMM) {
+        count.imm &= 63;
+        if (d.kind == MO_REG) {
+            emit_move(ctx, d, location(ctx, instr->a));
+            emit(ctx, op, d, count);
+            return;
+        }
+    } else {
+        emit_move(ctx, op_reg(REG_R11), location(ctx, instr->a));
+        emit_move(ctx, op_reg(REG_RCX), count);
+        emit(ctx, op, op_reg(REG_R11), op_reg(REG_RCX));
+        emit_move(ctx, d, op_reg(REG_R11));
+        return;
+    }
+    emit_move(ctx, op_reg(REG_R11), location(ctx, instr->a));
+    emit(ctx, op, op_reg(REG_R11), count);
+    emit_move(ctx, d, op_reg(REG_R11));
+}
+
+static void select_call(FunctionContext* ctx, const IRInstr* instr) {
+    size_t stack_args = instr->arg_count > 6 ? instr->arg_count - 6 : 0;
+    int cleanup = 0;
+
+    // Keep rsp 16-byte aligned at the call
+    if (stack_args % 2) {
+        emit(ctx, MOP_SUB, op_reg(REG_RSP), op_imm(8));
+        cleanup += 8;
+    }
+    for (size_t i = instr->arg_count; i > 6; i--) {
+        MOperand arg = location(ctx, instr->args[i - 1]);
+        if (arg.kind == MO_IMM && !fits_imm32(arg.imm)) {
+            emit(ctx, MOP_MOV, op_reg(REG_R10), arg);
+            arg = op_reg(REG_R10);
+        }
+        MOperand none = { .kind = MO_NONE };
+        emit(ctx, MOP_PUSH, none, arg);
+        cleanup += 8;
+    }
+
+    Move moves[6];
+    size_t move_count = 0;
+    for (size_t i = 0; i < instr->arg_count && i < 6; i++) {
+        moves[move_count].dst = op_reg(ARG_REGS[i]);
+        moves[move_count].src = location(ctx, instr->args[i]);
+        move_count++;
+    }
+    emit_parallel_move(ctx, moves, move_count);
+
+    MOperand target = { .kind = MO_FUNC, .symbol = instr->symbol };
+    MOperand none = { .kind = MO_NONE };
+    emit(ctx, MOP_CALL, none, target);
+
+    if (cleanup) emit(ctx, MOP_ADD, op_reg(REG_RSP), op_imm(cleanup));
+    if (ctx->ra.locations[instr->dst].kind != LOC_NONE) {
+        emit_move(ctx, location(ctx, instr->dst), op_reg(REG_RAX));
+    }
+}
+
+static void emit_epilogue(FunctionContext* ctx) {
+    if (ctx->saved_count > 0) {
+        emit(ctx, MOP_LEA, op_reg(REG_RSP), op_mem(REG_RBP, -8 * ctx->saved_count));
+        for (int i = ctx->saved_count; i > 0; i--) {
+            MOperand none = { .kind = MO_NONE };
+            emit(ctx, MOP_POP, op_reg(ctx->saved[i - 1]), none);
+        }
+    } else if (ctx->mf->frame_size > 0) {
+        emit(ctx, MOP_MOV, op_reg(REG_RSP), op_reg(REG_RBP));
+    }
+    MOperand none = { .kind = MO_NONE };
+    emit(ctx, MOP_POP, op_reg(REG_RBP), none);
+    emit0(ctx, MOP_RET);
+}
+
+static void emit_prologue(FunctionContext* ctx) {
+    MOperand none = { .kind = MO_NONE };
+    emit(ctx, MOP_PUSH, none, op_reg(REG_RBP));
+    emit(ctx, MOP_MOV, op_reg(REG_RBP), op_reg(REG_RSP));
+
+    for (int r = 0; r < REG_COUNT; r++) {
+        if (ctx->ra.used_callee_saved & REG_BIT(r)) {
+            ctx->saved[ctx->saved_count++] = (Reg)r;
+            emit(ctx, MOP_PUSH, none, op_reg((Reg)r));
+        }
+    }
+
+    // Spill area, padded so rsp stays 16-byte aligned
+    int frame = ctx->ra.spill_slots * 8;
+    if ((frame + ctx->saved_count * 8) % 16) frame += 8;
+    ctx->mf->frame_size = frame;
+    if (frame > 0) emit(ctx, MOP_SUB, op_reg(REG_RSP), op_imm(frame));
+
+    // Move incoming parameters to their allocated homes
+    const IRBlock* entry = ctx->fn->blocks[0];
+    size_t param_count = 0;
+    for (const IRInstr* instr = entry->first; instr; instr = instr->next) {
+        if (instr->op == IR_PARAM) param_count++;
+    }
+    Move* moves = malloc((param_count ? param_count : 1) * sizeof(Move));
+    if (!moves) {
+        ctx->failed = true;
+        return;
+    }
+    size_t move_count = 0;
+    for (const IRInstr* instr = entry->first; instr; instr = instr->next) {
+        if (instr->op != IR_PARAM) continue;
+        if (ctx->ra.locations[instr->dst].kind == LOC_NONE) continue;
+        int index = (int)instr->imm;
+        moves[move_count].dst = location(ctx, instr->dst);
+        moves[move_count].src = index < 6 ? op_reg(ARG_REGS[index])
+                                          : op_mem(REG_RBP, 16 + 8 * (index - 6));
+        move_count++;
+    }
+    emit_parallel_move(ctx, moves, move_count);
+    free(moves);
+}
+
+static void select_branch(FunctionContext* ctx, const IRInstr* instr, const IRInstr* fused,
+                          const IRBlock* next) {
+    int true_label = ctx->block_label[instr->target->id];
+    int false_label = ctx->block_label[instr->target_else->id];
+    bool true_next = next && next == instr->target;
+    bool false_next = next && next == instr->target_else;
+    CondCode cc;
+
+    if (fused) {
+        emit_compare(ctx, fused->a, fused->b);
+        cc = condition_code(fused->op);
+    } else {
+        MOperand cond = location(ctx, instr->a);
+        if (cond.kind == MO_IMM) {
+            int label = cond.imm ? true_label : false_label;
+            const IRBlock* target = cond.imm ? instr->target : instr->target_else;
+            if (next != target) emit(ctx, MOP_JMP, op_label(label), (MOperand){ .kind = MO_NONE });
+            return;
+        }
+        if (cond.kind == MO_REG) {
+            emit(ctx, MOP_TEST, cond, cond);
+        } else {
+            emit(ctx, MOP_CMP, cond, op_imm(0));
+        }
+        cc = CC_NE;
+    }
+
+    if (true_next) {
+        emit_cc(ctx, MOP_JCC, invert_condition(cc), op_label(false_label));
+        return;
+    }
+    emit_cc(ctx, MOP_JCC, cc, op_label(true_label));
+    if (!false_next) emit(ctx, MOP_JMP, op_label(false_label), (MOperand){ .kind = MO_NONE });
+}
+
+// Switch dispatch. Runs of cases dense enough become jump tables, every
+// other case stands alone (ir_switch_clusters()), and a balanced tree of
+// compares on the lowest value of each cluster picks the cluster, ending
+// in a short chain of compares once few are left.
+#define LINEAR_CLUSTERS 3
+
+static void emit_jump_to(FunctionContext* ctx, int label) {
+    emit(ctx, MOP_JMP, op_label(label), (MOperand){ .kind = MO_NONE });
+}
+
+// Flags from selector - value, for a selector in a register or memory
+static void emit_compare_imm(FunctionContext* ctx, MOperand selector, int64_t value) {
+    MOperand right = op_imm(value);
+    if (!fits_imm32(value)) {
+        emit(ctx, MOP_MOV, op_reg(REG_R10), right);
+        right = op_reg(REG_R10);
+    }
+    emit(ctx, MOP_CMP, selector, right);
+}
+
+// Index the table with selector - low, leaving for miss when out of range;
+// the holes in range go to the default
+static void emit_table(FunctionContext* ctx, const IRInstr* sw, MOperand selector,
+                       const IRSwitchCluster* cluster, int miss, int default_label) {
+    int64_t low = sw->cases[cluster->first].value;
+    uint64_t slots = (uint64_t)sw->cases[cluster->last].value - (uint64_t)low + 1;
+    emit_move(ctx, op_reg(REG_RAX), selector);
+    if (low != 0 && fits_imm32(low)) {
+        emit(ctx, MOP_SUB, op_reg(REG_RAX), op_imm(low));
+    } else if (low != 0) {
+        emit(ctx, MOP_MOV, op_reg(REG_R10), op_imm(low));
+        emit(ctx, MOP_SUB, op_reg(REG_RAX), op_reg(REG_R10));
+    }
+    emit(ctx, MOP_CMP, op_reg(REG_RAX), op_imm((int64_t)slots - 1));
+    emit_cc(ctx, MOP_JCC, CC_A, op_label(miss));
+
+    int table = ctx->mf->label_count++;
+    MOperand none = { .kind = MO_NONE };
+    emit(ctx, MOP_TABLE_JUMP, op_label(table), none);
+    emit(ctx, MOP_LABEL, op_label(table), none);
+    size_t c = cluster->first;
+    for (uint64_t slot = 0; slot < slots; slot++) {
+        int label = default_label;
+        if ((uint64_t)sw->cases[c].value - (uint64_t)low == slot) {
+            label = ctx->block_label[sw->cases[c].target->id];
+            c++;
+        }
+        emit(ctx, MOP_TABLE_ENTRY, op_label(label), op_label(table));
+    }
+}
+
+// Dispatch over clusters[lo, hi). The last compare chain jumps on to the
+// default only when jump_to_default is set.
+static void emit_clusters(FunctionContext* ctx, const IRInstr* sw, MOperand selector,
+                          const IRSwitchCluster* clusters, size_t lo, size_t hi, int default_label,
+                          bool jump_to_default) {
+    if (hi - lo <= LINEAR_CLUSTERS) {
+        for (size_t k = lo; k < hi; k++) {
+            const IRSwitchCluster* cluster = &clusters[k];
+            if (cluster->table) {
+                bool last = k + 1 == hi;
+                int miss = last ? default_label : ctx->mf->label_count++;
+                emit_table(ctx, sw, selector, cluster, miss, default_label);
+                if (last) return;
+                emit(ctx, MOP_LABEL, op_label(miss), (MOperand){ .kind = MO_NONE });
+                continue;
+            }
+            const IRCase* c = &sw->cases[cluster->first];
+            emit_compare_imm(ctx, selector, c->value);
+            emit_cc(ctx, MOP_JCC, CC_E, op_label(ctx->block_label[c->target->id]));
+        }
+        if (jump_to_default) emit_jump_to(ctx, default_label);
+        return;
+    }
+
+    size_t mid = lo + (hi - lo) / 2;
+    int upper = ctx->mf->label_count++;
+    emit_compare_imm(ctx, selector, sw->cases[clusters[mid].first].value);
+    emit_cc(ctx, MOP_JCC, CC_GE, op_label(upper));
+    emit_clusters(ctx, sw, selector, clusters, lo, mid, default_label, true);
+    emit(ctx, MOP_LABEL, op_label(upper), (MOperand){ .kind = MO_NONE });
+    emit_clusters(ctx, sw, selector, clusters, mid, hi, default_label, jump_to_default);
+}
+
+static void select_switch(FunctionContext* ctx, const IRInstr* sw, const IRBlock* next) {
+    int default_label = ctx->block_label[sw->target->id];
+    MOperand selector = location(ctx, sw->a);
+    if (selector.kind == MO_IMM) {
+        const IRBlock* target = ir_switch_target(sw, selector.imm);
+        if (next != target) emit_jump_to(ctx, ctx->block_label[target->id]);
+        return;
+    }
+    if (selector.kind != MO_REG) {
+        emit(ctx, MOP_MOV, op_reg(REG_R11), selector);
+        selector = op_reg(REG_R11);
+    }
+
+    int64_t* values = malloc((sw->case_count + 1) * sizeof(int64_t));
+    IRSwitchCluster* clusters = malloc((sw->case_count + 1) * sizeof(IRSwitchCluster));
+    if (!values || !clusters) {
+        free(values);
+        free(clusters);
+        ctx->failed = true;
+        return;
+    }
+    for (size_t i = 0; i < sw->case_count; i++) values[i] = sw->cases[i].value;
+    size_t count = ir_switch_clusters(values, sw->case_count, clusters);
+    emit_clusters(ctx, sw, selector, clusters, 0, count, default_label, next != sw->target);
+    free(values);
+    free(clusters);
+}
+
+// A compare whose only use is the branch right after it sets flags only
+static bool fuses_with_branch(const FunctionContext* ctx, const IRInstr* instr) {
+    return is_compare(instr->op) && instr->next && instr->next->op == IR_BRANCH &&
+           instr->next->a == instr->dst && ctx->use_count[instr->dst] == 1;
+}
+
+static void select_instruction(FunctionContext* ctx, const IRInstr* instr, const IRBlock* next) {
+    if (instr->dst != IR_NO_VREG && ctx->ra.locations[instr->dst].kind == LOC_NONE &&
+        !ir_has_side_effects(instr->op)) {
+        return;   // Result never used
+    }
+
+    switch (instr->op) {
+        case IR_CONST:
+            if (ctx->ra.locations[instr->dst].kind != LOC_CONST) {
+                emit_move(ctx, location(ctx, instr->dst), op_imm(instr->imm));
+            }
+            break;
+
+        case IR_COPY:
+            emit_move(ctx, location(ctx, instr->dst), location(ctx, instr->a));
+            break;
+
+        case IR_PARAM:
+            break;   // Handled by the prologue
+
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+            select_arithmetic(ctx, instr);
+            break;
+
+        case IR_DIV:
+            select_divide(ctx, instr);
+            break;
+
+        case IR_SHL:
+        case IR_SAR:
+        case IR_SHR:
+            select_shift(ctx, instr);
+            break;
+
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+        case IR_LE:
+        case IR_GE:
+            if (fuses_with_branch(ctx, instr)) break;
+            emit_compare(ctx, instr->a, instr->b);
+            emit_cc(ctx, MOP_SETCC, condition_code(instr->op), op_reg(REG_RAX));
+            emit(ctx, MOP_MOVZX8, op_reg(REG_RAX), op_reg(REG_RAX));
+            emit_move(ctx, location(ctx, instr->dst), op_reg(REG_RAX));
+            break;
+
+        case IR_LOAD_GLOBAL: {
+            MOperand global = { .kind = MO_GLOBAL, .symbol = instr->symbol };
+            emit_move(ctx, location(ctx, instr->dst), global);
+            break;
+        }
+
+        case IR_STORE_GLOBAL: {
+            MOperand global = { .kind = MO_GLOBAL, .symbol = instr->symbol };
+            emit_move(ctx, global, location(ctx, instr->a));
+            break;
+        }
+
+        case IR_CALL:
+            select_call(ctx, instr);
+            break;
+
+        case IR_JUMP:
+            if (next != instr->target) {
+                emit(ctx, MOP_JMP, op_label(ctx->block_label[instr->target->id]),
+                     (MOperand){ .kind = MO_NONE });
+            }
+            break;
+
+        case IR_BRANCH: {
+            const IRInstr* fused = instr->prev && fuses_with_branch(ctx, instr->prev)
+                ? instr->prev : NULL;
+            select_branch(ctx, instr, fused, next);
+            break;
+        }
+
+        case IR_SWITCH:
+            select_switch(ctx, instr, next);
+            break;
+
+        case IR_RET:
+            emit_move(ctx, op_reg(REG_RAX), location(ctx, instr->a));
+            emit_epilogue(ctx);
+            break;
+
+        case IR_PHI:
+            break;   // ir_finalize() has already turned phis into copies
+    }
+}
+
+static bool generate_function(CodeGen* cg, const IRFunction* fn, MFunction* mf) {
+    FunctionContext ctx = {0};
+    ctx.cg = cg;
+    ctx.fn = fn;
+    ctx.mf = mf;
+    mf->name = fn->name;
+
+    if (!regalloc_run(fn, !cg->options.regalloc, &ctx.ra)) {
+        codegen_error(cg, "Register allocation failed for '%s'", fn->name);
+        return false;
+    }
+
+    ctx.block_label = calloc(fn->next_block_id + 1, sizeof(int));
+    ctx.use_count = calloc(fn->vreg_count + 1, sizeof(int));
+    if (!ctx.block_label || !ctx.use_count) {
+        codegen_error(cg, "Out of memory");
+        ctx.failed = true;
+        goto done;
+    }
+
+    for (size_t b = 0; b < fn->block_count; b++) {
+        ctx.block_label[fn->blocks[b]->id] = mf->label_count++;
+        for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->op == IR_CALL) {
+                for (size_t i = 0; i < instr->arg_count; i++) ctx.use_count[instr->args[i]]++;
+            } else {
+                if (instr->a != IR_NO_VREG) ctx.use_count[instr->a]++;
+                if (instr->b != IR_NO_VREG) ctx.use_count[instr->b]++;
+            }
+        }
+    }
+
+    emit_prologue(&ctx);
+    for (size_t b = 0; b < fn->block_count; b++) {
+        const IRBlock* block = fn->blocks[b];
+        const IRBlock* next = b + 1 < fn->block_count ? fn->blocks[b + 1] : NULL;
+        emit(&ctx, MOP_LABEL, op_label(ctx.block_label[block->id]), (MOperand){ .kind = MO_NONE });
+        for (const IRInstr* instr = block->first; instr; instr = instr->next) {
+            select_instruction(&ctx, instr, next);
+        }
+    }
+
+    if (ctx.failed) codegen_error(cg, "Out of memory");
+
+done:
+    free(ctx.block_label);
+    free(ctx.use_count);
+    regalloc_free(&ctx.ra);
+    return !ctx.failed;
+}
+
+// Backend interface
+CodeGen* codegen_create(const IR* ir, const CodeGenOptions* options) {
+    CodeGen* cg = calloc(1, sizeof(CodeGen));
+    if (!cg) return NULL;
+    cg->ir = ir;
+    if (options) {
+        cg->options = *options;
+    } else {
+        cg->options.regalloc = true;
+    }
+    return cg;
+}
+
+void codegen_destroy(CodeGen* cg) {
+    if (!cg) return;
+    for (size_t i = 0; i < cg->function_count; i++) {
+        free(cg->functions[i].code);
+    }
+    free(cg->functions);
+    free(cg);
+}
+
+bool codegen_function(CodeGen* cg, const IRFunction* fn, MFunction* mf) {
+    memset(mf, 0, sizeof(*mf));
+    if (generate_function(cg, fn, mf)) return true;
+    free(mf->code);
+    memset(mf, 0, sizeof(*mf));
+    return false;
+}
+
+// Workers generate into their own copies of the generator, so that each
+// has its own error; the functions go to their places in cg->functions
+typedef struct {
+    CodeGen* cg;
+    CodeGen* workers;
+} ParallelCodeGen;
+
+static bool generate_task(void* context, size_t task, size_t worker) {
+    ParallelCodeGen* parallel = context;
+    CodeGen* cg = parallel->cg;
+    return generate_function(&parallel->workers[worker], cg->ir->functions[task], &cg->functions[task]);
+}
+
+bool codegen_run(CodeGen* cg) {
+    const IR* ir = cg->ir;
+    cg->functions = calloc(ir->function_count ? ir->function_count : 1, sizeof(MFunction));
+    if (!cg->functions) {
+        codegen_error(cg, "Out of memory");
+        return false;
+    }
+
+    size_t workers = schedule_workers(cg->options.threads, ir->function_count);
+    if (workers == 1) {
+        for (size_t i = 0; i < ir->function_count; i++) {
+            cg->function_count++;
+            if (!generate_function(cg, ir->functions[i], &cg->functions[i])) return false;
+        }
+        return true;
+    }
+
+    ParallelCodeGen parallel = { cg, malloc(workers * sizeof(CodeGen)) };
+    if (!parallel.workers) {
+        codegen_error(cg, "Out of memory");
+        return false;
+    }
+    for (size_t w = 0; w < workers; w++) parallel.workers[w] = *cg;
+    cg->function_count = ir->function_count;
+    TaskGraph graph = { .count = ir->function_count, .run = generate_task, .context = &parallel };
+    bool ok = schedule_run(&graph, workers, NULL);
+    for (size_t w = 0; !ok && w < workers && cg->error.code == ERROR_NONE; w++) {
+        cg->error = parallel.workers[w].error;
+    }
+    if (!ok) codegen_error(cg, "Out of memory");
+    free(parallel.workers);
+    return ok;
+}
+
+// AT&T syntax output
+static const char* const REG_NAMES[REG_COUNT] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+
+static const char* const REG8_NAMES[REG_COUNT] = {
+    "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"
+};
+
+static const char* condition_suffix(CondCode cc) {
+    switch (cc) {
+        case CC_E:  return "e";
+        case CC_NE: return "ne";
+        case CC_A:  return "a";
+        case CC_L:  return "l";
+        case CC_GE: return "ge";
+        case CC_LE: return "le";
+        case CC_G:  return "g";
+    }
+    return "?";
+}
+
+static void print_operand(FILE* out, const MFunction* mf, MOperand op) {
+    switch (op.kind) {
+        case MO_REG:    fprintf(out, "%%%s", REG_NAMES[op.reg]); break;
+        case MO_IMM:    fprintf(out, "$%lld", (long long)op.imm); break;
+        case MO_MEM:    fprintf(out, "%d(%%%s)", op.disp, REG_NAMES[op.reg]); break;
+        case MO_GLOBAL: fprintf(out, "%s(%%rip)", op.symbol); break;
+        case MO_LABEL:  fprintf(out, ".L%s.%lld", mf->name, (long long)op.imm); break;
+        case MO_FUNC:   fprintf(out, "%s", op.symbol); break;
+        case MO_NONE:   break;
+    }
+}
+
+static void print_binary(FILE* out, const MFunction* mf, const char* mnemonic, const MInst* inst) {
+    fprintf(out, "\t%s\t", mnemonic);
+    print_operand(out, mf, inst->src);
+    fprintf(out, ", ");
+    print_operand(out, mf, inst->dst);
+    fprintf(out, "\n");
+}
+
+static void print_unary(FILE* out, const MFunction* mf, const char* mnemonic, MOperand op) {
+    fprintf(out, "\t%s\t", mnemonic);
+    print_operand(out, mf, op);
+    fprintf(out, "\n");
+}
+
+static void print_shift(FILE* out, const MFunction* mf, const char* mnemonic, const MInst* inst) {
+    if (inst->src.kind == MO_IMM) {
+        print_binary(out, mf, mnemonic, inst);
+        return;
+    }
+    fprintf(out, "\t%s\t%%cl, ", mnemonic);
+    print_operand(out, mf, inst->dst);
+    fprintf(out, "\n");
+}
+
+static void print_instruction(FILE* out, const MFunction* mf, const MInst* inst) {
+    switch (inst->op) {
+        case MOP_LABEL:
+            print_operand(out, mf, inst->dst);
+            fprintf(out, ":\n");
+            break;
+        case MOP_MOV:
+            if (inst->src.kind == MO_IMM && !fits_imm32(inst->src.imm)) {
+                print_binary(out, mf, "movabsq", inst);
+            } else {
+                print_binary(out, mf, "movq", inst);
+            }
+            break;
+        case MOP_ADD:    print_binary(out, mf, "addq", inst); break;
+        case MOP_SUB:    print_binary(out, mf, "subq", inst); break;
+        case MOP_IMUL:   print_binary(out, mf, "imulq", inst); break;
+        case MOP_SHL:    print_shift(out, mf, "shlq", inst); break;
+        case MOP_SAR:    print_shift(out, mf, "sarq", inst); break;
+        case MOP_SHR:    print_shift(out, mf, "shrq", inst); break;
+        case MOP_CMP:    print_binary(out, mf, "cmpq", inst); break;
+        case MOP_TEST:   print_binary(out, mf, "testq", inst); break;
+        case MOP_LEA:    print_binary(out, mf, "leaq", inst); break;
+        case MOP_CQO:    fprintf(out, "\tcqto\n"); break;
+        case MOP_IDIV:   print_unary(out, mf, "idivq", inst->src); break;
+        case MOP_SETCC:
+            fprintf(out, "\tset%s\t%%%s\n", condition_suffix(inst->cc), REG8_NAMES[inst->dst.reg]);
+            break;
+        case MOP_MOVZX8:
+            fprintf(out, "\tmovzbq\t%%%s, %%%s\n", REG8_NAMES[inst->src.reg], REG_NAMES[inst->dst.reg]);
+            break;
+        case MOP_JMP:    print_unary(out, mf, "jmp", inst->dst); break;
+        case MOP_JCC:
+            fprintf(out, "\tj%s\t", condition_suffix(inst->cc));
+            print_operand(out, mf, inst->dst);
+            fprintf(out, "\n");
+            break;
+        case MOP_CALL:   print_unary(out, mf, "call", inst->src); break;
+        case MOP_RET:    fprintf(out, "\tret\n"); break;
+        case MOP_PUSH:   print_unary(out, mf, "pushq", inst->src); break;
+        case MOP_POP:    print_unary(out, mf, "popq", inst->dst); break;
+        case MOP_TABLE_JUMP:
+            fprintf(out, "\tleaq\t");
+            print_operand(out, mf, inst->dst);
+            fprintf(out, "(%%rip), %%r11\n\tmovslq\t(%%r11,%%rax,4), %%rax\n"
+                    "\taddq\t%%r11, %%rax\n\tjmp\t*%%rax\n");
+            break;
+        case MOP_TABLE_ENTRY:
+            fprintf(out, "\t.long\t");
+            print_operand(out, mf, inst->dst);
+            fprintf(out, " - ");
+            print_operand(out, mf, inst->src);
+            fprintf(out, "\n");
+            break;
+    }
+}
+
+bool codegen_emit_asm(const CodeGen* cg, FILE* out) {
+    const IR* ir = cg->ir;
+
+    if (ir->global_count > 0) {
+        fprintf(out, "\t.data\n");
+        for (size_t i = 0; i < ir->global_count; i++) {
+            const IRGlobal* global = &ir->globals[i];
+            fprintf(out, "\t.globl\t%s\n\t.p2align\t3\n%s:\n\t.quad\t%lld\n",
+                    global->name, global->name, (long long)global->init);
+        }
+    }
+
+    fprintf(out, "\t.text\n");
+    for (size_t f = 0; f < cg->function_count; f++) {
+        const MFunction* mf = &cg->functions[f];
+        fprintf(out, "\t.globl\t%s\n\t.type\t%s, @function\n%s:\n", mf->name, mf->name, mf->name);
+        for (size_t i = 0; i < mf->count; i++) {
+            print_instruction(out, mf, &mf->code[i]);
+        }
+        fprintf(out, "\t.size\t%s, .-%s\n", mf->name, mf->name);
+    }
+    fprintf(out, "\t.section\t.note.GNU-stack,\"\",@progbits\n");
+
+    return !ferror(out);
+}
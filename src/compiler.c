@@ -1,8 +1,27 @@
+#define _POSIX_C_SOURCE 200809L  // For clock_gettime
 #include "leancc.h"
 #include "parser.h"
+#include "preprocess.h"
+#include "pch.h"
+#include "ir.h"
+#include "codegen.h"
+#include "object.h"
+#include "optimize.h"
+#include "resolve.h"
+#include "vm.h"
+#include "jit.h"
+#include "tier.h"
+#include "output.h"
+#include "loader.h"
+#include "schedule.h"
+#include "intern.h"
+#include "arena.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 const char* get_version_string(void) {
     static char version[32];
@@ -13,11 +32,11 @@ const char* get_version_string(void) {
     return version;
 }
 
-// Read entire file content
-static char* read_file(const char* filename) {
+// Read entire file content; size_out may be NULL
+static char* read_file(const char* filename, size_t* size_out) {
     FILE* file = fopen(filename, "rb");
     if (!file) {
-        fprintf(stderr, "Error: Could not open file '%s'\n", filename);
+        fprintf(diagnostics(), "Error: Could not open file '%s'\n", filename);
         return NULL;
     }
 
@@ -29,7 +48,7 @@ static char* read_file(const char* filename) {
     // Allocate buffer for entire file
     char* buffer = malloc(size + 1);
     if (!buffer) {
-        fprintf(stderr, "Error: Out of memory\n");
+        fprintf(diagnostics(), "Error: Out of memory\n");
         fclose(file);
         return NULL;
     }
@@ -39,50 +58,1263 @@ static char* read_file(const char* filename) {
     fclose(file);
 
     if (read_size != (size_t)size) {
-        fprintf(stderr, "Error: Could not read entire file\n");
+        fprintf(diagnostics(), "Error: Could not read entire file\n");
         free(buffer);
         return NULL;
     }
 
     buffer[size] = '\0';
+    if (size_out) *size_out = (size_t)size;
     return buffer;
 }
 
-int compile_file(const char* input_file, const char* output_file) {
-    if (!input_file || !output_file) {
-        fprintf(stderr, "Error: Invalid arguments\n");
+static bool has_extension(const char* path, const char* extension) {
+    size_t len = strlen(path);
+    size_t ext_len = strlen(extension);
+    return len > ext_len && strcmp(path + len - ext_len, extension) == 0;
+}
+
+void compile_options_init(CompileOptions* options) {
+    memset(options, 0, sizeof(*options));
+    options->output_kind = OUTPUT_EXECUTABLE;
+    options->regalloc = true;
+    options->fold = true;
+    options->const_eval = true;
+    options->hash_cons = true;
+    options->tail_calls = true;
+    options->inline_calls = true;
+    options->inline_threshold = 40;
+    options->sccp = true;
+    options->simplify_cfg = true;
+    options->gvn = true;
+    options->licm = true;
+    options->strength_reduce = true;
+    options->dce = true;
+    options->prune_unreachable = true;
+    options->io_uring = true;
+    options->tier_threshold = 1000;
+
+    EvalLimits limits;
+    const_eval_limits_init(&limits);
+    options->const_eval_steps = limits.max_steps;
+    options->const_eval_depth = limits.max_depth;
+}
+
+// Encode machine code in-process
+static int encode_object(const CodeGen* cg, ObjectFile* obj) {
+    object_init(obj);
+    if (!codegen_emit_object(cg, obj)) {
+        fprintf(diagnostics(), "Error: Could not encode machine code\n");
+        object_free(obj);
         return 1;
     }
+    return 0;
+}
+
+// The .s or .o is formatted in memory and written with one writev
+static int write_output(OutputBuffer* out, bool formatted, const char* path) {
+    bool written = formatted && output_write_file(out, path, 0666);
+    output_close(out);
+    if (!written) {
+        fprintf(diagnostics(), "Error: Could not write output file '%s'\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+static int write_object(const CodeGen* cg, const char* path) {
+    ObjectFile obj;
+    if (encode_object(cg, &obj) != 0) {
+        return 1;
+    }
+
+    OutputBuffer out;
+    bool formatted = output_open(&out) && elf_write_object(&obj, out.stream);
+    object_free(&obj);
+    return write_output(&out, formatted, path);
+}
+
+static int write_assembly(const CodeGen* cg, const char* path) {
+    OutputBuffer out;
+    bool formatted = output_open(&out) && codegen_emit_asm(cg, out.stream);
+    return write_output(&out, formatted, path);
+}
+
+// Decode an object previously written by leancc -c, and free its bytes
+static int load_object(const char* path, char* bytes, size_t size, ObjectFile* obj) {
+    bool ok = elf_read_object((const unsigned char*)bytes, size, obj);
+    free(bytes);
+    if (!ok) {
+        fprintf(diagnostics(), "Error: '%s' is not a leancc object file\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+// One source file carried through to machine code
+typedef struct {
+    char* source;
+    struct Parser* parser;
+    ASTNode* ast;
+    IR* ir;
+    CodeGen* cg;
+} Compilation;
+
+static void compilation_free(Compilation* unit) {
+    codegen_destroy(unit->cg);
+    ir_destroy(unit->ir);
+    ast_destroy(unit->ast);
+    parser_destroy(unit->parser);
+    free(unit->source);
+    memset(unit, 0, sizeof(*unit));
+}
+
+static void fold_ast(ASTNode* ast, const char* input_file, const CompileOptions* options) {
+    FoldStats stats;
+    fold_program(ast, &stats);
+    if (options->stats) {
+        fprintf(diagnostics(), "%s: fold: %zu constants folded, %zu identities, %zu of %zu AST nodes eliminated\n",
+                input_file, stats.folded, stats.simplified,
+                stats.nodes_before - stats.nodes_after, stats.nodes_before);
+    }
+}
+
+// Preprocess and parse a source file, reporting its syntax errors. The
+// unit takes over source when the file is already loaded, and reads it
+// when source is NULL.
+static int parse_source(const char* input_file, char* source, const CompileOptions* options,
+                        Compilation* unit) {
+    memset(unit, 0, sizeof(*unit));
 
     // Read source file
-    char* source = read_file(input_file);
-    if (!source) {
+    unit->source = source ? source : read_file(input_file, NULL);
+    if (!unit->source) {
         return 1;
     }
 
     // Create parser
-    struct Parser* parser = parser_create(source);
-    if (!parser) {
-        fprintf(stderr, "Error: Could not create parser\n");
-        free(source);
+    PreprocessOptions pp_options = {
+        .include_paths = options->include_paths,
+        .include_path_count = options->include_path_count,
+        .defines = options->defines,
+        .define_count = options->define_count,
+        .pch = options->pch,
+    };
+    unit->parser = parser_create(unit->source, input_file, &pp_options);
+    if (!unit->parser) {
+        fprintf(diagnostics(), "Error: Could not create parser\n");
         return 1;
     }
 
     // Parse source
-    ASTNode* ast = parse(parser);
-    if (!ast) {
-        fprintf(stderr, "Error: %s\n", parser->error ? parser->error : "Unknown parse error");
-        parser_destroy(parser);
-        free(source);
+    unit->ast = parse(unit->parser);
+    if (!unit->ast) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
         return 1;
     }
+    const Parser* parser = unit->parser;
+    if (options->stats) {
+        PreprocessStats stats;
+        preprocess_stats(parser->preprocessor, &stats);
+        fprintf(diagnostics(), "%s: preprocess: %zu includes, %zu skipped by include guards, "
+                "%zu headers from the cache, %zu read, %zu macro expansions, "
+                "%zu macros from a precompiled header\n",
+                input_file, stats.includes, stats.skipped, stats.cached, stats.read, stats.expansions,
+                stats.precompiled);
+    }
+    if (parser->diagnostic_count > 0) {
+        for (size_t i = 0; i < parser->diagnostic_count; i++) {
+            const ParseDiagnostic* d = &parser->diagnostics[i];
+            fprintf(diagnostics(), "%s:%d:%d: Error: %s\n", d->file ? d->file : input_file,
+                    d->line, d->column, d->message);
+        }
+        if (parser->truncated) {
+            fprintf(diagnostics(), "%s: Too many errors, stopping\n", input_file);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Bind the names of a parsed unit, then run the AST optimizations
+static int analyze_unit(const char* input_file, const CompileOptions* options, Compilation* unit) {
+    // Bind every name once; the passes below go by the bindings
+    Error error = {0};
+    ResolveStats resolved;
+    if (!resolve_program(unit->ast, &error, &resolved)) {
+        fprintf(diagnostics(), "%s:%d:%d: Error: %s\n", input_file, error.line, error.column, error.message);
+        return 1;
+    }
+    if (options->stats) {
+        fprintf(diagnostics(), "%s: resolve: %zu functions, %zu globals, %zu frame slots; %zu local, "
+                "%zu global, %zu call and %zu external call names bound\n",
+                input_file, resolved.functions, resolved.globals, resolved.slots, resolved.locals,
+                resolved.global_refs, resolved.calls, resolved.external_calls);
+    }
 
-    // TODO: Generate code
+    if (options->fold) {
+        fold_ast(unit->ast, input_file, options);
+    }
+
+    // Evaluate pure calls with constant arguments, then fold their results
+    if (options->const_eval) {
+        EvalLimits limits;
+        const_eval_limits_init(&limits);
+        limits.max_steps = options->const_eval_steps;
+        limits.max_depth = options->const_eval_depth;
+
+        ConstEvalStats stats;
+        if (!const_eval_program(unit->ast, &limits, &stats)) {
+            fprintf(diagnostics(), "Error: Out of memory\n");
+            return 1;
+        }
+        if (options->stats) {
+            fprintf(diagnostics(), "%s: const-eval: %zu of %zu functions pure, %zu of %zu calls replaced, "
+                    "%zu over budget, %zu steps\n",
+                    input_file, stats.pure_functions, stats.functions, stats.replaced,
+                    stats.attempted, stats.over_budget, stats.steps);
+        }
+        if (stats.replaced && options->fold) {
+            fold_ast(unit->ast, input_file, options);
+        }
+    }
+
+    // Last, since the passes above rewrite nodes in place
+    if (options->hash_cons) {
+        HashConsStats stats;
+        if (!hash_cons_program(unit->ast, &stats)) {
+            fprintf(diagnostics(), "Error: Out of memory\n");
+            return 1;
+        }
+        if (options->stats) {
+            fprintf(diagnostics(), "%s: hash-cons: %zu of %zu expression nodes shared (%.1f%%)\n",
+                    input_file, stats.shared, stats.expressions,
+                    stats.expressions ? 100.0 * (double)stats.shared / (double)stats.expressions : 0.0);
+        }
+    }
+    return 0;
+}
+
+// Read and parse a source file, then run the AST optimizations
+static int parse_unit(const char* input_file, const CompileOptions* options, Compilation* unit) {
+    int result = parse_source(input_file, NULL, options, unit);
+    return result != 0 ? result : analyze_unit(input_file, options, unit);
+}
+
+static IROptOptions ir_options(const char* input_file, const CompileOptions* options) {
+    IROptOptions opt_options = {
+        .tail_calls = options->tail_calls,
+        .inline_calls = options->inline_calls,
+        .inline_threshold = options->inline_threshold,
+        .sccp = options->sccp,
+        .simplify_cfg = options->simplify_cfg,
+        .gvn = options->gvn,
+        .licm = options->licm,
+        .strength_reduce = options->strength_reduce,
+        .dce = options->dce,
+        .stats = options->stats ? diagnostics() : NULL,
+        .remarks = diagnostics(),
+        .remark_inlined = options->remark_inline,
+        .remark_missed = options->remark_inline_missed,
+        .unit = input_file,
+        .threads = options->threads,
+    };
+    return opt_options;
+}
+
+// Lower an analyzed unit to SSA form
+static int lower_to_ir(const char* input_file, Compilation* unit) {
+    Error error = {0};
+    unit->ir = ir_lower(unit->ast, &error);
+    if (!unit->ir) {
+        fprintf(diagnostics(), "%s:%d:%d: Error: %s\n", input_file, error.line, error.column,
+                error.code != ERROR_NONE ? error.message : "Out of memory");
+        return 1;
+    }
+    return 0;
+}
+
+// Lower an analyzed unit and optimize it; the IR is left in SSA form
+static int lower_unit(const char* input_file, const CompileOptions* options, Compilation* unit) {
+    if (lower_to_ir(input_file, unit) != 0) return 1;
+
+    // Optimize in SSA form, then leave it for the backend
+    IROptOptions opt_options = ir_options(input_file, options);
+    if (!ir_optimize(unit->ir, &opt_options)) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        return 1;
+    }
+    if (options->dump_ir) {
+        ir_print(stdout, unit->ir);
+    }
+    return 0;
+}
 
-    // Clean up
-    ast_destroy(ast);
-    parser_destroy(parser);
-    free(source);
+// Machine code for an optimized unit
+static int generate_unit(const CompileOptions* options, Compilation* unit) {
+    if (!ir_finalize(unit->ir, options->threads)) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        return 1;
+    }
 
+    // Generate code
+    CodeGenOptions cg_options = { .regalloc = options->regalloc, .threads = options->threads };
+    unit->cg = codegen_create(unit->ir, &cg_options);
+    if (!unit->cg || !codegen_run(unit->cg)) {
+        fprintf(diagnostics(), "Error: %s\n",
+                unit->cg && unit->cg->error.code != ERROR_NONE ? unit->cg->error.message : "Out of memory");
+        return 1;
+    }
     return 0;
 }
+
+// Parse, optimize and generate code; source as for parse_source()
+static int compile_unit(const char* input_file, char* source, const CompileOptions* options,
+                        Compilation* unit) {
+    int result = parse_source(input_file, source, options, unit);
+    if (result == 0) result = analyze_unit(input_file, options, unit);
+    if (result == 0) result = lower_unit(input_file, options, unit);
+    return result != 0 ? result : generate_unit(options, unit);
+}
+
+// Diagnostics of one run over several inputs: a buffer per input, made
+// current while that input is compiled, and last the driver's own. They
+// reach stderr in that order with one writev, whatever order the inputs
+// were compiled in, so the messages of different files never interleave.
+typedef struct {
+    OutputBuffer* buffers;   // count + 1, or NULL to print straight to stderr
+    size_t count;
+} DiagnosticBatch;
+
+// Direct diagnostics to input's buffer, or the driver's for count
+static void batch_select(DiagnosticBatch* batch, size_t input) {
+    diagnostics_set(batch->buffers ? &batch->buffers[input] : NULL);
+}
+
+static void batch_open(DiagnosticBatch* batch, size_t count) {
+    batch->count = count;
+    batch->buffers = calloc(count + 1, sizeof(OutputBuffer));
+    for (size_t i = 0; batch->buffers && i <= count; i++) {
+        output_open(&batch->buffers[i]);   // One that fails prints to stderr
+    }
+    batch_select(batch, count);
+}
+
+static void batch_flush(DiagnosticBatch* batch) {
+    if (batch->buffers) {
+        output_flush(batch->buffers, batch->count + 1, STDERR_FILENO);
+    }
+}
+
+static void batch_close(DiagnosticBatch* batch, const CompileOptions* options) {
+    batch_flush(batch);
+    diagnostics_set(NULL);
+    for (size_t i = 0; batch->buffers && i <= batch->count; i++) {
+        output_close(&batch->buffers[i]);
+    }
+    free(batch->buffers);
+    batch->buffers = NULL;
+
+    if (options->stats) {
+        OutputStats stats;
+        output_stats(&stats);
+        fprintf(stderr, "output: %zu bytes in %zu writev calls\n", stats.bytes, stats.writes);
+        InternStats names;
+        intern_stats(&names);
+        ArenaStats arenas;
+        arena_stats(&arenas);
+        fprintf(stderr, "memory: %zu names interned in %zu bytes; %zu arena chunks allocated, "
+                "%zu recycled\n",
+                names.strings, names.bytes, arenas.allocated, arenas.recycled);
+    }
+}
+
+// Run for each input as it finishes loading, on a worker thread and with
+// the input's diagnostics selected; takes over contents
+typedef int (*InputRun)(void* context, size_t input, char* contents, size_t size);
+
+typedef struct {
+    Loader* loader;
+    const char* const* inputs;
+    DiagnosticBatch* batch;
+    InputRun run;
+    void* context;
+    int* results;           // Per input
+} InputFeed;
+
+// Every task takes whichever input the loader finishes next
+static bool feed_task(void* context, size_t task, size_t worker) {
+    (void)task;
+    (void)worker;
+    InputFeed* feed = context;
+    size_t input = loader_next(feed->loader);
+    if (input == SIZE_MAX) {
+        return true;
+    }
+
+    batch_select(feed->batch, input);
+    size_t size;
+    bool opened;
+    char* contents = loader_take(feed->loader, input, &size, &opened);
+    if (contents) {
+        feed->results[input] = feed->run(feed->context, input, contents, size);
+    } else {
+        if (!opened) {
+            fprintf(diagnostics(), "Error: Could not open file '%s'\n", feed->inputs[input]);
+        } else {
+            fprintf(diagnostics(), "Error: Could not read entire file\n");
+        }
+        feed->results[input] = 1;
+    }
+    batch_select(feed->batch, feed->batch->count);
+    return true;
+}
+
+// Read every input in one batch and run each as soon as it is loaded, so
+// that reading the rest overlaps with the work on the first. Every input
+// is run even after one fails.
+static int feed_inputs(const char* const* inputs, size_t count, const CompileOptions* options,
+                       DiagnosticBatch* batch, InputRun run, void* context) {
+    int* results = calloc(count, sizeof(int));
+    Loader* loader = results ? loader_start(inputs, count, !options->io_uring) : NULL;
+    if (!loader) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        free(results);
+        return 1;
+    }
+
+    InputFeed feed = { loader, inputs, batch, run, context, results };
+    TaskGraph graph = { .count = count, .run = feed_task, .context = &feed };
+    ScheduleStats schedule;
+    int result = 0;
+    if (!schedule_run(&graph, options->threads, &schedule)) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        result = 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (results[i] != 0) result = results[i];
+    }
+    if (options->stats) {
+        LoaderStats stats;
+        loader_stats(loader, &stats);
+        fprintf(diagnostics(), "load: %zu files, %zu bytes through %s in %zu system calls, "
+                "on %zu worker%s\n",
+                stats.files, stats.bytes,
+                stats.backend == LOADER_IO_URING ? "io_uring" : "a thread pool",
+                stats.syscalls, schedule.workers, schedule.workers == 1 ? "" : "s");
+    }
+    loader_destroy(loader);
+    free(results);
+    return result;
+}
+
+// Drop the functions of the parsed sources that no call chain from main,
+// or from the objects given, can reach
+static bool prune_inputs(Compilation* units, const ObjectFile* objects, const char* const* inputs,
+                         size_t count, const CompileOptions* options) {
+    size_t root_count = 1;
+    size_t source_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (units[i].ast) source_count++;
+        for (size_t s = 0; s < objects[i].symbol_count; s++) {
+            if (objects[i].symbols[s].section == OBJ_SECTION_UNDEF) root_count++;
+        }
+    }
+    const char** roots = malloc(root_count * sizeof(char*));
+    ASTNode** programs = malloc((source_count + 1) * sizeof(ASTNode*));
+    bool ok = roots && programs;
+    if (ok) {
+        root_count = 0;
+        source_count = 0;
+        roots[root_count++] = "main";
+        for (size_t i = 0; i < count; i++) {
+            if (units[i].ast) programs[source_count++] = units[i].ast;
+            for (size_t s = 0; s < objects[i].symbol_count; s++) {
+                const ObjSymbol* symbol = &objects[i].symbols[s];
+                if (symbol->section == OBJ_SECTION_UNDEF) roots[root_count++] = symbol->name;
+            }
+        }
+        ReachStats stats;
+        ok = prune_unreachable(programs, source_count, roots, root_count, &stats);
+        if (ok && options->stats) {
+            fprintf(diagnostics(), "%s: reach: %zu of %zu functions reachable from main, %zu skipped\n",
+                    inputs[0], stats.reachable, stats.functions, stats.skipped);
+        }
+    }
+    if (!ok) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+    }
+    free(roots);
+    free(programs);
+    return ok;
+}
+
+// -funity: resolve each parsed source alone, which reports its errors
+// against its own file, then move them all into unity and compile that to
+// machine code under the name of the first source, *first. unity is left
+// empty when there are no sources.
+static int unify_units(Compilation* units, const char* const* inputs, size_t count,
+                       const CompileOptions* options, DiagnosticBatch* batch, Compilation* unity,
+                       size_t* first) {
+    memset(unity, 0, sizeof(*unity));
+    *first = count;
+    ASTNode** programs = malloc((count + 1) * sizeof(ASTNode*));
+    const char** names = malloc((count + 1) * sizeof(char*));
+    size_t* owners = malloc((count + 1) * sizeof(size_t));   // Input of each program
+    if (!programs || !names || !owners) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        free(programs);
+        free(names);
+        free(owners);
+        return 1;
+    }
+
+    int result = 0;
+    size_t sources = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!units[i].ast) continue;
+        batch_select(batch, i);
+        Error error = {0};
+        if (!resolve_program(units[i].ast, &error, NULL)) {
+            fprintf(diagnostics(), "%s:%d:%d: Error: %s\n", inputs[i], error.line, error.column, error.message);
+            result = 1;
+        }
+        programs[sources] = units[i].ast;
+        names[sources] = inputs[i];
+        owners[sources++] = i;
+    }
+
+    if (result == 0 && sources > 0) {
+        *first = owners[0];
+        Error error = {0};
+        size_t unit = 0;
+        UnityStats stats;
+        unity->ast = unity_merge(programs, sources, names, &error, &unit, &stats);
+        if (!unity->ast) {
+            if (error.code != ERROR_NONE) {
+                batch_select(batch, owners[unit]);
+                fprintf(diagnostics(), "%s:%d:%d: Error: %s\n", names[unit], error.line, error.column,
+                        error.message);
+            } else {
+                fprintf(diagnostics(), "Error: Out of memory\n");
+            }
+            result = 1;
+        } else {
+            batch_select(batch, *first);
+            if (options->stats) {
+                fprintf(diagnostics(), "%s: unity: %zu units, %zu functions, %zu globals, "
+                        "%zu calls across units\n",
+                        names[0], stats.units, stats.functions, stats.globals, stats.external_calls);
+            }
+            result = analyze_unit(names[0], options, unity);
+            if (result == 0) result = lower_unit(names[0], options, unity);
+            if (result == 0) result = generate_unit(options, unity);
+        }
+    }
+    batch_select(batch, count);
+    free(programs);
+    free(names);
+    free(owners);
+    return result;
+}
+
+typedef struct {
+    const char* const* inputs;
+    const CompileOptions* options;
+    Compilation* units;
+    ObjectFile* objects;    // NULL when there can be none
+} LinkInputs;
+
+static int parse_input(void* context, size_t input, char* contents, size_t size) {
+    LinkInputs* link = context;
+    const char* path = link->inputs[input];
+    return has_extension(path, ".o") ? load_object(path, contents, size, &link->objects[input])
+                                     : parse_source(path, contents, link->options, &link->units[input]);
+}
+
+// Compile or load every input, then link them with the builtin linker.
+// Every input is compiled even after one fails, so that one run reports
+// the errors of them all.
+static int link_inputs(const char* const* inputs, size_t count, const char* output_file,
+                       const CompileOptions* options, DiagnosticBatch* batch) {
+    ObjectFile* objects = calloc(count, sizeof(ObjectFile));
+    const ObjectFile** list = calloc(count, sizeof(ObjectFile*));
+    Compilation* units = calloc(count, sizeof(Compilation));
+    if (!objects || !list || !units) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        free(objects);
+        free(list);
+        free(units);
+        return 1;
+    }
+
+    // Parse every source first: which functions get compiled depends on
+    // the calls in all of them, and with -funity they become one unit
+    for (size_t i = 0; i < count; i++) {
+        list[i] = &objects[i];
+    }
+    LinkInputs link = { inputs, options, units, objects };
+    int result = feed_inputs(inputs, count, options, batch, parse_input, &link);
+    if (result == 0 && options->prune_unreachable &&
+        !prune_inputs(units, objects, inputs, count, options)) {
+        result = 1;
+    }
+
+    if (options->unity && result == 0) {
+        Compilation unity;
+        size_t first;
+        result = unify_units(units, inputs, count, options, batch, &unity, &first);
+        if (result == 0 && unity.cg) {
+            batch_select(batch, first);
+            result = encode_object(unity.cg, &objects[first]);
+            batch_select(batch, count);
+        }
+        compilation_free(&unity);
+    }
+    for (size_t i = 0; i < count && !options->unity; i++) {
+        if (!units[i].ast || units[i].parser->diagnostic_count > 0) continue;
+        batch_select(batch, i);
+        int input_result = analyze_unit(inputs[i], options, &units[i]);
+        if (input_result == 0) input_result = lower_unit(inputs[i], options, &units[i]);
+        if (input_result == 0) input_result = generate_unit(options, &units[i]);
+        if (input_result == 0) input_result = encode_object(units[i].cg, &objects[i]);
+        compilation_free(&units[i]);
+        if (input_result != 0) result = input_result;
+    }
+    batch_select(batch, count);
+
+    if (result == 0) {
+        char error[512];
+        if (!link_executable(list, count, output_file, error, sizeof(error))) {
+            fprintf(diagnostics(), "Error: %s\n", error);
+            result = 1;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        compilation_free(&units[i]);
+        object_free(&objects[i]);
+    }
+    free(objects);
+    free(list);
+    free(units);
+    return result;
+}
+
+// Write a .s or .o for one source file; source as for parse_source()
+static int compile_to_file(const char* input_file, char* source, const char* output_file,
+                           const CompileOptions* options) {
+    if (has_extension(input_file, ".o")) {
+        fprintf(diagnostics(), "Error: '%s': linker input unused with -S or -c\n", input_file);
+        free(source);
+        return 1;
+    }
+
+    Compilation unit;
+    int result = compile_unit(input_file, source, options, &unit);
+    if (result == 0) {
+        result = options->output_kind == OUTPUT_OBJECT ? write_object(unit.cg, output_file)
+                                                       : write_assembly(unit.cg, output_file);
+    }
+    compilation_free(&unit);
+    return result;
+}
+
+// Name the output for input "dir/name.c" as "name.s" or "name.o"
+static char* default_output_name(const char* input_file, OutputKind kind) {
+    const char* base = strrchr(input_file, '/');
+    base = base ? base + 1 : input_file;
+    size_t len = strlen(base);
+    const char* dot = strrchr(base, '.');
+    if (dot && dot != base) len = (size_t)(dot - base);
+
+    char* name = malloc(len + 3);
+    if (!name) return NULL;
+    memcpy(name, base, len);
+    memcpy(name + len, kind == OUTPUT_OBJECT ? ".o" : ".s", 3);
+    return name;
+}
+
+// What a precompiled header has to have been made with: the -I and -D
+// options, in order
+static uint64_t pch_configuration(const CompileOptions* options) {
+    uint64_t hash = PCH_HASH_INIT;
+    for (size_t i = 0; i < options->include_path_count; i++) {
+        hash = pch_hash("-I", 2, hash);
+        hash = pch_hash(options->include_paths[i], strlen(options->include_paths[i]) + 1, hash);
+    }
+    for (size_t i = 0; i < options->define_count; i++) {
+        hash = pch_hash("-D", 2, hash);
+        hash = pch_hash(options->defines[i], strlen(options->defines[i]) + 1, hash);
+    }
+    return hash;
+}
+
+// Options for a run: a copy of options with include_pch mapped, which
+// the caller closes. False when it cannot be used.
+static bool open_pch(const CompileOptions* options, CompileOptions* with_pch, Pch** pch) {
+    *with_pch = *options;
+    *pch = NULL;
+    if (!options->include_pch) return true;
+    char error[512];
+    *pch = pch_open(options->include_pch, pch_configuration(options), error, sizeof(error));
+    if (!*pch) {
+        fprintf(diagnostics(), "Error: %s\n", error);
+        return false;
+    }
+    with_pch->pch = *pch;
+    if (options->stats) {
+        PchStats stats;
+        pch_stats(*pch, &stats);
+        fprintf(diagnostics(), "%s: pch: %zu bytes mapped, %zu strings, %zu files checked\n",
+                options->include_pch, stats.bytes, stats.strings, stats.dependencies);
+    }
+    return true;
+}
+
+int emit_pch(const char* header, const char* output_file, const CompileOptions* options) {
+    CompileOptions defaults;
+    if (!options) {
+        compile_options_init(&defaults);
+        options = &defaults;
+    }
+    if (options->include_pch) {
+        fprintf(diagnostics(), "Error: A precompiled header cannot be made from another\n");
+        return 1;
+    }
+    if (access(header, R_OK) != 0) {
+        fprintf(diagnostics(), "Error: Could not open file '%s'\n", header);
+        return 1;
+    }
+
+    // Parsed as a unit that includes it, so that it goes through the
+    // header cache, which finds its guard, like every other header
+    const char* base = strrchr(header, '/');
+    base = base ? base + 1 : header;
+    size_t length = strlen(base) + sizeof("#include \"\"\n");
+    char* source = malloc(length);
+    size_t name_length = strlen(header) + sizeof(".pch");
+    char* name = output_file ? NULL : malloc(name_length);
+    if (!source || (!output_file && !name)) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        free(source);
+        free(name);
+        return 1;
+    }
+    snprintf(source, length, "#include \"%s\"\n", base);
+    if (name) snprintf(name, name_length, "%s.pch", header);
+
+    Compilation unit;
+    int result = parse_source(header, source, options, &unit);
+    PchWriter* writer = result == 0 ? pch_writer_create() : NULL;
+    if (result == 0 && !writer) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        result = 1;
+    }
+    if (writer) {
+        preprocess_save(unit.parser->preprocessor, writer);
+        parser_save(unit.parser, unit.ast, writer);
+        char error[512];
+        if (!pch_writer_finish(writer, output_file ? output_file : name, pch_configuration(options),
+                               error, sizeof(error))) {
+            fprintf(diagnostics(), "Error: %s\n", error);
+            result = 1;
+        }
+    }
+    pch_writer_destroy(writer);
+    compilation_free(&unit);
+    free(name);
+    return result;
+}
+
+int compile_file(const char* input_file, const char* output_file, const CompileOptions* options) {
+    return compile_files(&input_file, 1, output_file, options);
+}
+
+typedef struct {
+    const char* const* inputs;
+    const CompileOptions* options;
+} CompileInputs;
+
+static int compile_input(void* context, size_t input, char* contents, size_t size) {
+    (void)size;
+    CompileInputs* compile = context;
+    const char* path = compile->inputs[input];
+    char* name = default_output_name(path, compile->options->output_kind);
+    if (!name) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        free(contents);
+        return 1;
+    }
+    int result = compile_to_file(path, contents, name, compile->options);
+    free(name);
+    return result;
+}
+
+typedef struct {
+    char* name;
+    size_t input;
+} OutputName;
+
+static int compare_output_names(const void* a, const void* b) {
+    const OutputName* x = a;
+    const OutputName* y = b;
+    int order = strcmp(x->name, y->name);
+    if (order != 0) return order;
+    return x->input < y->input ? -1 : x->input > y->input;
+}
+
+// Outputs are named after their sources in the current directory, so
+// sources of the same name in different directories would overwrite
+// each other's output: reject them before compiling anything
+static int check_output_names(const char* const* inputs, size_t count, OutputKind kind) {
+    OutputName* names = calloc(count, sizeof(OutputName));
+    int result = names ? 0 : 1;
+    for (size_t i = 0; result == 0 && i < count; i++) {
+        names[i].name = default_output_name(inputs[i], kind);
+        names[i].input = i;
+        if (!names[i].name) result = 1;
+    }
+    if (result != 0) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+    } else {
+        qsort(names, count, sizeof(OutputName), compare_output_names);
+        for (size_t i = 1; i < count; i++) {
+            if (strcmp(names[i - 1].name, names[i].name) == 0) {
+                fprintf(diagnostics(), "Error: '%s' and '%s' would both be compiled to '%s'\n",
+                        inputs[names[i - 1].input], inputs[names[i].input], names[i].name);
+                result = 1;
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; names && i < count; i++) free(names[i].name);
+    free(names);
+    return result;
+}
+
+// -funity with -S or -c: every source into the one output
+static int unity_to_file(const char* const* inputs, size_t count, const char* output_file,
+                         const CompileOptions* options, DiagnosticBatch* batch) {
+    for (size_t i = 0; i < count; i++) {
+        if (has_extension(inputs[i], ".o")) {
+            fprintf(diagnostics(), "Error: '%s': linker input unused with -S or -c\n", inputs[i]);
+            return 1;
+        }
+    }
+    Compilation* units = calloc(count, sizeof(Compilation));
+    if (!units) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        return 1;
+    }
+
+    LinkInputs parse = { inputs, options, units, NULL };
+    int result = feed_inputs(inputs, count, options, batch, parse_input, &parse);
+    if (result == 0) {
+        Compilation unity;
+        size_t first;
+        result = unify_units(units, inputs, count, options, batch, &unity, &first);
+        if (result == 0) {
+            batch_select(batch, first);
+            result = options->output_kind == OUTPUT_OBJECT ? write_object(unity.cg, output_file)
+                                                           : write_assembly(unity.cg, output_file);
+            batch_select(batch, count);
+        }
+        compilation_free(&unity);
+    }
+    for (size_t i = 0; i < count; i++) {
+        compilation_free(&units[i]);
+    }
+    free(units);
+    return result;
+}
+
+static int compile_inputs(const char* const* input_files, size_t count, const char* output_file,
+                          const CompileOptions* options, DiagnosticBatch* batch) {
+    if (options->output_kind == OUTPUT_EXECUTABLE) {
+        return link_inputs(input_files, count, output_file ? output_file : "a.out", options, batch);
+    }
+
+    if (count == 1) {
+        const char* fallback = options->output_kind == OUTPUT_OBJECT ? "a.o" : "a.s";
+        batch_select(batch, 0);
+        return compile_to_file(input_files[0], NULL, output_file ? output_file : fallback, options);
+    }
+
+    // Several inputs with -S or -c: one output per input, named after it,
+    // or with -funity one for them all
+    if (options->unity) {
+        const char* fallback = options->output_kind == OUTPUT_OBJECT ? "a.o" : "a.s";
+        return unity_to_file(input_files, count, output_file ? output_file : fallback, options, batch);
+    }
+    if (output_file) {
+        fprintf(diagnostics(), "Error: Cannot specify -o with -S or -c and multiple input files\n");
+        return 1;
+    }
+    if (check_output_names(input_files, count, options->output_kind) != 0) return 1;
+    // Files compiled side by side each run their passes on one thread
+    CompileOptions file_options = *options;
+    if (schedule_workers(options->threads, count) > 1) {
+        file_options.threads = 1;
+    }
+    CompileInputs compile = { input_files, &file_options };
+    return feed_inputs(input_files, count, options, batch, compile_input, &compile);
+}
+
+int compile_files(const char* const* input_files, size_t count, const char* output_file,
+                  const CompileOptions* options) {
+    if (!input_files || count == 0) {
+        fprintf(diagnostics(), "Error: Invalid arguments\n");
+        return 1;
+    }
+
+    CompileOptions defaults;
+    if (!options) {
+        compile_options_init(&defaults);
+        options = &defaults;
+    }
+    CompileOptions with_pch;
+    Pch* pch;
+    if (!open_pch(options, &with_pch, &pch)) {
+        return 1;
+    }
+
+    DiagnosticBatch batch;
+    batch_open(&batch, count);
+    int result = compile_inputs(input_files, count, output_file, &with_pch, &batch);
+    batch_close(&batch, options);
+    pch_close(pch);
+    return result;
+}
+
+static double elapsed_us(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1e6 + (double)(now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+// Interpret bytecode compiled from every input
+static int run_bytecode(const char* const* inputs, size_t count, const CompileOptions* options,
+                        DiagnosticBatch* batch) {
+    BCProgram* program = bytecode_create();
+    if (!program) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        return 1;
+    }
+
+    int result = 0;
+    const char* failed_input = NULL;
+    Error error = {0};
+    for (size_t i = 0; i < count && result == 0; i++) {
+        batch_select(batch, i);
+        Compilation unit;
+        result = parse_unit(inputs[i], options, &unit);
+        if (result == 0 && !bytecode_add_unit(program, unit.ast, &error)) {
+            failed_input = inputs[i];
+            result = 1;
+        }
+        compilation_free(&unit);
+    }
+    batch_select(batch, count);
+    size_t unit = 0;
+    if (result == 0 && !bytecode_link(program, &error, &unit)) {
+        failed_input = inputs[unit];
+        result = 1;
+    }
+    if (failed_input) {
+        fprintf(diagnostics(), "%s:%d:%d: Error: %s\n", failed_input, error.line, error.column,
+                error.message);
+    }
+
+    const BCFunction* entry = result == 0 ? bytecode_find_function(program, "main") : NULL;
+    if (result == 0 && (!entry || entry->param_count != 0)) {
+        fprintf(diagnostics(), "Error: No main() without parameters to run\n");
+        result = 1;
+    }
+    if (result == 0) {
+        if (options->dump_ir) {
+            bytecode_print(stdout, program);
+        }
+        batch_flush(batch);
+
+        VM* vm = vm_create();
+        int64_t value = 0;
+        VMStats vm_stats = { 0, entry->name };
+        VMStatus status = VM_NO_MEMORY;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (vm) {
+            status = vm_run(vm, program, entry, NULL, &value, &vm_stats);
+        }
+        double us = elapsed_us(&start);
+        vm_destroy(vm);
+
+        if (status == VM_TRAP) {
+            fprintf(diagnostics(), "Error: Division trap in '%s'\n", vm_stats.function);
+        } else if (status == VM_STACK_OVERFLOW) {
+            fprintf(diagnostics(), "Error: Stack overflow in '%s'\n", vm_stats.function);
+        } else if (status == VM_NO_MEMORY) {
+            fprintf(diagnostics(), "Error: Out of memory\n");
+        }
+        result = status == VM_OK ? (int)value : 1;
+
+        if (options->stats && status == VM_OK) {
+            BCStats stats;
+            bytecode_stats(program, &stats);
+            fprintf(diagnostics(), "%s: run: %zu bytecode instructions, %zu superinstructions fused; "
+                    "%zu calls (%.1f us)\n",
+                    inputs[0], stats.instructions, stats.fused, vm_stats.calls, us);
+        }
+    }
+    bytecode_destroy(program);
+    return result;
+}
+
+// Interpret the AST directly, one node at a time
+static int run_tree(const char* input_file, const CompileOptions* options, DiagnosticBatch* batch) {
+    Compilation unit;
+    batch_select(batch, 0);
+    int result = parse_unit(input_file, options, &unit);
+    batch_select(batch, 1);
+    Evaluator* ev = result == 0 ? evaluator_create(unit.ast) : NULL;
+    if (result == 0 && !ev) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        result = 1;
+    }
+
+    if (result == 0) {
+        EvalLimits limits;
+        const_eval_limits_init(&limits);
+        limits.max_steps = SIZE_MAX;
+        limits.max_total_steps = SIZE_MAX;
+        limits.max_depth = 10000;
+
+        batch_flush(batch);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int64_t value = 0;
+        EvalStatus status = evaluator_call(ev, "main", NULL, 0, &limits, &value);
+        double us = elapsed_us(&start);
+
+        switch (status) {
+            case EVAL_OK:
+                result = (int)value;
+                break;
+            case EVAL_TRAP:
+                fprintf(diagnostics(), "Error: Division trap\n");
+                result = 1;
+                break;
+            case EVAL_DEPTH_LIMIT:
+                fprintf(diagnostics(), "Error: Calls nested more than %zu deep\n", limits.max_depth);
+                result = 1;
+                break;
+            default:
+                fprintf(diagnostics(), "Error: Could not evaluate main()\n");
+                result = 1;
+                break;
+        }
+        if (options->stats && status == EVAL_OK) {
+            fprintf(diagnostics(), "%s: run: tree walker, %zu steps (%.1f us)\n",
+                    input_file, evaluator_steps(ev), us);
+        }
+    }
+    evaluator_destroy(ev);
+    compilation_free(&unit);
+    return result;
+}
+
+// Compile to memory, each function on its first call, and run main()
+static int run_jit(const char* const* inputs, size_t count, const CompileOptions* options,
+                   DiagnosticBatch* batch) {
+    CodeGenOptions cg_options = { .regalloc = options->regalloc };
+    JIT* jit = jit_create(&cg_options);
+    if (!jit) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        return 1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = 0;
+    Error error = {0};
+    for (size_t i = 0; i < count && result == 0; i++) {
+        batch_select(batch, i);
+        Compilation unit;
+        // The JIT optimizes each function on its first call, unless the
+        // optimized IR is to be dumped first
+        IROptOptions optimize = ir_options(inputs[i], options);
+        result = parse_unit(inputs[i], options, &unit);
+        if (result == 0) {
+            result = options->dump_ir ? lower_unit(inputs[i], options, &unit) : lower_to_ir(inputs[i], &unit);
+        }
+        if (result == 0) {
+            // The JIT owns the IR from here on
+            IR* ir = unit.ir;
+            unit.ir = NULL;
+            if (!jit_add_unit(jit, ir, options->dump_ir ? NULL : &optimize, &error)) {
+                fprintf(diagnostics(), "Error: %s\n", error.message);
+                result = 1;
+            }
+        }
+        compilation_free(&unit);
+    }
+    batch_select(batch, count);
+    size_t unit = 0;
+    if (result == 0 && !jit_link(jit, &error, &unit)) {
+        fprintf(diagnostics(), "%s:%d:%d: Error: %s\n", inputs[unit], error.line, error.column,
+                error.message);
+        result = 1;
+    }
+
+    if (result == 0) {
+        batch_flush(batch);
+        int64_t value = 0;
+        if (jit_run(jit, "main", &value, &error, &unit)) {
+            result = (int)value;
+        } else if (error.line > 0) {
+            fprintf(diagnostics(), "%s:%d:%d: Error: %s\n", inputs[unit], error.line, error.column,
+                    error.message);
+            result = 1;
+        } else {
+            fprintf(diagnostics(), "Error: %s\n", error.message);
+            result = 1;
+        }
+        if (options->stats) {
+            JITStats stats;
+            jit_stats(jit, &stats);
+            fprintf(diagnostics(), "%s: jit: %zu of %zu functions compiled, %zu bytes of code, "
+                    "%zu calls patched (%.1f us compiling, %.1f us in all)\n",
+                    inputs[0], stats.compiled, stats.functions, stats.code_bytes, stats.patched,
+                    stats.compile_us, elapsed_us(&start));
+        }
+    }
+    jit_destroy(jit);
+    return result;
+}
+
+// Interpret, and move hot functions to native code optimized with the
+// interpreter's profile
+static int run_tiered(const char* const* inputs, size_t count, const CompileOptions* options,
+                      DiagnosticBatch* batch) {
+    TierOptions tier_options = {
+        .threshold = options->tier_threshold,
+        .optimize = ir_options(inputs[0], options),
+        .codegen = { .regalloc = options->regalloc },
+        .log = options->stats ? diagnostics() : NULL,
+    };
+    Compilation* units = calloc(count, sizeof(Compilation));
+    Tier* tier = tier_create(&tier_options);
+    if (!units || !tier) {
+        fprintf(diagnostics(), "Error: Out of memory\n");
+        free(units);
+        tier_destroy(tier);
+        return 1;
+    }
+
+    // Native code is lowered from the ASTs later, so they stay alive
+    int result = 0;
+    const char* failed_input = NULL;
+    Error error = {0};
+    for (size_t i = 0; i < count && result == 0; i++) {
+        batch_select(batch, i);
+        result = parse_unit(inputs[i], options, &units[i]);
+        if (result == 0 && !tier_add_unit(tier, units[i].ast, inputs[i], &error)) {
+            failed_input = inputs[i];
+            result = 1;
+        }
+    }
+    batch_select(batch, count);
+    size_t unit = 0;
+    if (result == 0 && !tier_link(tier, &error, &unit)) {
+        failed_input = inputs[unit];
+        result = 1;
+    }
+    if (failed_input) {
+        fprintf(diagnostics(), "%s:%d:%d: Error: %s\n", failed_input, error.line, error.column,
+                error.message);
+    }
+
+    if (result == 0) {
+        batch_flush(batch);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int64_t value = 0;
+        VMStats vm_stats;
+        VMStatus status = tier_run(tier, "main", &value, &vm_stats, &error);
+        double us = elapsed_us(&start);
+
+        if (status == VM_TRAP) {
+            fprintf(diagnostics(), "Error: Division trap in '%s'\n", vm_stats.function);
+        } else if (status == VM_STACK_OVERFLOW) {
+            fprintf(diagnostics(), "Error: Stack overflow in '%s'\n", vm_stats.function);
+        } else if (status == VM_NO_MEMORY) {
+            fprintf(diagnostics(), "Error: Out of memory\n");
+        } else if (status == VM_NATIVE_FAILED) {
+            fprintf(diagnostics(), "Error: %s\n", error.message);
+        }
+        result = status == VM_OK ? (int)value : 1;
+
+        if (options->stats && status == VM_OK) {
+            TierStats stats;
+            tier_stats(tier, &stats);
+            fprintf(diagnostics(), "%s: run: tiered, %zu of %zu functions promoted, %zu compiled; "
+                    "%zu interpreted calls; interpreter %.1f us, compiling %.1f us, "
+                    "native %.1f us (%.1f us)\n",
+                    inputs[0], stats.promoted, stats.functions, stats.compiled, stats.calls,
+                    stats.interpreter_us, stats.compile_us, stats.native_us, us);
+        }
+    }
+    tier_destroy(tier);
+    for (size_t i = 0; i < count; i++) {
+        compilation_free(&units[i]);
+    }
+    free(units);
+    return result;
+}
+
+int run_files(const char* const* input_files, size_t count, const CompileOptions* options) {
+    if (!input_files || count == 0) {
+        fprintf(diagnostics(), "Error: Invalid arguments\n");
+        return 1;
+    }
+
+    CompileOptions defaults;
+    if (!options) {
+        compile_options_init(&defaults);
+        options = &defaults;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (has_extension(input_files[i], ".o")) {
+            fprintf(diagnostics(), "Error: '%s': objects cannot be run\n", input_files[i]);
+            return 1;
+        }
+    }
+    if (options->run == RUN_TREE && count > 1) {
+        fprintf(diagnostics(), "Error: --run=tree takes a single source file\n");
+        return 1;
+    }
+
+    CompileOptions with_pch;
+    Pch* pch;
+    if (!open_pch(options, &with_pch, &pch)) {
+        return 1;
+    }
+
+    // What is printed before main() runs is flushed just before
+    DiagnosticBatch batch;
+    batch_open(&batch, count);
+    int result;
+    if (options->run == RUN_JIT) {
+        result = run_jit(input_files, count, &with_pch, &batch);
+    } else if (options->run == RUN_TIERED) {
+        result = run_tiered(input_files, count, &with_pch, &batch);
+    } else if (options->run == RUN_TREE) {
+        result = run_tree(input_files[0], &with_pch, &batch);
+    } else {
+        result = run_bytecode(input_files, count, &with_pch, &batch);
+    }
+    batch_close(&batch, options);
+    pch_close(pch);
+    return result;
+}
@@ -0,0 +1,245 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Aggressive dead code elimination (Cytron et al.). Everything starts out
+// dead except instructions with effects; liveness then flows backwards
+// through operands and through control dependence, so a branch survives
+// only if some live instruction depends on which way it goes. Dead
+// branches and switches become jumps to their immediate post-dominator.
+
+typedef struct {
+    IRFunction* fn;
+    DomTree pdom;
+    const IRInstr** def;        // Vreg -> defining instruction
+    int* def_block;             // Vreg -> index of its block
+    bool* vreg_live;
+    bool* branch_live;          // Per block: its terminating branch is live
+    bool* block_live;
+    int* cd_start;              // Blocks whose branches block b depends on:
+    int* cd;                    // cd[cd_start[b]..cd_start[b+1])
+    int* worklist;              // vreg v, or ~b for the branch ending block b
+    size_t top;
+} DCEContext;
+
+static void mark_vreg(DCEContext* ctx, int v) {
+    if (v == IR_NO_VREG || ctx->vreg_live[v] || !ctx->def[v]) return;
+    ctx->vreg_live[v] = true;
+    ctx->worklist[ctx->top++] = v;
+}
+
+static void mark_branch(DCEContext* ctx, int b) {
+    if (ctx->branch_live[b]) return;
+    ctx->branch_live[b] = true;
+    ctx->worklist[ctx->top++] = ~b;
+}
+
+static void mark_block(DCEContext* ctx, int b) {
+    if (ctx->block_live[b]) return;
+    ctx->block_live[b] = true;
+    for (int i = ctx->cd_start[b]; i < ctx->cd_start[b + 1]; i++) mark_branch(ctx, ctx->cd[i]);
+}
+
+static void mark_operands(DCEContext* ctx, const IRInstr* instr) {
+    if (instr->op == IR_CALL || instr->op == IR_PHI) {
+        for (size_t i = 0; i < instr->arg_count; i++) mark_vreg(ctx, instr->args[i]);
+    } else {
+        mark_vreg(ctx, instr->a);
+        mark_vreg(ctx, instr->b);
+    }
+}
+
+static void propagate(DCEContext* ctx) {
+    IRFunction* fn = ctx->fn;
+    while (ctx->top > 0) {
+        int item = ctx->worklist[--ctx->top];
+        if (item < 0) {
+            mark_block(ctx, ~item);
+            mark_operands(ctx, fn->blocks[~item]->last);
+            continue;
+        }
+
+        const IRInstr* instr = ctx->def[item];
+        int b = ctx->def_block[item];
+        mark_block(ctx, b);
+        mark_operands(ctx, instr);
+        if (instr->op == IR_PHI) {
+            // Which value a phi takes depends on how control reached it
+            const IRBlock* block = fn->blocks[b];
+            for (size_t p = 0; p < block->pred_count; p++) {
+                int pred = ctx->pdom.index[block->preds[p]->id];
+                mark_block(ctx, pred);
+                if (ir_is_conditional(block->preds[p]->last->op)) mark_branch(ctx, pred);
+            }
+        }
+    }
+}
+
+// Block b is control dependent on the branch ending x when b post-dominates
+// a successor of x but not x itself
+static bool compute_control_dependence(DCEContext* ctx) {
+    IRFunction* fn = ctx->fn;
+    size_t count = fn->block_count;
+    size_t capacity = 16, used = 0;
+    int* from = malloc(capacity * sizeof(int));
+    int* to = malloc(capacity * sizeof(int));
+    ctx->cd_start = calloc(count + 2, sizeof(int));
+    if (!from || !to || !ctx->cd_start) goto fail;
+
+    for (size_t x = 0; x < count; x++) {
+        size_t n = ir_successor_count(fn->blocks[x]);
+        if (n < 2) continue;
+        for (size_t s = 0; s < n; s++) {
+            int runner = ctx->pdom.index[ir_successor(fn->blocks[x], s)->id];
+            while (runner >= 0 && runner != ctx->pdom.idom[x] && runner < (int)count) {
+                if (used >= capacity) {
+                    capacity *= 2;
+                    int* new_from = realloc(from, capacity * sizeof(int));
+                    if (!new_from) goto fail;
+                    from = new_from;
+                    int* new_to = realloc(to, capacity * sizeof(int));
+                    if (!new_to) goto fail;
+                    to = new_to;
+                }
+                from[used] = runner;
+                to[used] = (int)x;
+                used++;
+                runner = ctx->pdom.idom[runner];
+            }
+        }
+    }
+
+    ctx->cd = malloc((used + 1) * sizeof(int));
+    int* fill = calloc(count + 1, sizeof(int));
+    if (!ctx->cd || !fill) {
+        free(fill);
+        goto fail;
+    }
+    for (size_t e = 0; e < used; e++) ctx->cd_start[from[e] + 1]++;
+    for (size_t b = 0; b < count; b++) ctx->cd_start[b + 1] += ctx->cd_start[b];
+    for (size_t e = 0; e < used; e++) ctx->cd[ctx->cd_start[from[e]] + fill[from[e]]++] = to[e];
+    free(fill);
+    free(from);
+    free(to);
+    return true;
+
+fail:
+    free(from);
+    free(to);
+    return false;
+}
+
+static bool is_critical(const DCEContext* ctx, const IRInstr* instr) {
+    switch (instr->op) {
+        case IR_STORE_GLOBAL:
+        case IR_CALL:
+        case IR_RET:
+            return true;
+        case IR_DIV: {
+            // Only a divisor known not to trap lets a division go
+            const IRInstr* divisor = ctx->def[instr->b];
+            return !divisor || divisor->op != IR_CONST || divisor->imm == 0 || divisor->imm == -1;
+        }
+        default:
+            return false;
+    }
+}
+
+static bool has_live_phi(const DCEContext* ctx, const IRBlock* block) {
+    for (const IRInstr* phi = block->first; phi && phi->op == IR_PHI; phi = phi->next) {
+        if (ctx->vreg_live[phi->dst]) return true;
+    }
+    return false;
+}
+
+bool ir_dce(IRFunction* fn, size_t* removed, size_t* branches) {
+    DCEContext ctx = { .fn = fn };
+    int vregs = fn->vreg_count;
+    size_t count = fn->block_count;
+    if (!ir_post_dominators(fn, &ctx.pdom)) return false;
+
+    ctx.def = calloc(vregs + 1, sizeof(IRInstr*));
+    ctx.def_block = calloc(vregs + 1, sizeof(int));
+    ctx.vreg_live = calloc(vregs + 1, sizeof(bool));
+    ctx.branch_live = calloc(count + 1, sizeof(bool));
+    ctx.block_live = calloc(count + 1, sizeof(bool));
+    ctx.worklist = malloc(((size_t)vregs + count + 1) * sizeof(int));
+    bool ok = ctx.def && ctx.def_block && ctx.vreg_live && ctx.branch_live &&
+              ctx.block_live && ctx.worklist && compute_control_dependence(&ctx);
+    if (!ok) goto done;
+
+    for (size_t b = 0; b < count; b++) {
+        for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->dst == IR_NO_VREG) continue;
+            ctx.def[instr->dst] = instr;
+            ctx.def_block[instr->dst] = (int)b;
+        }
+    }
+
+    // A block that never reaches the exit has no post-dominator to jump
+    // to, so with an infinite loop around every branch is kept
+    bool keep_branches = ctx.pdom.order_count < count + 1;
+
+    for (size_t b = 0; b < count; b++) {
+        for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (ir_is_conditional(instr->op) && keep_branches) {
+                mark_branch(&ctx, (int)b);
+            } else if (is_critical(&ctx, instr)) {
+                if (instr->dst != IR_NO_VREG) {
+                    mark_vreg(&ctx, instr->dst);
+                } else {
+                    mark_block(&ctx, (int)b);
+                    mark_operands(&ctx, instr);
+                }
+            }
+        }
+    }
+    propagate(&ctx);
+
+    // A dead branch cannot be folded into a block whose live phis would
+    // need an operand for the new edge
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = 0; b < count; b++) {
+            if (!ir_is_conditional(fn->blocks[b]->last->op) || ctx.branch_live[b]) continue;
+            int ipdom = ctx.pdom.idom[b];
+            if (ipdom < 0 || ipdom >= (int)count || has_live_phi(&ctx, fn->blocks[ipdom])) {
+                mark_branch(&ctx, (int)b);
+                propagate(&ctx);
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t b = 0; b < count; b++) {
+        IRBlock* block = fn->blocks[b];
+        IRInstr* instr = block->first;
+        while (instr) {
+            IRInstr* next = instr->next;
+            if (instr->dst != IR_NO_VREG && !ctx.vreg_live[instr->dst]) {
+                ir_remove(block, instr);
+                (*removed)++;
+            }
+            instr = next;
+        }
+    }
+    for (size_t b = 0; b < count && ok; b++) {
+        if (!ir_is_conditional(fn->blocks[b]->last->op) || ctx.branch_live[b]) continue;
+        ok = ir_make_jump(fn, fn->blocks[b], fn->blocks[ctx.pdom.idom[b]]);
+        (*branches)++;
+    }
+    ir_remove_unreachable(fn);
+
+done:
+    free(ctx.def);
+    free(ctx.def_block);
+    free(ctx.vreg_live);
+    free(ctx.branch_live);
+    free(ctx.block_live);
+    free(ctx.cd_start);
+    free(ctx.cd);
+    free(ctx.worklist);
+    dom_tree_free(&ctx.pdom);
+    return ok;
+}
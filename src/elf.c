@@ -0,0 +1,276 @@
+#include "object.h"
+#include <elf.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ELF64 relocatable object output for x86-64
+
+enum {
+    SEC_NULL,
+    SEC_TEXT,
+    SEC_DATA,
+    SEC_SYMTAB,
+    SEC_STRTAB,
+    SEC_RELA_TEXT,
+    SEC_NOTE_STACK,
+    SEC_SHSTRTAB,
+    SEC_COUNT
+};
+
+static bool write_bytes(FILE* out, const void* bytes, size_t size) {
+    return size == 0 || fwrite(bytes, 1, size, out) == size;
+}
+
+static bool write_padding(FILE* out, size_t from, size_t to) {
+    static const unsigned char zeros[16] = {0};
+    while (from < to) {
+        size_t n = to - from < sizeof(zeros) ? to - from : sizeof(zeros);
+        if (!write_bytes(out, zeros, n)) return false;
+        from += n;
+    }
+    return true;
+}
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static uint32_t add_string(ByteBuffer* table, const char* text) {
+    uint32_t offset = (uint32_t)table->size;
+    buffer_append(table, text, strlen(text) + 1);
+    return offset;
+}
+
+bool elf_write_object(const ObjectFile* obj, FILE* out) {
+    bool ok = false;
+    ByteBuffer strtab = {0};
+    ByteBuffer shstrtab = {0};
+    Elf64_Sym* symtab = calloc(obj->symbol_count + 1, sizeof(Elf64_Sym));
+    Elf64_Rela* rela = calloc(obj->reloc_count + 1, sizeof(Elf64_Rela));
+    size_t* elf_index = calloc(obj->symbol_count + 1, sizeof(size_t));
+    if (!symtab || !rela || !elf_index) goto done;
+
+    // Symbol table: the null symbol, then every symbol as global. There are
+    // no locals, so sh_info (first non-local) is 1.
+    buffer_append(&strtab, "", 1);
+    size_t sym_count = 1;
+    for (size_t i = 0; i < obj->symbol_count; i++) {
+        const ObjSymbol* symbol = &obj->symbols[i];
+        Elf64_Sym* sym = &symtab[sym_count];
+        sym->st_name = add_string(&strtab, symbol->name);
+        unsigned char type = symbol->section == OBJ_SECTION_UNDEF ? STT_NOTYPE
+                           : symbol->is_function ? STT_FUNC : STT_OBJECT;
+        sym->st_info = ELF64_ST_INFO(STB_GLOBAL, type);
+        sym->st_other = STV_DEFAULT;
+        sym->st_shndx = symbol->section == OBJ_SECTION_TEXT ? SEC_TEXT
+                      : symbol->section == OBJ_SECTION_DATA ? SEC_DATA : SHN_UNDEF;
+        sym->st_value = symbol->value;
+        sym->st_size = symbol->size;
+        elf_index[i] = sym_count++;
+    }
+
+    for (size_t i = 0; i < obj->reloc_count; i++) {
+        const ObjReloc* reloc = &obj->relocs[i];
+        unsigned type = reloc->type == RELOC_PLT32 ? R_X86_64_PLT32 : R_X86_64_PC32;
+        rela[i].r_offset = reloc->offset;
+        rela[i].r_info = ELF64_R_INFO(elf_index[reloc->symbol], type);
+        rela[i].r_addend = reloc->addend;
+    }
+
+    // Section names
+    uint32_t names[SEC_COUNT] = {0};
+    buffer_append(&shstrtab, "", 1);
+    names[SEC_TEXT] = add_string(&shstrtab, ".text");
+    names[SEC_DATA] = add_string(&shstrtab, ".data");
+    names[SEC_SYMTAB] = add_string(&shstrtab, ".symtab");
+    names[SEC_STRTAB] = add_string(&shstrtab, ".strtab");
+    names[SEC_RELA_TEXT] = add_string(&shstrtab, ".rela.text");
+    names[SEC_NOTE_STACK] = add_string(&shstrtab, ".note.GNU-stack");
+    names[SEC_SHSTRTAB] = add_string(&shstrtab, ".shstrtab");
+    if (!strtab.data || !shstrtab.data) goto done;
+
+    // Lay out section contents after the header
+    const void* contents[SEC_COUNT] = {0};
+    size_t sizes[SEC_COUNT] = {0};
+    size_t aligns[SEC_COUNT] = {0};
+    contents[SEC_TEXT] = obj->text.data;          sizes[SEC_TEXT] = obj->text.size;          aligns[SEC_TEXT] = 16;
+    contents[SEC_DATA] = obj->data.data;          sizes[SEC_DATA] = obj->data.size;          aligns[SEC_DATA] = 8;
+    contents[SEC_SYMTAB] = symtab;                sizes[SEC_SYMTAB] = sym_count * sizeof(Elf64_Sym); aligns[SEC_SYMTAB] = 8;
+    contents[SEC_STRTAB] = strtab.data;           sizes[SEC_STRTAB] = strtab.size;           aligns[SEC_STRTAB] = 1;
+    contents[SEC_RELA_TEXT] = rela;               sizes[SEC_RELA_TEXT] = obj->reloc_count * sizeof(Elf64_Rela); aligns[SEC_RELA_TEXT] = 8;
+    aligns[SEC_NOTE_STACK] = 1;
+    contents[SEC_SHSTRTAB] = shstrtab.data;       sizes[SEC_SHSTRTAB] = shstrtab.size;       aligns[SEC_SHSTRTAB] = 1;
+
+    size_t offsets[SEC_COUNT] = {0};
+    size_t offset = sizeof(Elf64_Ehdr);
+    for (int s = SEC_TEXT; s < SEC_COUNT; s++) {
+        offset = align_up(offset, aligns[s]);
+        offsets[s] = offset;
+        offset += sizes[s];
+    }
+    size_t shoff = align_up(offset, 8);
+
+    Elf64_Shdr shdrs[SEC_COUNT];
+    memset(shdrs, 0, sizeof(shdrs));
+    for (int s = SEC_TEXT; s < SEC_COUNT; s++) {
+        shdrs[s].sh_name = names[s];
+        shdrs[s].sh_offset = offsets[s];
+        shdrs[s].sh_size = sizes[s];
+        shdrs[s].sh_addralign = aligns[s];
+    }
+    shdrs[SEC_TEXT].sh_type = SHT_PROGBITS;
+    shdrs[SEC_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    shdrs[SEC_DATA].sh_type = SHT_PROGBITS;
+    shdrs[SEC_DATA].sh_flags = SHF_ALLOC | SHF_WRITE;
+    shdrs[SEC_SYMTAB].sh_type = SHT_SYMTAB;
+    shdrs[SEC_SYMTAB].sh_link = SEC_STRTAB;
+    shdrs[SEC_SYMTAB].sh_info = 1;
+    shdrs[SEC_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+    shdrs[SEC_STRTAB].sh_type = SHT_STRTAB;
+    shdrs[SEC_RELA_TEXT].sh_type = SHT_RELA;
+    shdrs[SEC_RELA_TEXT].sh_flags = SHF_INFO_LINK;
+    shdrs[SEC_RELA_TEXT].sh_link = SEC_SYMTAB;
+    shdrs[SEC_RELA_TEXT].sh_info = SEC_TEXT;
+    shdrs[SEC_RELA_TEXT].sh_entsize = sizeof(Elf64_Rela);
+    shdrs[SEC_NOTE_STACK].sh_type = SHT_PROGBITS;
+    shdrs[SEC_SHSTRTAB].sh_type = SHT_STRTAB;
+
+    Elf64_Ehdr ehdr;
+    memset(&ehdr, 0, sizeof(ehdr));
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = ET_REL;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_shoff = shoff;
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shnum = SEC_COUNT;
+    ehdr.e_shstrndx = SEC_SHSTRTAB;
+
+    if (!write_bytes(out, &ehdr, sizeof(ehdr))) goto done;
+    size_t written = sizeof(ehdr);
+    for (int s = SEC_TEXT; s < SEC_COUNT; s++) {
+        if (!write_padding(out, written, offsets[s]) || !write_bytes(out, contents[s], sizes[s])) goto done;
+        written = offsets[s] + sizes[s];
+    }
+    if (!write_padding(out, written, shoff) || !write_bytes(out, shdrs, sizeof(shdrs))) goto done;
+
+    ok = true;
+
+done:
+    buffer_free(&strtab);
+    buffer_free(&shstrtab);
+    free(symtab);
+    free(rela);
+    free(elf_index);
+    return ok;
+}
+
+static const Elf64_Shdr* section_header(const unsigned char* bytes, size_t size,
+                                        const Elf64_Ehdr* ehdr, size_t index) {
+    size_t offset = ehdr->e_shoff + index * sizeof(Elf64_Shdr);
+    if (index >= ehdr->e_shnum || offset + sizeof(Elf64_Shdr) > size) return NULL;
+    return (const Elf64_Shdr*)(bytes + offset);
+}
+
+static bool section_in_bounds(const Elf64_Shdr* shdr, size_t size) {
+    return shdr->sh_type == SHT_NOBITS ||
+           (shdr->sh_offset <= size && shdr->sh_size <= size - shdr->sh_offset);
+}
+
+bool elf_read_object(const unsigned char* bytes, size_t size, ObjectFile* obj) {
+    object_init(obj);
+    if (size < sizeof(Elf64_Ehdr)) return false;
+
+    Elf64_Ehdr ehdr;
+    memcpy(&ehdr, bytes, sizeof(ehdr));
+    if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr.e_type != ET_REL || ehdr.e_machine != EM_X86_64 ||
+        ehdr.e_shentsize != sizeof(Elf64_Shdr)) {
+        return false;
+    }
+
+    // Find the sections we understand by name
+    const Elf64_Shdr* shstr = section_header(bytes, size, &ehdr, ehdr.e_shstrndx);
+    if (!shstr || !section_in_bounds(shstr, size)) return false;
+    size_t text_index = 0, data_index = 0, symtab_index = 0, rela_index = 0;
+    for (size_t i = 1; i < ehdr.e_shnum; i++) {
+        const Elf64_Shdr* shdr = section_header(bytes, size, &ehdr, i);
+        if (!shdr || !section_in_bounds(shdr, size) || shdr->sh_name >= shstr->sh_size) return false;
+        const char* name = (const char*)bytes + shstr->sh_offset + shdr->sh_name;
+        if (strcmp(name, ".text") == 0) text_index = i;
+        else if (strcmp(name, ".data") == 0) data_index = i;
+        else if (shdr->sh_type == SHT_SYMTAB) symtab_index = i;
+        else if (shdr->sh_type == SHT_RELA) rela_index = i;
+    }
+    const Elf64_Shdr* rela = rela_index ? section_header(bytes, size, &ehdr, rela_index) : NULL;
+    if (rela && (!text_index || rela->sh_info != text_index)) return false;
+
+    const Elf64_Shdr* text = text_index ? section_header(bytes, size, &ehdr, text_index) : NULL;
+    const Elf64_Shdr* data = data_index ? section_header(bytes, size, &ehdr, data_index) : NULL;
+    if (text && !buffer_append(&obj->text, bytes + text->sh_offset, text->sh_size)) goto fail;
+    if (data && !buffer_append(&obj->data, bytes + data->sh_offset, data->sh_size)) goto fail;
+    if (!symtab_index) return true;
+
+    const Elf64_Shdr* symtab = section_header(bytes, size, &ehdr, symtab_index);
+    const Elf64_Shdr* strtab = section_header(bytes, size, &ehdr, symtab->sh_link);
+    if (rela && rela->sh_link != symtab_index) goto fail;
+    if (!strtab || !section_in_bounds(strtab, size)) goto fail;
+
+    size_t sym_count = symtab->sh_size / sizeof(Elf64_Sym);
+    size_t* mapping = calloc(sym_count + 1, sizeof(size_t));
+    if (!mapping) goto fail;
+    for (size_t i = 1; i < sym_count; i++) {
+        Elf64_Sym sym;
+        memcpy(&sym, bytes + symtab->sh_offset + i * sizeof(Elf64_Sym), sizeof(sym));
+        mapping[i] = OBJ_NO_SYMBOL;
+        if (ELF64_ST_BIND(sym.st_info) != STB_GLOBAL || sym.st_name >= strtab->sh_size) continue;
+
+        const char* name = (const char*)bytes + strtab->sh_offset + sym.st_name;
+        size_t index = object_symbol(obj, name);
+        if (index == OBJ_NO_SYMBOL) {
+            free(mapping);
+            goto fail;
+        }
+        ObjSymbol* symbol = &obj->symbols[index];
+        if (sym.st_shndx != SHN_UNDEF && sym.st_shndx == text_index) {
+            symbol->section = OBJ_SECTION_TEXT;
+        } else if (sym.st_shndx != SHN_UNDEF && sym.st_shndx == data_index) {
+            symbol->section = OBJ_SECTION_DATA;
+        }
+        symbol->value = sym.st_value;
+        symbol->size = sym.st_size;
+        symbol->is_function = ELF64_ST_TYPE(sym.st_info) == STT_FUNC;
+        mapping[i] = index;
+    }
+
+    if (rela) {
+        size_t count = rela->sh_size / sizeof(Elf64_Rela);
+        for (size_t i = 0; i < count; i++) {
+            Elf64_Rela entry;
+            memcpy(&entry, bytes + rela->sh_offset + i * sizeof(Elf64_Rela), sizeof(entry));
+            size_t sym = ELF64_R_SYM(entry.r_info);
+            unsigned type = ELF64_R_TYPE(entry.r_info);
+            if (sym == 0 || sym >= sym_count || mapping[sym] == OBJ_NO_SYMBOL ||
+                (type != R_X86_64_PC32 && type != R_X86_64_PLT32) ||
+                entry.r_offset + 4 > obj->text.size ||
+                !object_add_reloc(obj, entry.r_offset, mapping[sym],
+                                  type == R_X86_64_PLT32 ? RELOC_PLT32 : RELOC_PC32,
+                                  entry.r_addend)) {
+                free(mapping);
+                goto fail;
+            }
+        }
+    }
+
+    free(mapping);
+    return true;
+
+fail:
+    object_free(obj);
+    return false;
+}
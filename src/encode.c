@@ -0,0 +1,417 @@
+#include "codegen.h"
+#include "object.h"
+#include <stdlib.h>
+#include <string.h>
+
+// x86-64 machine code encoder. Turns the machine instructions produced by
+// codegen_run() into bytes, relaxing branches to their short forms where
+// the displacement fits, and records relocations for symbol references.
+// Jump tables sit in the code right after the jump through them and hold
+// offsets from the table, so they need no relocations.
+
+typedef struct {
+    unsigned char bytes[16];
+    int size;
+    int reloc_at;              // Offset of a rel32/disp32 field, or -1
+    const char* reloc_symbol;
+    RelocType reloc_type;
+} Encoding;
+
+static void put8(Encoding* e, unsigned value) {
+    e->bytes[e->size++] = (unsigned char)value;
+}
+
+static void put32(Encoding* e, uint32_t value) {
+    for (int i = 0; i < 4; i++) put8(e, (value >> (8 * i)) & 0xFF);
+}
+
+static void patch32(unsigned char* at, uint32_t value) {
+    for (int i = 0; i < 4; i++) at[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static void put64(Encoding* e, uint64_t value) {
+    for (int i = 0; i < 8; i++) put8(e, (value >> (8 * i)) & 0xFF);
+}
+
+static bool fits8(int64_t value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static bool fits32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static bool is_memory(MOperand op) {
+    return op.kind == MO_MEM || op.kind == MO_GLOBAL;
+}
+
+// REX prefix for a ModRM-encoded instruction; force emits it even when no
+// bits are set (needed to address spl/bpl/sil/dil as byte registers)
+static void put_rex(Encoding* e, bool w, int reg_field, MOperand rm, bool force) {
+    unsigned rex = 0x40;
+    if (w) rex |= 0x08;
+    if (reg_field & 8) rex |= 0x04;
+    if ((rm.kind == MO_REG || rm.kind == MO_MEM) && (rm.reg & 8)) rex |= 0x01;
+    if (rex != 0x40 || force) put8(e, rex);
+}
+
+static void put_modrm(Encoding* e, int reg_field, MOperand rm) {
+    int reg = (reg_field & 7) << 3;
+    if (rm.kind == MO_REG) {
+        put8(e, 0xC0 | reg | (rm.reg & 7));
+        return;
+    }
+    if (rm.kind == MO_GLOBAL) {
+        // RIP-relative; the displacement is filled in by a relocation
+        put8(e, reg | 5);
+        e->reloc_at = e->size;
+        e->reloc_symbol = rm.symbol;
+        e->reloc_type = RELOC_PC32;
+        put32(e, 0);
+        return;
+    }
+
+    int base = rm.reg & 7;
+    int mod = (rm.disp == 0 && base != 5) ? 0 : fits8(rm.disp) ? 1 : 2;
+    put8(e, (mod << 6) | reg | base);
+    if (base == 4) put8(e, 0x24);   // SIB: base only, no index
+    if (mod == 1) put8(e, (uint8_t)rm.disp);
+    if (mod == 2) put32(e, (uint32_t)rm.disp);
+}
+
+static void encode_rm(Encoding* e, bool w, const unsigned char* opcode, int opcode_size,
+                      int reg_field, MOperand rm) {
+    put_rex(e, w, reg_field, rm, false);
+    for (int i = 0; i < opcode_size; i++) put8(e, opcode[i]);
+    put_modrm(e, reg_field, rm);
+}
+
+static void encode_rm1(Encoding* e, bool w, unsigned char opcode, int reg_field, MOperand rm) {
+    encode_rm(e, w, &opcode, 1, reg_field, rm);
+}
+
+static void encode_mov(Encoding* e, MOperand dst, MOperand src) {
+    if (src.kind == MO_IMM) {
+        if (dst.kind == MO_REG && src.imm >= 0 && src.imm <= (int64_t)UINT32_MAX) {
+            // 32-bit move zero-extends into the full register
+            if (dst.reg & 8) put8(e, 0x41);
+            put8(e, 0xB8 + (dst.reg & 7));
+            put32(e, (uint32_t)src.imm);
+        } else if (fits32(src.imm)) {
+            encode_rm1(e, true, 0xC7, 0, dst);
+            put32(e, (uint32_t)src.imm);
+        } else {
+            put8(e, 0x48 | ((dst.reg & 8) ? 1 : 0));
+            put8(e, 0xB8 + (dst.reg & 7));
+            put64(e, (uint64_t)src.imm);
+        }
+    } else if (is_memory(src)) {
+        encode_rm1(e, true, 0x8B, dst.reg, src);
+    } else {
+        encode_rm1(e, true, 0x89, src.reg, dst);
+    }
+}
+
+// ADD, SUB and CMP share one encoding scheme
+static void encode_alu(Encoding* e, int ext, unsigned char rm_reg, unsigned char reg_rm,
+                       MOperand dst, MOperand src) {
+    if (src.kind == MO_IMM) {
+        if (fits8(src.imm)) {
+            encode_rm1(e, true, 0x83, ext, dst);
+            put8(e, (uint8_t)src.imm);
+        } else {
+            encode_rm1(e, true, 0x81, ext, dst);
+            put32(e, (uint32_t)src.imm);
+        }
+    } else if (is_memory(src)) {
+        encode_rm1(e, true, reg_rm, dst.reg, src);
+    } else {
+        encode_rm1(e, true, rm_reg, src.reg, dst);
+    }
+}
+
+static void encode_instruction(Encoding* e, const MInst* inst) {
+    memset(e, 0, sizeof(*e));
+    e->reloc_at = -1;
+
+    switch (inst->op) {
+        case MOP_LABEL:
+        case MOP_JMP:
+        case MOP_JCC:
+            break;   // Sized during branch relaxation
+
+        case MOP_MOV:
+            encode_mov(e, inst->dst, inst->src);
+            break;
+        case MOP_ADD:
+            encode_alu(e, 0, 0x01, 0x03, inst->dst, inst->src);
+            break;
+        case MOP_SUB:
+            encode_alu(e, 5, 0x29, 0x2B, inst->dst, inst->src);
+            break;
+        case MOP_CMP:
+            encode_alu(e, 7, 0x39, 0x3B, inst->dst, inst->src);
+            break;
+        case MOP_TEST:
+            encode_rm1(e, true, 0x85, inst->src.reg, inst->dst);
+            break;
+
+        case MOP_IMUL:
+            if (inst->src.kind == MO_IMM) {
+                bool short_imm = fits8(inst->src.imm);
+                encode_rm1(e, true, short_imm ? 0x6B : 0x69, inst->dst.reg, inst->dst);
+                if (short_imm) {
+                    put8(e, (uint8_t)inst->src.imm);
+                } else {
+                    put32(e, (uint32_t)inst->src.imm);
+                }
+            } else {
+                static const unsigned char opcode[] = { 0x0F, 0xAF };
+                encode_rm(e, true, opcode, 2, inst->dst.reg, inst->src);
+            }
+            break;
+
+        case MOP_SHL:
+        case MOP_SAR:
+        case MOP_SHR: {
+            int ext = inst->op == MOP_SHL ? 4 : inst->op == MOP_SHR ? 5 : 7;
+            if (inst->src.kind == MO_IMM) {
+                encode_rm1(e, true, 0xC1, ext, inst->dst);
+                put8(e, (uint8_t)inst->src.imm);
+            } else {
+                encode_rm1(e, true, 0xD3, ext, inst->dst);   // Count in cl
+            }
+            break;
+        }
+
+        case MOP_CQO:
+            put8(e, 0x48);
+            put8(e, 0x99);
+            break;
+        case MOP_IDIV:
+            encode_rm1(e, true, 0xF7, 7, inst->src);
+            break;
+
+        case MOP_SETCC: {
+            unsigned char opcode[] = { 0x0F, (unsigned char)(0x90 + inst->cc) };
+            put_rex(e, false, 0, inst->dst, inst->dst.reg >= 4 && inst->dst.reg < 8);
+            put8(e, opcode[0]);
+            put8(e, opcode[1]);
+            put_modrm(e, 0, inst->dst);
+            break;
+        }
+        case MOP_MOVZX8: {
+            static const unsigned char opcode[] = { 0x0F, 0xB6 };
+            encode_rm(e, true, opcode, 2, inst->dst.reg, inst->src);
+            break;
+        }
+        case MOP_LEA:
+            encode_rm1(e, true, 0x8D, inst->dst.reg, inst->src);
+            break;
+
+        case MOP_PUSH:
+            if (inst->src.kind == MO_REG) {
+                if (inst->src.reg & 8) put8(e, 0x41);
+                put8(e, 0x50 + (inst->src.reg & 7));
+            } else if (inst->src.kind == MO_IMM) {
+                if (fits8(inst->src.imm)) {
+                    put8(e, 0x6A);
+                    put8(e, (uint8_t)inst->src.imm);
+                } else {
+                    put8(e, 0x68);
+                    put32(e, (uint32_t)inst->src.imm);
+                }
+            } else {
+                encode_rm1(e, false, 0xFF, 6, inst->src);
+            }
+            break;
+        case MOP_POP:
+            if (inst->dst.reg & 8) put8(e, 0x41);
+            put8(e, 0x58 + (inst->dst.reg & 7));
+            break;
+
+        case MOP_CALL:
+            put8(e, 0xE8);
+            e->reloc_at = e->size;
+            e->reloc_symbol = inst->src.symbol;
+            e->reloc_type = RELOC_PLT32;
+            put32(e, 0);
+            break;
+        case MOP_RET:
+            put8(e, 0xC3);
+            break;
+
+        case MOP_TABLE_JUMP: {
+            // lea r11, [rip + table]; movsxd rax, [r11 + rax*4]; add rax, r11; jmp rax.
+            // The displacement of the lea is filled in once labels are placed.
+            static const unsigned char code[] = {
+                0x4C, 0x8D, 0x1D, 0, 0, 0, 0, 0x49, 0x63, 0x04, 0x83, 0x4C, 0x01, 0xD8, 0xFF, 0xE0
+            };
+            memcpy(e->bytes, code, sizeof(code));
+            e->size = sizeof(code);
+            break;
+        }
+        case MOP_TABLE_ENTRY:
+            put32(e, 0);
+            break;
+    }
+}
+
+static bool is_branch(MOpcode op) {
+    return op == MOP_JMP || op == MOP_JCC;
+}
+
+static int branch_size(const MInst* inst, bool long_form) {
+    if (!long_form) return 2;
+    return inst->op == MOP_JMP ? 5 : 6;
+}
+
+// Append one function's code to the object's .text
+bool encode_function(const MFunction* mf, ObjectFile* obj, uint64_t* start_out) {
+    size_t n = mf->count;
+    bool ok = false;
+    Encoding* encodings = calloc(n + 1, sizeof(Encoding));
+    bool* long_form = calloc(n + 1, sizeof(bool));
+    int64_t* offsets = calloc(n + 1, sizeof(int64_t));
+    int64_t* labels = calloc(mf->label_count + 1, sizeof(int64_t));
+    if (!encodings || !long_form || !offsets || !labels) goto done;
+
+    for (size_t i = 0; i < n; i++) encode_instruction(&encodings[i], &mf->code[i]);
+
+    // Branch relaxation: start short, lengthen branches that do not reach,
+    // and repeat until the layout is stable. Branches only ever grow, so
+    // this terminates.
+    int64_t size = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        size = 0;
+        for (size_t i = 0; i < n; i++) {
+            offsets[i] = size;
+            const MInst* inst = &mf->code[i];
+            if (inst->op == MOP_LABEL) {
+                labels[inst->dst.imm] = size;
+            } else if (is_branch(inst->op)) {
+                size += branch_size(inst, long_form[i]);
+            } else {
+                size += encodings[i].size;
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            const MInst* inst = &mf->code[i];
+            if (!is_branch(inst->op) || long_form[i]) continue;
+            int64_t disp = labels[inst->dst.imm] - (offsets[i] + 2);
+            if (!fits8(disp)) {
+                long_form[i] = true;
+                changed = true;
+            }
+        }
+    }
+
+    // Align the function start
+    while (obj->text.size % 16) {
+        unsigned char nop = 0x90;
+        if (!buffer_append(&obj->text, &nop, 1)) goto done;
+    }
+    uint64_t start = obj->text.size;
+    if (!buffer_reserve(&obj->text, (size_t)size)) goto done;
+
+    for (size_t i = 0; i < n; i++) {
+        const MInst* inst = &mf->code[i];
+        Encoding* e = &encodings[i];
+        if (is_branch(inst->op)) {
+            int size_now = branch_size(inst, long_form[i]);
+            int64_t disp = labels[inst->dst.imm] - (offsets[i] + size_now);
+            if (!long_form[i]) {
+                put8(e, inst->op == MOP_JMP ? 0xEB : 0x70 + inst->cc);
+                put8(e, (uint8_t)disp);
+            } else if (inst->op == MOP_JMP) {
+                put8(e, 0xE9);
+                put32(e, (uint32_t)disp);
+            } else {
+                put8(e, 0x0F);
+                put8(e, 0x80 + inst->cc);
+                put32(e, (uint32_t)disp);
+            }
+        } else if (inst->op == MOP_TABLE_JUMP) {
+            patch32(&e->bytes[3], (uint32_t)(labels[inst->dst.imm] - (offsets[i] + 7)));
+        } else if (inst->op == MOP_TABLE_ENTRY) {
+            patch32(e->bytes, (uint32_t)(labels[inst->dst.imm] - labels[inst->src.imm]));
+        }
+
+        uint64_t at = obj->text.size;
+        buffer_append(&obj->text, e->bytes, e->size);
+        if (e->reloc_at >= 0) {
+            size_t symbol = object_symbol(obj, e->reloc_symbol);
+            if (symbol == OBJ_NO_SYMBOL) goto done;
+            // The CPU adds the displacement to the end of the instruction
+            int64_t addend = -(int64_t)(e->size - e->reloc_at);
+            if (!object_add_reloc(obj, at + e->reloc_at, symbol, e->reloc_type, addend)) goto done;
+        }
+    }
+
+    if (start_out) *start_out = start;
+    ok = true;
+
+done:
+    free(encodings);
+    free(long_form);
+    free(offsets);
+    free(labels);
+    return ok;
+}
+
+static bool define_symbol(ObjectFile* obj, const char* name, ObjSection section,
+                          uint64_t value, uint64_t size, bool is_function) {
+    size_t index = object_symbol(obj, name);
+    if (index == OBJ_NO_SYMBOL) return false;
+    ObjSymbol* symbol = &obj->symbols[index];
+    symbol->section = section;
+    symbol->value = value;
+    symbol->size = size;
+    symbol->is_function = is_function;
+    return true;
+}
+
+// Calls between functions of the same object need no relocation
+static void resolve_local_calls(ObjectFile* obj) {
+    size_t kept = 0;
+    for (size_t i = 0; i < obj->reloc_count; i++) {
+        ObjReloc* reloc = &obj->relocs[i];
+        const ObjSymbol* symbol = &obj->symbols[reloc->symbol];
+        if (reloc->type == RELOC_PLT32 && symbol->section == OBJ_SECTION_TEXT) {
+            int32_t value = (int32_t)((int64_t)symbol->value + reloc->addend - (int64_t)reloc->offset);
+            memcpy(obj->text.data + reloc->offset, &value, sizeof(value));
+            continue;
+        }
+        obj->relocs[kept++] = *reloc;
+    }
+    obj->reloc_count = kept;
+}
+
+bool codegen_emit_object(const CodeGen* cg, ObjectFile* obj) {
+    const IR* ir = cg->ir;
+
+    for (size_t i = 0; i < ir->global_count; i++) {
+        const IRGlobal* global = &ir->globals[i];
+        uint64_t offset = obj->data.size;
+        unsigned char bytes[8];
+        for (int b = 0; b < 8; b++) bytes[b] = ((uint64_t)global->init >> (8 * b)) & 0xFF;
+        if (!buffer_append(&obj->data, bytes, sizeof(bytes)) ||
+            !define_symbol(obj, global->name, OBJ_SECTION_DATA, offset, 8, false)) {
+            return false;
+        }
+    }
+
+    for (size_t f = 0; f < cg->function_count; f++) {
+        const MFunction* mf = &cg->functions[f];
+        uint64_t start;
+        if (!encode_function(mf, obj, &start) ||
+            !define_symbol(obj, mf->name, OBJ_SECTION_TEXT, start, obj->text.size - start, true)) {
+            return false;
+        }
+    }
+
+    resolve_local_calls(obj);
+    return true;
+}
@@ -0,0 +1,239 @@
+#include "optimize.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Tree-walking evaluator for leancc programs. Names go by the bindings
+// resolve_program() left in the AST, as in compiled code: a local is its
+// frame slot, a global or function its index in this program. Evaluation
+// is bounded by a step and a call-depth limit.
+
+struct Evaluator {
+    const ASTNode** functions;   // By REF_FUNCTION index
+    size_t function_count;
+    int64_t* globals;            // By REF_GLOBAL index
+    size_t global_count;
+    const EvalLimits* limits;
+    size_t steps;
+    size_t depth;
+};
+
+typedef struct {
+    int64_t* slots;
+    bool returned;
+    bool broke;            // A break is leaving the innermost loop or switch
+    int64_t value;
+} Frame;
+
+static const ASTNode* find_function(const Evaluator* ev, const char* name) {
+    for (size_t i = 0; i < ev->function_count; i++) {
+        if (strcmp(ev->functions[i]->data.function.name, name) == 0) return ev->functions[i];
+    }
+    return NULL;
+}
+
+Evaluator* evaluator_create(const ASTNode* program) {
+    Evaluator* ev = calloc(1, sizeof(Evaluator));
+    if (!ev) return NULL;
+    size_t count = program->data.block.count;
+    ev->functions = calloc(count + 1, sizeof(ASTNode*));
+    ev->globals = calloc(count + 1, sizeof(int64_t));
+    if (!ev->functions || !ev->globals) {
+        evaluator_destroy(ev);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const ASTNode* node = program->data.block.statements[i];
+        if (node->type == NODE_FUNCTION) {
+            ev->functions[ev->function_count++] = node;
+        } else if (node->type == NODE_ASSIGNMENT) {
+            int64_t* global = &ev->globals[ev->global_count++];
+            if (!ast_constant_value(node->data.assignment.value, global)) *global = 0;
+        } else if (node->type == NODE_VARIABLE) {
+            ev->global_count++;
+        }
+    }
+    return ev;
+}
+
+void evaluator_destroy(Evaluator* ev) {
+    if (!ev) return;
+    free(ev->functions);
+    free(ev->globals);
+    free(ev);
+}
+
+static EvalStatus eval_function(Evaluator* ev, const ASTNode* fn, const int64_t* args,
+                                size_t arg_count, int64_t* result);
+
+static EvalStatus eval_expression(Evaluator* ev, Frame* frame, const ASTNode* node, int64_t* out) {
+    if (++ev->steps > ev->limits->max_steps) return EVAL_STEP_LIMIT;
+
+    switch (node->type) {
+        case NODE_NUMBER:
+            *out = node->data.number.value;
+            return EVAL_OK;
+
+        case NODE_VARIABLE: {
+            NameRef ref = node->data.variable.ref;
+            *out = ref.kind == REF_LOCAL ? frame->slots[ref.index] : ev->globals[ref.index];
+            return EVAL_OK;
+        }
+
+        case NODE_ASSIGNMENT: {
+            int64_t value;
+            EvalStatus status = eval_expression(ev, frame, node->data.assignment.value, &value);
+            if (status != EVAL_OK) return status;
+            NameRef ref = node->data.assignment.ref;
+            if (ref.kind == REF_LOCAL) frame->slots[ref.index] = value;
+            else ev->globals[ref.index] = value;
+            *out = value;
+            return EVAL_OK;
+        }
+
+        case NODE_BINARY_OP: {
+            int64_t left, right;
+            EvalStatus status = eval_expression(ev, frame, node->data.binary.left, &left);
+            if (status != EVAL_OK) return status;
+            status = eval_expression(ev, frame, node->data.binary.right, &right);
+            if (status != EVAL_OK) return status;
+            if (node->data.binary.op == OP_ASSIGN) return EVAL_UNSUPPORTED;
+            return fold_binary(node->data.binary.op, left, right, out) ? EVAL_OK : EVAL_TRAP;
+        }
+
+        case NODE_CALL: {
+            // Functions of other units are out of reach
+            if (node->data.call.ref.kind != REF_FUNCTION) return EVAL_UNSUPPORTED;
+            const ASTNode* callee = ev->functions[node->data.call.ref.index];
+            size_t count = node->data.call.arg_count;
+            int64_t* args = malloc((count + 1) * sizeof(int64_t));
+            if (!args) return EVAL_UNSUPPORTED;
+            EvalStatus status = EVAL_OK;
+            for (size_t i = 0; i < count && status == EVAL_OK; i++) {
+                status = eval_expression(ev, frame, node->data.call.args[i], &args[i]);
+            }
+            if (status == EVAL_OK) status = eval_function(ev, callee, args, count, out);
+            free(args);
+            return status;
+        }
+
+        default:
+            return EVAL_UNSUPPORTED;
+    }
+}
+
+static EvalStatus eval_statement(Evaluator* ev, Frame* frame, const ASTNode* node) {
+    if (!node) return EVAL_OK;
+    if (++ev->steps > ev->limits->max_steps) return EVAL_STEP_LIMIT;
+
+    EvalStatus status = EVAL_OK;
+    int64_t value;
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (size_t i = 0; i < node->data.block.count && !frame->returned && !frame->broke; i++) {
+                status = eval_statement(ev, frame, node->data.block.statements[i]);
+                if (status != EVAL_OK) return status;
+            }
+            return EVAL_OK;
+
+        case NODE_RETURN:
+            status = eval_expression(ev, frame, node->data.ret.expr, &frame->value);
+            frame->returned = status == EVAL_OK;
+            return status;
+
+        case NODE_IF_STMT:
+            status = eval_expression(ev, frame, node->data.if_stmt_node.condition, &value);
+            if (status != EVAL_OK) return status;
+            return eval_statement(ev, frame, value ? node->data.if_stmt_node.then_branch
+                                                   : node->data.if_stmt_node.else_branch);
+
+        case NODE_WHILE_STMT:
+            while (!frame->returned) {
+                status = eval_expression(ev, frame, node->data.while_stmt_node.condition, &value);
+                if (status != EVAL_OK || !value) return status;
+                status = eval_statement(ev, frame, node->data.while_stmt_node.body);
+                if (status != EVAL_OK) return status;
+                if (frame->broke) {
+                    frame->broke = false;
+                    break;
+                }
+            }
+            return EVAL_OK;
+
+        case NODE_SWITCH_STMT: {
+            status = eval_expression(ev, frame, node->data.switch_stmt_node.value, &value);
+            if (status != EVAL_OK) return status;
+            // Run the body from the matching label, or the default one
+            const ASTNode* body = node->data.switch_stmt_node.body;
+            size_t start = body->data.block.count;
+            for (size_t i = 0; i < body->data.block.count; i++) {
+                const ASTNode* label = body->data.block.statements[i];
+                if (label->type != NODE_CASE) continue;
+                if (label->data.case_label.is_default) {
+                    if (start == body->data.block.count) start = i;
+                } else if (label->data.case_label.value == value) {
+                    start = i;
+                    break;
+                }
+            }
+            for (size_t i = start; i < body->data.block.count && !frame->returned && !frame->broke; i++) {
+                status = eval_statement(ev, frame, body->data.block.statements[i]);
+                if (status != EVAL_OK) return status;
+            }
+            frame->broke = false;
+            return EVAL_OK;
+        }
+
+        case NODE_CASE:
+            return EVAL_OK;
+
+        case NODE_BREAK:
+            frame->broke = true;
+            return EVAL_OK;
+
+        case NODE_VARIABLE:
+            if (node->data.variable.is_declaration) {
+                // Uninitialized locals start out as zero, as in compiled code
+                frame->slots[node->data.variable.ref.index] = 0;
+                return EVAL_OK;
+            }
+            return eval_expression(ev, frame, node, &value);
+
+        default:
+            // Expression statement
+            return eval_expression(ev, frame, node, &value);
+    }
+}
+
+static EvalStatus eval_function(Evaluator* ev, const ASTNode* fn, const int64_t* args,
+                                size_t arg_count, int64_t* result) {
+    if (ev->depth >= ev->limits->max_depth) return EVAL_DEPTH_LIMIT;
+
+    Frame frame = {0};
+    frame.slots = calloc(fn->data.function.slot_count + 1, sizeof(int64_t));
+    if (!frame.slots) return EVAL_UNSUPPORTED;
+    memcpy(frame.slots, args, arg_count * sizeof(int64_t));
+
+    ev->depth++;
+    EvalStatus status = eval_statement(ev, &frame, fn->data.function.body);
+    ev->depth--;
+
+    // Falling off the end returns 0
+    *result = frame.returned ? frame.value : 0;
+    free(frame.slots);
+    return status;
+}
+
+EvalStatus evaluator_call(Evaluator* ev, const char* name, const int64_t* args, size_t arg_count,
+                          const EvalLimits* limits, int64_t* result) {
+    const ASTNode* fn = find_function(ev, name);
+    if (!fn || fn->data.function.param_count != arg_count) return EVAL_UNSUPPORTED;
+    ev->limits = limits;
+    ev->steps = 0;
+    ev->depth = 0;
+    return eval_function(ev, fn, args, arg_count, result);
+}
+
+size_t evaluator_steps(const Evaluator* ev) {
+    return ev->steps;
+}
@@ -0,0 +1,249 @@
+#include "optimize.h"
+#include <stdlib.h>
+
+// Constant folding and algebraic simplification. Expressions are rewritten
+// bottom-up; a replaced subtree is freed and its parent pointer updated.
+// Operands are only dropped or reordered when that cannot change which
+// calls and assignments run, or in which order.
+
+typedef struct {
+    FoldStats* stats;
+} FoldContext;
+
+bool fold_binary(BinaryOp op, int64_t left, int64_t right, int64_t* out) {
+    uint64_t ul = (uint64_t)left, ur = (uint64_t)right;
+    switch (op) {
+        case OP_ADD:           *out = (int64_t)(ul + ur); return true;
+        case OP_SUBTRACT:      *out = (int64_t)(ul - ur); return true;
+        case OP_MULTIPLY:      *out = (int64_t)(ul * ur); return true;
+        case OP_DIVIDE:
+            if (right == 0 || (left == INT64_MIN && right == -1)) return false;
+            *out = left / right;
+            return true;
+        case OP_EQUALS:        *out = left == right; return true;
+        case OP_NOT_EQUALS:    *out = left != right; return true;
+        case OP_LESS:          *out = left < right; return true;
+        case OP_GREATER:       *out = left > right; return true;
+        case OP_LESS_EQUAL:    *out = left <= right; return true;
+        case OP_GREATER_EQUAL: *out = left >= right; return true;
+        default:               return false;
+    }
+}
+
+bool ast_constant_value(const ASTNode* node, int64_t* out) {
+    if (node->type == NODE_NUMBER) {
+        *out = node->data.number.value;
+        return true;
+    }
+    if (node->type != NODE_BINARY_OP) return false;
+
+    int64_t left, right;
+    return ast_constant_value(node->data.binary.left, &left) &&
+           ast_constant_value(node->data.binary.right, &right) &&
+           fold_binary(node->data.binary.op, left, right, out);
+}
+
+bool ast_is_pure(const ASTNode* node) {
+    if (!node) return true;
+    switch (node->type) {
+        case NODE_NUMBER:
+        case NODE_VARIABLE:
+            return true;
+        case NODE_BINARY_OP:
+            return node->data.binary.op != OP_ASSIGN &&
+                   ast_is_pure(node->data.binary.left) &&
+                   ast_is_pure(node->data.binary.right);
+        default:
+            return false;
+    }
+}
+
+size_t ast_count_nodes(const ASTNode* node) {
+    if (!node) return 0;
+    size_t count = 1;
+    switch (node->type) {
+        case NODE_PROGRAM:
+        case NODE_BLOCK:
+            for (size_t i = 0; i < node->data.block.count; i++) {
+                count += ast_count_nodes(node->data.block.statements[i]);
+            }
+            break;
+        case NODE_FUNCTION:
+            count += ast_count_nodes(node->data.function.body);
+            break;
+        case NODE_RETURN:
+            count += ast_count_nodes(node->data.ret.expr);
+            break;
+        case NODE_BINARY_OP:
+            count += ast_count_nodes(node->data.binary.left);
+            count += ast_count_nodes(node->data.binary.right);
+            break;
+        case NODE_ASSIGNMENT:
+            count += ast_count_nodes(node->data.assignment.value);
+            break;
+        case NODE_CALL:
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                count += ast_count_nodes(node->data.call.args[i]);
+            }
+            break;
+        case NODE_IF_STMT:
+            count += ast_count_nodes(node->data.if_stmt_node.condition);
+            count += ast_count_nodes(node->data.if_stmt_node.then_branch);
+            count += ast_count_nodes(node->data.if_stmt_node.else_branch);
+            break;
+        case NODE_WHILE_STMT:
+            count += ast_count_nodes(node->data.while_stmt_node.condition);
+            count += ast_count_nodes(node->data.while_stmt_node.body);
+            break;
+        case NODE_SWITCH_STMT:
+            count += ast_count_nodes(node->data.switch_stmt_node.value);
+            count += ast_count_nodes(node->data.switch_stmt_node.body);
+            break;
+        default:
+            break;
+    }
+    return count;
+}
+
+static bool is_number(const ASTNode* node, int64_t value) {
+    return node->type == NODE_NUMBER && node->data.number.value == value;
+}
+
+// Replace binary with one of its operands, freeing the other and the node
+static ASTNode* keep_operand(ASTNode* binary, ASTNode* kept) {
+    ASTNode* dropped = kept == binary->data.binary.left ? binary->data.binary.right
+                                                        : binary->data.binary.left;
+    ast_destroy(dropped);
+    free(binary);
+    return kept;
+}
+
+// Simplify a binary node whose operands are already folded
+static ASTNode* simplify_binary(FoldContext* ctx, ASTNode* node) {
+    BinaryOp op = node->data.binary.op;
+    ASTNode* left = node->data.binary.left;
+    ASTNode* right = node->data.binary.right;
+    if (op == OP_ASSIGN) return node;
+
+    // Both operands constant: evaluate, reusing the left literal
+    int64_t value;
+    if (left->type == NODE_NUMBER && right->type == NODE_NUMBER &&
+        fold_binary(op, left->data.number.value, right->data.number.value, &value)) {
+        left->data.number.value = value;
+        ctx->stats->folded++;
+        return keep_operand(node, left);
+    }
+
+    // x - c is x + (-c) under wrapping arithmetic; it lets chains combine
+    if (op == OP_SUBTRACT && right->type == NODE_NUMBER && !is_number(right, 0)) {
+        node->data.binary.op = op = OP_ADD;
+        right->data.number.value = (int64_t)(0 - (uint64_t)right->data.number.value);
+    }
+
+    // Constants go on the right of commutative operators. A literal has no
+    // side effects, so swapping cannot reorder calls.
+    if ((op == OP_ADD || op == OP_MULTIPLY) && left->type == NODE_NUMBER &&
+        right->type != NODE_NUMBER) {
+        node->data.binary.left = right;
+        node->data.binary.right = left;
+        left = node->data.binary.left;
+        right = node->data.binary.right;
+    }
+
+    if (right->type == NODE_NUMBER) {
+        int64_t c = right->data.number.value;
+
+        // (x op c1) op c2 -> x op (c1 op c2) for op in {+, *}
+        if ((op == OP_ADD || op == OP_MULTIPLY) && left->type == NODE_BINARY_OP &&
+            left->data.binary.op == op && left->data.binary.right->type == NODE_NUMBER) {
+            ASTNode* inner = left->data.binary.right;
+            fold_binary(op, inner->data.number.value, c, &inner->data.number.value);
+            ctx->stats->folded++;
+            return simplify_binary(ctx, keep_operand(node, left));
+        }
+
+        if ((op == OP_ADD && c == 0) || (op == OP_MULTIPLY && c == 1) ||
+            (op == OP_DIVIDE && c == 1)) {
+            ctx->stats->simplified++;
+            return keep_operand(node, left);
+        }
+        if (op == OP_MULTIPLY && c == 0 && ast_is_pure(left)) {
+            ctx->stats->simplified++;
+            return keep_operand(node, right);
+        }
+        if (op == OP_SUBTRACT && c == 0) {
+            ctx->stats->simplified++;
+            return keep_operand(node, left);
+        }
+    }
+    return node;
+}
+
+static ASTNode* fold_expression(FoldContext* ctx, ASTNode* node) {
+    if (!node) return NULL;
+    switch (node->type) {
+        case NODE_BINARY_OP:
+            node->data.binary.left = fold_expression(ctx, node->data.binary.left);
+            node->data.binary.right = fold_expression(ctx, node->data.binary.right);
+            return simplify_binary(ctx, node);
+        case NODE_ASSIGNMENT:
+            node->data.assignment.value = fold_expression(ctx, node->data.assignment.value);
+            return node;
+        case NODE_CALL:
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                node->data.call.args[i] = fold_expression(ctx, node->data.call.args[i]);
+            }
+            return node;
+        default:
+            return node;
+    }
+}
+
+static void fold_statement(FoldContext* ctx, ASTNode* node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_PROGRAM:
+        case NODE_BLOCK:
+            for (size_t i = 0; i < node->data.block.count; i++) {
+                ASTNode** statement = &node->data.block.statements[i];
+                if ((*statement)->type == NODE_FUNCTION || (*statement)->type == NODE_BLOCK ||
+                    (*statement)->type == NODE_RETURN || (*statement)->type == NODE_IF_STMT ||
+                    (*statement)->type == NODE_WHILE_STMT || (*statement)->type == NODE_SWITCH_STMT) {
+                    fold_statement(ctx, *statement);
+                } else {
+                    *statement = fold_expression(ctx, *statement);
+                }
+            }
+            break;
+        case NODE_FUNCTION:
+            fold_statement(ctx, node->data.function.body);
+            break;
+        case NODE_RETURN:
+            node->data.ret.expr = fold_expression(ctx, node->data.ret.expr);
+            break;
+        case NODE_IF_STMT:
+            node->data.if_stmt_node.condition = fold_expression(ctx, node->data.if_stmt_node.condition);
+            fold_statement(ctx, node->data.if_stmt_node.then_branch);
+            fold_statement(ctx, node->data.if_stmt_node.else_branch);
+            break;
+        case NODE_WHILE_STMT:
+            node->data.while_stmt_node.condition = fold_expression(ctx, node->data.while_stmt_node.condition);
+            fold_statement(ctx, node->data.while_stmt_node.body);
+            break;
+        case NODE_SWITCH_STMT:
+            node->data.switch_stmt_node.value = fold_expression(ctx, node->data.switch_stmt_node.value);
+            fold_statement(ctx, node->data.switch_stmt_node.body);
+            break;
+        default:
+            break;
+    }
+}
+
+void fold_program(ASTNode* program, FoldStats* stats) {
+    FoldStats local;
+    FoldContext ctx = { .stats = stats ? stats : &local };
+    *ctx.stats = (FoldStats){0};
+    ctx.stats->nodes_before = ast_count_nodes(program);
+    fold_statement(&ctx, program);
+    ctx.stats->nodes_after = ast_count_nodes(program);
+}
@@ -0,0 +1,246 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Global value numbering over the dominator tree (dominator-based value
+// numbering, Briggs, Cooper and Simpson). An expression is redundant when
+// the same operator over the same value numbers was already computed in a
+// dominating block; its result is then forwarded to the earlier vreg.
+//
+// Global loads are only reused within a block, and a store forwards its
+// value to later loads of the same global. Calls may write any global.
+
+typedef struct {
+    IROpcode op;
+    int a;
+    int b;
+    int64_t imm;
+    const char* symbol;
+    unsigned epoch;             // Memory state a load was made in
+    int value;
+    int next;                   // Next entry in the bucket, or -1
+    size_t bucket;
+} ValueEntry;
+
+typedef struct {
+    ValueEntry* entries;        // A stack: the scope of a dominator subtree
+    size_t entry_count;         // is a suffix of it
+    int* buckets;
+    size_t bucket_mask;
+    unsigned epoch;
+    int* forward;
+} ValueTable;
+
+static bool is_commutative(IROpcode op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_EQ || op == IR_NE;
+}
+
+static bool is_numbered(IROpcode op) {
+    switch (op) {
+        case IR_CONST:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:      // A repeated division cannot trap where the first did not
+        case IR_SHL:
+        case IR_SAR:
+        case IR_SHR:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+        case IR_LE:
+        case IR_GE:
+        case IR_LOAD_GLOBAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static size_t hash_key(const ValueEntry* key) {
+    uint64_t h = 1469598103934665603ULL;
+    uint64_t parts[4] = { (uint64_t)key->op, (uint64_t)(uint32_t)key->a,
+                          (uint64_t)(uint32_t)key->b, (uint64_t)key->imm };
+    for (size_t i = 0; i < 4; i++) {
+        h ^= parts[i];
+        h *= 1099511628211ULL;
+    }
+    if (key->symbol) {
+        for (const char* c = key->symbol; *c; c++) {
+            h ^= (unsigned char)*c;
+            h *= 1099511628211ULL;
+        }
+        h ^= key->epoch;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+static bool same_key(const ValueEntry* x, const ValueEntry* y) {
+    if (x->op != y->op || x->a != y->a || x->b != y->b || x->imm != y->imm) return false;
+    if (!x->symbol || !y->symbol) return x->symbol == y->symbol;
+    return x->epoch == y->epoch && strcmp(x->symbol, y->symbol) == 0;
+}
+
+static int lookup(ValueTable* table, const ValueEntry* key) {
+    size_t bucket = hash_key(key) & table->bucket_mask;
+    for (int e = table->buckets[bucket]; e >= 0; e = table->entries[e].next) {
+        if (same_key(&table->entries[e], key)) return table->entries[e].value;
+    }
+    return IR_NO_VREG;
+}
+
+// Newer entries shadow older ones with the same key
+static void insert(ValueTable* table, const ValueEntry* key, int value) {
+    ValueEntry* entry = &table->entries[table->entry_count];
+    *entry = *key;
+    entry->value = value;
+    entry->bucket = hash_key(key) & table->bucket_mask;
+    entry->next = table->buckets[entry->bucket];
+    table->buckets[entry->bucket] = (int)table->entry_count++;
+}
+
+static void pop_scope(ValueTable* table, size_t mark) {
+    while (table->entry_count > mark) {
+        ValueEntry* entry = &table->entries[--table->entry_count];
+        table->buckets[entry->bucket] = entry->next;
+    }
+}
+
+static void make_key(ValueTable* table, const IRInstr* instr, ValueEntry* key) {
+    memset(key, 0, sizeof(*key));
+    key->op = instr->op;
+    key->a = instr->a;
+    key->b = instr->b;
+    if (instr->op == IR_CONST) key->imm = instr->imm;
+    if (is_commutative(instr->op) && key->a > key->b) {
+        key->a = instr->b;
+        key->b = instr->a;
+    }
+    if (instr->op == IR_LOAD_GLOBAL || instr->op == IR_STORE_GLOBAL) {
+        key->op = IR_LOAD_GLOBAL;
+        key->a = IR_NO_VREG;
+        key->symbol = instr->symbol;
+        key->epoch = table->epoch;
+    }
+}
+
+// Returns true when instr was redundant and has been removed
+static bool number_instruction(ValueTable* table, IRBlock* block, IRInstr* instr) {
+    int* forward = table->forward;
+    if (instr->op == IR_CALL || instr->op == IR_PHI) {
+        for (size_t i = 0; i < instr->arg_count; i++) {
+            instr->args[i] = ir_resolve_forward(forward, instr->args[i]);
+        }
+    } else {
+        if (instr->a != IR_NO_VREG) instr->a = ir_resolve_forward(forward, instr->a);
+        if (instr->b != IR_NO_VREG) instr->b = ir_resolve_forward(forward, instr->b);
+    }
+
+    ValueEntry key;
+    switch (instr->op) {
+        case IR_COPY:
+            forward[instr->dst] = instr->a;
+            ir_remove(block, instr);
+            return true;
+
+        case IR_PHI: {
+            // All operands already known to be one value
+            int same = IR_NO_VREG;
+            for (size_t i = 0; i < instr->arg_count; i++) {
+                if (instr->args[i] == instr->dst) continue;
+                if (same != IR_NO_VREG && instr->args[i] != same) return false;
+                same = instr->args[i];
+            }
+            if (same == IR_NO_VREG) return false;
+            forward[instr->dst] = same;
+            ir_remove(block, instr);
+            return true;
+        }
+
+        case IR_STORE_GLOBAL:
+            make_key(table, instr, &key);
+            insert(table, &key, instr->a);
+            return false;
+
+        case IR_CALL:
+            table->epoch++;
+            return false;
+
+        default:
+            break;
+    }
+    if (!is_numbered(instr->op)) return false;
+
+    make_key(table, instr, &key);
+    int existing = lookup(table, &key);
+    if (existing != IR_NO_VREG) {
+        forward[instr->dst] = existing;
+        ir_remove(block, instr);
+        return true;
+    }
+    insert(table, &key, instr->dst);
+    return false;
+}
+
+bool ir_gvn(IRFunction* fn, size_t* removed) {
+    DomTree tree;
+    if (!ir_dominators(fn, &tree)) return false;
+
+    size_t instr_count = ir_instr_count(fn);
+    size_t buckets = 16;
+    while (buckets < instr_count * 2) buckets *= 2;
+
+    ValueTable table = {0};
+    table.entries = malloc((instr_count + 1) * sizeof(ValueEntry));
+    table.buckets = malloc(buckets * sizeof(int));
+    table.bucket_mask = buckets - 1;
+    table.forward = malloc((fn->vreg_count + 1) * sizeof(int));
+    int* stack = malloc((2 * tree.count + 1) * sizeof(int));
+    size_t* marks = malloc((tree.count + 1) * sizeof(size_t));
+    bool ok = table.entries && table.buckets && table.forward && stack && marks;
+    if (!ok) goto done;
+
+    for (size_t i = 0; i < buckets; i++) table.buckets[i] = -1;
+    for (int v = 0; v < fn->vreg_count; v++) table.forward[v] = v;
+
+    // Preorder walk of the dominator tree; ~n on the stack leaves n's scope
+    size_t top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        int n = stack[--top];
+        if (n < 0) {
+            pop_scope(&table, marks[~n]);
+            continue;
+        }
+
+        marks[n] = table.entry_count;
+        table.epoch++;
+        IRBlock* block = fn->blocks[n];
+        IRInstr* instr = block->first;
+        while (instr) {
+            IRInstr* next = instr->next;
+            if (number_instruction(&table, block, instr)) (*removed)++;
+            instr = next;
+        }
+
+        stack[top++] = ~n;
+        for (int c = tree.child_start[n + 1]; c > tree.child_start[n]; c--) {
+            stack[top++] = tree.children[c - 1];
+        }
+    }
+
+    // Operands reached through back edges are forwarded last
+    ir_replace_vregs(fn, table.forward);
+    *removed += ir_remove_trivial_phis(fn);
+
+done:
+    free(table.entries);
+    free(table.buckets);
+    free(table.forward);
+    free(stack);
+    free(marks);
+    dom_tree_free(&tree);
+    return ok;
+}
@@ -0,0 +1,279 @@
+#include "optimize.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Hash-consing of pure expressions. Each function is walked in evaluation
+// order, and every number, variable read and arithmetic node is looked up
+// by its operator and the identity of its already-shared children; a
+// match replaces the node, which is freed. Sharing only holds within
+// straight-line code: the table is emptied wherever control flow joins or
+// splits, and a variable read only matches one from before the latest
+// assignment to that variable - or, for a global, before the latest call.
+// Variables are told apart by their resolved NameRef.
+// So within a stretch, one node always stands for one value, and lowering
+// computes it once.
+
+typedef struct {
+    ASTNode* node;           // NULL for an empty slot
+    size_t region;           // Stale unless the current one
+    size_t version;          // Of the variable, for reads
+} ConsEntry;
+
+typedef struct {
+    ConsEntry* entries;      // Open addressing
+    size_t capacity;
+    size_t count;            // Entries in the current region
+    size_t region;
+    size_t clock;            // Ticks at every write and call
+    size_t* locals;          // Tick of each slot's latest write
+    size_t local_capacity;
+    size_t* globals;         // Tick of each global's latest write
+    size_t last_call;        // Tick of the latest call, which may write any global
+    HashConsStats* stats;
+    bool failed;
+} ConsContext;
+
+static size_t hash_pointer(const void* pointer) {
+    uint64_t x = (uint64_t)(uintptr_t)pointer;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+static size_t hash_node(const ASTNode* node, size_t version) {
+    switch (node->type) {
+        case NODE_NUMBER:
+            return hash_pointer((const void*)(uintptr_t)node->data.number.value);
+        case NODE_VARIABLE:
+            return hash_pointer((const void*)(uintptr_t)(((size_t)node->data.variable.ref.index << 3) |
+                                                         node->data.variable.ref.kind)) ^
+                   (version * 0x9E3779B97F4A7C15ULL);
+        default:
+            return hash_pointer(node->data.binary.left) * 31 ^
+                   hash_pointer(node->data.binary.right) ^ (size_t)node->data.binary.op;
+    }
+}
+
+static bool same_node(const ConsEntry* entry, const ASTNode* node, size_t version) {
+    const ASTNode* other = entry->node;
+    if (other->type != node->type) return false;
+    switch (node->type) {
+        case NODE_NUMBER:
+            return other->data.number.value == node->data.number.value;
+        case NODE_VARIABLE:
+            return entry->version == version &&
+                   other->data.variable.ref.kind == node->data.variable.ref.kind &&
+                   other->data.variable.ref.index == node->data.variable.ref.index;
+        default:
+            return other->data.binary.op == node->data.binary.op &&
+                   other->data.binary.left == node->data.binary.left &&
+                   other->data.binary.right == node->data.binary.right;
+    }
+}
+
+// Forget every entry; stale slots count as empty
+static void new_region(ConsContext* ctx) {
+    ctx->region++;
+    ctx->count = 0;
+}
+
+// Version of the variable ref names: when it was last written
+static size_t version_of(const ConsContext* ctx, NameRef ref) {
+    if (ref.kind == REF_LOCAL) return ctx->locals[ref.index];
+    size_t written = ctx->globals[ref.index];
+    return written > ctx->last_call ? written : ctx->last_call;
+}
+
+static void write_name(ConsContext* ctx, NameRef ref) {
+    if (ref.kind == REF_LOCAL) ctx->locals[ref.index] = ++ctx->clock;
+    else ctx->globals[ref.index] = ++ctx->clock;
+}
+
+static bool grow_table(ConsContext* ctx) {
+    size_t capacity = ctx->capacity ? ctx->capacity * 2 : 256;
+    ConsEntry* table = calloc(capacity, sizeof(ConsEntry));
+    if (!table) return false;
+    for (size_t i = 0; i < ctx->capacity; i++) {
+        const ConsEntry* entry = &ctx->entries[i];
+        if (!entry->node || entry->region != ctx->region) continue;
+        size_t slot = hash_node(entry->node, entry->version) & (capacity - 1);
+        while (table[slot].node) slot = (slot + 1) & (capacity - 1);
+        table[slot] = *entry;
+    }
+    free(ctx->entries);
+    ctx->entries = table;
+    ctx->capacity = capacity;
+    return true;
+}
+
+// The node already standing for node's value in this region, or node
+// itself after recording it
+static ASTNode* hashcons_intern(ConsContext* ctx, ASTNode* node, size_t version) {
+    if ((ctx->count + 1) * 2 > ctx->capacity && !grow_table(ctx)) {
+        ctx->failed = true;
+        return node;
+    }
+    size_t mask = ctx->capacity - 1;
+    size_t slot = hash_node(node, version) & mask;
+    while (ctx->entries[slot].node && ctx->entries[slot].region == ctx->region) {
+        if (same_node(&ctx->entries[slot], node, version)) return ctx->entries[slot].node;
+        slot = (slot + 1) & mask;
+    }
+    ctx->entries[slot] = (ConsEntry){ node, ctx->region, version };
+    ctx->count++;
+    return node;
+}
+
+static void cons_slot(ConsContext* ctx, ASTNode** slot, bool* pure);
+
+// Share the subexpressions of node; *pure tells whether node itself could
+// be interned
+static ASTNode* cons_expression(ConsContext* ctx, ASTNode* node, bool* pure) {
+    *pure = false;
+    switch (node->type) {
+        case NODE_NUMBER:
+            *pure = true;
+            return hashcons_intern(ctx, node, 0);
+
+        case NODE_VARIABLE:
+            *pure = true;
+            return hashcons_intern(ctx, node, version_of(ctx, node->data.variable.ref));
+
+        case NODE_BINARY_OP: {
+            bool left_pure, right_pure;
+            cons_slot(ctx, &node->data.binary.left, &left_pure);
+            cons_slot(ctx, &node->data.binary.right, &right_pure);
+            if (!left_pure || !right_pure || node->data.binary.op == OP_ASSIGN) return node;
+            *pure = true;
+            return hashcons_intern(ctx, node, 0);
+        }
+
+        case NODE_ASSIGNMENT: {
+            bool value_pure;
+            cons_slot(ctx, &node->data.assignment.value, &value_pure);
+            write_name(ctx, node->data.assignment.ref);
+            return node;
+        }
+
+        case NODE_CALL: {
+            bool arg_pure;
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                cons_slot(ctx, &node->data.call.args[i], &arg_pure);
+            }
+            ctx->last_call = ++ctx->clock;
+            return node;
+        }
+
+        default:
+            return node;
+    }
+}
+
+// Replace *slot by the node sharing its value, if there is one
+static void cons_slot(ConsContext* ctx, ASTNode** slot, bool* pure) {
+    ASTNode* node = *slot;
+    ctx->stats->expressions += node->type == NODE_NUMBER || node->type == NODE_VARIABLE ||
+                               node->type == NODE_BINARY_OP;
+    ASTNode* shared = cons_expression(ctx, node, pure);
+    if (shared == node) return;
+    ctx->stats->shared++;
+    shared->refs++;
+    ast_destroy(node);
+    *slot = shared;
+}
+
+static void cons_statement(ConsContext* ctx, ASTNode** slot) {
+    ASTNode* node = *slot;
+    if (!node) return;
+    bool pure;
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (size_t i = 0; i < node->data.block.count; i++) {
+                cons_statement(ctx, &node->data.block.statements[i]);
+            }
+            break;
+
+        case NODE_RETURN:
+            cons_slot(ctx, &node->data.ret.expr, &pure);
+            new_region(ctx);
+            break;
+
+        case NODE_IF_STMT:
+            cons_slot(ctx, &node->data.if_stmt_node.condition, &pure);
+            new_region(ctx);
+            cons_statement(ctx, &node->data.if_stmt_node.then_branch);
+            new_region(ctx);
+            cons_statement(ctx, &node->data.if_stmt_node.else_branch);
+            new_region(ctx);
+            break;
+
+        case NODE_WHILE_STMT:
+            // The condition runs again after every iteration of the body
+            new_region(ctx);
+            cons_slot(ctx, &node->data.while_stmt_node.condition, &pure);
+            new_region(ctx);
+            cons_statement(ctx, &node->data.while_stmt_node.body);
+            new_region(ctx);
+            break;
+
+        case NODE_SWITCH_STMT:
+            cons_slot(ctx, &node->data.switch_stmt_node.value, &pure);
+            new_region(ctx);
+            cons_statement(ctx, &node->data.switch_stmt_node.body);
+            new_region(ctx);
+            break;
+
+        case NODE_CASE:
+        case NODE_BREAK:
+            new_region(ctx);
+            break;
+
+        case NODE_VARIABLE:
+            if (node->data.variable.is_declaration) {
+                write_name(ctx, node->data.variable.ref);
+            } else {
+                cons_slot(ctx, slot, &pure);
+            }
+            break;
+
+        default:
+            // Expression statement
+            cons_slot(ctx, slot, &pure);
+            break;
+    }
+}
+
+bool hash_cons_program(ASTNode* program, HashConsStats* stats) {
+    HashConsStats local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(*stats));
+    ConsContext ctx = { .stats = stats };
+    ctx.globals = calloc(program->data.block.count + 1, sizeof(size_t));
+    if (!ctx.globals) return false;
+
+    for (size_t i = 0; i < program->data.block.count && !ctx.failed; i++) {
+        ASTNode* node = program->data.block.statements[i];
+        if (node->type != NODE_FUNCTION) continue;
+        // Versions only need to differ within a region, and each function
+        // starts a new one
+        size_t slots = node->data.function.slot_count;
+        if (slots >= ctx.local_capacity) {
+            size_t* locals = realloc(ctx.locals, (slots + 1) * sizeof(size_t));
+            if (!locals) {
+                ctx.failed = true;
+                break;
+            }
+            ctx.locals = locals;
+            ctx.local_capacity = slots + 1;
+        }
+        memset(ctx.locals, 0, (slots + 1) * sizeof(size_t));
+        new_region(&ctx);
+        cons_statement(&ctx, &node->data.function.body);
+    }
+
+    free(ctx.entries);
+    free(ctx.locals);
+    free(ctx.globals);
+    return !ctx.failed;
+}
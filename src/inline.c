@@ -0,0 +1,337 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+// Function inlining on SSA form. A call is replaced by a copy of the
+// callee's blocks: parameters become the call's arguments, and returns
+// jump to a continuation block where a phi merges the returned values.
+//
+// Functions are visited bottom-up over the call graph, so a callee has
+// already been inlined into and optimized when its cost is measured.
+// Calls within one strongly connected component (recursion) are never
+// inlined. With a profile, the threshold is raised for callees that ran
+// often and lowered for callees that never ran.
+
+#define CALLER_SIZE_LIMIT 20000     // Instructions a caller may grow to
+#define HOT_THRESHOLD_FACTOR 3      // Hot callees may be this much larger
+#define COLD_THRESHOLD_DIVISOR 4    // ... and callees that never ran this much smaller
+
+typedef struct {
+    IR* ir;
+    IRFunction* fn;
+    const CallGraph* graph;
+    const IROptOptions* options;
+    int caller;                 // Index of fn in the call graph
+    size_t size;                // Current instruction count of fn
+    int* forward_from;          // Call results to replace once done
+    int* forward_to;
+    size_t forward_count;
+    size_t forward_capacity;
+} Inliner;
+
+static void remark(const Inliner* ctx, const IRInstr* call, bool inlined, const char* format, ...) {
+    const IROptOptions* options = ctx->options;
+    if (!options->remarks || (inlined ? !options->remark_inlined : !options->remark_missed)) return;
+
+    fprintf(options->remarks, "%s:%d:%d: remark: '%s' %s into '%s'",
+            ctx->fn->file ? ctx->fn->file : options->unit ? options->unit : "<input>",
+            call->line, call->column,
+            call->symbol, inlined ? "inlined" : "not inlined", ctx->fn->name);
+    va_list args;
+    va_start(args, format);
+    vfprintf(options->remarks, format, args);
+    va_end(args);
+    fprintf(options->remarks, " [%s]\n", inlined ? "-Rpass=inline" : "-Rpass-missed=inline");
+}
+
+// Instructions that survive inlining: parameters turn into the arguments
+// and returns into jumps that replace the call
+static size_t inline_cost(const IRFunction* callee) {
+    size_t cost = 0;
+    for (size_t b = 0; b < callee->block_count; b++) {
+        for (const IRInstr* instr = callee->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->op != IR_PARAM && instr->op != IR_RET) cost++;
+        }
+    }
+    return cost;
+}
+
+static int map_vreg(const int* map, int v) {
+    return v == IR_NO_VREG ? IR_NO_VREG : map[v];
+}
+
+static bool clone_instruction(IRFunction* fn, IRBlock* block, const IRInstr* instr,
+                              const int* vmap, IRBlock* const* bmap) {
+    IRInstr* copy = ir_instr_create(fn, instr->op);
+    if (!copy) return false;
+    copy->dst = map_vreg(vmap, instr->dst);
+    copy->a = map_vreg(vmap, instr->a);
+    copy->b = map_vreg(vmap, instr->b);
+    copy->imm = instr->imm;
+    copy->line = instr->line;
+    copy->column = instr->column;
+    copy->symbol = instr->symbol;
+    if (instr->arg_count) {
+        copy->args = arena_alloc(&fn->arena, instr->arg_count * sizeof(int));
+        if (!copy->args) return false;
+        for (size_t i = 0; i < instr->arg_count; i++) copy->args[i] = vmap[instr->args[i]];
+        copy->arg_count = instr->arg_count;
+    }
+    if (instr->target) copy->target = bmap[instr->target->id];
+    if (instr->target_else) copy->target_else = bmap[instr->target_else->id];
+    if (instr->op == IR_SWITCH) {
+        copy->cases = arena_alloc(&fn->arena, (instr->case_count + 1) * sizeof(IRCase));
+        copy->succs = arena_alloc(&fn->arena, (instr->case_count + 1) * sizeof(IRBlock*));
+        if (!copy->cases || !copy->succs) return false;
+        copy->case_count = instr->case_count;
+        for (size_t i = 0; i < instr->case_count; i++) {
+            copy->cases[i].value = instr->cases[i].value;
+            copy->cases[i].target = bmap[instr->cases[i].target->id];
+        }
+        ir_switch_update(copy);
+    }
+    ir_append(block, copy);
+    return true;
+}
+
+static bool add_forward(Inliner* ctx, int from, int to) {
+    if (ctx->forward_count >= ctx->forward_capacity) {
+        size_t new_capacity = ctx->forward_capacity ? ctx->forward_capacity * 2 : 16;
+        int* new_from = realloc(ctx->forward_from, new_capacity * sizeof(int));
+        if (!new_from) return false;
+        ctx->forward_from = new_from;
+        int* new_to = realloc(ctx->forward_to, new_capacity * sizeof(int));
+        if (!new_to) return false;
+        ctx->forward_to = new_to;
+        ctx->forward_capacity = new_capacity;
+    }
+    ctx->forward_from[ctx->forward_count] = from;
+    ctx->forward_to[ctx->forward_count] = to;
+    ctx->forward_count++;
+    return true;
+}
+
+// Replace call, which sits in fn->blocks[index], with the body of callee.
+// The copied blocks and the continuation follow the calling block.
+static bool inline_call(Inliner* ctx, size_t index, IRInstr* call, const IRFunction* callee) {
+    IRFunction* fn = ctx->fn;
+    IRBlock* block = fn->blocks[index];
+    size_t first_new = fn->block_count;
+    int* vmap = malloc((callee->vreg_count + 1) * sizeof(int));
+    IRBlock** bmap = calloc(callee->next_block_id + 1, sizeof(IRBlock*));
+    int* returns = malloc((callee->block_count + 1) * sizeof(int));
+    bool ok = false;
+    if (!vmap || !bmap || !returns) goto done;
+
+    // Arguments take the place of the parameters; everything else is renamed
+    for (int v = 0; v < callee->vreg_count; v++) vmap[v] = IR_NO_VREG;
+    for (size_t b = 0; b < callee->block_count; b++) {
+        for (const IRInstr* instr = callee->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->dst == IR_NO_VREG) continue;
+            vmap[instr->dst] = instr->op == IR_PARAM ? call->args[instr->imm] : ir_new_vreg(fn);
+        }
+    }
+
+    for (size_t b = 0; b < callee->block_count; b++) {
+        bmap[callee->blocks[b]->id] = ir_block_create(fn);
+        if (!bmap[callee->blocks[b]->id]) goto done;
+    }
+    IRBlock* cont = ir_block_create(fn);
+    if (!cont) goto done;
+
+    size_t return_count = 0;
+    for (size_t b = 0; b < callee->block_count; b++) {
+        const IRBlock* source = callee->blocks[b];
+        IRBlock* copy = bmap[source->id];
+        for (size_t p = 0; p < source->pred_count; p++) {
+            if (!ir_add_pred(fn, copy, bmap[source->preds[p]->id])) goto done;
+        }
+        for (const IRInstr* instr = source->first; instr; instr = instr->next) {
+            if (instr->op == IR_PARAM) continue;
+            if (instr->op == IR_RET) {
+                IRInstr* jump = ir_instr_create(fn, IR_JUMP);
+                if (!jump || !ir_add_pred(fn, cont, copy)) goto done;
+                jump->target = cont;
+                ir_append(copy, jump);
+                returns[return_count++] = vmap[instr->a];
+                continue;
+            }
+            if (!clone_instruction(fn, copy, instr, vmap, bmap)) goto done;
+        }
+    }
+
+    // Everything after the call moves to the continuation
+    cont->first = call->next;
+    cont->last = call->next ? block->last : NULL;
+    if (call->next) call->next->prev = NULL;
+    call->next = NULL;
+    block->last = call;
+    ir_remove(block, call);
+    size_t n = ir_successor_count(cont);
+    for (size_t s = 0; s < n; s++) {
+        IRBlock* succ = ir_successor(cont, s);
+        for (size_t p = 0; p < succ->pred_count; p++) {
+            if (succ->preds[p] == block) succ->preds[p] = cont;
+        }
+    }
+
+    IRBlock* entry = bmap[callee->blocks[0]->id];
+    IRInstr* jump = ir_instr_create(fn, IR_JUMP);
+    if (!jump || !ir_add_pred(fn, entry, block)) goto done;
+    jump->target = entry;
+    ir_append(block, jump);
+
+    // The call's value is whatever the callee returned
+    int result;
+    if (return_count == 1) {
+        result = returns[0];
+    } else {
+        IRInstr* merge = ir_instr_create(fn, return_count ? IR_PHI : IR_CONST);
+        if (!merge) goto done;
+        merge->dst = ir_new_vreg(fn);
+        if (return_count) {
+            merge->args = arena_alloc(&fn->arena, return_count * sizeof(int));
+            if (!merge->args) goto done;
+            memcpy(merge->args, returns, return_count * sizeof(int));
+            merge->arg_count = return_count;
+        }
+        ir_insert_before(cont, cont->first, merge);
+        result = merge->dst;
+    }
+    if (!add_forward(ctx, call->dst, result)) goto done;
+
+    // Move the new blocks from the end to just after the calling block
+    size_t added = fn->block_count - first_new;
+    IRBlock** moved = malloc(added * sizeof(IRBlock*));
+    if (!moved) goto done;
+    memcpy(moved, &fn->blocks[first_new], added * sizeof(IRBlock*));
+    memmove(&fn->blocks[index + 1 + added], &fn->blocks[index + 1],
+            (first_new - index - 1) * sizeof(IRBlock*));
+    memcpy(&fn->blocks[index + 1], moved, added * sizeof(IRBlock*));
+    free(moved);
+    ok = true;
+
+done:
+    free(vmap);
+    free(bmap);
+    free(returns);
+    return ok;
+}
+
+static int compare_pointers(const void* x, const void* y) {
+    uintptr_t a = (uintptr_t)*(const IRInstr* const*)x;
+    uintptr_t b = (uintptr_t)*(const IRInstr* const*)y;
+    return a < b ? -1 : a > b;
+}
+
+// Decide on one call site; returns the callee to inline, or NULL
+static const IRFunction* consider(Inliner* ctx, const IRInstr* call) {
+    int callee_index = call_graph_find(ctx->graph, call->symbol);
+    if (callee_index < 0) {
+        remark(ctx, call, false, ": definition not available");
+        return NULL;
+    }
+    const IRFunction* callee = ctx->ir->functions[callee_index];
+    if (ctx->graph->scc[callee_index] == ctx->graph->scc[ctx->caller] ||
+        ctx->graph->recursive[callee_index]) {
+        remark(ctx, call, false, ": recursive");
+        return NULL;
+    }
+    if (callee->out_of_ssa) {
+        remark(ctx, call, false, ": already compiled");
+        return NULL;
+    }
+    if (call->arg_count != callee->param_count) {
+        remark(ctx, call, false, ": called with %zu arguments, takes %zu",
+               call->arg_count, callee->param_count);
+        return NULL;
+    }
+    if (callee->blocks[0]->pred_count > 0) {
+        remark(ctx, call, false, ": entry block is a loop header");
+        return NULL;
+    }
+
+    size_t cost = inline_cost(callee);
+    size_t threshold = ctx->options->inline_threshold;
+    const IRProfile* profile = ctx->options->profile;
+    if (profile) {
+        uint64_t calls = ir_profile_calls(profile, callee->name);
+        if (calls >= profile->hot_calls) threshold *= HOT_THRESHOLD_FACTOR;
+        else if (calls == 0) threshold /= COLD_THRESHOLD_DIVISOR;
+    }
+    if (cost > threshold) {
+        remark(ctx, call, false, " because too costly (cost=%zu, threshold=%zu)", cost, threshold);
+        return NULL;
+    }
+    if (ctx->size + cost > CALLER_SIZE_LIMIT) {
+        remark(ctx, call, false, " because the caller is too large (size=%zu, limit=%d)",
+               ctx->size, CALLER_SIZE_LIMIT);
+        return NULL;
+    }
+    remark(ctx, call, true, " with (cost=%zu, threshold=%zu)", cost, threshold);
+    ctx->size += cost;
+    return callee;
+}
+
+bool ir_inline_calls(IR* ir, IRFunction* fn, const CallGraph* graph,
+                     const IROptOptions* options, size_t* sites, size_t* inlined) {
+    Inliner ctx = {
+        .ir = ir, .fn = fn, .graph = graph, .options = options,
+        .caller = call_graph_find(graph, fn->name), .size = ir_instr_count(fn),
+    };
+
+    // Only the original call sites are candidates, not calls copied in
+    // from callees: those were already considered inside the callee
+    size_t call_count = 0;
+    for (size_t b = 0; b < fn->block_count; b++) {
+        for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->op == IR_CALL) call_count++;
+        }
+    }
+    if (call_count == 0) return true;
+    IRInstr** calls = malloc(call_count * sizeof(IRInstr*));
+    if (!calls) return false;
+    call_count = 0;
+    for (size_t b = 0; b < fn->block_count; b++) {
+        for (IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->op == IR_CALL) calls[call_count++] = instr;
+        }
+    }
+    qsort(calls, call_count, sizeof(IRInstr*), compare_pointers);
+
+    bool ok = true;
+    for (size_t b = 0; b < fn->block_count && ok; b++) {
+        for (IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->op != IR_CALL ||
+                !bsearch(&instr, calls, call_count, sizeof(IRInstr*), compare_pointers)) {
+                continue;
+            }
+            (*sites)++;
+            const IRFunction* callee = consider(&ctx, instr);
+            if (!callee) continue;
+
+            // The rest of this block moves to the continuation, which is
+            // visited after the inlined blocks
+            ok = inline_call(&ctx, b, instr, callee);
+            if (ok) (*inlined)++;
+            break;
+        }
+    }
+
+    if (ok && ctx.forward_count) {
+        int* forward = malloc((fn->vreg_count + 1) * sizeof(int));
+        ok = forward != NULL;
+        if (ok) {
+            for (int v = 0; v < fn->vreg_count; v++) forward[v] = v;
+            for (size_t i = 0; i < ctx.forward_count; i++) forward[ctx.forward_from[i]] = ctx.forward_to[i];
+            ir_replace_vregs(fn, forward);
+        }
+        free(forward);
+    }
+
+    free(calls);
+    free(ctx.forward_from);
+    free(ctx.forward_to);
+    return ok;
+}
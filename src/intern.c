@@ -0,0 +1,111 @@
+#include "intern.h"
+#include "arena.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// An open-addressing table of pointers to entries, kept at most half full.
+// Lookups take no lock: they load the current table and probe it, and an
+// entry only ever appears complete, stored with release into a slot that
+// was empty. Inserting takes the lock and probes again. Growing builds a
+// larger table and publishes it the same way; the replaced tables stay,
+// since a lookup may still be probing one, and together they are smaller
+// than the table that replaced them. Entries are never removed.
+
+typedef struct {
+    uint64_t hash;
+    size_t length;
+    char text[];
+} Entry;
+
+typedef struct Table {
+    size_t capacity;              // Power of two
+    struct Table* previous;       // Replaced by this one, kept for lookups in it
+    _Atomic(Entry*) slots[];
+} Table;
+
+#define INTERN_INITIAL_CAPACITY 1024
+
+static _Atomic(Table*) current;
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static Arena intern_arena = { NULL, 64 * 1024 };   // Entries; never freed
+static size_t intern_count;      // Under intern_lock, like the rest
+static size_t intern_bytes;
+
+static uint64_t hash_text(const char* text, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) hash = (hash ^ (unsigned char)text[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+// The entry for text in table, or NULL with slot set to where it goes
+static Entry* probe(Table* table, uint64_t hash, const char* text, size_t length, size_t* slot) {
+    size_t mask = table->capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Entry* entry = atomic_load_explicit(&table->slots[i], memory_order_acquire);
+        if (!entry) {
+            *slot = i;
+            return NULL;
+        }
+        if (entry->hash == hash && entry->length == length && memcmp(entry->text, text, length) == 0) {
+            return entry;
+        }
+    }
+}
+
+// Replace the table with one twice its size. The caller holds intern_lock.
+static Table* grow(Table* table) {
+    size_t capacity = table ? table->capacity * 2 : INTERN_INITIAL_CAPACITY;
+    Table* grown = calloc(1, sizeof(Table) + capacity * sizeof(_Atomic(Entry*)));
+    if (!grown) return NULL;
+    grown->capacity = capacity;
+    grown->previous = table;
+    for (size_t i = 0; table && i < table->capacity; i++) {
+        Entry* entry = atomic_load_explicit(&table->slots[i], memory_order_relaxed);
+        if (!entry) continue;
+        size_t slot = entry->hash & (capacity - 1);
+        while (atomic_load_explicit(&grown->slots[slot], memory_order_relaxed)) slot = (slot + 1) & (capacity - 1);
+        atomic_store_explicit(&grown->slots[slot], entry, memory_order_relaxed);
+    }
+    atomic_store_explicit(&current, grown, memory_order_release);
+    return grown;
+}
+
+const char* intern(const char* text) {
+    size_t length = strlen(text);
+    uint64_t hash = hash_text(text, length);
+    size_t slot;
+    Table* table = atomic_load_explicit(&current, memory_order_acquire);
+    Entry* entry = table ? probe(table, hash, text, length, &slot) : NULL;
+    if (entry) return entry->text;
+
+    pthread_mutex_lock(&intern_lock);
+    table = atomic_load_explicit(&current, memory_order_relaxed);
+    entry = table ? probe(table, hash, text, length, &slot) : NULL;
+    if (!entry && (!table || (intern_count + 1) * 2 > table->capacity)) {
+        table = grow(table);
+        if (table) probe(table, hash, text, length, &slot);
+    }
+    if (!entry && table) {
+        entry = arena_alloc(&intern_arena, sizeof(Entry) + length + 1);
+        if (entry) {
+            entry->hash = hash;
+            entry->length = length;
+            memcpy(entry->text, text, length + 1);
+            atomic_store_explicit(&table->slots[slot], entry, memory_order_release);
+            intern_count++;
+            intern_bytes += length + 1;
+        }
+    }
+    pthread_mutex_unlock(&intern_lock);
+    return entry ? entry->text : NULL;
+}
+
+void intern_stats(InternStats* stats) {
+    pthread_mutex_lock(&intern_lock);
+    stats->strings = intern_count;
+    stats->bytes = intern_bytes;
+    pthread_mutex_unlock(&intern_lock);
+}
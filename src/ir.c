@@ -0,0 +1,533 @@
+#include "ir.h"
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Module construction
+IR* ir_create(void) {
+    IR* ir = calloc(1, sizeof(IR));
+    if (!ir) return NULL;
+    arena_init(&ir->arena, 4096);
+    return ir;
+}
+
+static void ir_function_destroy(IRFunction* fn) {
+    if (!fn) return;
+    free(fn->blocks);
+    arena_free(&fn->arena);
+    free(fn);
+}
+
+void ir_destroy(IR* ir) {
+    if (!ir) return;
+    for (size_t i = 0; i < ir->function_count; i++) {
+        ir_function_destroy(ir->functions[i]);
+    }
+    free(ir->functions);
+    free(ir->globals);
+    arena_free(&ir->arena);
+    free(ir);
+}
+
+IRFunction* ir_add_function(IR* ir, const char* name, size_t param_count) {
+    if (ir->function_count >= ir->function_capacity) {
+        size_t new_capacity = ir->function_capacity == 0 ? 8 : ir->function_capacity * 2;
+        IRFunction** new_functions = realloc(ir->functions, new_capacity * sizeof(IRFunction*));
+        if (!new_functions) return NULL;
+        ir->functions = new_functions;
+        ir->function_capacity = new_capacity;
+    }
+
+    IRFunction* fn = calloc(1, sizeof(IRFunction));
+    if (!fn) return NULL;
+    arena_init(&fn->arena, 0);
+    fn->name = intern(name);
+    fn->param_count = param_count;
+    if (!fn->name) {
+        ir_function_destroy(fn);
+        return NULL;
+    }
+
+    ir->functions[ir->function_count++] = fn;
+    return fn;
+}
+
+bool ir_add_global(IR* ir, const char* name, int64_t init) {
+    if (ir_find_global(ir, name)) return false;
+
+    if (ir->global_count >= ir->global_capacity) {
+        size_t new_capacity = ir->global_capacity == 0 ? 8 : ir->global_capacity * 2;
+        IRGlobal* new_globals = realloc(ir->globals, new_capacity * sizeof(IRGlobal));
+        if (!new_globals) return false;
+        ir->globals = new_globals;
+        ir->global_capacity = new_capacity;
+    }
+
+    const char* copy = arena_strdup(&ir->arena, name);
+    if (!copy) return false;
+    ir->globals[ir->global_count].name = copy;
+    ir->globals[ir->global_count].init = init;
+    ir->global_count++;
+    return true;
+}
+
+const IRGlobal* ir_find_global(const IR* ir, const char* name) {
+    for (size_t i = 0; i < ir->global_count; i++) {
+        if (strcmp(ir->globals[i].name, name) == 0) {
+            return &ir->globals[i];
+        }
+    }
+    return NULL;
+}
+
+const IRFunction* ir_find_function(const IR* ir, const char* name) {
+    for (size_t i = 0; i < ir->function_count; i++) {
+        if (strcmp(ir->functions[i]->name, name) == 0) {
+            return ir->functions[i];
+        }
+    }
+    return NULL;
+}
+
+// Function construction
+IRBlock* ir_block_create(IRFunction* fn) {
+    if (fn->block_count >= fn->block_capacity) {
+        size_t new_capacity = fn->block_capacity == 0 ? 8 : fn->block_capacity * 2;
+        IRBlock** new_blocks = realloc(fn->blocks, new_capacity * sizeof(IRBlock*));
+        if (!new_blocks) return NULL;
+        fn->blocks = new_blocks;
+        fn->block_capacity = new_capacity;
+    }
+
+    IRBlock* block = arena_alloc(&fn->arena, sizeof(IRBlock));
+    if (!block) return NULL;
+    block->id = fn->next_block_id++;
+    fn->blocks[fn->block_count++] = block;
+    return block;
+}
+
+IRInstr* ir_instr_create(IRFunction* fn, IROpcode op) {
+    IRInstr* instr = arena_alloc(&fn->arena, sizeof(IRInstr));
+    if (!instr) return NULL;
+    instr->op = op;
+    instr->dst = IR_NO_VREG;
+    instr->a = IR_NO_VREG;
+    instr->b = IR_NO_VREG;
+    return instr;
+}
+
+int ir_new_vreg(IRFunction* fn) {
+    return fn->vreg_count++;
+}
+
+void ir_append(IRBlock* block, IRInstr* instr) {
+    instr->prev = block->last;
+    instr->next = NULL;
+    if (block->last) {
+        block->last->next = instr;
+    } else {
+        block->first = instr;
+    }
+    block->last = instr;
+}
+
+void ir_insert_before(IRBlock* block, IRInstr* before, IRInstr* instr) {
+    if (!before) {
+        ir_append(block, instr);
+        return;
+    }
+    instr->next = before;
+    instr->prev = before->prev;
+    if (before->prev) {
+        before->prev->next = instr;
+    } else {
+        block->first = instr;
+    }
+    before->prev = instr;
+}
+
+void ir_remove(IRBlock* block, IRInstr* instr) {
+    if (instr->prev) {
+        instr->prev->next = instr->next;
+    } else {
+        block->first = instr->next;
+    }
+    if (instr->next) {
+        instr->next->prev = instr->prev;
+    } else {
+        block->last = instr->prev;
+    }
+    instr->prev = NULL;
+    instr->next = NULL;
+}
+
+bool ir_add_pred(IRFunction* fn, IRBlock* block, IRBlock* pred) {
+    if (block->pred_count >= block->pred_capacity) {
+        size_t new_capacity = block->pred_capacity == 0 ? 2 : block->pred_capacity * 2;
+        IRBlock** preds = arena_alloc(&fn->arena, new_capacity * sizeof(IRBlock*));
+        if (!preds) return false;
+        if (block->pred_count) memcpy(preds, block->preds, block->pred_count * sizeof(IRBlock*));
+        block->preds = preds;
+        block->pred_capacity = new_capacity;
+    }
+    block->preds[block->pred_count++] = pred;
+    return true;
+}
+
+void ir_remove_pred(IRBlock* block, size_t index) {
+    for (IRInstr* phi = block->first; phi && phi->op == IR_PHI; phi = phi->next) {
+        if (index < phi->arg_count) {
+            memmove(&phi->args[index], &phi->args[index + 1],
+                    (phi->arg_count - index - 1) * sizeof(int));
+            phi->arg_count--;
+        }
+    }
+    memmove(&block->preds[index], &block->preds[index + 1],
+            (block->pred_count - index - 1) * sizeof(IRBlock*));
+    block->pred_count--;
+}
+
+IRInstr* ir_first_non_phi(const IRBlock* block) {
+    IRInstr* instr = block->first;
+    while (instr && instr->op == IR_PHI) instr = instr->next;
+    return instr;
+}
+
+IRInstr* ir_phi_create(IRFunction* fn, IRBlock* block) {
+    IRInstr* phi = ir_instr_create(fn, IR_PHI);
+    if (!phi) return NULL;
+    phi->dst = ir_new_vreg(fn);
+    ir_insert_before(block, ir_first_non_phi(block), phi);
+    return phi;
+}
+
+// Analysis helpers
+bool ir_is_terminator(IROpcode op) {
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_SWITCH || op == IR_RET;
+}
+
+bool ir_is_conditional(IROpcode op) {
+    return op == IR_BRANCH || op == IR_SWITCH;
+}
+
+bool ir_has_side_effects(IROpcode op) {
+    switch (op) {
+        case IR_STORE_GLOBAL:
+        case IR_CALL:
+        case IR_JUMP:
+        case IR_BRANCH:
+        case IR_SWITCH:
+        case IR_RET:
+            return true;
+        case IR_DIV:
+            // May trap on a zero divisor; callers that know the divisor
+            // is a nonzero constant can treat it as pure.
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t ir_successor_count(const IRBlock* block) {
+    const IRInstr* term = block->last;
+    if (!term) return 0;
+    switch (term->op) {
+        case IR_JUMP:   return 1;
+        case IR_BRANCH: return 2;
+        case IR_SWITCH: return term->succ_count;
+        default:        return 0;
+    }
+}
+
+IRBlock* ir_successor(const IRBlock* block, size_t i) {
+    const IRInstr* term = block->last;
+    if (term->op == IR_SWITCH) return term->succs[i];
+    return i == 0 ? term->target : term->target_else;
+}
+
+IRInstr* ir_switch_create(IRFunction* fn, size_t case_count) {
+    IRInstr* sw = ir_instr_create(fn, IR_SWITCH);
+    if (!sw) return NULL;
+    sw->cases = arena_alloc(&fn->arena, (case_count + 1) * sizeof(IRCase));
+    sw->succs = arena_alloc(&fn->arena, (case_count + 1) * sizeof(IRBlock*));
+    if (!sw->cases || !sw->succs) return NULL;
+    sw->case_count = case_count;
+    return sw;
+}
+
+static int compare_cases(const void* a, const void* b) {
+    int64_t x = ((const IRCase*)a)->value;
+    int64_t y = ((const IRCase*)b)->value;
+    return (x > y) - (x < y);
+}
+
+void ir_switch_update(IRInstr* sw) {
+    qsort(sw->cases, sw->case_count, sizeof(IRCase), compare_cases);
+    sw->succs[0] = sw->target;
+    sw->succ_count = 1;
+    for (size_t i = 0; i < sw->case_count; i++) {
+        IRBlock* target = sw->cases[i].target;
+        size_t s = 0;
+        while (s < sw->succ_count && sw->succs[s] != target) s++;
+        if (s == sw->succ_count) sw->succs[sw->succ_count++] = target;
+    }
+}
+
+IRBlock* ir_switch_target(const IRInstr* sw, int64_t value) {
+    size_t low = 0, high = sw->case_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (sw->cases[mid].value == value) return sw->cases[mid].target;
+        if (sw->cases[mid].value < value) low = mid + 1;
+        else high = mid;
+    }
+    return sw->target;
+}
+
+// A run becomes a table when it has enough cases and enough of its slots
+// hold one; runs grow greedily from the lowest value
+#define TABLE_MIN_CASES 4
+#define TABLE_MIN_DENSITY 40         // Percent of the slots that hold a case
+#define TABLE_MAX_SLOTS 4096
+
+size_t ir_switch_clusters(const int64_t* values, size_t count, IRSwitchCluster* clusters) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; ) {
+        size_t last = i;
+        for (size_t j = i + 1; j < count; j++) {
+            uint64_t slots = (uint64_t)values[j] - (uint64_t)values[i] + 1;
+            if (slots > TABLE_MAX_SLOTS) break;
+            if ((j - i + 1) * 100 >= slots * TABLE_MIN_DENSITY) last = j;
+        }
+        if (last - i + 1 < TABLE_MIN_CASES) last = i;
+        clusters[n++] = (IRSwitchCluster){ i, last, last > i };
+        i = last + 1;
+    }
+    return n;
+}
+
+void ir_retarget(IRInstr* term, IRBlock* from, IRBlock* to) {
+    if (term->target == from) term->target = to;
+    if (term->target_else == from) term->target_else = to;
+    if (term->op != IR_SWITCH) return;
+    for (size_t i = 0; i < term->case_count; i++) {
+        if (term->cases[i].target == from) term->cases[i].target = to;
+    }
+    ir_switch_update(term);
+}
+
+bool ir_make_jump(IRFunction* fn, IRBlock* block, IRBlock* target) {
+    bool already_pred = false;
+    size_t n = ir_successor_count(block);
+    for (size_t s = 0; s < n; s++) {
+        IRBlock* succ = ir_successor(block, s);
+        for (size_t p = succ->pred_count; p > 0; p--) {
+            if (succ->preds[p - 1] != block) continue;
+            if (succ == target && !already_pred) {
+                already_pred = true;
+                continue;
+            }
+            ir_remove_pred(succ, p - 1);
+        }
+    }
+    if (!already_pred && !ir_add_pred(fn, target, block)) return false;
+
+    IRInstr* term = block->last;
+    term->op = IR_JUMP;
+    term->a = IR_NO_VREG;
+    term->target = target;
+    term->target_else = NULL;
+    term->cases = NULL;
+    term->case_count = 0;
+    term->succs = NULL;
+    term->succ_count = 0;
+    return true;
+}
+
+// Drop blocks that cannot be reached from the entry block, along with the
+// phi operands that flowed in from them
+void ir_remove_unreachable(IRFunction* fn) {
+    if (fn->block_count == 0) return;
+
+    bool* reachable = calloc(fn->next_block_id, sizeof(bool));
+    IRBlock** worklist = malloc(fn->block_count * sizeof(IRBlock*));
+    if (!reachable || !worklist) {
+        free(reachable);
+        free(worklist);
+        return;
+    }
+
+    size_t top = 0;
+    reachable[fn->blocks[0]->id] = true;
+    worklist[top++] = fn->blocks[0];
+    while (top > 0) {
+        IRBlock* block = worklist[--top];
+        size_t n = ir_successor_count(block);
+        for (size_t s = 0; s < n; s++) {
+            IRBlock* succ = ir_successor(block, s);
+            if (!reachable[succ->id]) {
+                reachable[succ->id] = true;
+                worklist[top++] = succ;
+            }
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < fn->block_count; i++) {
+        IRBlock* block = fn->blocks[i];
+        if (!reachable[block->id]) continue;
+        for (size_t p = block->pred_count; p > 0; p--) {
+            if (!reachable[block->preds[p - 1]->id]) ir_remove_pred(block, p - 1);
+        }
+        fn->blocks[kept++] = block;
+    }
+    fn->block_count = kept;
+
+    free(reachable);
+    free(worklist);
+}
+
+size_t ir_instr_count(const IRFunction* fn) {
+    size_t count = 0;
+    for (size_t b = 0; b < fn->block_count; b++) {
+        for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) count++;
+    }
+    return count;
+}
+
+size_t ir_operands(IRInstr* instr, int** out, size_t max) {
+    size_t n = 0;
+    if (instr->op == IR_CALL || instr->op == IR_PHI) {
+        for (size_t i = 0; i < instr->arg_count && n < max; i++) out[n++] = &instr->args[i];
+        return n;
+    }
+    if (instr->a != IR_NO_VREG && n < max) out[n++] = &instr->a;
+    if (instr->b != IR_NO_VREG && n < max) out[n++] = &instr->b;
+    return n;
+}
+
+int ir_resolve_forward(int* forward, int v) {
+    int root = v;
+    while (forward[root] != root) root = forward[root];
+    while (forward[v] != root) {
+        int next = forward[v];
+        forward[v] = root;
+        v = next;
+    }
+    return root;
+}
+
+void ir_replace_vregs(IRFunction* fn, int* forward) {
+    for (size_t b = 0; b < fn->block_count; b++) {
+        for (IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->op == IR_CALL || instr->op == IR_PHI) {
+                for (size_t i = 0; i < instr->arg_count; i++) {
+                    instr->args[i] = ir_resolve_forward(forward, instr->args[i]);
+                }
+            } else {
+                if (instr->a != IR_NO_VREG) instr->a = ir_resolve_forward(forward, instr->a);
+                if (instr->b != IR_NO_VREG) instr->b = ir_resolve_forward(forward, instr->b);
+            }
+        }
+    }
+}
+
+// Debug output
+const char* ir_opcode_name(IROpcode op) {
+    switch (op) {
+        case IR_CONST:        return "const";
+        case IR_COPY:         return "copy";
+        case IR_PARAM:        return "param";
+        case IR_ADD:          return "add";
+        case IR_SUB:          return "sub";
+        case IR_MUL:          return "mul";
+        case IR_DIV:          return "div";
+        case IR_SHL:          return "shl";
+        case IR_SAR:          return "sar";
+        case IR_SHR:          return "shr";
+        case IR_EQ:           return "eq";
+        case IR_NE:           return "ne";
+        case IR_LT:           return "lt";
+        case IR_GT:           return "gt";
+        case IR_LE:           return "le";
+        case IR_GE:           return "ge";
+        case IR_LOAD_GLOBAL:  return "load";
+        case IR_STORE_GLOBAL: return "store";
+        case IR_CALL:         return "call";
+        case IR_JUMP:         return "jump";
+        case IR_BRANCH:       return "branch";
+        case IR_SWITCH:       return "switch";
+        case IR_RET:          return "ret";
+        case IR_PHI:          return "phi";
+    }
+    return "?";
+}
+
+static void ir_print_instr(FILE* out, const IRBlock* block, const IRInstr* instr) {
+    fprintf(out, "    ");
+    if (instr->dst != IR_NO_VREG) {
+        fprintf(out, "v%d = ", instr->dst);
+    }
+    fprintf(out, "%s", ir_opcode_name(instr->op));
+
+    switch (instr->op) {
+        case IR_CONST:
+        case IR_PARAM:
+            fprintf(out, " %lld", (long long)instr->imm);
+            break;
+        case IR_LOAD_GLOBAL:
+            fprintf(out, " @%s", instr->symbol);
+            break;
+        case IR_STORE_GLOBAL:
+            fprintf(out, " @%s, v%d", instr->symbol, instr->a);
+            break;
+        case IR_CALL:
+            fprintf(out, " @%s(", instr->symbol);
+            for (size_t i = 0; i < instr->arg_count; i++) {
+                fprintf(out, "%sv%d", i ? ", " : "", instr->args[i]);
+            }
+            fprintf(out, ")");
+            break;
+        case IR_JUMP:
+            fprintf(out, " b%d", instr->target->id);
+            break;
+        case IR_BRANCH:
+            fprintf(out, " v%d, b%d, b%d", instr->a, instr->target->id, instr->target_else->id);
+            break;
+        case IR_SWITCH:
+            fprintf(out, " v%d, b%d [", instr->a, instr->target->id);
+            for (size_t i = 0; i < instr->case_count; i++) {
+                fprintf(out, "%s%lld: b%d", i ? ", " : "", (long long)instr->cases[i].value,
+                        instr->cases[i].target->id);
+            }
+            fprintf(out, "]");
+            break;
+        case IR_PHI:
+            for (size_t i = 0; i < instr->arg_count; i++) {
+                fprintf(out, "%s[v%d, b%d]", i ? ", " : " ", instr->args[i], block->preds[i]->id);
+            }
+            break;
+        default:
+            if (instr->a != IR_NO_VREG) fprintf(out, " v%d", instr->a);
+            if (instr->b != IR_NO_VREG) fprintf(out, ", v%d", instr->b);
+            break;
+    }
+    fprintf(out, "\n");
+}
+
+void ir_print(FILE* out, const IR* ir) {
+    for (size_t i = 0; i < ir->global_count; i++) {
+        fprintf(out, "global @%s = %lld\n", ir->globals[i].name, (long long)ir->globals[i].init);
+    }
+    for (size_t f = 0; f < ir->function_count; f++) {
+        const IRFunction* fn = ir->functions[f];
+        fprintf(out, "function @%s(%zu params):\n", fn->name, fn->param_count);
+        for (size_t i = 0; i < fn->block_count; i++) {
+            const IRBlock* block = fn->blocks[i];
+            fprintf(out, "  b%d:\n", block->id);
+            for (const IRInstr* instr = block->first; instr; instr = instr->next) {
+                ir_print_instr(out, block, instr);
+            }
+        }
+    }
+}
@@ -0,0 +1,512 @@
+#define _DEFAULT_SOURCE  // For MAP_ANONYMOUS and clock_gettime
+#include "jit.h"
+#include "intern.h"
+#include "object.h"
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// Memory layout: one mapping holds the globals of every unit, followed by
+// the code area. Keeping both in one mapping keeps every rip-relative
+// operand and call within rel32 range. The code area starts with the
+// trampoline, then one stub per function; compiled functions follow.
+//
+// A stub loads its function's index into r11 and jumps to the trampoline,
+// which saves the argument registers, calls jit_resolve() and jumps to the
+// address it returns with the arguments restored. rax, r10 and r11 are
+// scratch at calls in code from codegen.c, so the stub may clobber them.
+
+#define JIT_CODE_SIZE (64u << 20)
+#define JIT_STUB_SIZE 16
+#define PAGE_SIZE 4096
+
+// A rel32 field aimed at a stub, to redirect once its function exists
+typedef struct {
+    unsigned char* at;
+    int64_t addend;
+} JITSite;
+
+typedef struct {
+    IRFunction* fn;
+    size_t unit;
+    unsigned char* stub;
+    unsigned char* code;          // NULL until first called
+    JITSite* sites;
+    size_t site_count;
+    size_t site_capacity;
+    bool optimized;               // Or about to be, when optimizing on first call
+} JITFunction;
+
+typedef struct {
+    IR* ir;
+    CodeGen* cg;
+    unsigned char* globals;       // ir->globals[i] lives at globals + 8 * i
+    size_t first;                 // Its first function in jit->functions
+    bool lazy;                    // Functions are optimized on their first call
+    bool started;                 // ... and ir_optimize_start() has run
+    IROptOptions optimize;
+    CallGraph graph;              // When inlining
+    int* rank;                    // Position of each function in graph.order
+} JITUnit;
+
+struct JIT {
+    CodeGenOptions options;
+    JITUnit* units;
+    size_t unit_count;
+    size_t unit_capacity;
+    JITFunction* functions;
+    size_t function_count;
+    size_t function_capacity;
+    int* slots;                   // Open-addressing index from name to function index + 1
+    size_t slot_capacity;
+    unsigned char* region;
+    size_t region_size;
+    unsigned char* code;          // Start of the code area
+    size_t code_used;
+    unsigned char* trampoline;
+    jmp_buf* failure;             // Where jit_resolve() goes when compiling fails
+    Error* error;
+    size_t error_unit;            // Of an undefined call
+    JITStats stats;
+};
+
+static bool jit_error(Error* error, const char* format, ...) {
+    error->code = ERROR_CODEGEN;
+    error->line = 0;
+    error->column = 0;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+    return false;
+}
+
+static double elapsed_us(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1e6 + (double)(now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void put_rel32(unsigned char* at, const unsigned char* target, int64_t addend) {
+    int32_t rel = (int32_t)((int64_t)(target - at) + addend);
+    memcpy(at, &rel, sizeof(rel));
+}
+
+// W^X: the code area is either being written or being run
+static bool make_writable(JIT* jit) {
+    return mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) == 0;
+}
+
+static bool make_executable(JIT* jit) {
+    return mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC) == 0;
+}
+
+// Where name is in jit->slots, or the empty slot it would take. Function
+// names are interned, so they compare by pointer.
+static size_t function_slot(const JIT* jit, const char* name) {
+    size_t mask = jit->slot_capacity - 1;
+    size_t slot = (size_t)(((uint64_t)(uintptr_t)name * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+    while (jit->slots[slot] && jit->functions[jit->slots[slot] - 1].fn->name != name) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// -1 when undefined or before jit_link()
+static int find_interned(const JIT* jit, const char* name) {
+    if (!jit->slot_capacity) return -1;
+    return jit->slots[function_slot(jit, name)] - 1;
+}
+
+static int find_function(const JIT* jit, const char* name) {
+    name = intern(name);
+    return name ? find_interned(jit, name) : -1;
+}
+
+JIT* jit_create(const CodeGenOptions* options) {
+    JIT* jit = calloc(1, sizeof(JIT));
+    if (!jit) return NULL;
+    if (options) {
+        jit->options = *options;
+    } else {
+        jit->options.regalloc = true;
+    }
+    return jit;
+}
+
+void jit_destroy(JIT* jit) {
+    if (!jit) return;
+    for (size_t i = 0; i < jit->function_count; i++) free(jit->functions[i].sites);
+    for (size_t i = 0; i < jit->unit_count; i++) {
+        codegen_destroy(jit->units[i].cg);
+        ir_destroy(jit->units[i].ir);
+        call_graph_free(&jit->units[i].graph);
+        free(jit->units[i].rank);
+    }
+    if (jit->region) munmap(jit->region, jit->region_size);
+    free(jit->functions);
+    free(jit->slots);
+    free(jit->units);
+    free(jit);
+}
+
+bool jit_add_unit(JIT* jit, IR* ir, const IROptOptions* optimize, Error* error) {
+    if (jit->unit_count >= jit->unit_capacity) {
+        size_t capacity = jit->unit_capacity ? jit->unit_capacity * 2 : 4;
+        JITUnit* units = realloc(jit->units, capacity * sizeof(JITUnit));
+        if (!units) {
+            ir_destroy(ir);
+            return jit_error(error, "Out of memory");
+        }
+        jit->units = units;
+        jit->unit_capacity = capacity;
+    }
+    JITUnit* unit = &jit->units[jit->unit_count++];
+    memset(unit, 0, sizeof(*unit));
+    unit->ir = ir;
+    unit->first = jit->function_count;
+    unit->lazy = optimize != NULL;
+    if (optimize) unit->optimize = *optimize;
+    unit->cg = codegen_create(ir, &jit->options);
+    if (!unit->cg) return jit_error(error, "Out of memory");
+
+    for (size_t i = 0; i < ir->function_count; i++) {
+        if (jit->function_count >= jit->function_capacity) {
+            size_t capacity = jit->function_capacity ? jit->function_capacity * 2 : 16;
+            JITFunction* functions = realloc(jit->functions, capacity * sizeof(JITFunction));
+            if (!functions) return jit_error(error, "Out of memory");
+            jit->functions = functions;
+            jit->function_capacity = capacity;
+        }
+        JITFunction* function = &jit->functions[jit->function_count++];
+        memset(function, 0, sizeof(*function));
+        function->fn = ir->functions[i];
+        function->unit = jit->unit_count - 1;
+    }
+    return true;
+}
+
+// Each name must be defined once
+static bool index_functions(JIT* jit, Error* error, size_t* unit) {
+    size_t capacity = 64;
+    while (capacity < jit->function_count * 2) capacity *= 2;
+    jit->slots = calloc(capacity, sizeof(int));
+    if (!jit->slots) return jit_error(error, "Out of memory");
+    jit->slot_capacity = capacity;
+    for (size_t i = 0; i < jit->function_count; i++) {
+        const JITFunction* function = &jit->functions[i];
+        size_t slot = function_slot(jit, function->fn->name);
+        if (jit->slots[slot]) {
+            *unit = function->unit;
+            return jit_error(error, "multiple definition of '%s'", function->fn->name);
+        }
+        jit->slots[slot] = (int)i + 1;
+    }
+    return true;
+}
+
+static void emit_trampoline(unsigned char* p, JIT* jit, void* (*resolve)(JIT*, uint64_t)) {
+    static const unsigned char save[] = {
+        0x57, 0x56, 0x52, 0x51, 0x41, 0x50, 0x41, 0x51,   // push rdi, rsi, rdx, rcx, r8, r9
+        0x48, 0x83, 0xEC, 0x08                            // sub rsp, 8 (realign for the call)
+    };
+    static const unsigned char restore[] = {
+        0x48, 0x83, 0xC4, 0x08,                           // add rsp, 8
+        0x41, 0x59, 0x41, 0x58, 0x59, 0x5A, 0x5E, 0x5F,   // pop r9, r8, rcx, rdx, rsi, rdi
+        0xFF, 0xE0                                        // jmp rax
+    };
+    uint64_t self = (uint64_t)(uintptr_t)jit;
+    uint64_t target = (uint64_t)(uintptr_t)resolve;
+
+    memcpy(p, save, sizeof(save));
+    p += sizeof(save);
+    *p++ = 0x48; *p++ = 0xBF;                             // movabs rdi, jit
+    memcpy(p, &self, 8);
+    p += 8;
+    *p++ = 0x4C; *p++ = 0x89; *p++ = 0xDE;                // mov rsi, r11
+    *p++ = 0x48; *p++ = 0xB8;                             // movabs rax, resolve
+    memcpy(p, &target, 8);
+    p += 8;
+    *p++ = 0xFF; *p++ = 0xD0;                             // call rax
+    memcpy(p, restore, sizeof(restore));
+}
+
+static void emit_stub(unsigned char* p, uint64_t index, const unsigned char* trampoline) {
+    *p++ = 0x49; *p++ = 0xBB;                             // movabs r11, index
+    memcpy(p, &index, 8);
+    p += 8;
+    *p++ = 0xE9;                                          // jmp trampoline
+    put_rel32(p, trampoline, -4);
+    p += 4;
+    *p = 0xCC;
+}
+
+static void* jit_resolve(JIT* jit, uint64_t index);
+
+bool jit_link(JIT* jit, Error* error, size_t* unit) {
+    *unit = 0;
+    if (!index_functions(jit, error, unit)) return false;
+
+    size_t global_count = 0;
+    for (size_t i = 0; i < jit->unit_count; i++) global_count += jit->units[i].ir->global_count;
+    size_t data_size = (global_count * 8 + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    size_t stubs_size = 64 + jit->function_count * JIT_STUB_SIZE;
+    if (stubs_size > JIT_CODE_SIZE) return jit_error(error, "Too many functions");
+
+    jit->region_size = data_size + JIT_CODE_SIZE;
+    void* region = mmap(NULL, jit->region_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) return jit_error(error, "Could not map memory for code");
+    jit->region = region;
+    jit->code = jit->region + data_size;
+
+    unsigned char* data = jit->region;
+    for (size_t i = 0; i < jit->unit_count; i++) {
+        JITUnit* u = &jit->units[i];
+        u->globals = data;
+        for (size_t g = 0; g < u->ir->global_count; g++) {
+            memcpy(data, &u->ir->globals[g].init, 8);
+            data += 8;
+        }
+    }
+
+    jit->trampoline = jit->code;
+    emit_trampoline(jit->trampoline, jit, jit_resolve);
+    for (size_t i = 0; i < jit->function_count; i++) {
+        jit->functions[i].stub = jit->code + 64 + i * JIT_STUB_SIZE;
+        emit_stub(jit->functions[i].stub, i, jit->trampoline);
+    }
+    jit->code_used = stubs_size;
+    jit->stats.functions = jit->function_count;
+    if (!make_executable(jit)) return jit_error(error, "Could not make code executable");
+    return true;
+}
+
+static bool add_site(JITFunction* function, unsigned char* at, int64_t addend) {
+    if (function->site_count >= function->site_capacity) {
+        size_t capacity = function->site_capacity ? function->site_capacity * 2 : 4;
+        JITSite* sites = realloc(function->sites, capacity * sizeof(JITSite));
+        if (!sites) return false;
+        function->sites = sites;
+        function->site_capacity = capacity;
+    }
+    function->sites[function->site_count].at = at;
+    function->sites[function->site_count].addend = addend;
+    function->site_count++;
+    return true;
+}
+
+// Copy the encoded function into the code area and resolve its references:
+// globals of its unit, and functions, compiled or not yet
+static bool place_code(JIT* jit, JITFunction* function, const ObjectFile* obj) {
+    size_t start = (jit->code_used + 15) & ~(size_t)15;
+    if (start + obj->text.size > JIT_CODE_SIZE) {
+        return jit_error(jit->error, "Out of memory for code");
+    }
+    unsigned char* code = jit->code + start;
+    memcpy(code, obj->text.data, obj->text.size);
+    jit->code_used = start + obj->text.size;
+    jit->stats.code_bytes += obj->text.size;
+    function->code = code;
+
+    const JITUnit* unit = &jit->units[function->unit];
+    for (size_t i = 0; i < obj->reloc_count; i++) {
+        const ObjReloc* reloc = &obj->relocs[i];
+        const char* name = obj->symbols[reloc->symbol].name;
+        unsigned char* at = code + reloc->offset;
+        const unsigned char* target;
+        const IRGlobal* global = ir_find_global(unit->ir, name);
+        if (reloc->type == RELOC_PC32 && global) {
+            target = unit->globals + 8 * (size_t)(global - unit->ir->globals);
+        } else {
+            int callee = find_function(jit, name);
+            if (callee < 0) return jit_error(jit->error, "undefined reference to '%s'", name);
+            JITFunction* other = &jit->functions[callee];
+            target = other->code;
+            if (!target) {
+                target = other->stub;
+                if (!add_site(other, at, reloc->addend)) return jit_error(jit->error, "Out of memory");
+            }
+        }
+        put_rel32(at, target, reloc->addend);
+    }
+
+    // From now on calls reach the code directly, through the stub at most once
+    for (size_t i = 0; i < function->site_count; i++) {
+        put_rel32(function->sites[i].at, code, function->sites[i].addend);
+    }
+    jit->stats.patched += function->site_count;
+    function->site_count = 0;
+    function->stub[0] = 0xE9;
+    put_rel32(function->stub + 1, code, -4);
+    return true;
+}
+
+static int compare_ints(const void* x, const void* y) {
+    int a = *(const int*)x, b = *(const int*)y;
+    return (a > b) - (a < b);
+}
+
+// Optimize function and, callees first, every function it reaches that is
+// not optimized yet, so whatever it may inline is in its final form. Each
+// function is optimized after everything it reaches, so the search stops
+// at optimized ones.
+static bool optimize_reachable(JITUnit* unit, JITFunction* functions, JITFunction* function) {
+    if (!unit->started) {
+        unit->started = true;
+        if (!ir_optimize_start(unit->ir, &unit->graph, &unit->optimize)) return false;
+        if (unit->optimize.inline_calls) {
+            unit->rank = malloc((unit->graph.count + 1) * sizeof(int));
+            if (!unit->rank) return false;
+            for (size_t i = 0; i < unit->graph.count; i++) unit->rank[unit->graph.order[i]] = (int)i;
+        }
+    }
+    function->optimized = true;
+    if (!unit->optimize.inline_calls) {
+        return ir_optimize_function(unit->ir, function->fn, NULL, &unit->optimize);
+    }
+
+    const CallGraph* graph = &unit->graph;
+    int* stack = malloc((graph->count + 1) * sizeof(int));
+    int* found = malloc((graph->count + 1) * sizeof(int));   // By rank
+    bool ok = stack && found;
+    size_t depth = 0, count = 0;
+    if (ok) stack[depth++] = (int)(function - functions - unit->first);
+    while (depth > 0) {
+        int f = stack[--depth];
+        found[count++] = unit->rank[f];
+        for (int e = graph->edge_start[f]; e < graph->edge_start[f + 1]; e++) {
+            JITFunction* callee = &functions[unit->first + (size_t)graph->edges[e]];
+            if (callee->optimized) continue;
+            callee->optimized = true;
+            stack[depth++] = graph->edges[e];
+        }
+    }
+    if (ok) qsort(found, count, sizeof(int), compare_ints);
+    for (size_t i = 0; i < count && ok; i++) {
+        IRFunction* fn = unit->ir->functions[graph->order[found[i]]];
+        ok = ir_optimize_function(unit->ir, fn, graph, &unit->optimize);
+    }
+    free(stack);
+    free(found);
+    return ok;
+}
+
+// Every call must name a function of some unit
+static bool check_calls(JIT* jit, const JITFunction* function) {
+    for (size_t b = 0; b < function->fn->block_count; b++) {
+        for (const IRInstr* instr = function->fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->op != IR_CALL || find_interned(jit, instr->symbol) >= 0) continue;
+            jit->error_unit = function->unit;
+            jit_error(jit->error, "undefined reference to '%s'", instr->symbol);
+            jit->error->line = instr->line;
+            jit->error->column = instr->column;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool compile_function(JIT* jit, JITFunction* function) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    JITUnit* unit = &jit->units[function->unit];
+    if (unit->lazy && !function->optimized && !optimize_reachable(unit, jit->functions, function)) {
+        return jit_error(jit->error, "Out of memory");
+    }
+    if (!check_calls(jit, function)) return false;
+    CodeGen* cg = unit->cg;
+    if (!ir_destruct_ssa(function->fn)) return jit_error(jit->error, "Out of memory");
+    MFunction mf;
+    if (!codegen_function(cg, function->fn, &mf)) {
+        return jit_error(jit->error, "%s", cg->error.code != ERROR_NONE ? cg->error.message
+                                                                       : "Out of memory");
+    }
+
+    ObjectFile obj;
+    object_init(&obj);
+    bool ok = encode_function(&mf, &obj, NULL);
+    if (!ok) jit_error(jit->error, "Could not encode machine code for '%s'", function->fn->name);
+    if (ok && !make_writable(jit)) ok = jit_error(jit->error, "Could not make code writable");
+    if (ok) {
+        ok = place_code(jit, function, &obj);
+        if (!make_executable(jit)) ok = jit_error(jit->error, "Could not make code executable");
+    }
+    object_free(&obj);
+    free(mf.code);
+
+    jit->stats.compiled += ok;
+    jit->stats.compile_us += elapsed_us(&start);
+    return ok;
+}
+
+// Called from the trampoline on the first call to a function
+static void* jit_resolve(JIT* jit, uint64_t index) {
+    JITFunction* function = &jit->functions[index];
+    if (!function->code && !compile_function(jit, function)) longjmp(*jit->failure, 1);
+    return function->code;
+}
+
+int jit_find(const JIT* jit, const char* name) {
+    return find_function(jit, name);
+}
+
+size_t jit_param_count(const JIT* jit, int function) {
+    return jit->functions[function].fn->param_count;
+}
+
+bool jit_compile(JIT* jit, int function, Error* error) {
+    jit->error = error;
+    return jit->functions[function].code || compile_function(jit, &jit->functions[function]);
+}
+
+bool jit_call(JIT* jit, int function, const int64_t* args, int64_t* result, Error* error) {
+    size_t count = jit->functions[function].fn->param_count;
+    if (count > JIT_MAX_ARGS) {
+        return jit_error(error, "'%s' takes more than %d arguments",
+                         jit->functions[function].fn->name, JIT_MAX_ARGS);
+    }
+    // Extra arguments are harmless: the caller pops them
+    int64_t a[JIT_MAX_ARGS] = {0};
+    if (count) memcpy(a, args, count * sizeof(int64_t));
+
+    // Frames of generated code hold nothing to clean up, so a failure to
+    // compile unwinds straight back here
+    jmp_buf failure;
+    jit->failure = &failure;
+    jit->error = error;
+    if (setjmp(failure)) return false;
+
+    typedef int64_t (*Entry)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t,
+                             int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t);
+    Entry entry = (Entry)(void*)jit->functions[function].stub;
+    *result = entry(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7],
+                    a[8], a[9], a[10], a[11], a[12], a[13], a[14], a[15]);
+    return true;
+}
+
+bool jit_run(JIT* jit, const char* name, int64_t* result, Error* error, size_t* unit) {
+    *unit = 0;
+    int index = find_function(jit, name);
+    if (index < 0 || jit->functions[index].fn->param_count != 0) {
+        return jit_error(error, "No %s() without parameters to run", name);
+    }
+    jit->error_unit = 0;
+    bool ok = jit_call(jit, index, NULL, result, error);
+    *unit = jit->error_unit;
+    return ok;
+}
+
+int64_t* jit_globals(JIT* jit, size_t* count) {
+    *count = 0;
+    for (size_t i = 0; i < jit->unit_count; i++) *count += jit->units[i].ir->global_count;
+    return (int64_t*)(void*)jit->region;
+}
+
+void jit_stats(const JIT* jit, JITStats* stats) {
+    *stats = jit->stats;
+}
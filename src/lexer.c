@@ -0,0 +1,467 @@
+#include "parser.h"
+#include "arena.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Table-driven lexer. Every byte maps to a character class through one
+// 256-entry table; identifiers and numbers are scanned by tight loops over
+// that table, and punctuators by a DFA over classes whose transition table
+// spells out every C operator. The DFA munches maximally: it runs until no
+// transition applies and yields the last accepting state, so "<<=" is one
+// token and "..x" is two dots. Integer literals are converted eight digits
+// at a time with SWAR arithmetic and checked for overflow. The source is
+// NUL-terminated, so looking one byte ahead never needs a bounds check.
+// Errors are returned as TOKEN_ERROR with the message attached, for the
+// preprocessor to report when the parser reaches them.
+
+typedef enum {
+    C_OTHER,
+    C_LETTER,          // Letters and '_'
+    C_DIGIT,           // Right after C_LETTER: identifiers continue with either
+    C_SPACE,
+    C_NEWLINE,
+    C_LPAREN, C_RPAREN, C_LBRACE, C_RBRACE, C_LBRACKET, C_RBRACKET,
+    C_SEMICOLON, C_COMMA, C_COLON, C_QUESTION, C_TILDE, C_DOT, C_HASH,
+    C_PLUS, C_MINUS, C_STAR, C_SLASH, C_PERCENT, C_EQUALS, C_BANG,
+    C_LESS, C_GREATER, C_AMP, C_PIPE, C_CARET,
+    CLASS_COUNT
+} CharClass;
+
+#define LETTERS(c) \
+    [c + 0] = C_LETTER, [c + 1] = C_LETTER, [c + 2] = C_LETTER, [c + 3] = C_LETTER, \
+    [c + 4] = C_LETTER, [c + 5] = C_LETTER, [c + 6] = C_LETTER, [c + 7] = C_LETTER, \
+    [c + 8] = C_LETTER, [c + 9] = C_LETTER, [c + 10] = C_LETTER, [c + 11] = C_LETTER, \
+    [c + 12] = C_LETTER, [c + 13] = C_LETTER, [c + 14] = C_LETTER, [c + 15] = C_LETTER, \
+    [c + 16] = C_LETTER, [c + 17] = C_LETTER, [c + 18] = C_LETTER, [c + 19] = C_LETTER, \
+    [c + 20] = C_LETTER, [c + 21] = C_LETTER, [c + 22] = C_LETTER, [c + 23] = C_LETTER, \
+    [c + 24] = C_LETTER, [c + 25] = C_LETTER
+
+static const uint8_t char_class[256] = {
+    LETTERS('a'), LETTERS('A'), ['_'] = C_LETTER,
+    ['0'] = C_DIGIT, ['1'] = C_DIGIT, ['2'] = C_DIGIT, ['3'] = C_DIGIT, ['4'] = C_DIGIT,
+    ['5'] = C_DIGIT, ['6'] = C_DIGIT, ['7'] = C_DIGIT, ['8'] = C_DIGIT, ['9'] = C_DIGIT,
+    [' '] = C_SPACE, ['\t'] = C_SPACE, ['\v'] = C_SPACE, ['\f'] = C_SPACE, ['\r'] = C_SPACE,
+    ['\n'] = C_NEWLINE,
+    ['('] = C_LPAREN, [')'] = C_RPAREN, ['{'] = C_LBRACE, ['}'] = C_RBRACE,
+    ['['] = C_LBRACKET, [']'] = C_RBRACKET, [';'] = C_SEMICOLON, [','] = C_COMMA,
+    [':'] = C_COLON, ['?'] = C_QUESTION, ['~'] = C_TILDE, ['.'] = C_DOT, ['#'] = C_HASH,
+    ['+'] = C_PLUS, ['-'] = C_MINUS, ['*'] = C_STAR, ['/'] = C_SLASH, ['%'] = C_PERCENT,
+    ['='] = C_EQUALS, ['!'] = C_BANG, ['<'] = C_LESS, ['>'] = C_GREATER, ['&'] = C_AMP,
+    ['|'] = C_PIPE, ['^'] = C_CARET,
+};
+
+// Value plus one of each hexadecimal digit, 0 for other bytes
+static const uint8_t hex_digit[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+static inline CharClass class_of(char c) {
+    return (CharClass)char_class[(unsigned char)c];
+}
+
+static inline bool is_identifier_char(char c) {
+    return (unsigned)(class_of(c) - C_LETTER) < 2;
+}
+
+// DFA states. Each state is the punctuator read so far; S_DEAD means no
+// transition.
+typedef enum {
+    S_DEAD,
+    S_START,
+    S_LPAREN, S_RPAREN, S_LBRACE, S_RBRACE, S_LBRACKET, S_RBRACKET,
+    S_SEMICOLON, S_COMMA, S_COLON, S_QUESTION, S_TILDE,
+    S_DOT, S_DOT_DOT, S_ELLIPSIS,
+    S_HASH, S_HASH_HASH,
+    S_PLUS, S_INCREMENT, S_PLUS_ASSIGN,
+    S_MINUS, S_DECREMENT, S_MINUS_ASSIGN, S_ARROW,
+    S_STAR, S_STAR_ASSIGN,
+    S_SLASH, S_SLASH_ASSIGN,
+    S_PERCENT, S_PERCENT_ASSIGN,
+    S_ASSIGN, S_EQ,
+    S_BANG, S_NEQ,
+    S_LT, S_LTE, S_SHL, S_SHL_ASSIGN,
+    S_GT, S_GTE, S_SHR, S_SHR_ASSIGN,
+    S_AMP, S_AND_AND, S_AMP_ASSIGN,
+    S_PIPE, S_OR_OR, S_PIPE_ASSIGN,
+    S_CARET, S_CARET_ASSIGN,
+    STATE_COUNT
+} LexState;
+
+static const uint8_t transitions[STATE_COUNT][CLASS_COUNT] = {
+    [S_START] = {
+        [C_LPAREN] = S_LPAREN, [C_RPAREN] = S_RPAREN, [C_LBRACE] = S_LBRACE,
+        [C_RBRACE] = S_RBRACE, [C_LBRACKET] = S_LBRACKET, [C_RBRACKET] = S_RBRACKET,
+        [C_SEMICOLON] = S_SEMICOLON, [C_COMMA] = S_COMMA, [C_COLON] = S_COLON,
+        [C_QUESTION] = S_QUESTION, [C_TILDE] = S_TILDE, [C_DOT] = S_DOT, [C_HASH] = S_HASH,
+        [C_PLUS] = S_PLUS, [C_MINUS] = S_MINUS, [C_STAR] = S_STAR, [C_SLASH] = S_SLASH,
+        [C_PERCENT] = S_PERCENT, [C_EQUALS] = S_ASSIGN, [C_BANG] = S_BANG, [C_LESS] = S_LT,
+        [C_GREATER] = S_GT, [C_AMP] = S_AMP, [C_PIPE] = S_PIPE, [C_CARET] = S_CARET,
+    },
+    [S_DOT] = { [C_DOT] = S_DOT_DOT },
+    [S_DOT_DOT] = { [C_DOT] = S_ELLIPSIS },
+    [S_HASH] = { [C_HASH] = S_HASH_HASH },
+    [S_PLUS] = { [C_PLUS] = S_INCREMENT, [C_EQUALS] = S_PLUS_ASSIGN },
+    [S_MINUS] = { [C_MINUS] = S_DECREMENT, [C_EQUALS] = S_MINUS_ASSIGN, [C_GREATER] = S_ARROW },
+    [S_STAR] = { [C_EQUALS] = S_STAR_ASSIGN },
+    [S_SLASH] = { [C_EQUALS] = S_SLASH_ASSIGN },
+    [S_PERCENT] = { [C_EQUALS] = S_PERCENT_ASSIGN },
+    [S_ASSIGN] = { [C_EQUALS] = S_EQ },
+    [S_BANG] = { [C_EQUALS] = S_NEQ },
+    [S_LT] = { [C_EQUALS] = S_LTE, [C_LESS] = S_SHL },
+    [S_SHL] = { [C_EQUALS] = S_SHL_ASSIGN },
+    [S_GT] = { [C_EQUALS] = S_GTE, [C_GREATER] = S_SHR },
+    [S_SHR] = { [C_EQUALS] = S_SHR_ASSIGN },
+    [S_AMP] = { [C_AMP] = S_AND_AND, [C_EQUALS] = S_AMP_ASSIGN },
+    [S_PIPE] = { [C_PIPE] = S_OR_OR, [C_EQUALS] = S_PIPE_ASSIGN },
+    [S_CARET] = { [C_EQUALS] = S_CARET_ASSIGN },
+};
+
+// Token of each accepting state; TOKEN_EOF marks the others
+static const uint8_t accepts[STATE_COUNT] = {
+    [S_LPAREN] = TOKEN_LPAREN, [S_RPAREN] = TOKEN_RPAREN, [S_LBRACE] = TOKEN_LBRACE,
+    [S_RBRACE] = TOKEN_RBRACE, [S_LBRACKET] = TOKEN_LBRACKET, [S_RBRACKET] = TOKEN_RBRACKET,
+    [S_SEMICOLON] = TOKEN_SEMICOLON, [S_COMMA] = TOKEN_COMMA, [S_COLON] = TOKEN_COLON,
+    [S_QUESTION] = TOKEN_QUESTION, [S_TILDE] = TOKEN_TILDE,
+    [S_DOT] = TOKEN_DOT, [S_ELLIPSIS] = TOKEN_ELLIPSIS,
+    [S_HASH] = TOKEN_HASH, [S_HASH_HASH] = TOKEN_HASH_HASH,
+    [S_PLUS] = TOKEN_PLUS, [S_INCREMENT] = TOKEN_INCREMENT, [S_PLUS_ASSIGN] = TOKEN_PLUS_ASSIGN,
+    [S_MINUS] = TOKEN_MINUS, [S_DECREMENT] = TOKEN_DECREMENT,
+    [S_MINUS_ASSIGN] = TOKEN_MINUS_ASSIGN, [S_ARROW] = TOKEN_ARROW,
+    [S_STAR] = TOKEN_STAR, [S_STAR_ASSIGN] = TOKEN_STAR_ASSIGN,
+    [S_SLASH] = TOKEN_SLASH, [S_SLASH_ASSIGN] = TOKEN_SLASH_ASSIGN,
+    [S_PERCENT] = TOKEN_PERCENT, [S_PERCENT_ASSIGN] = TOKEN_PERCENT_ASSIGN,
+    [S_ASSIGN] = TOKEN_ASSIGN, [S_EQ] = TOKEN_EQ,
+    [S_BANG] = TOKEN_BANG, [S_NEQ] = TOKEN_NEQ,
+    [S_LT] = TOKEN_LT, [S_LTE] = TOKEN_LTE, [S_SHL] = TOKEN_SHL, [S_SHL_ASSIGN] = TOKEN_SHL_ASSIGN,
+    [S_GT] = TOKEN_GT, [S_GTE] = TOKEN_GTE, [S_SHR] = TOKEN_SHR, [S_SHR_ASSIGN] = TOKEN_SHR_ASSIGN,
+    [S_AMP] = TOKEN_AMP, [S_AND_AND] = TOKEN_AND_AND, [S_AMP_ASSIGN] = TOKEN_AMP_ASSIGN,
+    [S_PIPE] = TOKEN_PIPE, [S_OR_OR] = TOKEN_OR_OR, [S_PIPE_ASSIGN] = TOKEN_PIPE_ASSIGN,
+    [S_CARET] = TOKEN_CARET, [S_CARET_ASSIGN] = TOKEN_CARET_ASSIGN,
+};
+
+static const char* const spellings[TOKEN_TYPE_COUNT] = {
+    [TOKEN_INT] = "int", [TOKEN_RETURN] = "return", [TOKEN_IF] = "if", [TOKEN_ELSE] = "else",
+    [TOKEN_WHILE] = "while", [TOKEN_SWITCH] = "switch", [TOKEN_CASE] = "case",
+    [TOKEN_DEFAULT] = "default", [TOKEN_BREAK] = "break",
+    [TOKEN_LPAREN] = "(", [TOKEN_RPAREN] = ")", [TOKEN_LBRACE] = "{", [TOKEN_RBRACE] = "}",
+    [TOKEN_SEMICOLON] = ";", [TOKEN_COMMA] = ",", [TOKEN_ASSIGN] = "=", [TOKEN_COLON] = ":",
+    [TOKEN_PLUS] = "+", [TOKEN_MINUS] = "-", [TOKEN_STAR] = "*", [TOKEN_SLASH] = "/",
+    [TOKEN_EQ] = "==", [TOKEN_NEQ] = "!=", [TOKEN_LT] = "<", [TOKEN_GT] = ">",
+    [TOKEN_LTE] = "<=", [TOKEN_GTE] = ">=",
+    [TOKEN_LBRACKET] = "[", [TOKEN_RBRACKET] = "]", [TOKEN_QUESTION] = "?", [TOKEN_TILDE] = "~",
+    [TOKEN_BANG] = "!", [TOKEN_PERCENT] = "%", [TOKEN_AMP] = "&", [TOKEN_PIPE] = "|",
+    [TOKEN_CARET] = "^", [TOKEN_SHL] = "<<", [TOKEN_SHR] = ">>", [TOKEN_AND_AND] = "&&",
+    [TOKEN_OR_OR] = "||", [TOKEN_INCREMENT] = "++", [TOKEN_DECREMENT] = "--",
+    [TOKEN_ARROW] = "->", [TOKEN_DOT] = ".", [TOKEN_ELLIPSIS] = "...",
+    [TOKEN_PLUS_ASSIGN] = "+=", [TOKEN_MINUS_ASSIGN] = "-=", [TOKEN_STAR_ASSIGN] = "*=",
+    [TOKEN_SLASH_ASSIGN] = "/=", [TOKEN_PERCENT_ASSIGN] = "%=", [TOKEN_AMP_ASSIGN] = "&=",
+    [TOKEN_PIPE_ASSIGN] = "|=", [TOKEN_CARET_ASSIGN] = "^=", [TOKEN_SHL_ASSIGN] = "<<=",
+    [TOKEN_SHR_ASSIGN] = ">>=", [TOKEN_HASH] = "#", [TOKEN_HASH_HASH] = "##",
+};
+
+const char* token_spelling(TokenType type) {
+    return (unsigned)type < TOKEN_TYPE_COUNT ? spellings[type] : NULL;
+}
+
+void lexer_init(Lexer* lexer, const char* source, size_t length, const char* file, struct Arena* arena) {
+    memset(lexer, 0, sizeof(*lexer));
+    lexer->source = source;
+    lexer->length = length;
+    lexer->line = 1;
+    lexer->column = 1;
+    lexer->file = file;
+    lexer->arena = arena;
+}
+
+static char* lexer_copy(Lexer* lexer, const char* text, size_t length) {
+    char* copy = arena_alloc(lexer->arena, length + 1);
+    if (copy) memcpy(copy, text, length);
+    return copy;
+}
+
+// Turn token into a TOKEN_ERROR reported at line:column
+static void lex_error(Lexer* lexer, Token* token, int line, int column, const char* format, ...) {
+    char message[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    token->type = TOKEN_ERROR;
+    token->line = line;
+    token->column = column;
+    token->text = lexer_copy(lexer, message, strlen(message));
+}
+
+static TokenType keyword(const char* text, size_t length) {
+#define KEYWORD(word, type) \
+    if (length == sizeof(word) - 1 && memcmp(text, word, length) == 0) return type
+    switch (text[0]) {
+        case 'b': KEYWORD("break", TOKEN_BREAK); break;
+        case 'c': KEYWORD("case", TOKEN_CASE); break;
+        case 'd': KEYWORD("default", TOKEN_DEFAULT); break;
+        case 'e': KEYWORD("else", TOKEN_ELSE); break;
+        case 'i': KEYWORD("if", TOKEN_IF); KEYWORD("int", TOKEN_INT); break;
+        case 'r': KEYWORD("return", TOKEN_RETURN); break;
+        case 's': KEYWORD("switch", TOKEN_SWITCH); break;
+        case 'w': KEYWORD("while", TOKEN_WHILE); break;
+    }
+#undef KEYWORD
+    return TOKEN_IDENTIFIER;
+}
+
+// SWAR conversion of eight ASCII digits at once, the first digit in the
+// lowest byte as a little-endian load puts it
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SWAR_LITERALS 1
+#else
+#define SWAR_LITERALS 0
+#endif
+
+static inline uint64_t load8(const char* p) {
+    uint64_t chunk;
+    memcpy(&chunk, p, sizeof(chunk));
+    return chunk;
+}
+
+static inline bool eight_decimal_digits(uint64_t chunk) {
+    // Every byte is 0x30..0x39: high nibble 3, and adding 6 does not carry into it
+    return ((chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+static inline uint64_t decimal8(uint64_t chunk) {
+    chunk -= 0x3030303030303030ULL;
+    chunk = chunk * 10 + (chunk >> 8);                   // Pairs of digits, in every other byte
+    return ((chunk & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)) +
+            ((chunk >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))) >> 32;
+}
+
+static inline uint64_t hex8(uint64_t chunk) {
+    // '0'..'9' keep their low nibble; letters have bit 6 set and need 9 more
+    uint64_t v = (chunk & 0x0F0F0F0F0F0F0F0FULL) + 9 * ((chunk >> 6) & 0x0101010101010101ULL);
+    v = ((v & 0x00FF00FF00FF00FFULL) << 4) | ((v >> 8) & 0x00FF00FF00FF00FFULL);
+    v = ((v & 0x0000FFFF0000FFFFULL) << 8) | ((v >> 16) & 0x0000FFFF0000FFFFULL);
+    return ((v & 0xFFFFULL) << 16) | ((v >> 32) & 0xFFFFULL);
+}
+
+// The length of the integer suffix at p: u, l or ll in either case, in
+// either order, and ll not mixing cases. 0 for none.
+static size_t integer_suffix(const char* p) {
+    size_t n = 0;
+    bool unsigned_first = (p[0] | 0x20) == 'u';
+    if (unsigned_first) n++;
+    if ((p[n] | 0x20) == 'l') n += p[n + 1] == p[n] ? 2 : 1;
+    if (!unsigned_first && n > 0 && (p[n] | 0x20) == 'u') n++;
+    return n;
+}
+
+// An integer literal: decimal, 0x hexadecimal or 0 octal, with an
+// optional integer suffix, which changes nothing since int is 64-bit.
+// Decimal literals must fit in int64_t; the others may use all 64 bits.
+static const char* lex_number(Lexer* lexer, const char* p, const char* end,
+                              int line, int column, Token* token) {
+    uint64_t value = 0;
+    bool overflow = false;
+
+    if (p[0] == '0' && (p[1] | 0x20) == 'x') {
+        p += 2;
+        size_t count = 0;
+        while (hex_digit[(unsigned char)p[count]]) count++;
+        if (count == 0) {
+            lex_error(lexer, token, line, column, "Hexadecimal literal without digits");
+            return NULL;
+        }
+        const char* digits_end = p + count;
+#if SWAR_LITERALS
+        while (digits_end - p >= 8 && (value >> 32) == 0) {
+            value = (value << 32) | hex8(load8(p));
+            p += 8;
+        }
+#endif
+        for (; p < digits_end; p++) {
+            if (value >> 60) overflow = true;
+            value = (value << 4) | (uint64_t)(hex_digit[(unsigned char)*p] - 1);
+        }
+    } else if (p[0] == '0') {
+        for (p++; class_of(*p) == C_DIGIT; p++) {
+            unsigned digit = (unsigned)(*p - '0');
+            if (digit > 7) {
+                lex_error(lexer, token, line, column, "Invalid digit '%c' in octal literal", *p);
+                return NULL;
+            }
+            if (value >> 61) overflow = true;
+            value = value * 8 + digit;
+        }
+    } else {
+#if SWAR_LITERALS
+        // Below 10^10, eight more digits still fit comfortably
+        while (end - p >= 8 && value < 10000000000ULL && eight_decimal_digits(load8(p))) {
+            value = value * 100000000ULL + decimal8(load8(p));
+            p += 8;
+        }
+#endif
+        for (; class_of(*p) == C_DIGIT; p++) {
+            uint64_t digit = (uint64_t)(*p - '0');
+            if (value > (INT64_MAX - digit) / 10) overflow = true;
+            value = value * 10 + digit;
+        }
+    }
+    (void)end;
+
+    const char* suffix = p;
+    p += integer_suffix(p);
+    if (is_identifier_char(*p)) {
+        while (is_identifier_char(*p)) p++;
+        lex_error(lexer, token, line, column, "Invalid suffix '%.*s' on integer literal",
+                  (int)(p - suffix), suffix);
+        return NULL;
+    }
+    if (overflow) {
+        lex_error(lexer, token, line, column, "Integer literal is too large");
+        return NULL;
+    }
+    token->type = TOKEN_NUMBER;
+    token->value.number = (int64_t)value;
+    return p;
+}
+
+// A header name right after '#include': "name" or <name>, delimiters kept
+static const char* lex_header_name(Lexer* lexer, const char* p, Token* token) {
+    char close = *p == '<' ? '>' : '"';
+    const char* q = p + 1;
+    while (*q && *q != close && *q != '\n') q++;
+    if (*q != close) {
+        lex_error(lexer, token, token->line, token->column, "Missing terminating %c in header name", close);
+        return q;
+    }
+    token->type = TOKEN_HEADER_NAME;
+    token->text = lexer_copy(lexer, p, (size_t)(q + 1 - p));
+    return q + 1;
+}
+
+Token lex_token(Lexer* lexer) {
+    Token token = {0};
+    const char* source = lexer->source;
+    const char* end = source + lexer->length;
+    const char* p = source + lexer->position;
+    int line = lexer->line;
+    int column = lexer->column;
+    uint8_t flags = lexer->position == 0 ? TOKEN_LINE_START : 0;
+    token.file = lexer->file;
+
+    // Whitespace and comments
+    for (;;) {
+        CharClass cls = class_of(*p);
+        if (cls == C_SPACE) {
+            p++;
+            column++;
+            flags |= TOKEN_SPACE_BEFORE;
+        } else if (cls == C_NEWLINE) {
+            p++;
+            line++;
+            column = 1;
+            flags |= TOKEN_LINE_START;
+        } else if (cls == C_SLASH && p[1] == '/') {
+            while (p < end && *p != '\n') {
+                p++;
+                column++;
+            }
+            flags |= TOKEN_SPACE_BEFORE;
+        } else if (cls == C_SLASH && p[1] == '*') {
+            int start_line = line;
+            int start_column = column;
+            p += 2;
+            column += 2;
+            while (p < end && !(p[0] == '*' && p[1] == '/')) {
+                if (*p == '\n') {
+                    line++;
+                    column = 0;
+                }
+                p++;
+                column++;
+            }
+            if (p >= end) {
+                lex_error(lexer, &token, start_line, start_column, "Unterminated comment");
+                lexer->position = (size_t)(p - source);
+                lexer->line = line;
+                lexer->column = column;
+                return token;
+            }
+            p += 2;
+            column += 2;
+            flags |= TOKEN_SPACE_BEFORE;
+        } else {
+            break;
+        }
+    }
+
+    token.line = line;
+    token.column = column;
+    token.flags = flags;
+    const char* start = p;
+    CharClass cls = class_of(*p);
+
+    if (p >= end) {
+        token.type = TOKEN_EOF;
+    } else if (lexer->directive == 2 && !(flags & TOKEN_LINE_START) && (*p == '"' || *p == '<')) {
+        p = lex_header_name(lexer, p, &token);
+    } else if (cls == C_LETTER) {
+        while (is_identifier_char(*++p)) {}
+        size_t length = (size_t)(p - start);
+        token.type = keyword(start, length);
+        if (token.type == TOKEN_IDENTIFIER) {
+            token.value.identifier = lexer_copy(lexer, start, length);
+        }
+    } else if (cls == C_DIGIT) {
+        const char* next = lex_number(lexer, p, end, line, column, &token);
+        if (next) {
+            p = next;
+        } else {
+            while (is_identifier_char(*p)) p++;
+        }
+    } else {
+        // Punctuators: run the DFA as far as it goes, then back up to the
+        // last accepting state
+        unsigned state = transitions[S_START][cls];
+        if (state == S_DEAD) {
+            unsigned char c = (unsigned char)*p;
+            if (c >= 0x20 && c < 0x7F) lex_error(lexer, &token, line, column, "Unexpected character '%c'", c);
+            else lex_error(lexer, &token, line, column, "Unexpected byte 0x%02x", c);
+            p++;
+        } else {
+            const char* accepted_end = ++p;
+            unsigned accepted = state;
+            while ((state = transitions[state][class_of(*p)]) != S_DEAD) {
+                p++;
+                if (accepts[state] != TOKEN_EOF) {
+                    accepted = state;
+                    accepted_end = p;
+                }
+            }
+            p = accepted_end;
+            token.type = (TokenType)accepts[accepted];
+        }
+    }
+
+    // After '#' and 'include' on one line comes a header name, which is
+    // not made of tokens
+    if (token.type == TOKEN_HASH && (flags & TOKEN_LINE_START)) {
+        lexer->directive = 1;
+    } else if (lexer->directive == 1 && token.type == TOKEN_IDENTIFIER && !(flags & TOKEN_LINE_START) &&
+               strcmp(token.value.identifier, "include") == 0) {
+        lexer->directive = 2;
+    } else {
+        lexer->directive = 0;
+    }
+
+    lexer->position = (size_t)(p - source);
+    lexer->line = line;
+    lexer->column = column + (int)(p - start);
+    return token;
+}
@@ -0,0 +1,152 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Loop-invariant code motion. An instruction whose operands are all
+// defined outside a loop computes the same value on every iteration; if
+// it also cannot trap, and any global it loads is not stored in the loop,
+// it moves to the loop's preheader. Loops are visited innermost first, so
+// an invariant climbs out of as many loops as it is invariant in.
+
+typedef struct {
+    IRFunction* fn;
+    const LoopForest* forest;
+    const IRInstr** def;        // Vreg -> defining instruction
+    int* def_block;             // Vreg -> index of its block
+} LICMContext;
+
+// Calls and the globals stored anywhere in the loop
+typedef struct {
+    bool calls;
+    const char** stored;
+    size_t stored_count;
+} LoopEffects;
+
+static bool collect_effects(const LICMContext* ctx, const Loop* loop, LoopEffects* effects) {
+    size_t capacity = 0;
+    memset(effects, 0, sizeof(*effects));
+    for (size_t i = 0; i < loop->block_count; i++) {
+        for (const IRInstr* instr = ctx->fn->blocks[loop->blocks[i]]->first; instr; instr = instr->next) {
+            if (instr->op == IR_CALL) effects->calls = true;
+            if (instr->op != IR_STORE_GLOBAL) continue;
+            if (effects->stored_count >= capacity) {
+                capacity = capacity ? capacity * 2 : 4;
+                const char** stored = realloc(effects->stored, capacity * sizeof(char*));
+                if (!stored) return false;
+                effects->stored = stored;
+            }
+            effects->stored[effects->stored_count++] = instr->symbol;
+        }
+    }
+    return true;
+}
+
+static bool is_stored(const LoopEffects* effects, const char* symbol) {
+    for (size_t i = 0; i < effects->stored_count; i++) {
+        if (strcmp(effects->stored[i], symbol) == 0) return true;
+    }
+    return false;
+}
+
+static bool is_invariant(const LICMContext* ctx, int loop, int v) {
+    return v == IR_NO_VREG || ctx->def_block[v] < 0 ||
+           !loop_contains(ctx->forest, loop, ctx->def_block[v]);
+}
+
+static bool can_hoist(const LICMContext* ctx, const LoopEffects* effects, const IRInstr* instr) {
+    switch (instr->op) {
+        case IR_CONST:
+        case IR_COPY:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_SHL:
+        case IR_SAR:
+        case IR_SHR:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+        case IR_LE:
+        case IR_GE:
+            return true;
+        case IR_DIV: {
+            // Executed speculatively, so it must not be able to trap
+            const IRInstr* divisor = ctx->def[instr->b];
+            return divisor && divisor->op == IR_CONST && divisor->imm != 0 && divisor->imm != -1;
+        }
+        case IR_LOAD_GLOBAL:
+            return !effects->calls && !is_stored(effects, instr->symbol);
+        default:
+            return false;
+    }
+}
+
+static bool hoist_loop(LICMContext* ctx, int l, size_t* hoisted) {
+    const Loop* loop = &ctx->forest->loops[l];
+    LoopEffects effects;
+    if (!collect_effects(ctx, loop, &effects)) {
+        free(effects.stored);
+        return false;
+    }
+
+    // Blocks come in reverse postorder, so operands are seen before uses
+    IRBlock* preheader = ctx->fn->blocks[loop->preheader];
+    for (size_t i = 0; i < loop->block_count; i++) {
+        IRBlock* block = ctx->fn->blocks[loop->blocks[i]];
+        IRInstr* instr = block->first;
+        while (instr) {
+            IRInstr* next = instr->next;
+            if (can_hoist(ctx, &effects, instr) && is_invariant(ctx, l, instr->a) &&
+                is_invariant(ctx, l, instr->b)) {
+                ir_remove(block, instr);
+                ir_insert_before(preheader, preheader->last, instr);
+                ctx->def_block[instr->dst] = loop->preheader;
+                (*hoisted)++;
+            }
+            instr = next;
+        }
+    }
+    free(effects.stored);
+    return true;
+}
+
+bool ir_licm(IRFunction* fn, size_t* loops, size_t* preheaders, size_t* hoisted) {
+    if (!ir_insert_preheaders(fn, preheaders)) return false;
+
+    DomTree dom;
+    LoopForest forest;
+    if (!ir_dominators(fn, &dom)) return false;
+    if (!ir_find_loops(fn, &dom, &forest)) {
+        dom_tree_free(&dom);
+        return false;
+    }
+    *loops += forest.count;
+
+    LICMContext ctx = { .fn = fn, .forest = &forest };
+    ctx.def = calloc(fn->vreg_count + 1, sizeof(IRInstr*));
+    ctx.def_block = malloc((fn->vreg_count + 1) * sizeof(int));
+    bool ok = ctx.def && ctx.def_block;
+    if (ok) {
+        for (int v = 0; v < fn->vreg_count; v++) ctx.def_block[v] = -1;
+        for (size_t b = 0; b < fn->block_count; b++) {
+            for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+                if (instr->dst == IR_NO_VREG) continue;
+                ctx.def[instr->dst] = instr;
+                ctx.def_block[instr->dst] = (int)b;
+            }
+        }
+    }
+
+    // Nested loops follow the loops that contain them
+    for (size_t l = forest.count; l > 0 && ok; l--) {
+        if (forest.loops[l - 1].preheader < 0) continue;
+        ok = hoist_loop(&ctx, (int)(l - 1), hoisted);
+    }
+
+    free(ctx.def);
+    free(ctx.def_block);
+    loop_forest_free(&forest);
+    dom_tree_free(&dom);
+    return ok;
+}
@@ -0,0 +1,259 @@
+#include "object.h"
+#include "output.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Static linker for leancc objects. Every input's .text and .data are
+// concatenated into one image, global symbols are resolved across inputs,
+// and the result is written as a non-PIE ELF64 executable with one R+X and
+// one RW segment. There is no libc: the entry point is a _start stub that
+// calls main and passes its return value to exit_group.
+
+#define IMAGE_BASE 0x400000
+#define PAGE_SIZE 0x1000
+
+enum {
+    PHDR_TEXT,
+    PHDR_DATA,
+    PHDR_STACK,
+    PHDR_COUNT
+};
+
+// _start: xor %ebp,%ebp; call main; mov %rax,%rdi; mov $231,%eax; syscall
+static const unsigned char start_stub[] = {
+    0x31, 0xED,
+    0xE8, 0x00, 0x00, 0x00, 0x00,
+    0x48, 0x89, 0xC7,
+    0xB8, 0xE7, 0x00, 0x00, 0x00,
+    0x0F, 0x05
+};
+#define START_CALL_OFFSET 3
+
+typedef struct {
+    ObjectFile image;      // Merged sections, symbols and relocations
+    char* error;
+    size_t error_size;
+} Linker;
+
+static bool link_error(Linker* linker, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(linker->error, linker->error_size, format, args);
+    va_end(args);
+    return false;
+}
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static bool pad_buffer(ByteBuffer* buffer, size_t alignment, unsigned char fill) {
+    while (buffer->size % alignment != 0) {
+        if (!buffer_append(buffer, &fill, 1)) return false;
+    }
+    return true;
+}
+
+// Define name in the image, rejecting a second definition
+static size_t define_symbol(Linker* linker, const ObjSymbol* symbol, uint64_t value) {
+    size_t index = object_symbol(&linker->image, symbol->name);
+    if (index == OBJ_NO_SYMBOL) {
+        link_error(linker, "Out of memory");
+        return OBJ_NO_SYMBOL;
+    }
+    ObjSymbol* target = &linker->image.symbols[index];
+    if (target->section != OBJ_SECTION_UNDEF) {
+        link_error(linker, "multiple definition of '%s'", symbol->name);
+        return OBJ_NO_SYMBOL;
+    }
+    target->section = symbol->section;
+    target->value = value;
+    target->size = symbol->size;
+    target->is_function = symbol->is_function;
+    return index;
+}
+
+// Append one input object to the image
+static bool merge_object(Linker* linker, const ObjectFile* obj) {
+    ObjectFile* image = &linker->image;
+    if (!pad_buffer(&image->text, 16, 0x90) || !pad_buffer(&image->data, 8, 0)) {
+        return link_error(linker, "Out of memory");
+    }
+    uint64_t text_base = image->text.size;
+    uint64_t data_base = image->data.size;
+    if (!buffer_append(&image->text, obj->text.data, obj->text.size) ||
+        !buffer_append(&image->data, obj->data.data, obj->data.size)) {
+        return link_error(linker, "Out of memory");
+    }
+
+    size_t* mapping = malloc((obj->symbol_count + 1) * sizeof(size_t));
+    if (!mapping) return link_error(linker, "Out of memory");
+
+    bool ok = false;
+    for (size_t i = 0; i < obj->symbol_count; i++) {
+        const ObjSymbol* symbol = &obj->symbols[i];
+        if (symbol->section == OBJ_SECTION_UNDEF) {
+            mapping[i] = object_symbol(image, symbol->name);
+            if (mapping[i] == OBJ_NO_SYMBOL) {
+                link_error(linker, "Out of memory");
+                goto done;
+            }
+            continue;
+        }
+        uint64_t base = symbol->section == OBJ_SECTION_TEXT ? text_base : data_base;
+        mapping[i] = define_symbol(linker, symbol, base + symbol->value);
+        if (mapping[i] == OBJ_NO_SYMBOL) goto done;
+    }
+
+    for (size_t i = 0; i < obj->reloc_count; i++) {
+        const ObjReloc* reloc = &obj->relocs[i];
+        if (!object_add_reloc(image, text_base + reloc->offset, mapping[reloc->symbol],
+                              reloc->type, reloc->addend)) {
+            link_error(linker, "Out of memory");
+            goto done;
+        }
+    }
+    ok = true;
+
+done:
+    free(mapping);
+    return ok;
+}
+
+static uint64_t symbol_address(const ObjSymbol* symbol, uint64_t text_addr, uint64_t data_addr) {
+    return (symbol->section == OBJ_SECTION_TEXT ? text_addr : data_addr) + symbol->value;
+}
+
+// Patch every relocation now that final addresses are known
+static bool apply_relocations(Linker* linker, uint64_t text_addr, uint64_t data_addr) {
+    ObjectFile* image = &linker->image;
+    for (size_t i = 0; i < image->reloc_count; i++) {
+        const ObjReloc* reloc = &image->relocs[i];
+        const ObjSymbol* symbol = &image->symbols[reloc->symbol];
+        if (symbol->section == OBJ_SECTION_UNDEF) {
+            return link_error(linker, "undefined reference to '%s'", symbol->name);
+        }
+
+        // PLT32 and PC32 coincide without shared libraries: S + A - P
+        int64_t value = (int64_t)(symbol_address(symbol, text_addr, data_addr) + reloc->addend -
+                                  (text_addr + reloc->offset));
+        if (value < INT32_MIN || value > INT32_MAX) {
+            return link_error(linker, "relocation against '%s' out of range", symbol->name);
+        }
+        int32_t rel = (int32_t)value;
+        memcpy(image->text.data + reloc->offset, &rel, sizeof(rel));
+    }
+    return true;
+}
+
+static bool write_executable(Linker* linker, const char* output_file,
+                             size_t text_offset, size_t data_offset, uint64_t entry) {
+    const ObjectFile* image = &linker->image;
+
+    Elf64_Ehdr ehdr;
+    memset(&ehdr, 0, sizeof(ehdr));
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = ET_EXEC;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_entry = entry;
+    ehdr.e_phoff = sizeof(Elf64_Ehdr);
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    ehdr.e_phnum = PHDR_COUNT;
+
+    // The text segment maps the headers too, from file offset 0
+    Elf64_Phdr phdrs[PHDR_COUNT];
+    memset(phdrs, 0, sizeof(phdrs));
+    phdrs[PHDR_TEXT].p_type = PT_LOAD;
+    phdrs[PHDR_TEXT].p_flags = PF_R | PF_X;
+    phdrs[PHDR_TEXT].p_offset = 0;
+    phdrs[PHDR_TEXT].p_vaddr = phdrs[PHDR_TEXT].p_paddr = IMAGE_BASE;
+    phdrs[PHDR_TEXT].p_filesz = phdrs[PHDR_TEXT].p_memsz = text_offset + image->text.size;
+    phdrs[PHDR_TEXT].p_align = PAGE_SIZE;
+    phdrs[PHDR_DATA].p_type = PT_LOAD;
+    phdrs[PHDR_DATA].p_flags = PF_R | PF_W;
+    phdrs[PHDR_DATA].p_offset = data_offset;
+    phdrs[PHDR_DATA].p_vaddr = phdrs[PHDR_DATA].p_paddr = IMAGE_BASE + data_offset;
+    phdrs[PHDR_DATA].p_filesz = phdrs[PHDR_DATA].p_memsz = image->data.size;
+    phdrs[PHDR_DATA].p_align = PAGE_SIZE;
+    phdrs[PHDR_STACK].p_type = PT_GNU_STACK;
+    phdrs[PHDR_STACK].p_flags = PF_R | PF_W;
+    phdrs[PHDR_STACK].p_align = 16;
+
+    int fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    if (fd < 0) {
+        return link_error(linker, "Could not open output file '%s'", output_file);
+    }
+
+    // The whole file in one writev, straight from the image
+    static unsigned char zeros[PAGE_SIZE];
+    size_t headers = sizeof(ehdr) + sizeof(phdrs);
+    size_t text_end = text_offset + image->text.size;
+    struct iovec iov[] = {
+        { &ehdr, sizeof(ehdr) },
+        { phdrs, sizeof(phdrs) },
+        { zeros, text_offset - headers },
+        { image->text.data, image->text.size },
+        { zeros, data_offset - text_end },
+        { image->data.data, image->data.size },
+    };
+    bool ok = output_writev(fd, iov, (int)(sizeof(iov) / sizeof(iov[0])));
+    if (close(fd) != 0 || !ok) {
+        return link_error(linker, "Could not write output file '%s'", output_file);
+    }
+    return true;
+}
+
+bool link_executable(const ObjectFile* const* objects, size_t count,
+                     const char* output_file, char* error, size_t error_size) {
+    Linker linker;
+    object_init(&linker.image);
+    linker.error = error;
+    linker.error_size = error_size;
+    bool ok = false;
+
+    // The entry stub comes first and claims _start
+    ObjectFile start;
+    object_init(&start);
+    size_t start_symbol = object_symbol(&start, "_start");
+    size_t main_symbol = object_symbol(&start, "main");
+    if (start_symbol == OBJ_NO_SYMBOL || main_symbol == OBJ_NO_SYMBOL ||
+        !buffer_append(&start.text, start_stub, sizeof(start_stub)) ||
+        !object_add_reloc(&start, START_CALL_OFFSET, main_symbol, RELOC_PLT32, -4)) {
+        link_error(&linker, "Out of memory");
+        goto done;
+    }
+    start.symbols[start_symbol].section = OBJ_SECTION_TEXT;
+    start.symbols[start_symbol].size = sizeof(start_stub);
+    start.symbols[start_symbol].is_function = true;
+
+    if (!merge_object(&linker, &start)) goto done;
+    for (size_t i = 0; i < count; i++) {
+        if (!merge_object(&linker, objects[i])) goto done;
+    }
+
+    // Text follows the headers; data starts on the next page boundary so
+    // the two segments can be mapped with different permissions
+    size_t headers = sizeof(Elf64_Ehdr) + PHDR_COUNT * sizeof(Elf64_Phdr);
+    size_t text_offset = align_up(headers, 16);
+    size_t data_offset = align_up(text_offset + linker.image.text.size, PAGE_SIZE);
+    uint64_t text_addr = IMAGE_BASE + text_offset;
+    uint64_t data_addr = IMAGE_BASE + data_offset;
+
+    if (!apply_relocations(&linker, text_addr, data_addr)) goto done;
+    ok = write_executable(&linker, output_file, text_offset, data_offset, text_addr);
+
+done:
+    object_free(&start);
+    object_free(&linker.image);
+    return ok;
+}
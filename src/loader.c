@@ -0,0 +1,584 @@
+#define _DEFAULT_SOURCE  // For syscall(), MAP_POPULATE and d_type
+#include "loader.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The io_uring backend talks to the kernel directly, without liburing.
+// Each file goes through two rounds: IORING_OP_OPENAT and IORING_OP_STATX
+// side by side, then IORING_OP_READ into a buffer of the size statx
+// reported (again after a short read), and last an IORING_OP_CLOSE nobody
+// waits for. The submission queue is flushed at most once per call to
+// loader_next(), together with whatever it has gathered since.
+
+#define RING_ENTRIES 256
+#define WINDOW 64               // Files between their open and their last read
+#define POOL_THREADS 8          // Readers in the thread pool
+
+enum { OP_OPEN, OP_STATX, OP_READ, OP_CLOSE };
+
+typedef struct {
+    const char* path;
+    char* data;
+    size_t size;
+    size_t read;
+    int fd;
+    int pending;                // io_uring operations in flight, but for the close
+    bool opened;
+    bool failed;
+    bool arrived;
+    struct statx statx;         // io_uring only
+} LoadFile;
+
+typedef struct {
+    int fd;
+    _Atomic unsigned* sq_head;
+    _Atomic unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    _Atomic unsigned* cq_head;
+    _Atomic unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;               // The same as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned queued;            // Entries written but not submitted yet
+    size_t in_flight;           // Submitted, the closes included
+} Ring;
+
+struct Loader {
+    LoadFile* files;
+    size_t count;
+    LoaderBackend backend;
+    pthread_mutex_t lock;
+    pthread_cond_t arrived;
+    size_t* ready;              // Loaded and not handed out yet, in arrival order
+    size_t ready_head;
+    size_t ready_tail;
+    size_t handed_out;
+    size_t bytes;
+    _Atomic size_t syscalls;
+
+    // io_uring
+    Ring ring;
+    size_t next_file;           // First file not started
+    size_t active;              // Files started and not finished
+    bool broken;                // io_uring_enter() failed for good
+
+    // Thread pool
+    pthread_t* threads;
+    size_t thread_count;
+    _Atomic size_t next_claim;
+};
+
+// Called with the lock held
+static void arrive(Loader* loader, size_t index) {
+    LoadFile* file = &loader->files[index];
+    if (!file->failed) loader->bytes += file->size;
+    file->arrived = true;
+    loader->ready[loader->ready_tail++] = index;
+    pthread_cond_broadcast(&loader->arrived);
+}
+
+// io_uring
+
+static int ring_enter(Ring* ring, unsigned submit, unsigned wait) {
+    return (int)syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+                        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static void ring_close(Ring* ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map && ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_size);
+    if (ring->sq_map) munmap(ring->sq_map, ring->sq_map_size);
+    if (ring->fd >= 0) close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+// Everything a file needs must be there, or the thread pool does the work
+static bool ring_supports(int fd) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, size);
+    if (!probe) return false;
+    bool ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    const int needed[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE };
+    for (size_t i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+static bool ring_open(Ring* ring) {
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (ring->fd < 0) return false;
+    if (!ring_supports(ring->fd)) {
+        ring_close(ring);
+        return false;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cq_map_size > ring->sq_map_size) ring->sq_map_size = ring->cq_map_size;
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) ring->sq_map = NULL;
+    ring->cq_map = single ? ring->sq_map
+                          : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) ring->cq_map = NULL;
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) ring->sqes = NULL;
+    if (!ring->sq_map || !ring->cq_map || !ring->sqes) {
+        ring_close(ring);
+        return false;
+    }
+
+    char* sq = ring->sq_map;
+    char* cq = ring->cq_map;
+    ring->sq_head = (_Atomic unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (_Atomic unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (_Atomic unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// Hand what is queued to the kernel, and wait for at least wait completions
+static bool ring_submit(Loader* loader, unsigned wait) {
+    Ring* ring = &loader->ring;
+    while (ring->queued > 0 || wait > 0) {
+        int done = ring_enter(ring, ring->queued, wait);
+        atomic_fetch_add(&loader->syscalls, 1);
+        if (done < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            return false;
+        }
+        ring->in_flight += (size_t)done;
+        ring->queued -= (unsigned)done;
+        wait = 0;
+    }
+    return true;
+}
+
+static struct io_uring_sqe* ring_get(Loader* loader) {
+    Ring* ring = &loader->ring;
+    unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    if (tail - head >= ring->sq_entries && !ring_submit(loader, 0)) return NULL;
+    struct io_uring_sqe* sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void ring_push(Ring* ring) {
+    unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+    atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+    ring->queued++;
+}
+
+static bool queue_op(Loader* loader, size_t index, int op) {
+    LoadFile* file = &loader->files[index];
+    struct io_uring_sqe* sqe = ring_get(loader);
+    if (!sqe) return false;
+    sqe->user_data = (uint64_t)index << 2 | (uint64_t)op;
+    switch (op) {
+        case OP_OPEN:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)file->path;
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            break;
+        case OP_STATX:
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)file->path;
+            sqe->len = STATX_SIZE;
+            sqe->off = (uintptr_t)&file->statx;
+            break;
+        case OP_READ: {
+            size_t left = file->size - file->read;
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = file->fd;
+            sqe->addr = (uintptr_t)(file->data + file->read);
+            sqe->len = (unsigned)(left < (1u << 30) ? left : (1u << 30));
+            sqe->off = file->read;
+            break;
+        }
+        case OP_CLOSE:
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = file->fd;
+            break;
+    }
+    ring_push(&loader->ring);
+    if (op != OP_CLOSE) file->pending++;
+    return true;
+}
+
+static void finish_file(Loader* loader, size_t index) {
+    LoadFile* file = &loader->files[index];
+    if (file->fd >= 0 && !queue_op(loader, index, OP_CLOSE)) close(file->fd);
+    file->fd = -1;
+    if (file->failed) {
+        free(file->data);
+        file->data = NULL;
+    } else {
+        file->data[file->size] = '\0';
+    }
+    loader->active--;
+    arrive(loader, index);
+}
+
+// Take a file on once its open and statx, or its last read, are back
+static void advance(Loader* loader, size_t index) {
+    LoadFile* file = &loader->files[index];
+    if (file->pending > 0) return;
+    if (!file->failed && !file->data) {
+        file->opened = true;
+        file->data = malloc(file->size + 1);
+        if (!file->data) file->failed = true;
+    }
+    if (!file->failed && file->read < file->size) {
+        if (queue_op(loader, index, OP_READ)) return;
+        file->failed = true;
+    }
+    finish_file(loader, index);
+}
+
+static void complete(Loader* loader, uint64_t user_data, int result) {
+    size_t index = (size_t)(user_data >> 2);
+    int op = (int)(user_data & 3);
+    LoadFile* file = &loader->files[index];
+    loader->ring.in_flight--;
+    if (op == OP_CLOSE) return;
+    file->pending--;
+    if (result < 0) {
+        file->failed = true;
+    } else if (op == OP_OPEN) {
+        file->fd = result;
+    } else if (op == OP_STATX) {
+        file->size = (size_t)file->statx.stx_size;
+    } else if (result == 0) {
+        file->size = file->read;   // It shrank
+    } else {
+        file->read += (size_t)result;
+    }
+    advance(loader, index);
+}
+
+static void ring_reap(Loader* loader) {
+    Ring* ring = &loader->ring;
+    unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+    while (head != atomic_load_explicit(ring->cq_tail, memory_order_acquire)) {
+        const struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int result = cqe->res;
+        atomic_store_explicit(ring->cq_head, ++head, memory_order_release);
+        complete(loader, user_data, result);
+    }
+}
+
+// Start files up to the window, reap what is back and submit; waits for a
+// completion only when asked to and nothing is ready to hand out
+static void ring_pump(Loader* loader, bool wait) {
+    while (loader->active < WINDOW && loader->next_file < loader->count) {
+        size_t index = loader->next_file++;
+        LoadFile* file = &loader->files[index];
+        loader->active++;
+        if (!queue_op(loader, index, OP_OPEN) || !queue_op(loader, index, OP_STATX)) {
+            file->failed = true;
+            if (file->pending == 0) finish_file(loader, index);
+        }
+    }
+    ring_reap(loader);
+    bool waiting = wait && loader->ready_head == loader->ready_tail && loader->ring.in_flight > 0;
+    if (!ring_submit(loader, waiting ? 1 : 0)) {
+        // The ring is unusable, so whatever has not arrived fails
+        loader->broken = true;
+        for (size_t i = 0; i < loader->count; i++) {
+            if (loader->files[i].arrived) continue;
+            loader->files[i].failed = true;
+            arrive(loader, i);
+        }
+        loader->next_file = loader->count;
+        return;
+    }
+    ring_reap(loader);
+}
+
+// Thread pool
+
+static void read_whole(Loader* loader, LoadFile* file) {
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    atomic_fetch_add(&loader->syscalls, 1);
+    if (fd < 0) {
+        file->failed = true;
+        return;
+    }
+    file->opened = true;
+    struct stat st;
+    atomic_fetch_add(&loader->syscalls, 2);   // The close too
+    if (fstat(fd, &st) != 0 || !(file->data = malloc((size_t)st.st_size + 1))) {
+        file->failed = true;
+        close(fd);
+        return;
+    }
+    file->size = (size_t)st.st_size;
+    while (file->read < file->size) {
+        ssize_t got = read(fd, file->data + file->read, file->size - file->read);
+        atomic_fetch_add(&loader->syscalls, 1);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) file->failed = true;
+        if (got <= 0) break;
+        file->read += (size_t)got;
+    }
+    file->size = file->read;
+    close(fd);
+    if (file->failed) {
+        free(file->data);
+        file->data = NULL;
+    } else {
+        file->data[file->size] = '\0';
+    }
+}
+
+static void* pool_read(void* arg) {
+    Loader* loader = arg;
+    for (;;) {
+        size_t index = atomic_fetch_add(&loader->next_claim, 1);
+        if (index >= loader->count) break;
+        read_whole(loader, &loader->files[index]);
+        pthread_mutex_lock(&loader->lock);
+        arrive(loader, index);
+        pthread_mutex_unlock(&loader->lock);
+    }
+    return NULL;
+}
+
+// Without a single reader thread, loader_next() reads the files itself
+static bool pool_start(Loader* loader) {
+    loader->backend = LOADER_THREADS;
+    size_t count = loader->count < POOL_THREADS ? loader->count : POOL_THREADS;
+    loader->threads = calloc(count ? count : 1, sizeof(pthread_t));
+    if (!loader->threads) return false;
+    for (size_t i = 0; i < count; i++) {
+        if (pthread_create(&loader->threads[i], NULL, pool_read, loader) != 0) break;
+        loader->thread_count++;
+    }
+    return true;
+}
+
+// Interface
+
+Loader* loader_start(const char* const* paths, size_t count, bool force_threads) {
+    Loader* loader = calloc(1, sizeof(Loader));
+    if (!loader) return NULL;
+    loader->count = count;
+    loader->files = calloc(count ? count : 1, sizeof(LoadFile));
+    loader->ready = malloc((count ? count : 1) * sizeof(size_t));
+    if (!loader->files || !loader->ready) {
+        free(loader->files);
+        free(loader->ready);
+        free(loader);
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        loader->files[i].path = paths[i];
+        loader->files[i].fd = -1;
+    }
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->arrived, NULL);
+    loader->ring.fd = -1;
+
+    if (!force_threads && count > 0 && ring_open(&loader->ring)) {
+        loader->backend = LOADER_IO_URING;
+        ring_pump(loader, false);
+        return loader;
+    }
+    if (!pool_start(loader)) {
+        loader_destroy(loader);
+        return NULL;
+    }
+    return loader;
+}
+
+size_t loader_next(Loader* loader) {
+    pthread_mutex_lock(&loader->lock);
+    size_t index = SIZE_MAX;
+    while (loader->handed_out < loader->count) {
+        if (loader->ready_head != loader->ready_tail) {
+            index = loader->ready[loader->ready_head++];
+            loader->handed_out++;
+            break;
+        }
+        if (loader->backend == LOADER_IO_URING) {
+            ring_pump(loader, true);
+        } else if (loader->thread_count == 0) {
+            size_t claimed = atomic_fetch_add(&loader->next_claim, 1);
+            read_whole(loader, &loader->files[claimed]);
+            arrive(loader, claimed);
+        } else {
+            pthread_cond_wait(&loader->arrived, &loader->lock);
+        }
+    }
+    // Keep the kernel busy while the caller works on this one
+    if (index != SIZE_MAX && loader->backend == LOADER_IO_URING) ring_pump(loader, false);
+    pthread_mutex_unlock(&loader->lock);
+    return index;
+}
+
+char* loader_take(Loader* loader, size_t index, size_t* size, bool* opened) {
+    LoadFile* file = &loader->files[index];
+    char* data = file->failed ? NULL : file->data;
+    if (data) file->data = NULL;
+    if (size) *size = data ? file->size : 0;
+    if (opened) *opened = file->opened;
+    return data;
+}
+
+void loader_stats(Loader* loader, LoaderStats* stats) {
+    stats->backend = loader->backend;
+    stats->files = loader->count;
+    pthread_mutex_lock(&loader->lock);
+    stats->bytes = loader->bytes;
+    pthread_mutex_unlock(&loader->lock);
+    stats->syscalls = atomic_load(&loader->syscalls);
+}
+
+void loader_destroy(Loader* loader) {
+    if (!loader) return;
+    if (loader->backend == LOADER_IO_URING) {
+        // The kernel may still write into the buffers and close the files
+        loader->next_file = loader->count;
+        while (!loader->broken && (loader->ring.in_flight > 0 || loader->ring.queued > 0)) {
+            if (!ring_submit(loader, loader->ring.in_flight > 0 ? 1 : 0)) break;
+            ring_reap(loader);
+        }
+        ring_close(&loader->ring);
+    }
+    for (size_t i = 0; i < loader->thread_count; i++) pthread_join(loader->threads[i], NULL);
+    for (size_t i = 0; i < loader->count; i++) {
+        free(loader->files[i].data);
+        if (loader->files[i].fd >= 0) close(loader->files[i].fd);
+    }
+    pthread_mutex_destroy(&loader->lock);
+    pthread_cond_destroy(&loader->arrived);
+    free(loader->threads);
+    free(loader->files);
+    free(loader->ready);
+    free(loader);
+}
+
+// Directory inputs
+
+typedef struct {
+    char** paths;
+    size_t count;
+    size_t capacity;
+} PathList;
+
+static bool add_path(PathList* list, char* path) {
+    if (list->count >= list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        char** paths = realloc(list->paths, capacity * sizeof(char*));
+        if (!paths) return false;
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+    list->paths[list->count++] = path;
+    return true;
+}
+
+static bool is_source(const char* name) {
+    size_t length = strlen(name);
+    return length > 2 && strcmp(name + length - 2, ".c") == 0;
+}
+
+static bool walk(const char* directory, PathList* list) {
+    DIR* dir = opendir(directory);
+    if (!dir) return false;
+    bool ok = true;
+    struct dirent* entry;
+    while (ok && (entry = readdir(dir))) {
+        const char* name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        size_t length = strlen(directory) + strlen(name) + 2;
+        char* path = malloc(length);
+        if (!path) {
+            ok = false;
+            break;
+        }
+        snprintf(path, length, "%s/%s", directory, name);
+
+        // A link counts as the file it points to, but a linked directory is
+        // skipped, so links cannot make the walk loop
+        unsigned char type = entry->d_type;
+        struct stat st;
+        if (type == DT_UNKNOWN) {
+            if (lstat(path, &st) != 0) type = DT_UNKNOWN;
+            else if (S_ISREG(st.st_mode)) type = DT_REG;
+            else if (S_ISDIR(st.st_mode)) type = DT_DIR;
+            else if (S_ISLNK(st.st_mode)) type = DT_LNK;
+        }
+        if (type == DT_LNK) {
+            type = stat(path, &st) == 0 && S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR) {
+            ok = walk(path, list);
+            free(path);
+        } else if (type == DT_REG && is_source(name)) {
+            ok = add_path(list, path);
+            if (!ok) free(path);
+        } else {
+            free(path);
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+bool loader_find_sources(const char* directory, char*** paths, size_t* count) {
+    PathList list = {0};
+    if (!walk(directory, &list)) {
+        for (size_t i = 0; i < list.count; i++) free(list.paths[i]);
+        free(list.paths);
+        return false;
+    }
+    if (list.count > 1) qsort(list.paths, list.count, sizeof(char*), compare_paths);
+    *paths = list.paths;
+    *count = list.count;
+    return true;
+}
@@ -0,0 +1,216 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Natural loops. Every back edge (an edge into a block that dominates its
+// source) defines a loop: the header plus the blocks that reach the back
+// edge without passing through the header. Back edges into one header
+// make one loop.
+
+static int compare_size(const void* x, const void* y) {
+    const Loop* a = x;
+    const Loop* b = y;
+    if (a->block_count != b->block_count) return a->block_count < b->block_count ? 1 : -1;
+    return a->header - b->header;
+}
+
+// The blocks of the loop headed by h, in reverse postorder
+static bool collect_body(const IRFunction* fn, const DomTree* dom, int h, bool* in_body,
+                         int* stack, Loop* loop) {
+    size_t top = 0;
+    in_body[h] = true;
+    const IRBlock* header = fn->blocks[h];
+    for (size_t p = 0; p < header->pred_count; p++) {
+        int pred = dom->index[header->preds[p]->id];
+        if (!in_body[pred] && dom_tree_dominates(dom, h, pred)) {
+            in_body[pred] = true;
+            stack[top++] = pred;
+        }
+    }
+    while (top > 0) {
+        const IRBlock* block = fn->blocks[stack[--top]];
+        for (size_t p = 0; p < block->pred_count; p++) {
+            int pred = dom->index[block->preds[p]->id];
+            if (!in_body[pred] && dom_tree_dominates(dom, h, pred)) {
+                in_body[pred] = true;
+                stack[top++] = pred;
+            }
+        }
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < dom->order_count; i++) count += in_body[dom->order[i]];
+    loop->blocks = malloc(count * sizeof(int));
+    if (!loop->blocks) return false;
+    for (size_t i = 0; i < dom->order_count; i++) {
+        int b = dom->order[i];
+        if (!in_body[b]) continue;
+        loop->blocks[loop->block_count++] = b;
+        in_body[b] = false;
+    }
+    return true;
+}
+
+// The single block outside the loop that enters it, if it does nothing
+// but jump to the header
+static int find_preheader(const IRFunction* fn, const DomTree* dom, const LoopForest* forest,
+                          int loop) {
+    const IRBlock* header = fn->blocks[forest->loops[loop].header];
+    int preheader = -1;
+    for (size_t p = 0; p < header->pred_count; p++) {
+        int pred = dom->index[header->preds[p]->id];
+        if (loop_contains(forest, loop, pred)) continue;
+        if (preheader >= 0) return -1;
+        preheader = pred;
+    }
+    if (preheader < 0 || fn->blocks[preheader]->last->op != IR_JUMP) return -1;
+    return preheader;
+}
+
+bool ir_find_loops(const IRFunction* fn, const DomTree* dom, LoopForest* forest) {
+    size_t count = fn->block_count;
+    memset(forest, 0, sizeof(*forest));
+    bool* in_body = calloc(count + 1, sizeof(bool));
+    int* stack = malloc((count + 1) * sizeof(int));
+    size_t capacity = 0;
+    bool ok = false;
+    forest->innermost = malloc((count + 1) * sizeof(int));
+    if (!in_body || !stack || !forest->innermost) goto done;
+
+    for (size_t i = 0; i < dom->order_count; i++) {
+        int h = dom->order[i];
+        const IRBlock* header = fn->blocks[h];
+        bool is_header = false;
+        for (size_t p = 0; p < header->pred_count && !is_header; p++) {
+            is_header = dom_tree_dominates(dom, h, dom->index[header->preds[p]->id]);
+        }
+        if (!is_header) continue;
+
+        if (forest->count >= capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            Loop* loops = realloc(forest->loops, capacity * sizeof(Loop));
+            if (!loops) goto done;
+            forest->loops = loops;
+        }
+        Loop* loop = &forest->loops[forest->count++];
+        memset(loop, 0, sizeof(*loop));
+        loop->header = h;
+        if (!collect_body(fn, dom, h, in_body, stack, loop)) goto done;
+    }
+
+    // A loop has more blocks than any loop nested in it, so after sorting
+    // by size the innermost loop of a block is the last one to claim it
+    if (forest->count) qsort(forest->loops, forest->count, sizeof(Loop), compare_size);
+    for (size_t b = 0; b < count; b++) forest->innermost[b] = -1;
+    for (size_t l = 0; l < forest->count; l++) {
+        Loop* loop = &forest->loops[l];
+        loop->parent = forest->innermost[loop->header];
+        loop->depth = loop->parent >= 0 ? forest->loops[loop->parent].depth + 1 : 1;
+        for (size_t i = 0; i < loop->block_count; i++) forest->innermost[loop->blocks[i]] = (int)l;
+    }
+    for (size_t l = 0; l < forest->count; l++) {
+        forest->loops[l].preheader = find_preheader(fn, dom, forest, (int)l);
+    }
+    ok = true;
+
+done:
+    free(in_body);
+    free(stack);
+    if (!ok) loop_forest_free(forest);
+    return ok;
+}
+
+bool loop_contains(const LoopForest* forest, int loop, int block) {
+    for (int l = forest->innermost[block]; l >= 0; l = forest->loops[l].parent) {
+        if (l == loop) return true;
+    }
+    return false;
+}
+
+void loop_forest_free(LoopForest* forest) {
+    for (size_t l = 0; l < forest->count; l++) free(forest->loops[l].blocks);
+    free(forest->loops);
+    free(forest->innermost);
+    memset(forest, 0, sizeof(*forest));
+}
+
+// Route the edges from outside the loop (the preds of header at the given
+// positions) through a new block just before the header. Header phis keep
+// one operand for it, merged by a phi in the preheader when several edges
+// came in.
+static bool insert_preheader(IRFunction* fn, IRBlock* header, const size_t* outside,
+                             size_t outside_count) {
+    IRBlock* preheader = ir_block_create(fn);
+    IRInstr* jump = ir_instr_create(fn, IR_JUMP);
+    if (!preheader || !jump) return false;
+
+    for (size_t i = 0; i < outside_count; i++) {
+        IRBlock* pred = header->preds[outside[i]];
+        if (!ir_add_pred(fn, preheader, pred)) return false;
+        ir_retarget(pred->last, header, preheader);
+    }
+
+    // The operand for the new edge replaces the first outside operand
+    for (IRInstr* phi = header->first; phi && phi->op == IR_PHI; phi = phi->next) {
+        int value = phi->args[outside[0]];
+        if (outside_count > 1) {
+            IRInstr* merge = ir_phi_create(fn, preheader);
+            if (!merge) return false;
+            merge->args = arena_alloc(&fn->arena, outside_count * sizeof(int));
+            if (!merge->args) return false;
+            for (size_t i = 0; i < outside_count; i++) merge->args[i] = phi->args[outside[i]];
+            merge->arg_count = outside_count;
+            value = merge->dst;
+        }
+        phi->args[outside[0]] = value;
+    }
+    header->preds[outside[0]] = preheader;
+    for (size_t i = outside_count; i > 1; i--) ir_remove_pred(header, outside[i - 1]);
+
+    jump->target = header;
+    ir_append(preheader, jump);
+    size_t h = 0;
+    while (fn->blocks[h] != header) h++;
+    memmove(&fn->blocks[h + 1], &fn->blocks[h], (fn->block_count - 1 - h) * sizeof(IRBlock*));
+    fn->blocks[h] = preheader;
+    return true;
+}
+
+bool ir_insert_preheaders(IRFunction* fn, size_t* inserted) {
+    DomTree dom;
+    LoopForest forest;
+    if (!ir_dominators(fn, &dom)) return false;
+    if (!ir_find_loops(fn, &dom, &forest)) {
+        dom_tree_free(&dom);
+        return false;
+    }
+
+    // Insertions only touch their own header's edges, so the loops found
+    // up front stay valid while blocks move around
+    IRBlock** headers = malloc((forest.count + 1) * sizeof(IRBlock*));
+    size_t* outside = malloc((2 * fn->block_count + 1) * sizeof(size_t));
+    bool ok = headers && outside;
+    for (size_t l = 0; l < forest.count && ok; l++) {
+        headers[l] = forest.loops[l].preheader < 0 ? fn->blocks[forest.loops[l].header] : NULL;
+    }
+    for (size_t l = 0; l < forest.count && ok; l++) {
+        IRBlock* header = headers[l];
+        if (!header) continue;
+        size_t outside_count = 0;
+        for (size_t p = 0; p < header->pred_count; p++) {
+            if (!loop_contains(&forest, (int)l, dom.index[header->preds[p]->id])) {
+                outside[outside_count++] = p;
+            }
+        }
+        // A loop around the entry block has no edge from outside
+        if (outside_count == 0) continue;
+        ok = insert_preheader(fn, header, outside, outside_count);
+        if (ok) (*inserted)++;
+    }
+
+    free(headers);
+    free(outside);
+    loop_forest_free(&forest);
+    dom_tree_free(&dom);
+    return ok;
+}
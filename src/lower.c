@@ -0,0 +1,717 @@
+#include "ir.h"
+#include "optimize.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+// Lowering of the AST into SSA-form IR.
+//
+// SSA is built on the fly, following Braun et al., "Simple and Efficient
+// Construction of Static Single Assignment Form": each block remembers the
+// vreg that currently holds every variable it assigns, and a read looks
+// backwards through the predecessors, placing phis where paths join. A
+// block is sealed once all its predecessors are known; reads in blocks
+// that are not sealed yet (loop headers) get placeholder phis whose
+// operands are filled in on sealing. The structured if/while/switch
+// shapes tell exactly when that is, so no dominance frontiers are needed.
+// A local's variable number is the frame slot resolve_program() gave it.
+
+typedef struct {
+    int block;                   // Block id, or -1 for an empty slot
+    int var;
+    int vreg;
+} Definition;
+
+typedef struct {
+    IRBlock* block;
+    IRInstr* phi;
+    int var;
+} IncompletePhi;
+
+// Value of an expression node shared by hash-consing, in the block that
+// computed it; uses later in that block take it instead of recomputing
+typedef struct {
+    const ASTNode* node;         // NULL for an empty slot
+    int block;
+    int vreg;
+} SharedValue;
+
+typedef struct {
+    IR* ir;
+    IRFunction* fn;
+    IRBlock* block;              // Block currently receiving instructions
+
+    Definition* defs;            // (block, var) -> current vreg, open addressing
+    size_t def_count;
+    size_t def_capacity;
+    bool* sealed;                // By block id
+    size_t sealed_capacity;
+    IncompletePhi* incomplete;
+    size_t incomplete_count;
+    size_t incomplete_capacity;
+    int undef;                   // Lazily created zero for undefined reads
+    SharedValue* shared;         // By node address, open addressing
+    size_t shared_count;
+    size_t shared_capacity;
+    IRBlock* break_target;       // Exit of the innermost loop or switch
+
+    Error* error;
+} LowerContext;
+
+static void lower_error(LowerContext* ctx, const ASTNode* node, const char* format, ...) {
+    if (!ctx->error || ctx->error->code != ERROR_NONE) return;
+    ctx->error->code = ERROR_SEMANTIC;
+    ctx->error->line = node ? node->line : 0;
+    ctx->error->column = node ? node->column : 0;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(ctx->error->message, sizeof(ctx->error->message), format, args);
+    va_end(args);
+}
+
+static bool failed(const LowerContext* ctx) {
+    return ctx->error && ctx->error->code != ERROR_NONE;
+}
+
+static size_t definition_slot(const LowerContext* ctx, int block, int var) {
+    size_t hash = ((size_t)(unsigned)block * 0x9E3779B1u) ^ ((size_t)(unsigned)var * 0x85EBCA77u);
+    size_t mask = ctx->def_capacity - 1;
+    size_t slot = hash & mask;
+    while (ctx->defs[slot].block >= 0 &&
+           (ctx->defs[slot].block != block || ctx->defs[slot].var != var)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static void write_variable(LowerContext* ctx, IRBlock* block, int var, int vreg) {
+    if ((ctx->def_count + 1) * 2 > ctx->def_capacity) {
+        size_t old_capacity = ctx->def_capacity;
+        Definition* old = ctx->defs;
+        size_t new_capacity = old_capacity ? old_capacity * 2 : 64;
+        ctx->defs = malloc(new_capacity * sizeof(Definition));
+        if (!ctx->defs) {
+            ctx->defs = old;
+            lower_error(ctx, NULL, "Out of memory");
+            return;
+        }
+        ctx->def_capacity = new_capacity;
+        for (size_t i = 0; i < new_capacity; i++) ctx->defs[i].block = -1;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].block >= 0) ctx->defs[definition_slot(ctx, old[i].block, old[i].var)] = old[i];
+        }
+        free(old);
+    }
+
+    size_t slot = definition_slot(ctx, block->id, var);
+    if (ctx->defs[slot].block < 0) ctx->def_count++;
+    ctx->defs[slot] = (Definition){ block->id, var, vreg };
+}
+
+static size_t shared_slot(const LowerContext* ctx, const ASTNode* node) {
+    uint64_t x = (uint64_t)(uintptr_t)node;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    size_t mask = ctx->shared_capacity - 1;
+    size_t slot = (size_t)x & mask;
+    while (ctx->shared[slot].node && ctx->shared[slot].node != node) slot = (slot + 1) & mask;
+    return slot;
+}
+
+static int shared_value(const LowerContext* ctx, const ASTNode* node) {
+    if (ctx->shared_capacity == 0) return IR_NO_VREG;
+    const SharedValue* entry = &ctx->shared[shared_slot(ctx, node)];
+    return entry->node && entry->block == ctx->block->id ? entry->vreg : IR_NO_VREG;
+}
+
+static void remember_shared(LowerContext* ctx, const ASTNode* node, int vreg) {
+    if ((ctx->shared_count + 1) * 2 > ctx->shared_capacity) {
+        size_t old_capacity = ctx->shared_capacity;
+        SharedValue* old = ctx->shared;
+        size_t new_capacity = old_capacity ? old_capacity * 2 : 64;
+        ctx->shared = calloc(new_capacity, sizeof(SharedValue));
+        if (!ctx->shared) {
+            ctx->shared = old;
+            lower_error(ctx, node, "Out of memory");
+            return;
+        }
+        ctx->shared_capacity = new_capacity;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].node) ctx->shared[shared_slot(ctx, old[i].node)] = old[i];
+        }
+        free(old);
+    }
+
+    size_t slot = shared_slot(ctx, node);
+    if (!ctx->shared[slot].node) ctx->shared_count++;
+    ctx->shared[slot] = (SharedValue){ node, ctx->block->id, vreg };
+}
+
+static IRBlock* new_block(LowerContext* ctx) {
+    IRBlock* block = ir_block_create(ctx->fn);
+    if (!block) return NULL;
+    if ((size_t)block->id >= ctx->sealed_capacity) {
+        size_t new_capacity = ctx->sealed_capacity ? ctx->sealed_capacity * 2 : 64;
+        bool* sealed = realloc(ctx->sealed, new_capacity * sizeof(bool));
+        if (!sealed) return NULL;
+        memset(sealed + ctx->sealed_capacity, 0, (new_capacity - ctx->sealed_capacity) * sizeof(bool));
+        ctx->sealed = sealed;
+        ctx->sealed_capacity = new_capacity;
+    }
+    return block;
+}
+
+static int read_variable(LowerContext* ctx, IRBlock* block, int var);
+
+// A variable read before any assignment on some path is zero there
+static int undefined_value(LowerContext* ctx) {
+    if (ctx->undef != IR_NO_VREG) return ctx->undef;
+    IRBlock* entry = ctx->fn->blocks[0];
+    IRInstr* zero = ir_instr_create(ctx->fn, IR_CONST);
+    if (!zero) {
+        lower_error(ctx, NULL, "Out of memory");
+        return IR_NO_VREG;
+    }
+    zero->dst = ir_new_vreg(ctx->fn);
+    IRInstr* after_params = entry->first;
+    while (after_params && after_params->op == IR_PARAM) after_params = after_params->next;
+    ir_insert_before(entry, after_params, zero);
+    ctx->undef = zero->dst;
+    return zero->dst;
+}
+
+static void add_phi_operands(LowerContext* ctx, IRBlock* block, IRInstr* phi, int var) {
+    phi->arg_count = block->pred_count;
+    phi->args = arena_alloc(&ctx->fn->arena, (block->pred_count + 1) * sizeof(int));
+    if (!phi->args) {
+        lower_error(ctx, NULL, "Out of memory");
+        return;
+    }
+    for (size_t i = 0; i < block->pred_count; i++) {
+        phi->args[i] = read_variable(ctx, block->preds[i], var);
+    }
+}
+
+static int read_variable_recursive(LowerContext* ctx, IRBlock* block, int var) {
+    int value;
+    if (!ctx->sealed[block->id]) {
+        // More predecessors may come; finish the phi when the block is sealed
+        IRInstr* phi = ir_phi_create(ctx->fn, block);
+        if (!phi) {
+            lower_error(ctx, NULL, "Out of memory");
+            return IR_NO_VREG;
+        }
+        if (ctx->incomplete_count >= ctx->incomplete_capacity) {
+            size_t new_capacity = ctx->incomplete_capacity ? ctx->incomplete_capacity * 2 : 16;
+            IncompletePhi* list = realloc(ctx->incomplete, new_capacity * sizeof(IncompletePhi));
+            if (!list) {
+                lower_error(ctx, NULL, "Out of memory");
+                return IR_NO_VREG;
+            }
+            ctx->incomplete = list;
+            ctx->incomplete_capacity = new_capacity;
+        }
+        ctx->incomplete[ctx->incomplete_count++] = (IncompletePhi){ block, phi, var };
+        value = phi->dst;
+    } else if (block->pred_count == 0) {
+        value = undefined_value(ctx);
+    } else if (block->pred_count == 1) {
+        value = read_variable(ctx, block->preds[0], var);
+    } else {
+        // Record the phi before reading the operands, which may loop back here
+        IRInstr* phi = ir_phi_create(ctx->fn, block);
+        if (!phi) {
+            lower_error(ctx, NULL, "Out of memory");
+            return IR_NO_VREG;
+        }
+        write_variable(ctx, block, var, phi->dst);
+        add_phi_operands(ctx, block, phi, var);
+        value = phi->dst;
+    }
+    write_variable(ctx, block, var, value);
+    return value;
+}
+
+static int read_variable(LowerContext* ctx, IRBlock* block, int var) {
+    if (failed(ctx)) return IR_NO_VREG;
+    if (ctx->def_capacity) {
+        size_t slot = definition_slot(ctx, block->id, var);
+        if (ctx->defs[slot].block >= 0) return ctx->defs[slot].vreg;
+    }
+    return read_variable_recursive(ctx, block, var);
+}
+
+// All predecessors of block are known
+static void seal_block(LowerContext* ctx, IRBlock* block) {
+    ctx->sealed[block->id] = true;
+    for (size_t i = 0; i < ctx->incomplete_count && !failed(ctx); ) {
+        IncompletePhi entry = ctx->incomplete[i];
+        if (entry.block != block) {
+            i++;
+            continue;
+        }
+        ctx->incomplete[i] = ctx->incomplete[--ctx->incomplete_count];
+        add_phi_operands(ctx, block, entry.phi, entry.var);
+    }
+}
+
+static IRInstr* emit(LowerContext* ctx, IROpcode op) {
+    IRInstr* instr = ir_instr_create(ctx->fn, op);
+    if (!instr) {
+        lower_error(ctx, NULL, "Out of memory");
+        return NULL;
+    }
+    ir_append(ctx->block, instr);
+    return instr;
+}
+
+static bool block_terminated(const IRBlock* block) {
+    return block->last && ir_is_terminator(block->last->op);
+}
+
+// Continue emission in a fresh block (used after return statements)
+static void start_block(LowerContext* ctx, IRBlock* block) {
+    ctx->block = block;
+}
+
+static IROpcode binary_opcode(BinaryOp op) {
+    switch (op) {
+        case OP_ADD:           return IR_ADD;
+        case OP_SUBTRACT:      return IR_SUB;
+        case OP_MULTIPLY:      return IR_MUL;
+        case OP_DIVIDE:        return IR_DIV;
+        case OP_EQUALS:        return IR_EQ;
+        case OP_NOT_EQUALS:    return IR_NE;
+        case OP_LESS:          return IR_LT;
+        case OP_GREATER:       return IR_GT;
+        case OP_LESS_EQUAL:    return IR_LE;
+        case OP_GREATER_EQUAL: return IR_GE;
+        default:               return IR_CONST;
+    }
+}
+
+static int lower_expression(LowerContext* ctx, const ASTNode* node);
+static void lower_statement(LowerContext* ctx, const ASTNode* node);
+
+static int emit_const(LowerContext* ctx, int64_t value) {
+    IRInstr* instr = emit(ctx, IR_CONST);
+    if (!instr) return IR_NO_VREG;
+    instr->dst = ir_new_vreg(ctx->fn);
+    instr->imm = value;
+    return instr->dst;
+}
+
+static int lower_assignment(LowerContext* ctx, const ASTNode* node) {
+    int value = lower_expression(ctx, node->data.assignment.value);
+    if (value == IR_NO_VREG) return IR_NO_VREG;
+
+    NameRef ref = node->data.assignment.ref;
+    if (ref.kind == REF_LOCAL) {
+        // The value simply becomes the variable's current definition
+        write_variable(ctx, ctx->block, ref.index, value);
+        return value;
+    }
+    IRInstr* store = emit(ctx, IR_STORE_GLOBAL);
+    if (!store) return IR_NO_VREG;
+    store->symbol = node->data.assignment.name;
+    store->a = value;
+    return value;
+}
+
+static int lower_call(LowerContext* ctx, const ASTNode* node) {
+    size_t count = node->data.call.arg_count;
+    int* args = count ? arena_alloc(&ctx->fn->arena, count * sizeof(int)) : NULL;
+    if (count && !args) {
+        lower_error(ctx, node, "Out of memory");
+        return IR_NO_VREG;
+    }
+
+    // Arguments are evaluated left to right
+    for (size_t i = 0; i < count; i++) {
+        args[i] = lower_expression(ctx, node->data.call.args[i]);
+        if (args[i] == IR_NO_VREG) return IR_NO_VREG;
+    }
+
+    IRInstr* call = emit(ctx, IR_CALL);
+    if (!call) return IR_NO_VREG;
+    call->dst = ir_new_vreg(ctx->fn);
+    call->symbol = node->data.call.name;
+    call->line = node->line;
+    call->column = node->column;
+    call->args = args;
+    call->arg_count = count;
+    return call->dst;
+}
+
+static int lower_expression(LowerContext* ctx, const ASTNode* node) {
+    if (failed(ctx)) return IR_NO_VREG;
+
+    switch (node->type) {
+        case NODE_NUMBER:
+            return emit_const(ctx, node->data.number.value);
+
+        case NODE_VARIABLE: {
+            NameRef ref = node->data.variable.ref;
+            if (ref.kind == REF_LOCAL) return read_variable(ctx, ctx->block, ref.index);
+            IRInstr* load = emit(ctx, IR_LOAD_GLOBAL);
+            if (!load) return IR_NO_VREG;
+            load->dst = ir_new_vreg(ctx->fn);
+            load->symbol = node->data.variable.name;
+            return load->dst;
+        }
+
+        case NODE_ASSIGNMENT:
+            return lower_assignment(ctx, node);
+
+        case NODE_BINARY_OP: {
+            IROpcode op = binary_opcode(node->data.binary.op);
+            if (op == IR_CONST) {
+                lower_error(ctx, node, "Invalid assignment target");
+                return IR_NO_VREG;
+            }
+            // Hash-consing only shares a node where it has one value
+            int known = node->refs > 0 ? shared_value(ctx, node) : IR_NO_VREG;
+            if (known != IR_NO_VREG) return known;
+            int left = lower_expression(ctx, node->data.binary.left);
+            if (left == IR_NO_VREG) return IR_NO_VREG;
+            int right = lower_expression(ctx, node->data.binary.right);
+            if (right == IR_NO_VREG) return IR_NO_VREG;
+
+            IRInstr* instr = emit(ctx, op);
+            if (!instr) return IR_NO_VREG;
+            instr->dst = ir_new_vreg(ctx->fn);
+            instr->a = left;
+            instr->b = right;
+            if (node->refs > 0) remember_shared(ctx, node, instr->dst);
+            return instr->dst;
+        }
+
+        case NODE_CALL:
+            return lower_call(ctx, node);
+
+        default:
+            lower_error(ctx, node, "Unsupported expression");
+            return IR_NO_VREG;
+    }
+}
+
+static void lower_block(LowerContext* ctx, const ASTNode* block) {
+    for (size_t i = 0; i < block->data.block.count && !failed(ctx); i++) {
+        lower_statement(ctx, block->data.block.statements[i]);
+    }
+}
+
+// Lower a condition and branch on it
+static void lower_branch(LowerContext* ctx, const ASTNode* condition,
+                         IRBlock* if_true, IRBlock* if_false) {
+    int value = lower_expression(ctx, condition);
+    if (value == IR_NO_VREG) return;
+    IRInstr* branch = emit(ctx, IR_BRANCH);
+    if (!branch) return;
+    branch->a = value;
+    branch->target = if_true;
+    branch->target_else = if_false;
+    branch->line = condition->line;
+    branch->column = condition->column;
+    if (!ir_add_pred(ctx->fn, if_true, ctx->block) || !ir_add_pred(ctx->fn, if_false, ctx->block)) {
+        lower_error(ctx, condition, "Out of memory");
+    }
+}
+
+static void emit_jump(LowerContext* ctx, IRBlock* target) {
+    if (block_terminated(ctx->block)) return;
+    IRInstr* jump = emit(ctx, IR_JUMP);
+    if (!jump) return;
+    jump->target = target;
+    if (!ir_add_pred(ctx->fn, target, ctx->block)) lower_error(ctx, NULL, "Out of memory");
+}
+
+// One block per label. The switch enters them; each also follows on from
+// the statement before it. Cases are sorted and dispatched in codegen.
+static void lower_switch(LowerContext* ctx, const ASTNode* node) {
+    const ASTNode* body = node->data.switch_stmt_node.body;
+    int value = lower_expression(ctx, node->data.switch_stmt_node.value);
+    if (value == IR_NO_VREG) return;
+
+    size_t case_count = 0;
+    for (size_t i = 0; i < body->data.block.count; i++) {
+        const ASTNode* stmt = body->data.block.statements[i];
+        if (stmt->type == NODE_CASE && !stmt->data.case_label.is_default) case_count++;
+    }
+    IRBlock** labels = calloc(body->data.block.count + 1, sizeof(IRBlock*));
+    IRBlock* exit = new_block(ctx);
+    IRInstr* sw = ir_switch_create(ctx->fn, case_count);
+    if (!labels || !exit || !sw) {
+        free(labels);
+        lower_error(ctx, node, "Out of memory");
+        return;
+    }
+
+    sw->a = value;
+    sw->target = exit;
+    sw->line = node->line;
+    sw->column = node->column;
+    size_t c = 0;
+    for (size_t i = 0; i < body->data.block.count && !failed(ctx); i++) {
+        const ASTNode* stmt = body->data.block.statements[i];
+        if (stmt->type != NODE_CASE) continue;
+        labels[i] = new_block(ctx);
+        if (!labels[i] || !ir_add_pred(ctx->fn, labels[i], ctx->block)) {
+            lower_error(ctx, stmt, "Out of memory");
+        } else if (stmt->data.case_label.is_default) {
+            sw->target = labels[i];
+        } else {
+            sw->cases[c].value = stmt->data.case_label.value;
+            sw->cases[c].target = labels[i];
+            c++;
+        }
+    }
+    if (failed(ctx) || (sw->target == exit && !ir_add_pred(ctx->fn, exit, ctx->block))) {
+        free(labels);
+        lower_error(ctx, node, "Out of memory");
+        return;
+    }
+    ir_switch_update(sw);
+    ir_append(ctx->block, sw);
+
+    IRBlock* outer_break = ctx->break_target;
+    ctx->break_target = exit;
+    for (size_t i = 0; i < body->data.block.count && !failed(ctx); i++) {
+        if (!labels[i]) {
+            lower_statement(ctx, body->data.block.statements[i]);
+            continue;
+        }
+        emit_jump(ctx, labels[i]);
+        seal_block(ctx, labels[i]);
+        start_block(ctx, labels[i]);
+    }
+    ctx->break_target = outer_break;
+    free(labels);
+    if (failed(ctx)) return;
+
+    emit_jump(ctx, exit);
+    seal_block(ctx, exit);
+    start_block(ctx, exit);
+}
+
+static void lower_statement(LowerContext* ctx, const ASTNode* node) {
+    if (failed(ctx)) return;
+
+    // Code after a return is unreachable; give it a block of its own so the
+    // terminator stays last. ir_remove_unreachable() drops it later.
+    if (block_terminated(ctx->block)) {
+        IRBlock* dead = new_block(ctx);
+        if (!dead) {
+            lower_error(ctx, node, "Out of memory");
+            return;
+        }
+        seal_block(ctx, dead);
+        start_block(ctx, dead);
+    }
+
+    switch (node->type) {
+        case NODE_VARIABLE:
+            if (node->data.variable.is_declaration) {
+                // Uninitialized locals start out as zero
+                int zero = emit_const(ctx, 0);
+                if (zero != IR_NO_VREG) write_variable(ctx, ctx->block, node->data.variable.ref.index, zero);
+            } else {
+                lower_expression(ctx, node);
+            }
+            break;
+
+        case NODE_RETURN: {
+            int value = lower_expression(ctx, node->data.ret.expr);
+            if (value == IR_NO_VREG) return;
+            IRInstr* ret = emit(ctx, IR_RET);
+            if (ret) ret->a = value;
+            break;
+        }
+
+        case NODE_BLOCK:
+            lower_block(ctx, node);
+            break;
+
+        case NODE_IF_STMT: {
+            IRBlock* then_block = new_block(ctx);
+            IRBlock* else_block = node->data.if_stmt_node.else_branch
+                ? new_block(ctx) : NULL;
+            IRBlock* join = new_block(ctx);
+            if (!then_block || !join || (node->data.if_stmt_node.else_branch && !else_block)) {
+                lower_error(ctx, node, "Out of memory");
+                return;
+            }
+
+            lower_branch(ctx, node->data.if_stmt_node.condition, then_block,
+                         else_block ? else_block : join);
+            if (failed(ctx)) return;
+
+            seal_block(ctx, then_block);
+            start_block(ctx, then_block);
+            lower_statement(ctx, node->data.if_stmt_node.then_branch);
+            emit_jump(ctx, join);
+
+            if (else_block) {
+                seal_block(ctx, else_block);
+                start_block(ctx, else_block);
+                lower_statement(ctx, node->data.if_stmt_node.else_branch);
+                emit_jump(ctx, join);
+            }
+
+            seal_block(ctx, join);
+            start_block(ctx, join);
+            break;
+        }
+
+        case NODE_WHILE_STMT: {
+            IRBlock* outer_break = ctx->break_target;
+            IRBlock* header = new_block(ctx);
+            IRBlock* body = new_block(ctx);
+            IRBlock* exit = new_block(ctx);
+            if (!header || !body || !exit) {
+                lower_error(ctx, node, "Out of memory");
+                return;
+            }
+
+            // The header stays unsealed until the back edge is known
+            emit_jump(ctx, header);
+            start_block(ctx, header);
+            lower_branch(ctx, node->data.while_stmt_node.condition, body, exit);
+            if (failed(ctx)) return;
+
+            seal_block(ctx, body);
+            start_block(ctx, body);
+            ctx->break_target = exit;
+            lower_statement(ctx, node->data.while_stmt_node.body);
+            ctx->break_target = outer_break;
+            emit_jump(ctx, header);
+
+            // Breaks have added their edges to exit by now
+            seal_block(ctx, header);
+            seal_block(ctx, exit);
+            start_block(ctx, exit);
+            break;
+        }
+
+        case NODE_SWITCH_STMT:
+            lower_switch(ctx, node);
+            break;
+
+        case NODE_BREAK:
+            emit_jump(ctx, ctx->break_target);
+            break;
+
+        case NODE_CASE:
+            lower_error(ctx, node, "Case label not directly within a switch");
+            break;
+
+        default:
+            // Expression statement; the value is discarded
+            lower_expression(ctx, node);
+            break;
+    }
+}
+
+static void lower_function(LowerContext* ctx, const ASTNode* node) {
+    IRFunction* fn = ir_add_function(ctx->ir, node->data.function.name,
+                                     node->data.function.param_count);
+    if (!fn) {
+        lower_error(ctx, node, "Out of memory");
+        return;
+    }
+
+    fn->file = node->data.function.file;
+    ctx->fn = fn;
+    ctx->def_count = 0;
+    for (size_t i = 0; i < ctx->def_capacity; i++) ctx->defs[i].block = -1;
+    memset(ctx->sealed, 0, ctx->sealed_capacity * sizeof(bool));
+    ctx->incomplete_count = 0;
+    ctx->undef = IR_NO_VREG;
+    ctx->shared_count = 0;
+    if (ctx->shared_capacity) memset(ctx->shared, 0, ctx->shared_capacity * sizeof(SharedValue));
+
+    ctx->block = new_block(ctx);
+    if (!ctx->block) {
+        lower_error(ctx, node, "Out of memory");
+        return;
+    }
+    seal_block(ctx, ctx->block);
+
+    // Parameters are copied out of their incoming locations on entry; they
+    // are the first locals
+    for (size_t i = 0; i < node->data.function.param_count; i++) {
+        IRInstr* param = emit(ctx, IR_PARAM);
+        if (!param) return;
+        param->dst = ir_new_vreg(fn);
+        param->imm = (int64_t)i;
+        write_variable(ctx, ctx->block, (int)i, param->dst);
+    }
+
+    lower_block(ctx, node->data.function.body);
+    if (failed(ctx)) return;
+
+    // Falling off the end returns 0 (as main() does in C)
+    if (!block_terminated(ctx->block)) {
+        int zero = emit_const(ctx, 0);
+        IRInstr* ret = emit(ctx, IR_RET);
+        if (ret) ret->a = zero;
+    }
+
+    // Drop dead code after returns and the phis that only one value reaches
+    ir_remove_unreachable(fn);
+    ir_remove_trivial_phis(fn);
+}
+
+// Global initializers must be compile-time constants
+static void lower_global(LowerContext* ctx, const ASTNode* node) {
+    const char* name;
+    int64_t init = 0;
+
+    if (node->type == NODE_ASSIGNMENT) {
+        name = node->data.assignment.name;
+        if (!ast_constant_value(node->data.assignment.value, &init)) {
+            lower_error(ctx, node, "Initializer of global '%s' is not a constant", name);
+            return;
+        }
+    } else {
+        name = node->data.variable.name;
+    }
+
+    if (!ir_add_global(ctx->ir, name, init)) {
+        lower_error(ctx, node, "Duplicate global '%s'", name);
+    }
+}
+
+IR* ir_lower(const ASTNode* program, Error* error) {
+    IR* ir = ir_create();
+    if (!ir) return NULL;
+
+    LowerContext ctx = {0};
+    ctx.ir = ir;
+    ctx.error = error;
+
+    // Globals first, so functions can refer to ones declared after them
+    for (size_t i = 0; i < program->data.block.count && !failed(&ctx); i++) {
+        const ASTNode* node = program->data.block.statements[i];
+        if (node->type != NODE_FUNCTION) {
+            lower_global(&ctx, node);
+        }
+    }
+
+    for (size_t i = 0; i < program->data.block.count && !failed(&ctx); i++) {
+        const ASTNode* node = program->data.block.statements[i];
+        if (node->type == NODE_FUNCTION) lower_function(&ctx, node);
+    }
+
+    free(ctx.defs);
+    free(ctx.sealed);
+    free(ctx.incomplete);
+    free(ctx.shared);
+    if (failed(&ctx)) {
+        ir_destroy(ir);
+        return NULL;
+    }
+    return ir;
+}
@@ -1,10 +1,147 @@
+#define _POSIX_C_SOURCE 200809L  // For stat
 #include "leancc.h"
+#include "loader.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
+// One write: stderr is unbuffered, and the text is long
 static void print_usage(const char* program) {
-    fprintf(stderr, "Usage: %s <input_file> [-o <output_file>]\n", program);
+    fprintf(stderr,
+            "Usage: %s <input_file>... [-o <output_file>] [options]\n"
+            "Inputs are C sources or objects from -c; executables are linked in-process\n"
+            "A directory input stands for every .c file below it\n"
+            "Options:\n"
+            "  -S              Write x86-64 assembly instead of an executable\n"
+            "  -c              Write an ELF object file without running an assembler\n"
+            "  -I <dir>        Search dir for #include <...> and, after the including\n"
+            "                  file's directory, for #include \"...\"\n"
+            "  -D <name>[=<value>]\n"
+            "                  Define a macro before each unit (value 1 by default)\n"
+            "  --emit-pch      Precompile the one input, a header, into <output_file>\n"
+            "                  (default: its name plus .pch)\n"
+            "  --include-pch <file>\n"
+            "                  Start every unit where the precompiled header left off,\n"
+            "                  as if it were included first; it must be made with the\n"
+            "                  same -I and -D options, from headers that are unchanged\n"
+            "  -fno-regalloc   Keep every value on the stack (naive baseline)\n"
+            "  -fno-fold       Skip constant folding and algebraic simplification\n"
+            "  -fno-const-eval Keep calls to pure functions with constant arguments\n"
+            "  -fno-hash-cons  Keep identical subexpressions as separate AST nodes\n"
+            "  -fno-tail-calls Keep self tail calls instead of turning them into loops\n"
+            "  -fno-inline     Never inline function calls\n"
+            "  -finline-threshold=N\n"
+            "                  Inline callees of at most N instructions (default 40)\n"
+            "  -Rpass=inline, -Rpass-missed=inline\n"
+            "                  Report call sites that were, or were not, inlined\n"
+            "  -fno-sccp       Skip sparse conditional constant propagation\n"
+            "  -fno-simplify-cfg\n"
+            "                  Keep empty blocks and blocks that could be merged\n"
+            "  -fno-gvn        Skip global value numbering on the SSA form\n"
+            "  -fno-licm       Leave loop-invariant code inside loops\n"
+            "  -fno-strength-reduce\n"
+            "                  Keep induction variable multiplications, and\n"
+            "                  multiplications and divisions by powers of two\n"
+            "  -fno-dce        Skip aggressive dead code elimination\n"
+            "  -fno-prune-unreachable\n"
+            "                  Compile every function of an executable, not only\n"
+            "                  those main() can reach\n"
+            "  -funity         Compile the sources as one unit, so that calls from one\n"
+            "                  file to another are inlined and evaluated like local\n"
+            "                  ones; -S and -c then write a single output\n"
+            "  -fconst-eval-steps=N, -fconst-eval-depth=N\n"
+            "                  Budgets for evaluating one such call\n"
+            "  -fthreads=N     Optimize and generate code on N threads, callees\n"
+            "                  before callers (default: one per processor)\n"
+            "  -fno-io-uring   Read input files on a thread pool instead of\n"
+            "                  submitting them to io_uring in batches\n"
+            "  --run           Run main() in the bytecode VM instead of compiling\n"
+            "  --run=tree      Run main() in the tree-walking evaluator\n"
+            "  --jit           Compile to memory, each function on its first call,\n"
+            "                  and run main()\n"
+            "  --tiered        Run main() in the bytecode VM, compiling functions to\n"
+            "                  memory once they are hot, with the profile so far\n"
+            "  -ftier-threshold=N\n"
+            "                  Calls plus loop iterations that make a function hot\n"
+            "                  (default 1000)\n"
+            "  --dump-ir       Print the IR (the bytecode with --run) to stdout\n"
+            "  --stats         Report what the preprocessor and each optimization\n"
+            "                  pass did, the system calls that loaded the inputs and\n"
+            "                  the writev calls that wrote the output\n",
+            program);
+}
+
+typedef struct {
+    const char** files;
+    size_t count;
+    size_t capacity;
+    char** owned;           // Paths found in directories, freed at exit
+    size_t owned_count;
+} InputList;
+
+static bool add_input(InputList* inputs, const char* path) {
+    if (inputs->count >= inputs->capacity) {
+        size_t capacity = inputs->capacity * 2;
+        const char** files = realloc(inputs->files, capacity * sizeof(char*));
+        if (!files) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return false;
+        }
+        inputs->files = files;
+        inputs->capacity = capacity;
+    }
+    inputs->files[inputs->count++] = path;
+    return true;
+}
+
+// A directory adds every .c file below it, in a stable order
+static bool add_directory(InputList* inputs, const char* directory) {
+    char** paths;
+    size_t count;
+    if (!loader_find_sources(directory, &paths, &count)) {
+        fprintf(stderr, "Error: Could not read directory '%s'\n", directory);
+        return false;
+    }
+    if (count == 0) {
+        fprintf(stderr, "Error: No .c files in directory '%s'\n", directory);
+        free(paths);
+        return false;
+    }
+    char** owned = realloc(inputs->owned, (inputs->owned_count + count) * sizeof(char*));
+    if (!owned) {
+        for (size_t i = 0; i < count; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+    inputs->owned = owned;
+    memcpy(owned + inputs->owned_count, paths, count * sizeof(char*));
+    inputs->owned_count += count;
+    free(paths);
+
+    for (size_t i = 0; i < count; i++) {
+        if (!add_input(inputs, owned[inputs->owned_count - count + i])) return false;
+    }
+    return true;
+}
+
+static void free_inputs(InputList* inputs) {
+    for (size_t i = 0; i < inputs->owned_count; i++) {
+        free(inputs->owned[i]);
+    }
+    free(inputs->owned);
+    free(inputs->files);
+}
+
+static bool parse_count(const char* text, size_t* out) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (*text < '0' || *text > '9' || *end != '\0') return false;
+    *out = (size_t)value;
+    return true;
 }
 
 int main(int argc, char* argv[]) {
@@ -13,8 +150,23 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
-    const char* input_file = NULL;
-    const char* output_file = "a.out";
+    InputList inputs = { calloc(argc, sizeof(char*)), 0, (size_t)argc, NULL, 0 };
+    const char* output_file = NULL;
+    bool emit = false;
+    if (!inputs.files) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    CompileOptions options;
+    compile_options_init(&options);
+    const char** include_paths = calloc(argc, sizeof(char*));
+    const char** defines = calloc(argc, sizeof(char*));
+    if (!include_paths || !defines) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    options.include_paths = include_paths;
+    options.defines = defines;
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
@@ -24,22 +176,145 @@ int main(int argc, char* argv[]) {
                 return 1;
             }
             output_file = argv[++i];
+        } else if (strcmp(argv[i], "--emit-pch") == 0) {
+            emit = true;
+        } else if (strcmp(argv[i], "--include-pch") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --include-pch requires a precompiled header\n");
+                return 1;
+            }
+            options.include_pch = argv[++i];
+        } else if (strncmp(argv[i], "-I", 2) == 0 || strncmp(argv[i], "-D", 2) == 0) {
+            // The value joined to the flag, or the next argument
+            char flag = argv[i][1];
+            const char* value = argv[i][2] ? argv[i] + 2 : i + 1 < argc ? argv[++i] : NULL;
+            if (!value) {
+                fprintf(stderr, "Error: -%c requires %s\n", flag, flag == 'I' ? "a directory" : "a macro name");
+                return 1;
+            }
+            if (flag == 'I') include_paths[options.include_path_count++] = value;
+            else defines[options.define_count++] = value;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            options.output_kind = OUTPUT_ASSEMBLY;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            options.output_kind = OUTPUT_OBJECT;
+        } else if (strcmp(argv[i], "-fno-regalloc") == 0) {
+            options.regalloc = false;
+        } else if (strcmp(argv[i], "-fno-fold") == 0) {
+            options.fold = false;
+        } else if (strcmp(argv[i], "-fno-const-eval") == 0) {
+            options.const_eval = false;
+        } else if (strcmp(argv[i], "-fno-hash-cons") == 0) {
+            options.hash_cons = false;
+        } else if (strcmp(argv[i], "-fno-tail-calls") == 0) {
+            options.tail_calls = false;
+        } else if (strcmp(argv[i], "-fno-inline") == 0) {
+            options.inline_calls = false;
+        } else if (strncmp(argv[i], "-finline-threshold=", 19) == 0) {
+            if (!parse_count(argv[i] + 19, &options.inline_threshold)) {
+                fprintf(stderr, "Error: Invalid value in '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-Rpass=inline") == 0) {
+            options.remark_inline = true;
+        } else if (strcmp(argv[i], "-Rpass-missed=inline") == 0) {
+            options.remark_inline_missed = true;
+        } else if (strcmp(argv[i], "-fno-sccp") == 0) {
+            options.sccp = false;
+        } else if (strcmp(argv[i], "-fno-simplify-cfg") == 0) {
+            options.simplify_cfg = false;
+        } else if (strcmp(argv[i], "-fno-gvn") == 0) {
+            options.gvn = false;
+        } else if (strcmp(argv[i], "-fno-licm") == 0) {
+            options.licm = false;
+        } else if (strcmp(argv[i], "-fno-strength-reduce") == 0) {
+            options.strength_reduce = false;
+        } else if (strcmp(argv[i], "-fno-dce") == 0) {
+            options.dce = false;
+        } else if (strcmp(argv[i], "-fno-prune-unreachable") == 0) {
+            options.prune_unreachable = false;
+        } else if (strcmp(argv[i], "-funity") == 0) {
+            options.unity = true;
+        } else if (strncmp(argv[i], "-fconst-eval-steps=", 19) == 0) {
+            if (!parse_count(argv[i] + 19, &options.const_eval_steps)) {
+                fprintf(stderr, "Error: Invalid value in '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "-fconst-eval-depth=", 19) == 0) {
+            if (!parse_count(argv[i] + 19, &options.const_eval_depth)) {
+                fprintf(stderr, "Error: Invalid value in '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "-ftier-threshold=", 17) == 0) {
+            if (!parse_count(argv[i] + 17, &options.tier_threshold)) {
+                fprintf(stderr, "Error: Invalid value in '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "-fthreads=", 10) == 0) {
+            if (!parse_count(argv[i] + 10, &options.threads)) {
+                fprintf(stderr, "Error: Invalid value in '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-fno-io-uring") == 0) {
+            options.io_uring = false;
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            options.dump_ir = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = true;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            options.run = RUN_VM;
+        } else if (strcmp(argv[i], "--run=tree") == 0) {
+            options.run = RUN_TREE;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            options.run = RUN_JIT;
+        } else if (strcmp(argv[i], "--tiered") == 0) {
+            options.run = RUN_TIERED;
         } else if (argv[i][0] == '-') {
             fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
             return 1;
         } else {
-            if (input_file) {
-                fprintf(stderr, "Error: Multiple input files not supported\n");
+            struct stat st;
+            bool added = stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)
+                             ? add_directory(&inputs, argv[i])
+                             : add_input(&inputs, argv[i]);
+            if (!added) {
+                free_inputs(&inputs);
                 return 1;
             }
-            input_file = argv[i];
         }
     }
     
-    if (!input_file) {
+    if (inputs.count == 0) {
         fprintf(stderr, "Error: No input file specified\n");
         return 1;
     }
     
-    return compile_file(input_file, output_file);
+    // A .s output name selects assembly output
+    if (output_file) {
+        size_t len = strlen(output_file);
+        if (len > 2 && strcmp(output_file + len - 2, ".s") == 0) {
+            options.output_kind = OUTPUT_ASSEMBLY;
+        }
+    }
+    
+    if (emit && inputs.count > 1) {
+        fprintf(stderr, "Error: --emit-pch takes a single header\n");
+        free_inputs(&inputs);
+        return 1;
+    }
+    
+    if (options.unity && options.run != RUN_NONE) {
+        fprintf(stderr, "Error: -funity cannot be combined with --run, --jit or --tiered\n");
+        free_inputs(&inputs);
+        return 1;
+    }
+    
+    int result = emit ? emit_pch(inputs.files[0], output_file, &options)
+                 : options.run != RUN_NONE
+                     ? run_files(inputs.files, inputs.count, &options)
+                     : compile_files(inputs.files, inputs.count, output_file, &options);
+    free_inputs(&inputs);
+    free(include_paths);
+    free(defines);
+    return result;
 }
@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L  // For strdup
+#include "object.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Byte buffers
+bool buffer_reserve(ByteBuffer* buffer, size_t size) {
+    if (buffer->size + size <= buffer->capacity) return true;
+    size_t new_capacity = buffer->capacity == 0 ? 256 : buffer->capacity;
+    while (new_capacity < buffer->size + size) new_capacity *= 2;
+    unsigned char* new_data = realloc(buffer->data, new_capacity);
+    if (!new_data) return false;
+    buffer->data = new_data;
+    buffer->capacity = new_capacity;
+    return true;
+}
+
+bool buffer_append(ByteBuffer* buffer, const void* bytes, size_t size) {
+    if (!buffer_reserve(buffer, size)) return false;
+    memcpy(buffer->data + buffer->size, bytes, size);
+    buffer->size += size;
+    return true;
+}
+
+void buffer_free(ByteBuffer* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+// Objects
+void object_init(ObjectFile* obj) {
+    memset(obj, 0, sizeof(*obj));
+}
+
+void object_free(ObjectFile* obj) {
+    buffer_free(&obj->text);
+    buffer_free(&obj->data);
+    for (size_t i = 0; i < obj->symbol_count; i++) {
+        free(obj->symbols[i].name);
+    }
+    free(obj->symbols);
+    free(obj->relocs);
+    free(obj->symbol_index);
+    memset(obj, 0, sizeof(*obj));
+}
+
+static uint64_t hash_name(const char* name) {
+    uint64_t hash = 1469598103934665603ULL;   // FNV-1a
+    for (; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool rebuild_index(ObjectFile* obj, size_t capacity) {
+    size_t* index = malloc(capacity * sizeof(size_t));
+    if (!index) return false;
+    for (size_t i = 0; i < capacity; i++) index[i] = OBJ_NO_SYMBOL;
+
+    for (size_t s = 0; s < obj->symbol_count; s++) {
+        size_t slot = hash_name(obj->symbols[s].name) & (capacity - 1);
+        while (index[slot] != OBJ_NO_SYMBOL) slot = (slot + 1) & (capacity - 1);
+        index[slot] = s;
+    }
+
+    free(obj->symbol_index);
+    obj->symbol_index = index;
+    obj->index_capacity = capacity;
+    return true;
+}
+
+size_t object_find_symbol(const ObjectFile* obj, const char* name) {
+    if (obj->index_capacity == 0) return OBJ_NO_SYMBOL;
+    size_t slot = hash_name(name) & (obj->index_capacity - 1);
+    while (obj->symbol_index[slot] != OBJ_NO_SYMBOL) {
+        size_t s = obj->symbol_index[slot];
+        if (strcmp(obj->symbols[s].name, name) == 0) return s;
+        slot = (slot + 1) & (obj->index_capacity - 1);
+    }
+    return OBJ_NO_SYMBOL;
+}
+
+size_t object_symbol(ObjectFile* obj, const char* name) {
+    size_t existing = object_find_symbol(obj, name);
+    if (existing != OBJ_NO_SYMBOL) return existing;
+
+    if (obj->symbol_count >= obj->symbol_capacity) {
+        size_t new_capacity = obj->symbol_capacity == 0 ? 16 : obj->symbol_capacity * 2;
+        ObjSymbol* new_symbols = realloc(obj->symbols, new_capacity * sizeof(ObjSymbol));
+        if (!new_symbols) return OBJ_NO_SYMBOL;
+        obj->symbols = new_symbols;
+        obj->symbol_capacity = new_capacity;
+    }
+
+    // Keep the hash table at most half full
+    if ((obj->symbol_count + 1) * 2 > obj->index_capacity) {
+        size_t capacity = obj->index_capacity == 0 ? 32 : obj->index_capacity * 2;
+        if (!rebuild_index(obj, capacity)) return OBJ_NO_SYMBOL;
+    }
+
+    ObjSymbol* symbol = &obj->symbols[obj->symbol_count];
+    memset(symbol, 0, sizeof(*symbol));
+    symbol->name = strdup(name);
+    if (!symbol->name) return OBJ_NO_SYMBOL;
+    symbol->section = OBJ_SECTION_UNDEF;
+
+    size_t slot = hash_name(name) & (obj->index_capacity - 1);
+    while (obj->symbol_index[slot] != OBJ_NO_SYMBOL) slot = (slot + 1) & (obj->index_capacity - 1);
+    obj->symbol_index[slot] = obj->symbol_count;
+    return obj->symbol_count++;
+}
+
+bool object_add_reloc(ObjectFile* obj, uint64_t offset, size_t symbol, RelocType type, int64_t addend) {
+    if (obj->reloc_count >= obj->reloc_capacity) {
+        size_t new_capacity = obj->reloc_capacity == 0 ? 16 : obj->reloc_capacity * 2;
+        ObjReloc* new_relocs = realloc(obj->relocs, new_capacity * sizeof(ObjReloc));
+        if (!new_relocs) return false;
+        obj->relocs = new_relocs;
+        obj->reloc_capacity = new_capacity;
+    }
+    ObjReloc* reloc = &obj->relocs[obj->reloc_count++];
+    reloc->offset = offset;
+    reloc->symbol = symbol;
+    reloc->type = type;
+    reloc->addend = addend;
+    return true;
+}
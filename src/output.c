@@ -0,0 +1,111 @@
+#define _POSIX_C_SOURCE 200809L  // For open_memstream
+#include "output.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef IOV_MAX
+#define OUTPUT_IOV_MAX IOV_MAX
+#else
+#define OUTPUT_IOV_MAX 16       // The least POSIX allows
+#endif
+
+static _Atomic size_t total_writes;
+static _Atomic size_t total_bytes;
+static _Thread_local OutputBuffer* current;
+
+bool output_open(OutputBuffer* buffer) {
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->stream = open_memstream(&buffer->data, &buffer->size);
+    return buffer->stream != NULL;
+}
+
+void output_close(OutputBuffer* buffer) {
+    if (current == buffer) current = NULL;
+    if (buffer->stream) fclose(buffer->stream);
+    free(buffer->data);
+    buffer->stream = NULL;
+    buffer->data = NULL;
+    buffer->size = 0;
+}
+
+bool output_writev(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        // Empty entries would stall the loop below after a short write
+        if (iov->iov_len == 0) {
+            iov++;
+            count--;
+            continue;
+        }
+        ssize_t written = writev(fd, iov, count < OUTPUT_IOV_MAX ? count : OUTPUT_IOV_MAX);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        atomic_fetch_add(&total_writes, 1);
+        atomic_fetch_add(&total_bytes, (size_t)written);
+
+        size_t left = (size_t)written;
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+bool output_flush(OutputBuffer* buffers, size_t count, int fd) {
+    struct iovec small[8];
+    struct iovec* iov = count <= 8 ? small : malloc(count * sizeof(struct iovec));
+    if (!iov) return false;
+
+    int used = 0;
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        OutputBuffer* buffer = &buffers[i];
+        if (!buffer->stream) continue;
+        if (fflush(buffer->stream) != 0) ok = false;
+        if (buffer->size == 0) continue;
+        iov[used].iov_base = buffer->data;
+        iov[used].iov_len = buffer->size;
+        used++;
+    }
+    ok = output_writev(fd, iov, used) && ok;
+
+    // Start over; the next flush updates size to the new position
+    for (size_t i = 0; i < count; i++) {
+        if (buffers[i].stream && buffers[i].size > 0) fseeko(buffers[i].stream, 0, SEEK_SET);
+    }
+    if (iov != small) free(iov);
+    return ok;
+}
+
+bool output_write_file(OutputBuffer* buffer, const char* path, unsigned mode) {
+    if (!buffer->stream) return false;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, (mode_t)mode);
+    if (fd < 0) return false;
+    bool ok = output_flush(buffer, 1, fd);
+    return close(fd) == 0 && ok;
+}
+
+FILE* diagnostics(void) {
+    return current && current->stream ? current->stream : stderr;
+}
+
+void diagnostics_set(OutputBuffer* buffer) {
+    current = buffer;
+}
+
+void output_stats(OutputStats* stats) {
+    stats->writes = atomic_load(&total_writes);
+    stats->bytes = atomic_load(&total_bytes);
+}
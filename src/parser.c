@@ -1,13 +1,15 @@
-#define _POSIX_C_SOURCE 200809L  // For strdup
 #include "parser.h"
+#include "optimize.h"
+#include "preprocess.h"
+#include "pch.h"
+#include "intern.h"
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdio.h>
 
 // Forward declarations
 static ASTNode* create_node(NodeType type);
-static Token get_next_token(struct Parser* parser);
 static bool expect(struct Parser* parser, TokenType type);
 static ASTNode* parse_function(struct Parser* parser);
 static ASTNode* parse_statement(struct Parser* parser);
@@ -16,187 +18,116 @@ static ASTNode* parse_primary(struct Parser* parser);
 static ASTNode* parse_variable_declaration(struct Parser* parser);
 static ASTNode* parse_if_statement(struct Parser* parser);
 static ASTNode* parse_while_statement(struct Parser* parser);
+static ASTNode* parse_switch_statement(struct Parser* parser);
 static ASTNode* parse_block(struct Parser* parser);
 static ASTNode* parse_function_call(struct Parser* parser, const char* name);
 static ASTNode* parse_declaration(struct Parser* parser);
+static bool load_globals(struct Parser* parser);
+static bool load_declarations(struct Parser* parser, ASTNode* program);
 
 // Helper functions
-static void set_error(struct Parser* parser, const char* message) {
-    if (parser) {
-        parser->error = message;
+static void add_diagnostic(struct Parser* parser, const char* file, int line, int column, const char* message) {
+    if (parser->diagnostic_count == PARSER_MAX_DIAGNOSTICS) {
+        parser->truncated = true;
+        return;
     }
-}
-
-static char get_next_char(struct Parser* parser) {
-    if (parser->position >= parser->source_length) {
-        return EOF;
+    // Kept in source order: a check made at the end of a construct can
+    // find an error before ones already reported inside it. Errors in
+    // different files stay in the order they were found.
+    size_t i = parser->diagnostic_count++;
+    for (; i > 0; i--) {
+        const ParseDiagnostic* previous = &parser->diagnostics[i - 1];
+        if (previous->file != file) break;
+        if (previous->line < line || (previous->line == line && previous->column <= column)) break;
+        parser->diagnostics[i] = *previous;
     }
-    return parser->source[parser->position++];
+    ParseDiagnostic* diagnostic = &parser->diagnostics[i];
+    diagnostic->file = file;
+    diagnostic->line = line;
+    diagnostic->column = column;
+    snprintf(diagnostic->message, sizeof(diagnostic->message), "%s", message);
+    parser->error = parser->diagnostics[0].message;
 }
 
-static void skip_whitespace(struct Parser* parser) {
-    while (parser->position < parser->source_length) {
-        char c = parser->source[parser->position];
-        
-        if (isspace(c)) {
-            if (c == '\n') {
-                parser->line++;
-                parser->column = 0;
-            } else {
-                parser->column++;
-            }
-            parser->position++;
-            continue;
-        }
-        
-        // Skip single-line comments
-        if (c == '/' && parser->position + 1 < parser->source_length) {
-            if (parser->source[parser->position + 1] == '/') {
-                parser->position += 2;
-                parser->column += 2;
-                
-                while (parser->position < parser->source_length && 
-                       parser->source[parser->position] != '\n') {
-                    parser->position++;
-                    parser->column++;
-                }
-                continue;
-            }
-        }
-        
-        break;
-    }
+void parser_report(struct Parser* parser, int line, int column, const char* format, ...) {
+    // Until the parser resynchronizes, errors are most likely knock-on
+    // effects of this one
+    if (parser->panicking) return;
+    parser->panicking = true;
+    char message[sizeof(parser->diagnostics[0].message)];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    add_diagnostic(parser, parser->current.file, line, column, message);
 }
 
-static bool is_keyword(const char* text, const char* keyword) {
-    return strcmp(text, keyword) == 0;
+void parser_report_in(struct Parser* parser, const char* file, int line, int column, bool resync,
+                      const char* format, ...) {
+    if (resync) {
+        if (parser->panicking) return;
+        parser->panicking = true;
+    }
+    char message[sizeof(parser->diagnostics[0].message)];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    add_diagnostic(parser, file, line, column, message);
 }
 
-static Token get_next_token(struct Parser* parser) {
-    Token token = {0};
-    token.line = parser->line;
-    token.column = parser->column;
-    
-    skip_whitespace(parser);
-    
-    if (parser->position >= parser->source_length) {
+// The next token after current, through the lookahead. A malformed token
+// is reported once it becomes current.
+static Token next_token(struct Parser* parser) {
+    Token token;
+    if (parser->truncated) {
+        token = parser->current;
         token.type = TOKEN_EOF;
         return token;
     }
-    
-    char c = get_next_char(parser);
-    
-    // Handle identifiers and keywords
-    if (isalpha(c) || c == '_') {
-        size_t start = parser->position - 1;
-        while (parser->position < parser->source_length && 
-               (isalnum(parser->source[parser->position]) || parser->source[parser->position] == '_')) {
-            parser->position++;
-            parser->column++;
-        }
-        
-        size_t len = parser->position - start;
-        char* text = malloc(len + 1);
-        strncpy(text, &parser->source[start], len);
-        text[len] = '\0';
-        
-        // Check for keywords
-        if (strcmp(text, "int") == 0) token.type = TOKEN_INT;
-        else if (strcmp(text, "return") == 0) token.type = TOKEN_RETURN;
-        else if (strcmp(text, "if") == 0) token.type = TOKEN_IF;
-        else if (strcmp(text, "else") == 0) token.type = TOKEN_ELSE;
-        else if (strcmp(text, "while") == 0) token.type = TOKEN_WHILE;
-        else {
-            token.type = TOKEN_IDENTIFIER;
-            token.value.identifier = text;
-            return token;
-        }
-        
-        free(text);
-        return token;
-    }
-    
-    // Handle numbers
-    if (isdigit(c)) {
-        int64_t value = 0;
-        size_t start = parser->position - 1;
-        
-        while (parser->position < parser->source_length && isdigit(parser->source[parser->position])) {
-            value = value * 10 + (parser->source[parser->position] - '0');
-            parser->position++;
-            parser->column++;
-        }
-        
-        size_t len = parser->position - start;
-        char* text = malloc(len + 1);
-        strncpy(text, &parser->source[start], len);
-        text[len] = '\0';
-        
-        token.type = TOKEN_NUMBER;
-        token.value.number = value;
-        free(text);
-        return token;
+    if (parser->lookahead_count > 0) {
+        token = parser->lookahead[0];
+        parser->lookahead[0] = parser->lookahead[1];
+        parser->lookahead_count--;
+    } else {
+        token = preprocess_token(parser->preprocessor);
     }
-    
-    // Handle operators and delimiters
-    parser->position++;
-    parser->column++;
-    
-    switch (c) {
-        case '(': token.type = TOKEN_LPAREN; break;
-        case ')': token.type = TOKEN_RPAREN; break;
-        case '{': token.type = TOKEN_LBRACE; break;
-        case '}': token.type = TOKEN_RBRACE; break;
-        case ';': token.type = TOKEN_SEMICOLON; break;
-        case ',': token.type = TOKEN_COMMA; break;
-        case '+': token.type = TOKEN_PLUS; break;
-        case '-': token.type = TOKEN_MINUS; break;
-        case '*': token.type = TOKEN_STAR; break;
-        case '/': token.type = TOKEN_SLASH; break;
-        case '=':
-            if (parser->position < parser->source_length && parser->source[parser->position] == '=') {
-                parser->position++;
-                parser->column++;
-                token.type = TOKEN_EQ;
-            } else {
-                token.type = TOKEN_ASSIGN;
-            }
-            break;
-        case '!':
-            if (parser->position < parser->source_length && parser->source[parser->position] == '=') {
-                parser->position++;
-                parser->column++;
-                token.type = TOKEN_NEQ;
-            } else {
-                token.type = TOKEN_ERROR;
-            }
-            break;
-        case '<':
-            if (parser->position < parser->source_length && parser->source[parser->position] == '=') {
-                parser->position++;
-                parser->column++;
-                token.type = TOKEN_LTE;
-            } else {
-                token.type = TOKEN_LT;
-            }
-            break;
-        case '>':
-            if (parser->position < parser->source_length && parser->source[parser->position] == '=') {
-                parser->position++;
-                parser->column++;
-                token.type = TOKEN_GTE;
-            } else {
-                token.type = TOKEN_GT;
-            }
-            break;
-        default:
-            token.type = TOKEN_ERROR;
-            break;
+    parser->consumed++;
+    if (token.type == TOKEN_ERROR) {
+        parser_report_in(parser, token.file, token.line, token.column, true, "%s", token.text);
     }
-    
     return token;
 }
 
+// The token n places past current, without consuming anything
+static const Token* peek_token(struct Parser* parser, size_t n) {
+    while (parser->lookahead_count <= n) {
+        parser->lookahead[parser->lookahead_count++] = preprocess_token(parser->preprocessor);
+    }
+    return &parser->lookahead[n];
+}
+
+// A syntax error at the current token
+static void set_error(struct Parser* parser, const char* message) {
+    parser_report(parser, parser->current.line, parser->current.column, "%s", message);
+}
+
+// An error that leaves the parser where it would be without it, such as a
+// duplicate case value, so parsing goes on without skipping anything
+static void report_in_place(struct Parser* parser, int line, int column, const char* message) {
+    if (!parser->panicking) add_diagnostic(parser, parser->current.file, line, column, message);
+}
+
+// Tokens the lexer knows but the grammar does not use yet get a clearer
+// message than an unexpected token
+static bool unsupported_operator(struct Parser* parser) {
+    TokenType type = parser->current.type;
+    if (type < TOKEN_LBRACKET || type >= TOKEN_TYPE_COUNT) return false;
+    parser_report(parser, parser->current.line, parser->current.column,
+                  "Operator '%s' is not supported", token_spelling(type));
+    return true;
+}
+
 static int get_precedence(BinaryOp op) {
     switch (op) {
         case OP_ASSIGN:
@@ -245,30 +176,37 @@ static ASTNode* parse_primary(struct Parser* parser) {
         num->data.number.value = parser->current.value.number;
         num->line = parser->current.line;
         num->column = parser->current.column;
-        parser->current = get_next_token(parser);
+        parser->current = next_token(parser);
         return num;
     }
     
     if (parser->current.type == TOKEN_IDENTIFIER) {
         const char* name = parser->current.value.identifier;
-        parser->current = get_next_token(parser);
+        int line = parser->current.line;
+        int column = parser->current.column;
+        parser->current = next_token(parser);
         
         // Check if this is a function call
         if (parser->current.type == TOKEN_LPAREN) {
-            return parse_function_call(parser, name);
+            ASTNode* call = parse_function_call(parser, name);
+            if (call) {
+                call->line = line;
+                call->column = column;
+            }
+            return call;
         }
         
         // Otherwise, it's a variable reference
         Symbol* symbol = scope_find(parser->current_scope, name);
         if (!symbol) {
-            set_error(parser, "Undefined variable");
+            parser_report(parser, line, column, "Undefined variable '%s'", name);
             return NULL;
         }
         
         ASTNode* var = create_node(NODE_VARIABLE);
         if (!var) return NULL;
         
-        var->data.variable.name = strdup(name);
+        var->data.variable.name = intern(name);
         var->line = parser->current.line;
         var->column = parser->current.column;
         
@@ -280,7 +218,7 @@ static ASTNode* parse_primary(struct Parser* parser) {
                 return NULL;
             }
             
-            parser->current = get_next_token(parser);
+            parser->current = next_token(parser);
             ASTNode* value = parse_expression(parser);
             if (!value) {
                 ast_destroy(var);
@@ -290,7 +228,7 @@ static ASTNode* parse_primary(struct Parser* parser) {
             
             assign->data.assignment.name = var->data.variable.name;
             assign->data.assignment.value = value;
-            free(var);  // Free the variable node but keep its name
+            free(var);
             return assign;
         }
         
@@ -298,7 +236,7 @@ static ASTNode* parse_primary(struct Parser* parser) {
     }
     
     if (parser->current.type == TOKEN_LPAREN) {
-        parser->current = get_next_token(parser);
+        parser->current = next_token(parser);
         ASTNode* expr = parse_expression(parser);
         if (!expr || !expect(parser, TOKEN_RPAREN)) {
             ast_destroy(expr);
@@ -307,7 +245,7 @@ static ASTNode* parse_primary(struct Parser* parser) {
         return expr;
     }
     
-    set_error(parser, "Expected expression");
+    if (!unsupported_operator(parser)) set_error(parser, "Expected expression");
     return NULL;
 }
 
@@ -317,9 +255,16 @@ static ASTNode* parse_expression_precedence(struct Parser* parser, int min_prece
     
     while (true) {
         BinaryOp op = get_binary_op(parser->current.type);
+        if ((int)op < 0 && unsupported_operator(parser)) {
+            ast_destroy(left);
+            return NULL;
+        }
         if ((int)op < 0 || get_precedence(op) < min_precedence) break;
         
-        parser->current = get_next_token(parser);
+        // Binary nodes are located at their operator
+        int line = parser->current.line;
+        int column = parser->current.column;
+        parser->current = next_token(parser);
         
         int next_min_precedence = get_precedence(op) + 1;
         ASTNode* right = parse_expression_precedence(parser, next_min_precedence);
@@ -336,6 +281,8 @@ static ASTNode* parse_expression_precedence(struct Parser* parser, int min_prece
         }
         
         binary->data.binary.op = op;
+        binary->line = line;
+        binary->column = column;
         binary->data.binary.left = left;
         binary->data.binary.right = right;
         left = binary;
@@ -353,9 +300,7 @@ static bool expect(struct Parser* parser, TokenType type) {
         set_error(parser, "Unexpected token");
         return false;
     }
-    Token old = parser->current;
-    parser->current = get_next_token(parser);
-    free((void*)old.text);
+    parser->current = next_token(parser);
     return true;
 }
 
@@ -381,8 +326,10 @@ static ASTNode* parse_function(struct Parser* parser) {
     ASTNode* func = create_node(NODE_FUNCTION);
     if (!func) return NULL;
     
-    func->data.function.name = strdup(parser->current.value.identifier);
-    parser->current = get_next_token(parser);
+    func->data.function.name = intern(parser->current.value.identifier);
+    func->line = parser->current.line;
+    func->column = parser->current.column;
+    parser->current = next_token(parser);
     
     // Create new scope for function parameters
     Scope* param_scope = create_scope(parser->current_scope);
@@ -416,15 +363,26 @@ static ASTNode* parse_function(struct Parser* parser) {
         // Add parameter to symbol table
         Symbol* param = create_symbol(parser->current.value.identifier, SYMBOL_VARIABLE);
         if (!param || !scope_add(parser->current_scope, param)) {
+            set_error(parser, "Duplicate parameter name");
+            ast_destroy(func);
+            return NULL;
+        }
+        
+        // Record parameter name on the function node
+        const char** new_params = realloc(func->data.function.params,
+                                          (func->data.function.param_count + 1) * sizeof(char*));
+        if (!new_params) {
             ast_destroy(func);
             return NULL;
         }
+        func->data.function.params = new_params;
+        func->data.function.params[func->data.function.param_count++] = param->name;
         
-        parser->current = get_next_token(parser);
+        parser->current = next_token(parser);
         
         // Check for more parameters
         if (parser->current.type == TOKEN_COMMA) {
-            parser->current = get_next_token(parser);
+            parser->current = next_token(parser);
             continue;
         }
         
@@ -440,12 +398,6 @@ static ASTNode* parse_function(struct Parser* parser) {
         return NULL;
     }
     
-    // Parse function body
-    if (!expect(parser, TOKEN_LBRACE)) {
-        ast_destroy(func);
-        return NULL;
-    }
-    
     // Create new scope for function body
     Scope* body_scope = create_scope(parser->current_scope);
     if (!body_scope) {
@@ -454,53 +406,129 @@ static ASTNode* parse_function(struct Parser* parser) {
     }
     parser->current_scope = body_scope;
     
-    // Parse statements
-    ASTNode* body = create_node(NODE_BLOCK);
+    // Parse function body
+    ASTNode* body = parse_block(parser);
     if (!body) {
         ast_destroy(func);
         return NULL;
     }
     
-    body->data.block.statements = NULL;
-    body->data.block.count = 0;
-    body->data.block.capacity = 0;
+    // Restore outer scope, dropping the body and parameter scopes
+    parser->current_scope = param_scope->parent;
+    destroy_scope(body_scope);
+    destroy_scope(param_scope);
     
-    while (parser->current.type != TOKEN_RBRACE) {
+    func->data.function.body = body;
+    return func;
+}
+
+// Consume the current token
+static void advance(struct Parser* parser) {
+    parser->current = next_token(parser);
+}
+
+static bool starts_statement(TokenType type) {
+    switch (type) {
+        case TOKEN_INT:
+        case TOKEN_IF:
+        case TOKEN_WHILE:
+        case TOKEN_SWITCH:
+        case TOKEN_RETURN:
+        case TOKEN_BREAK:
+        case TOKEN_CASE:
+        case TOKEN_DEFAULT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Panic-mode recovery after a statement or declaration failed to parse:
+// skip to where parsing can resume. In a block that is past a ';' or a
+// whole '{...}', or at a keyword that starts a statement or the '}' that
+// closes the block; at the top level it is an 'int' outside any braces.
+// start is parser->consumed when the failed parse began; if nothing was
+// consumed since, the offending token goes first, so recovery always
+// makes progress.
+static void synchronize(struct Parser* parser, size_t start, bool top_level) {
+    if (parser->truncated) {
+        advance(parser);
+        return;
+    }
+    if (parser->consumed == start && parser->current.type != TOKEN_EOF &&
+        (top_level || parser->current.type != TOKEN_RBRACE)) {
+        advance(parser);
+    }
+    
+    int depth = 0;
+    while (parser->current.type != TOKEN_EOF) {
+        TokenType type = parser->current.type;
+        if (depth == 0) {
+            if (top_level && type == TOKEN_INT) break;
+            if (!top_level && (type == TOKEN_RBRACE || starts_statement(type))) break;
+        }
+        if (type == TOKEN_LBRACE) depth++;
+        else if (type == TOKEN_RBRACE && depth > 0) depth--;
+        advance(parser);
+        if (!top_level && depth == 0 && type == TOKEN_SEMICOLON) break;
+        // A block ends the statement unless an else carries it on
+        if (!top_level && depth == 0 && type == TOKEN_RBRACE && parser->current.type != TOKEN_ELSE) break;
+    }
+    
+    // Errors from here on are new ones, except at the end of the input,
+    // where they can only be about what the failed part left unclosed
+    if (parser->current.type != TOKEN_EOF) parser->panicking = false;
+}
+
+// Stand a NODE_ERROR, located where the failed part began, in for it
+static ASTNode* recover(struct Parser* parser, size_t start, int line, int column, bool top_level) {
+    synchronize(parser, start, top_level);
+    ASTNode* error = create_node(NODE_ERROR);
+    if (error) {
+        error->line = line;
+        error->column = column;
+    }
+    return error;
+}
+
+static bool append_statement(ASTNode* block, ASTNode* stmt) {
+    if (block->data.block.count >= block->data.block.capacity) {
+        size_t new_capacity = block->data.block.capacity == 0 ? 4 : block->data.block.capacity * 2;
+        ASTNode** new_statements = realloc(block->data.block.statements, new_capacity * sizeof(ASTNode*));
+        if (!new_statements) return false;
+        block->data.block.statements = new_statements;
+        block->data.block.capacity = new_capacity;
+    }
+    block->data.block.statements[block->data.block.count++] = stmt;
+    return true;
+}
+
+// '{' statements '}'. A statement that fails to parse leaves a NODE_ERROR
+// in its place and the rest of the block is parsed as usual.
+static ASTNode* parse_block(struct Parser* parser) {
+    if (!expect(parser, TOKEN_LBRACE)) return NULL;
+    
+    ASTNode* block = create_node(NODE_BLOCK);
+    if (!block) return NULL;
+    
+    while (parser->current.type != TOKEN_RBRACE && parser->current.type != TOKEN_EOF) {
+        size_t start = parser->consumed;
+        int line = parser->current.line;
+        int column = parser->current.column;
         ASTNode* stmt = parse_statement(parser);
-        if (!stmt) {
-            ast_destroy(func);
-            ast_destroy(body);
+        if (!stmt) stmt = recover(parser, start, line, column, false);
+        if (!stmt || !append_statement(block, stmt)) {
+            ast_destroy(stmt);
+            ast_destroy(block);
             return NULL;
         }
-        
-        // Add statement to block
-        if (body->data.block.count >= body->data.block.capacity) {
-            size_t new_capacity = body->data.block.capacity == 0 ? 4 : body->data.block.capacity * 2;
-            ASTNode** new_statements = realloc(body->data.block.statements, new_capacity * sizeof(ASTNode*));
-            if (!new_statements) {
-                ast_destroy(func);
-                ast_destroy(body);
-                ast_destroy(stmt);
-                return NULL;
-            }
-            body->data.block.statements = new_statements;
-            body->data.block.capacity = new_capacity;
-        }
-        
-        body->data.block.statements[body->data.block.count++] = stmt;
     }
     
     if (!expect(parser, TOKEN_RBRACE)) {
-        ast_destroy(func);
-        ast_destroy(body);
+        ast_destroy(block);
         return NULL;
     }
-    
-    // Restore outer scope
-    parser->current_scope = parser->current_scope->parent;
-    
-    func->data.function.body = body;
-    return func;
+    return block;
 }
 
 static ASTNode* parse_if_statement(struct Parser* parser) {
@@ -513,105 +541,22 @@ static ASTNode* parse_if_statement(struct Parser* parser) {
         return NULL;
     }
     
-    if (!expect(parser, TOKEN_LBRACE)) {
-        ast_destroy(condition);
-        return NULL;
-    }
-    
-    ASTNode* then_branch = create_node(NODE_BLOCK);
+    ASTNode* then_branch = parse_block(parser);
     if (!then_branch) {
         ast_destroy(condition);
         return NULL;
     }
     
-    then_branch->data.block.statements = NULL;
-    then_branch->data.block.count = 0;
-    then_branch->data.block.capacity = 0;
-    
-    while (parser->current.type != TOKEN_RBRACE) {
-        ASTNode* stmt = parse_statement(parser);
-        if (!stmt) {
-            ast_destroy(condition);
-            ast_destroy(then_branch);
-            return NULL;
-        }
-        
-        // Add statement to block
-        if (then_branch->data.block.count >= then_branch->data.block.capacity) {
-            size_t new_capacity = then_branch->data.block.capacity == 0 ? 4 : then_branch->data.block.capacity * 2;
-            ASTNode** new_statements = realloc(then_branch->data.block.statements, new_capacity * sizeof(ASTNode*));
-            if (!new_statements) {
-                ast_destroy(condition);
-                ast_destroy(then_branch);
-                ast_destroy(stmt);
-                return NULL;
-            }
-            then_branch->data.block.statements = new_statements;
-            then_branch->data.block.capacity = new_capacity;
-        }
-        
-        then_branch->data.block.statements[then_branch->data.block.count++] = stmt;
-    }
-    
-    if (!expect(parser, TOKEN_RBRACE)) {
-        ast_destroy(condition);
-        ast_destroy(then_branch);
-        return NULL;
-    }
-    
     ASTNode* else_branch = NULL;
     if (parser->current.type == TOKEN_ELSE) {
-        parser->current = get_next_token(parser);
-        
-        if (!expect(parser, TOKEN_LBRACE)) {
-            ast_destroy(condition);
-            ast_destroy(then_branch);
-            return NULL;
-        }
+        parser->current = next_token(parser);
         
-        else_branch = create_node(NODE_BLOCK);
+        else_branch = parse_block(parser);
         if (!else_branch) {
             ast_destroy(condition);
             ast_destroy(then_branch);
             return NULL;
         }
-        
-        else_branch->data.block.statements = NULL;
-        else_branch->data.block.count = 0;
-        else_branch->data.block.capacity = 0;
-        
-        while (parser->current.type != TOKEN_RBRACE) {
-            ASTNode* stmt = parse_statement(parser);
-            if (!stmt) {
-                ast_destroy(condition);
-                ast_destroy(then_branch);
-                ast_destroy(else_branch);
-                return NULL;
-            }
-            
-            // Add statement to block
-            if (else_branch->data.block.count >= else_branch->data.block.capacity) {
-                size_t new_capacity = else_branch->data.block.capacity == 0 ? 4 : else_branch->data.block.capacity * 2;
-                ASTNode** new_statements = realloc(else_branch->data.block.statements, new_capacity * sizeof(ASTNode*));
-                if (!new_statements) {
-                    ast_destroy(condition);
-                    ast_destroy(then_branch);
-                    ast_destroy(else_branch);
-                    return NULL;
-                }
-                else_branch->data.block.statements = new_statements;
-                else_branch->data.block.capacity = new_capacity;
-            }
-            
-            else_branch->data.block.statements[else_branch->data.block.count++] = stmt;
-        }
-        
-        if (!expect(parser, TOKEN_RBRACE)) {
-            ast_destroy(condition);
-            ast_destroy(then_branch);
-            ast_destroy(else_branch);
-            return NULL;
-        }
     }
     
     ASTNode* if_stmt = create_node(NODE_IF_STMT);
@@ -638,66 +583,159 @@ static ASTNode* parse_while_statement(struct Parser* parser) {
         return NULL;
     }
     
-    if (!expect(parser, TOKEN_LBRACE)) {
+    parser->breakable++;
+    ASTNode* body = parse_block(parser);
+    parser->breakable--;
+    if (!body) {
         ast_destroy(condition);
         return NULL;
     }
     
-    ASTNode* body = create_node(NODE_BLOCK);
-    if (!body) {
+    ASTNode* while_stmt = create_node(NODE_WHILE_STMT);
+    if (!while_stmt) {
         ast_destroy(condition);
+        ast_destroy(body);
+        return NULL;
+    }
+    
+    while_stmt->data.while_stmt_node.condition = condition;
+    while_stmt->data.while_stmt_node.body = body;
+    return while_stmt;
+}
+
+// By value, then by position, so the first of equal labels comes first
+static int compare_labels(const void* a, const void* b) {
+    const ASTNode* x = *(const ASTNode* const*)a;
+    const ASTNode* y = *(const ASTNode* const*)b;
+    int64_t u = x->data.case_label.value;
+    int64_t v = y->data.case_label.value;
+    if (u != v) return (u > v) - (u < v);
+    if (x->line != y->line) return (x->line > y->line) - (x->line < y->line);
+    return (x->column > y->column) - (x->column < y->column);
+}
+
+// A 'case' or 'default' label, which stands among the statements of the
+// switch body itself; labels nested deeper are not supported
+static ASTNode* parse_case_label(struct Parser* parser) {
+    ASTNode* label = create_node(NODE_CASE);
+    if (!label) return NULL;
+    label->line = parser->current.line;
+    label->column = parser->current.column;
+    
+    if (parser->current.type == TOKEN_DEFAULT) {
+        parser->current = next_token(parser);
+        label->data.case_label.is_default = true;
+    } else {
+        parser->current = next_token(parser);
+        ASTNode* value = parse_expression(parser);
+        if (!value) {
+            ast_destroy(label);
+            return NULL;
+        }
+        bool constant = ast_constant_value(value, &label->data.case_label.value);
+        ast_destroy(value);
+        if (!constant) {
+            set_error(parser, "Case label is not a constant expression");
+            ast_destroy(label);
+            return NULL;
+        }
+    }
+    
+    if (!expect(parser, TOKEN_COLON)) {
+        ast_destroy(label);
         return NULL;
     }
+    return label;
+}
+
+static ASTNode* parse_switch_statement(struct Parser* parser) {
+    int line = parser->current.line;
+    int column = parser->current.column;
+    if (!expect(parser, TOKEN_SWITCH)) return NULL;
+    if (!expect(parser, TOKEN_LPAREN)) return NULL;
     
-    body->data.block.statements = NULL;
-    body->data.block.count = 0;
-    body->data.block.capacity = 0;
+    ASTNode* value = parse_expression(parser);
+    if (!value || !expect(parser, TOKEN_RPAREN) || !expect(parser, TOKEN_LBRACE)) {
+        ast_destroy(value);
+        return NULL;
+    }
     
-    while (parser->current.type != TOKEN_RBRACE) {
-        ASTNode* stmt = parse_statement(parser);
+    ASTNode* body = create_node(NODE_BLOCK);
+    ASTNode* switch_stmt = create_node(NODE_SWITCH_STMT);
+    if (!body || !switch_stmt) {
+        ast_destroy(value);
+        ast_destroy(body);
+        free(switch_stmt);
+        return NULL;
+    }
+    switch_stmt->line = line;
+    switch_stmt->column = column;
+    switch_stmt->data.switch_stmt_node.value = value;
+    switch_stmt->data.switch_stmt_node.body = body;
+    
+    size_t case_count = 0;
+    bool has_default = false;
+    parser->breakable++;
+    while (parser->current.type != TOKEN_RBRACE && parser->current.type != TOKEN_EOF) {
+        size_t start = parser->consumed;
+        int stmt_line = parser->current.line;
+        int stmt_column = parser->current.column;
+        bool is_label = parser->current.type == TOKEN_CASE || parser->current.type == TOKEN_DEFAULT;
+        ASTNode* stmt = is_label ? parse_case_label(parser) : parse_statement(parser);
+        if (!stmt) stmt = recover(parser, start, stmt_line, stmt_column, false);
         if (!stmt) {
-            ast_destroy(condition);
-            ast_destroy(body);
+            parser->breakable--;
+            ast_destroy(switch_stmt);
             return NULL;
         }
-        
-        // Add statement to block
-        if (body->data.block.count >= body->data.block.capacity) {
-            size_t new_capacity = body->data.block.capacity == 0 ? 4 : body->data.block.capacity * 2;
-            ASTNode** new_statements = realloc(body->data.block.statements, new_capacity * sizeof(ASTNode*));
-            if (!new_statements) {
-                ast_destroy(condition);
-                ast_destroy(body);
-                return NULL;
+        if (stmt->type == NODE_CASE && stmt->data.case_label.is_default) {
+            if (has_default) {
+                report_in_place(parser, stmt->line, stmt->column, "Multiple default labels in one switch");
             }
-            body->data.block.statements = new_statements;
-            body->data.block.capacity = new_capacity;
+            has_default = true;
+        } else if (stmt->type == NODE_CASE) {
+            case_count++;
+        }
+        if (!append_statement(body, stmt)) {
+            parser->breakable--;
+            ast_destroy(stmt);
+            ast_destroy(switch_stmt);
+            return NULL;
         }
-        
-        body->data.block.statements[body->data.block.count++] = stmt;
     }
+    parser->breakable--;
     
     if (!expect(parser, TOKEN_RBRACE)) {
-        ast_destroy(condition);
-        ast_destroy(body);
+        ast_destroy(switch_stmt);
         return NULL;
     }
     
-    ASTNode* while_stmt = create_node(NODE_WHILE_STMT);
-    if (!while_stmt) {
-        ast_destroy(condition);
-        ast_destroy(body);
+    // Sorted, equal case values end up next to each other
+    const ASTNode** labels = malloc((case_count + 1) * sizeof(ASTNode*));
+    if (!labels) {
+        ast_destroy(switch_stmt);
         return NULL;
     }
-    
-    while_stmt->data.while_stmt_node.condition = condition;
-    while_stmt->data.while_stmt_node.body = body;
-    return while_stmt;
+    size_t n = 0;
+    for (size_t i = 0; i < body->data.block.count; i++) {
+        const ASTNode* stmt = body->data.block.statements[i];
+        if (stmt->type == NODE_CASE && !stmt->data.case_label.is_default) {
+            labels[n++] = stmt;
+        }
+    }
+    qsort(labels, n, sizeof(ASTNode*), compare_labels);
+    for (size_t i = 1; i < n; i++) {
+        if (labels[i]->data.case_label.value == labels[i - 1]->data.case_label.value) {
+            report_in_place(parser, labels[i]->line, labels[i]->column, "Duplicate case value");
+        }
+    }
+    free(labels);
+    return switch_stmt;
 }
 
 static ASTNode* parse_variable_declaration(struct Parser* parser) {
     // Skip 'int' keyword, we already checked it
-    parser->current = get_next_token(parser);
+    parser->current = next_token(parser);
     
     // Get variable name
     if (parser->current.type != TOKEN_IDENTIFIER) {
@@ -728,12 +766,15 @@ static ASTNode* parse_variable_declaration(struct Parser* parser) {
         return NULL;
     }
     
-    var->data.variable.name = strdup(name);
-    parser->current = get_next_token(parser);
+    var->data.variable.name = intern(name);
+    var->data.variable.is_declaration = true;
+    var->line = parser->current.line;
+    var->column = parser->current.column;
+    parser->current = next_token(parser);
     
     // Check for initialization
     if (parser->current.type == TOKEN_ASSIGN) {
-        parser->current = get_next_token(parser);
+        parser->current = next_token(parser);
         
         // Create assignment node
         ASTNode* assign = create_node(NODE_ASSIGNMENT);
@@ -742,7 +783,10 @@ static ASTNode* parse_variable_declaration(struct Parser* parser) {
             return NULL;
         }
         
-        assign->data.assignment.name = strdup(name);
+        assign->data.assignment.name = intern(name);
+        assign->data.assignment.is_declaration = true;
+        assign->line = var->line;
+        assign->column = var->column;
         assign->data.assignment.value = parse_expression(parser);
         
         if (!assign->data.assignment.value) {
@@ -751,7 +795,6 @@ static ASTNode* parse_variable_declaration(struct Parser* parser) {
             return NULL;
         }
         
-        free(var->data.variable.name);
         free(var);
         var = assign;
     }
@@ -769,7 +812,7 @@ static ASTNode* parse_function_call(struct Parser* parser, const char* name) {
     ASTNode* call = create_node(NODE_CALL);
     if (!call) return NULL;
     
-    call->data.call.name = strdup(name);
+    call->data.call.name = intern(name);
     call->data.call.args = NULL;
     call->data.call.arg_count = 0;
     
@@ -834,11 +877,36 @@ static ASTNode* parse_statement(struct Parser* parser) {
         case TOKEN_WHILE:
             return parse_while_statement(parser);
             
+        case TOKEN_SWITCH:
+            return parse_switch_statement(parser);
+            
+        case TOKEN_BREAK: {
+            if (parser->breakable == 0) {
+                set_error(parser, "Break statement not within a loop or switch");
+                return NULL;
+            }
+            ASTNode* brk = create_node(NODE_BREAK);
+            if (!brk) return NULL;
+            brk->line = parser->current.line;
+            brk->column = parser->current.column;
+            parser->current = next_token(parser);
+            if (!expect(parser, TOKEN_SEMICOLON)) {
+                ast_destroy(brk);
+                return NULL;
+            }
+            return brk;
+        }
+        
+        case TOKEN_CASE:
+        case TOKEN_DEFAULT:
+            set_error(parser, "Case label not directly within a switch");
+            return NULL;
+            
         case TOKEN_RETURN: {
             ASTNode* ret = create_node(NODE_RETURN);
             if (!ret) return NULL;
             
-            parser->current = get_next_token(parser);
+            parser->current = next_token(parser);
             ret->data.ret.expr = parse_expression(parser);
             
             if (!ret->data.ret.expr || !expect(parser, TOKEN_SEMICOLON)) {
@@ -858,7 +926,7 @@ static ASTNode* parse_statement(struct Parser* parser) {
         }
         
         default:
-            set_error(parser, "Unexpected token in statement");
+            if (!unsupported_operator(parser)) set_error(parser, "Unexpected token in statement");
             return NULL;
     }
 }
@@ -870,29 +938,17 @@ static ASTNode* parse_declaration(struct Parser* parser) {
         return NULL;
     }
     
-    // Look ahead to see if this is a function or variable declaration
-    Token current = parser->current;
-    parser->current = get_next_token(parser);
-    
-    if (parser->current.type != TOKEN_IDENTIFIER) {
+    // Look ahead to see if this is a function or variable declaration;
+    // both paths parse from the type specifier
+    if (peek_token(parser, 0)->type != TOKEN_IDENTIFIER) {
+        advance(parser);
         set_error(parser, "Expected identifier after type specifier");
         return NULL;
     }
     
-    // Save identifier and look ahead
-    const char* name = parser->current.value.identifier;
-    parser->current = get_next_token(parser);
-    
-    // Function declaration if we see a left parenthesis
-    if (parser->current.type == TOKEN_LPAREN) {
-        // Restore state for function parsing
-        parser->current = current;
+    if (peek_token(parser, 1)->type == TOKEN_LPAREN) {
         return parse_function(parser);
     }
-    
-    // Otherwise, must be a variable declaration
-    // Restore state for variable parsing
-    parser->current = current;
     return parse_variable_declaration(parser);
 }
 
@@ -907,13 +963,30 @@ ASTNode* parse(struct Parser* parser) {
     program->data.block.statements = NULL;
     program->data.block.count = 0;
     program->data.block.capacity = 0;
+    if (parser->pch && !load_declarations(parser, program)) {
+        ast_destroy(program);
+        return NULL;
+    }
     
     // Parse declarations and functions
     while (parser->current.type != TOKEN_EOF) {
+        Scope* scope = parser->current_scope;
+        size_t start = parser->consumed;
+        int line = parser->current.line;
+        int column = parser->current.column;
         ASTNode* node = parse_declaration(parser);
         if (!node) {
-            ast_destroy(program);
-            return NULL;
+            // Drop the scopes of a function that failed part way
+            while (parser->current_scope != scope) {
+                Scope* parent = parser->current_scope->parent;
+                destroy_scope(parser->current_scope);
+                parser->current_scope = parent;
+            }
+            node = recover(parser, start, line, column, true);
+            if (!node) {
+                ast_destroy(program);
+                return NULL;
+            }
         }
         
         // Add to program block
@@ -940,6 +1013,11 @@ ASTNode* parse(struct Parser* parser) {
 // AST cleanup
 void ast_destroy(ASTNode* node) {
     if (!node) return;
+    // A node shared by hash-consing goes with its last parent
+    if (node->refs > 0) {
+        node->refs--;
+        return;
+    }
     
     switch (node->type) {
         case NODE_PROGRAM:
@@ -950,7 +1028,7 @@ void ast_destroy(ASTNode* node) {
             break;
             
         case NODE_FUNCTION:
-            free(node->data.function.name);
+            free(node->data.function.params);
             ast_destroy(node->data.function.body);
             break;
             
@@ -971,11 +1049,9 @@ void ast_destroy(ASTNode* node) {
             break;
             
         case NODE_VARIABLE:
-            free(node->data.variable.name);
             break;
             
         case NODE_ASSIGNMENT:
-            free(node->data.assignment.name);
             ast_destroy(node->data.assignment.value);
             break;
             
@@ -992,8 +1068,17 @@ void ast_destroy(ASTNode* node) {
             ast_destroy(node->data.while_stmt_node.body);
             break;
             
+        case NODE_SWITCH_STMT:
+            ast_destroy(node->data.switch_stmt_node.value);
+            ast_destroy(node->data.switch_stmt_node.body);
+            break;
+            
+        case NODE_CASE:
+        case NODE_BREAK:
+        case NODE_ERROR:
+            break;
+            
         case NODE_CALL:
-            free(node->data.call.name);
             for (size_t i = 0; i < node->data.call.arg_count; i++) {
                 ast_destroy(node->data.call.args[i]);
             }
@@ -1012,27 +1097,331 @@ void ast_destroy(ASTNode* node) {
     free(node);
 }
 
+// PCH_GLOBALS holds the count and names of the global scope, oldest
+// first. PCH_DECLARATIONS holds the count of top-level declarations and
+// each of them: a node is its type plus one (0 for none), its line and
+// column in one word, then its fields, children in place.
+
+static void save_node(PchWriter* writer, const ASTNode* node) {
+    const PchSection d = PCH_DECLARATIONS;
+    if (!node) {
+        pch_put(writer, d, 0);
+        return;
+    }
+    pch_put(writer, d, (uint64_t)node->type + 1);
+    pch_put(writer, d, (uint64_t)(uint32_t)node->line | (uint64_t)(uint32_t)node->column << 32);
+    switch (node->type) {
+        case NODE_PROGRAM:
+        case NODE_BLOCK:
+            pch_put(writer, d, node->data.block.count);
+            for (size_t i = 0; i < node->data.block.count; i++) {
+                save_node(writer, node->data.block.statements[i]);
+            }
+            break;
+        case NODE_FUNCTION:
+            pch_put_string(writer, d, node->data.function.name);
+            pch_put(writer, d, node->data.function.param_count);
+            for (size_t i = 0; i < node->data.function.param_count; i++) {
+                pch_put_string(writer, d, node->data.function.params[i]);
+            }
+            save_node(writer, node->data.function.body);
+            break;
+        case NODE_RETURN:
+            save_node(writer, node->data.ret.expr);
+            break;
+        case NODE_IF:
+            save_node(writer, node->data.if_stmt.condition);
+            save_node(writer, node->data.if_stmt.then_branch);
+            save_node(writer, node->data.if_stmt.else_branch);
+            break;
+        case NODE_WHILE:
+            save_node(writer, node->data.while_loop.condition);
+            save_node(writer, node->data.while_loop.body);
+            break;
+        case NODE_BINARY_OP:
+            pch_put(writer, d, node->data.binary.op);
+            save_node(writer, node->data.binary.left);
+            save_node(writer, node->data.binary.right);
+            break;
+        case NODE_UNARY_OP:
+            pch_put(writer, d, node->data.unary.op);
+            save_node(writer, node->data.unary.operand);
+            break;
+        case NODE_VARIABLE:
+            pch_put_string(writer, d, node->data.variable.name);
+            pch_put(writer, d, node->data.variable.is_declaration);
+            break;
+        case NODE_NUMBER:
+            pch_put(writer, d, (uint64_t)node->data.number.value);
+            break;
+        case NODE_ASSIGNMENT:
+            pch_put_string(writer, d, node->data.assignment.name);
+            pch_put(writer, d, node->data.assignment.is_declaration);
+            save_node(writer, node->data.assignment.value);
+            break;
+        case NODE_CALL:
+            pch_put_string(writer, d, node->data.call.name);
+            pch_put(writer, d, node->data.call.arg_count);
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                save_node(writer, node->data.call.args[i]);
+            }
+            break;
+        case NODE_IF_STMT:
+            save_node(writer, node->data.if_stmt_node.condition);
+            save_node(writer, node->data.if_stmt_node.then_branch);
+            save_node(writer, node->data.if_stmt_node.else_branch);
+            break;
+        case NODE_WHILE_STMT:
+            save_node(writer, node->data.while_stmt_node.condition);
+            save_node(writer, node->data.while_stmt_node.body);
+            break;
+        case NODE_SWITCH_STMT:
+            save_node(writer, node->data.switch_stmt_node.value);
+            save_node(writer, node->data.switch_stmt_node.body);
+            break;
+        case NODE_CASE:
+            pch_put(writer, d, (uint64_t)node->data.case_label.value);
+            pch_put(writer, d, node->data.case_label.is_default);
+            break;
+        case NODE_BREAK:
+        case NODE_ERROR:
+            break;
+    }
+}
+
+void parser_save(const struct Parser* parser, const ASTNode* program, PchWriter* writer) {
+    // The scope lists the newest symbol first
+    size_t count = 0;
+    for (const Symbol* symbol = parser->current_scope->symbols; symbol; symbol = symbol->next) count++;
+    const char** names = malloc((count ? count : 1) * sizeof(char*));
+    if (!names) {
+        pch_writer_fail(writer);
+        return;
+    }
+    size_t n = 0;
+    for (const Symbol* symbol = parser->current_scope->symbols; symbol; symbol = symbol->next) {
+        names[n++] = symbol->name;
+    }
+    pch_put(writer, PCH_GLOBALS, count);
+    for (size_t i = count; i > 0; i--) pch_put_string(writer, PCH_GLOBALS, names[i - 1]);
+    free(names);
+
+    pch_put(writer, PCH_DECLARATIONS, program->data.block.count);
+    for (size_t i = 0; i < program->data.block.count; i++) {
+        save_node(writer, program->data.block.statements[i]);
+    }
+}
+
+// Decoding fails on a malformed section, or when out of memory
+typedef struct {
+    PchReader reader;
+    bool out_of_memory;
+} NodeLoader;
+
+// A count of items of at least one word each, which the section must still hold
+static size_t load_count(NodeLoader* loader) {
+    size_t count = pch_get(&loader->reader);
+    if (count > loader->reader.count - loader->reader.index) {
+        loader->reader.failed = true;
+        return 0;
+    }
+    return count;
+}
+
+static const char* load_name(NodeLoader* loader) {
+    const char* name = pch_get_string(&loader->reader);
+    if (!name) {
+        loader->reader.failed = true;
+        return NULL;
+    }
+    name = intern(name);
+    if (!name) loader->out_of_memory = true;
+    return name;
+}
+
+static ASTNode** load_array(NodeLoader* loader, size_t count) {
+    ASTNode** items = malloc((count ? count : 1) * sizeof(ASTNode*));
+    if (!items) loader->out_of_memory = true;
+    return items;
+}
+
+static ASTNode* load_node(NodeLoader* loader);
+
+// A node that cannot be missing
+static ASTNode* load_child(NodeLoader* loader) {
+    ASTNode* node = load_node(loader);
+    if (!node && !loader->out_of_memory) loader->reader.failed = true;
+    return node;
+}
+
+static ASTNode* load_node(NodeLoader* loader) {
+    uint64_t type = pch_get(&loader->reader);
+    if (type == 0 || type > NODE_ERROR + 1) {
+        if (type != 0) loader->reader.failed = true;
+        return NULL;
+    }
+    ASTNode* node = create_node((NodeType)(type - 1));
+    if (!node) {
+        loader->out_of_memory = true;
+        return NULL;
+    }
+    uint64_t location = pch_get(&loader->reader);
+    node->line = (int32_t)(uint32_t)location;
+    node->column = (int32_t)(uint32_t)(location >> 32);
+    size_t count;
+    switch (node->type) {
+        case NODE_PROGRAM:
+        case NODE_BLOCK:
+            count = load_count(loader);
+            node->data.block.statements = load_array(loader, count);
+            node->data.block.capacity = count;
+            while (node->data.block.statements && node->data.block.count < count &&
+                   !loader->reader.failed && !loader->out_of_memory) {
+                node->data.block.statements[node->data.block.count++] = load_child(loader);
+            }
+            break;
+        case NODE_FUNCTION:
+            node->data.function.name = load_name(loader);
+            count = load_count(loader);
+            node->data.function.params = (const char**)load_array(loader, count);
+            while (node->data.function.params && node->data.function.param_count < count &&
+                   !loader->reader.failed && !loader->out_of_memory) {
+                node->data.function.params[node->data.function.param_count++] = load_name(loader);
+            }
+            node->data.function.body = load_child(loader);
+            break;
+        case NODE_RETURN:
+            node->data.ret.expr = load_node(loader);
+            break;
+        case NODE_IF:
+            node->data.if_stmt.condition = load_child(loader);
+            node->data.if_stmt.then_branch = load_child(loader);
+            node->data.if_stmt.else_branch = load_node(loader);
+            break;
+        case NODE_WHILE:
+            node->data.while_loop.condition = load_child(loader);
+            node->data.while_loop.body = load_child(loader);
+            break;
+        case NODE_BINARY_OP:
+            node->data.binary.op = (BinaryOp)pch_get(&loader->reader);
+            node->data.binary.left = load_child(loader);
+            node->data.binary.right = load_child(loader);
+            break;
+        case NODE_UNARY_OP:
+            node->data.unary.op = (TokenType)pch_get(&loader->reader);
+            node->data.unary.operand = load_child(loader);
+            break;
+        case NODE_VARIABLE:
+            node->data.variable.name = load_name(loader);
+            node->data.variable.is_declaration = pch_get(&loader->reader) != 0;
+            break;
+        case NODE_NUMBER:
+            node->data.number.value = (int64_t)pch_get(&loader->reader);
+            break;
+        case NODE_ASSIGNMENT:
+            node->data.assignment.name = load_name(loader);
+            node->data.assignment.is_declaration = pch_get(&loader->reader) != 0;
+            node->data.assignment.value = load_child(loader);
+            break;
+        case NODE_CALL:
+            node->data.call.name = load_name(loader);
+            count = load_count(loader);
+            node->data.call.args = load_array(loader, count);
+            while (node->data.call.args && node->data.call.arg_count < count &&
+                   !loader->reader.failed && !loader->out_of_memory) {
+                node->data.call.args[node->data.call.arg_count++] = load_child(loader);
+            }
+            break;
+        case NODE_IF_STMT:
+            node->data.if_stmt_node.condition = load_child(loader);
+            node->data.if_stmt_node.then_branch = load_child(loader);
+            node->data.if_stmt_node.else_branch = load_node(loader);
+            break;
+        case NODE_WHILE_STMT:
+            node->data.while_stmt_node.condition = load_child(loader);
+            node->data.while_stmt_node.body = load_child(loader);
+            break;
+        case NODE_SWITCH_STMT:
+            node->data.switch_stmt_node.value = load_child(loader);
+            node->data.switch_stmt_node.body = load_child(loader);
+            break;
+        case NODE_CASE:
+            node->data.case_label.value = (int64_t)pch_get(&loader->reader);
+            node->data.case_label.is_default = pch_get(&loader->reader) != 0;
+            break;
+        case NODE_BREAK:
+        case NODE_ERROR:
+            break;
+    }
+    return node;
+}
+
+// Start the global scope, or the program, with the precompiled header's;
+// false when out of memory. A malformed section is reported.
+static bool load_globals(struct Parser* parser) {
+    NodeLoader loader = { .out_of_memory = false };
+    pch_reader(parser->pch, PCH_GLOBALS, &loader.reader);
+    size_t count = load_count(&loader);
+    for (size_t i = 0; i < count && !loader.reader.failed; i++) {
+        const char* name = pch_get_string(&loader.reader);
+        Symbol* symbol = name ? create_symbol(name, SYMBOL_VARIABLE) : NULL;
+        if (name && !symbol) return false;
+        if (!symbol || !scope_add(parser->current_scope, symbol)) {
+            free(symbol);
+            loader.reader.failed = true;
+        }
+    }
+    if (loader.reader.failed || loader.reader.index != loader.reader.count) {
+        add_diagnostic(parser, NULL, 1, 1, "Precompiled header is corrupt");
+    }
+    return true;
+}
+
+static bool load_declarations(struct Parser* parser, ASTNode* program) {
+    NodeLoader loader = { .out_of_memory = false };
+    pch_reader(parser->pch, PCH_DECLARATIONS, &loader.reader);
+    size_t count = load_count(&loader);
+    program->data.block.statements = load_array(&loader, count);
+    program->data.block.capacity = program->data.block.statements ? count : 0;
+    while (program->data.block.statements && program->data.block.count < count &&
+           !loader.reader.failed && !loader.out_of_memory) {
+        ASTNode* node = load_child(&loader);
+        if (node) program->data.block.statements[program->data.block.count++] = node;
+    }
+    if (loader.out_of_memory) return false;
+    if (loader.reader.failed || loader.reader.index != loader.reader.count) {
+        add_diagnostic(parser, NULL, 1, 1, "Precompiled header is corrupt");
+    }
+    return true;
+}
+
 // Parser creation and destruction
-struct Parser* parser_create(const char* source) {
+struct Parser* parser_create(const char* source, const char* path, const struct PreprocessOptions* options) {
     struct Parser* parser = malloc(sizeof(struct Parser));
     if (!parser) return NULL;
     
-    parser->source = source;
-    parser->source_length = strlen(source);
-    parser->position = 0;
-    parser->line = 1;
-    parser->column = 1;
+    parser->current = (Token){ .type = TOKEN_EOF, .line = 1, .column = 1 };
+    parser->lookahead_count = 0;
+    parser->consumed = 0;
     parser->error = NULL;
+    parser->diagnostic_count = 0;
+    parser->panicking = false;
+    parser->truncated = false;
+    parser->breakable = 0;
+    parser->pch = options ? options->pch : NULL;
     
     // Create global scope
     parser->current_scope = create_scope(NULL);
-    if (!parser->current_scope) {
+    bool ready = parser->current_scope && (!parser->pch || load_globals(parser));
+    parser->preprocessor = ready ? preprocess_create(parser, source, path, options) : NULL;
+    if (!parser->preprocessor) {
+        destroy_scope(parser->current_scope);
         free(parser);
         return NULL;
     }
     
     // Get first token
-    parser->current = get_next_token(parser);
+    parser->current = next_token(parser);
     return parser;
 }
 
@@ -1046,5 +1435,6 @@ void parser_destroy(struct Parser* parser) {
         parser->current_scope = parent;
     }
     
+    preprocess_destroy(parser->preprocessor);
     free(parser);
 }
@@ -0,0 +1,340 @@
+#define _POSIX_C_SOURCE 200809L  // For clock_gettime, ftello
+#include "ir.h"
+#include "output.h"
+#include "schedule.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The scalar optimization pipeline over SSA form, and the way out of it.
+// Every stage works on one function at a time and touches nothing but that
+// function and the finished callees it inlines, so the functions are
+// spread over worker threads: bottom-up over the strongly connected
+// components of the call graph when inlining, otherwise all at once. The
+// IR comes out the same whatever the number of workers.
+
+static double elapsed_us(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1e6 + (double)(now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static bool optimize_function(IR* ir, IRFunction* fn, const CallGraph* graph,
+                              const IROptOptions* options) {
+    size_t call_sites = 0, inlined = 0;
+    size_t constants = 0, folded = 0, unreachable = 0, merged = 0, threaded = 0;
+    size_t gvn_removed = 0, dce_removed = 0, dce_branches = 0;
+    size_t loops = 0, preheaders = 0, hoisted = 0, reduced = 0, shifts = 0;
+    size_t branches = 0, likely = 0;
+    double inline_us = 0, sccp_us = 0, gvn_us = 0, loop_us = 0, dce_us = 0, layout_us = 0;
+    struct timespec start;
+
+    if (graph) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!ir_inline_calls(ir, fn, graph, options, &call_sites, &inlined)) return false;
+        inline_us = elapsed_us(&start);
+    }
+    // Constant branches go first, so later passes never see dead code
+    if (options->sccp || options->simplify_cfg) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (options->sccp && !ir_sccp(fn, &constants, &folded, &unreachable)) return false;
+        if (options->simplify_cfg && !ir_simplify_cfg(fn, &merged, &threaded)) return false;
+        sccp_us = elapsed_us(&start);
+    }
+    size_t before = ir_instr_count(fn);
+    if (options->gvn) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!ir_gvn(fn, &gvn_removed)) return false;
+        gvn_us = elapsed_us(&start);
+    }
+    if (options->licm || options->strength_reduce) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (options->licm && !ir_licm(fn, &loops, &preheaders, &hoisted)) return false;
+        if (options->strength_reduce && !ir_reduce_strength(fn, &reduced, &shifts)) return false;
+        loop_us = elapsed_us(&start);
+    }
+    if (options->dce) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!ir_dce(fn, &dce_removed, &dce_branches)) return false;
+        dce_us = elapsed_us(&start);
+    }
+    // Dead branches and inlined bodies leave empty blocks behind
+    if (options->simplify_cfg) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!ir_simplify_cfg(fn, &merged, &threaded)) return false;
+        sccp_us += elapsed_us(&start);
+    }
+    // Last, so no later pass undoes the order
+    if (options->profile) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!ir_layout_blocks(fn, options->profile, &branches, &likely)) return false;
+        layout_us = elapsed_us(&start);
+    }
+
+    if (options->stats) {
+        const char* unit = options->unit ? options->unit : "<input>";
+        if (graph) {
+            fprintf(options->stats, "%s: %s: inline: %zu of %zu calls inlined (%.1f us)\n",
+                    unit, fn->name, inlined, call_sites, inline_us);
+        }
+        fprintf(options->stats, "%s: %s: sccp: %zu constants, %zu branches folded, "
+                "%zu blocks unreachable; cfg: %zu blocks merged, %zu jumps threaded (%.1f us)\n",
+                unit, fn->name, constants, folded, unreachable, merged, threaded, sccp_us);
+        fprintf(options->stats, "%s: %s: gvn: %zu of %zu instructions redundant (%.1f us); "
+                "dce: %zu instructions, %zu branches dead (%.1f us)\n",
+                unit, fn->name, gvn_removed, before, gvn_us, dce_removed, dce_branches, dce_us);
+        fprintf(options->stats, "%s: %s: loops: %zu loops, %zu preheaders inserted, "
+                "%zu instructions hoisted; %zu induction multiplications reduced, "
+                "%zu shifts (%.1f us)\n",
+                unit, fn->name, loops, preheaders, hoisted, reduced, shifts, loop_us);
+        if (branches) {
+            fprintf(options->stats, "%s: %s: layout: %zu of %zu profiled branches fall through "
+                    "to their likelier successor (%.1f us)\n",
+                    unit, fn->name, likely, branches, layout_us);
+        }
+    }
+    return true;
+}
+
+static bool eliminate_tail_calls(IR* ir, IRFunction* fn, const CallGraph* graph,
+                                 const IROptOptions* options) {
+    (void)ir;
+    (void)graph;
+    size_t self_calls = 0, eliminated = 0, accumulated = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!ir_eliminate_tail_calls(fn, &self_calls, &eliminated, &accumulated)) return false;
+    double us = elapsed_us(&start);
+
+    if (options->stats) {
+        fprintf(options->stats, "%s: %s: tailcall: %zu of %zu self calls turned into jumps, "
+                "%zu through an accumulator (%.1f us)\n",
+                options->unit ? options->unit : "<input>", fn->name,
+                eliminated, self_calls, accumulated, us);
+    }
+    return true;
+}
+
+static bool destruct_ssa(IR* ir, IRFunction* fn, const CallGraph* graph,
+                         const IROptOptions* options) {
+    (void)ir;
+    (void)graph;
+    (void)options;
+    return ir_destruct_ssa(fn);
+}
+
+typedef bool (*FunctionPass)(IR* ir, IRFunction* fn, const CallGraph* graph,
+                             const IROptOptions* options);
+
+// What one task printed: ranges of its worker's buffers
+typedef struct {
+    size_t worker;
+    off_t stats[2];
+    off_t remarks[2];
+} Segment;
+
+// A pass over the functions of a module, one task per group of functions
+typedef struct {
+    IR* ir;
+    const CallGraph* graph;
+    FunctionPass pass;
+    const int* start;               // Task t runs over functions[start[t]..start[t+1]) in
+    const int* functions;           // order; NULL for one function per task, by index
+    const IROptOptions* options;
+    IROptOptions* worker_options;   // Per worker, printing to its own buffers
+    OutputBuffer* buffers;          // Two per worker: statistics, then remarks
+    Segment* segments;              // Per task, when anything is printed
+} Parallel;
+
+static off_t position(FILE* stream) {
+    return stream ? ftello(stream) : 0;
+}
+
+static bool run_task(void* context, size_t task, size_t worker) {
+    Parallel* parallel = context;
+    const IROptOptions* options = &parallel->worker_options[worker];
+    Segment* segment = parallel->segments ? &parallel->segments[task] : NULL;
+    if (segment) {
+        segment->worker = worker;
+        segment->stats[0] = position(options->stats);
+        segment->remarks[0] = position(options->remarks);
+    }
+    bool shared = options->remarks == options->stats;   // Then the statistics range has both
+
+    size_t first = parallel->start ? (size_t)parallel->start[task] : task;
+    size_t last = parallel->start ? (size_t)parallel->start[task + 1] : task + 1;
+    for (size_t i = first; i < last; i++) {
+        IRFunction* fn = parallel->ir->functions[parallel->functions ? parallel->functions[i] : (int)i];
+        if (!parallel->pass(parallel->ir, fn, parallel->graph, options)) return false;
+    }
+
+    if (segment) {
+        segment->stats[1] = position(options->stats);
+        segment->remarks[1] = shared ? segment->remarks[0] : position(options->remarks);
+    }
+    return true;
+}
+
+static void copy_segment(FILE* out, const OutputBuffer* buffer, const off_t* range) {
+    if (out && range[1] > range[0]) fwrite(buffer->data + range[0], 1, (size_t)(range[1] - range[0]), out);
+}
+
+// Run the tasks of graph, whose run and context this fills in. Statistics
+// and remarks are kept per worker and printed afterwards in task order,
+// which is the order of a serial run.
+static bool run_parallel(Parallel* parallel, TaskGraph* graph, ScheduleStats* stats) {
+    const IROptOptions* options = parallel->options;
+    size_t workers = schedule_workers(options->threads, graph->count);
+    bool remarks = options->remarks && (options->remark_inlined || options->remark_missed);
+    bool prints = options->stats || remarks;
+
+    parallel->worker_options = calloc(workers, sizeof(IROptOptions));
+    parallel->buffers = prints ? calloc(workers * 2, sizeof(OutputBuffer)) : NULL;
+    parallel->segments = prints ? calloc(graph->count ? graph->count : 1, sizeof(Segment)) : NULL;
+    bool ok = parallel->worker_options && (!prints || (parallel->buffers && parallel->segments));
+    for (size_t w = 0; ok && w < workers; w++) {
+        IROptOptions* worker = &parallel->worker_options[w];
+        *worker = *options;
+        if (!prints) continue;
+        ok = output_open(&parallel->buffers[2 * w]) && output_open(&parallel->buffers[2 * w + 1]);
+        worker->stats = options->stats ? parallel->buffers[2 * w].stream : NULL;
+        // Both in one buffer when they share a stream, to keep them interleaved
+        worker->remarks = !remarks ? NULL
+                        : options->remarks == options->stats ? worker->stats
+                        : parallel->buffers[2 * w + 1].stream;
+    }
+
+    if (ok) {
+        graph->run = run_task;
+        graph->context = parallel;
+        ok = schedule_run(graph, workers, stats);
+    }
+    for (size_t w = 0; ok && prints && w < workers; w++) {
+        ok = fflush(parallel->buffers[2 * w].stream) == 0 && fflush(parallel->buffers[2 * w + 1].stream) == 0;
+    }
+    for (size_t t = 0; ok && prints && t < graph->count; t++) {
+        const Segment* segment = &parallel->segments[t];
+        copy_segment(options->stats, &parallel->buffers[2 * segment->worker], segment->stats);
+        copy_segment(options->remarks, &parallel->buffers[2 * segment->worker + 1], segment->remarks);
+    }
+
+    for (size_t w = 0; parallel->buffers && w < workers * 2; w++) output_close(&parallel->buffers[w]);
+    free(parallel->buffers);
+    free(parallel->segments);
+    free(parallel->worker_options);
+    return ok;
+}
+
+// Run pass over every function, in any order
+static bool run_each(IR* ir, FunctionPass pass, const IROptOptions* options, ScheduleStats* stats) {
+    if (schedule_workers(options->threads, ir->function_count) == 1) {
+        for (size_t i = 0; i < ir->function_count; i++) {
+            if (!pass(ir, ir->functions[i], NULL, options)) return false;
+        }
+        return true;
+    }
+    Parallel parallel = { .ir = ir, .pass = pass, .options = options };
+    TaskGraph graph = { .count = ir->function_count };
+    return run_parallel(&parallel, &graph, stats);
+}
+
+// One task per strongly connected component, waiting for the components
+// its members call. Components are numbered bottom-up and each one's
+// members are contiguous in graph->order, so in task order the functions
+// come in the order of a serial run.
+static bool optimize_components(IR* ir, const CallGraph* graph, const IROptOptions* options,
+                                ScheduleStats* stats) {
+    size_t count = graph->scc_count;
+    int* start = calloc(count + 1, sizeof(int));
+    int* waits = calloc(count + 1, sizeof(int));
+    int* next_start = calloc(count + 2, sizeof(int));
+    int* next = malloc((graph->edge_start[graph->count] + 1) * sizeof(int));
+    bool ok = start && waits && next_start && next;
+
+    for (size_t f = 0; ok && f < graph->count; f++) {
+        int scc = graph->scc[f];
+        start[scc + 1]++;
+        for (int e = graph->edge_start[f]; e < graph->edge_start[f + 1]; e++) {
+            int callee = graph->scc[graph->edges[e]];
+            if (callee == scc) continue;
+            waits[scc]++;
+            next_start[callee + 2]++;
+        }
+    }
+    for (size_t c = 0; ok && c < count; c++) {
+        start[c + 1] += start[c];
+        next_start[c + 2] += next_start[c + 1];
+    }
+    // next_start[c + 1] is where the next entry of c goes, and ends up as
+    // the start of c + 1
+    for (size_t f = 0; ok && f < graph->count; f++) {
+        int scc = graph->scc[f];
+        for (int e = graph->edge_start[f]; e < graph->edge_start[f + 1]; e++) {
+            int callee = graph->scc[graph->edges[e]];
+            if (callee != scc) next[next_start[callee + 1]++] = scc;
+        }
+    }
+
+    if (ok) {
+        Parallel parallel = {
+            .ir = ir, .graph = graph, .pass = optimize_function,
+            .start = start, .functions = graph->order, .options = options,
+        };
+        TaskGraph tasks = { .count = count, .waits = waits, .next_start = next_start, .next = next };
+        ok = run_parallel(&parallel, &tasks, stats);
+    }
+    free(start);
+    free(waits);
+    free(next_start);
+    free(next);
+    return ok;
+}
+
+bool ir_optimize_start(IR* ir, CallGraph* graph, const IROptOptions* options) {
+    memset(graph, 0, sizeof(*graph));
+    // Loops instead of self calls first, so the call graph no longer sees
+    // those functions as recursive
+    if (options->tail_calls && !run_each(ir, eliminate_tail_calls, options, NULL)) return false;
+    return !options->inline_calls || call_graph_build(ir, graph);
+}
+
+bool ir_optimize_function(IR* ir, IRFunction* fn, const CallGraph* graph,
+                          const IROptOptions* options) {
+    return optimize_function(ir, fn, options->inline_calls ? graph : NULL, options);
+}
+
+bool ir_optimize(IR* ir, const IROptOptions* options) {
+    CallGraph graph;
+    if (!ir_optimize_start(ir, &graph, options)) return false;
+
+    ScheduleStats schedule = {0};
+    bool ok;
+    size_t components = ir->function_count;
+    if (!options->inline_calls) {
+        ok = run_each(ir, optimize_function, options, &schedule);
+    } else {
+        // Callees first, so they are inlined in their optimized form
+        components = graph.scc_count;
+        if (schedule_workers(options->threads, components) == 1) {
+            ok = true;
+            for (size_t i = 0; i < graph.count && ok; i++) {
+                ok = optimize_function(ir, ir->functions[graph.order[i]], &graph, options);
+            }
+        } else {
+            ok = optimize_components(ir, &graph, options, &schedule);
+        }
+    }
+    call_graph_free(&graph);
+
+    if (ok && options->stats && schedule.workers > 1) {
+        fprintf(options->stats, "%s: schedule: %zu functions in %zu tasks on %zu workers, "
+                "%zu tasks stolen\n", options->unit ? options->unit : "<input>",
+                ir->function_count, components, schedule.workers, schedule.steals);
+    }
+    return ok;
+}
+
+bool ir_finalize(IR* ir, size_t threads) {
+    IROptOptions options = { .threads = threads };
+    return run_each(ir, destruct_ssa, &options, NULL);
+}
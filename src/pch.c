@@ -0,0 +1,377 @@
+#define _POSIX_C_SOURCE 200809L  // For mkstemp and fchmod
+#include "pch.h"
+#include "output.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File layout, every part a whole number of words:
+//
+//   PchFileHeader
+//   string table   NUL-terminated strings, each stored once, then padding
+//   dependencies   three words each: path, size and content hash
+//   sections       in PchSection order
+//
+// A string is stored as a word holding its offset in the table plus one,
+// so that 0 can stand for NULL. Words are in the writer's byte order,
+// which the reader checks rather than converts: a snapshot is a build
+// artifact, made and used on one machine.
+
+#define PCH_MAGIC "leanpch"
+#define PCH_VERSION 1
+#define PCH_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t configuration;        // Hash of the -I and -D options it was made under
+    uint64_t string_bytes;         // Padding included
+    uint64_t dependency_count;
+    uint64_t section_words[PCH_SECTION_COUNT];
+} PchFileHeader;
+
+uint64_t pch_hash(const void* data, size_t size, uint64_t hash) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+// Size and content hash of the file at path; false if it cannot be read
+static bool hash_file(const char* path, uint64_t* size, uint64_t* hash) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    unsigned char buffer[64 * 1024];
+    *size = 0;
+    *hash = PCH_HASH_INIT;
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        *hash = pch_hash(buffer, (size_t)n, *hash);
+        *size += (uint64_t)n;
+    }
+    close(fd);
+    return n == 0;
+}
+
+// A section being written
+typedef struct {
+    uint64_t* items;
+    size_t count;
+    size_t capacity;
+} WordList;
+
+struct PchWriter {
+    char* strings;
+    size_t string_bytes;
+    size_t string_capacity;
+    uint64_t* slots;               // Interning table: string words, 0 where empty
+    size_t slot_count;             // A power of two
+    size_t string_count;
+    WordList sections[PCH_SECTION_COUNT];
+    char** dependencies;
+    size_t dependency_count;
+    size_t dependency_capacity;
+    bool failed;                   // Out of memory at some point
+};
+
+PchWriter* pch_writer_create(void) {
+    return calloc(1, sizeof(PchWriter));
+}
+
+void pch_writer_destroy(PchWriter* writer) {
+    if (!writer) return;
+    free(writer->strings);
+    free(writer->slots);
+    for (size_t s = 0; s < PCH_SECTION_COUNT; s++) {
+        free(writer->sections[s].items);
+    }
+    for (size_t i = 0; i < writer->dependency_count; i++) {
+        free(writer->dependencies[i]);
+    }
+    free(writer->dependencies);
+    free(writer);
+}
+
+static bool grow(PchWriter* writer, void** items, size_t* capacity, size_t needed, size_t size) {
+    if (needed <= *capacity) return true;
+    size_t grown = *capacity ? *capacity * 2 : 256;
+    while (grown < needed) grown *= 2;
+    void* larger = realloc(*items, grown * size);
+    if (!larger) {
+        writer->failed = true;
+        return false;
+    }
+    *items = larger;
+    *capacity = grown;
+    return true;
+}
+
+void pch_put(PchWriter* writer, PchSection section, uint64_t word) {
+    WordList* list = &writer->sections[section];
+    void* items = list->items;
+    if (!grow(writer, &items, &list->capacity, list->count + 1, sizeof(uint64_t))) return;
+    list->items = items;
+    list->items[list->count++] = word;
+}
+
+// The word standing for text, adding it to the table the first time
+static uint64_t pch_intern_string(PchWriter* writer, const char* text) {
+    if (writer->string_count * 2 >= writer->slot_count) {
+        size_t count = writer->slot_count ? writer->slot_count * 2 : 1024;
+        uint64_t* slots = calloc(count, sizeof(uint64_t));
+        if (!slots) {
+            writer->failed = true;
+            return 0;
+        }
+        for (size_t i = 0; i < writer->slot_count; i++) {
+            uint64_t word = writer->slots[i];
+            if (!word) continue;
+            const char* old = writer->strings + word - 1;
+            size_t slot = pch_hash(old, strlen(old), PCH_HASH_INIT) & (count - 1);
+            while (slots[slot]) slot = (slot + 1) & (count - 1);
+            slots[slot] = word;
+        }
+        free(writer->slots);
+        writer->slots = slots;
+        writer->slot_count = count;
+    }
+
+    size_t length = strlen(text);
+    size_t slot = pch_hash(text, length, PCH_HASH_INIT) & (writer->slot_count - 1);
+    for (; writer->slots[slot]; slot = (slot + 1) & (writer->slot_count - 1)) {
+        if (strcmp(writer->strings + writer->slots[slot] - 1, text) == 0) return writer->slots[slot];
+    }
+    void* strings = writer->strings;
+    if (!grow(writer, &strings, &writer->string_capacity, writer->string_bytes + length + 1, 1)) return 0;
+    writer->strings = strings;
+    memcpy(writer->strings + writer->string_bytes, text, length + 1);
+    uint64_t word = writer->string_bytes + 1;
+    writer->string_bytes += length + 1;
+    writer->slots[slot] = word;
+    writer->string_count++;
+    return word;
+}
+
+void pch_put_string(PchWriter* writer, PchSection section, const char* text) {
+    pch_put(writer, section, text ? pch_intern_string(writer, text) : 0);
+}
+
+void pch_writer_fail(PchWriter* writer) {
+    writer->failed = true;
+}
+
+void pch_add_dependency(PchWriter* writer, const char* path) {
+    void* items = writer->dependencies;
+    char* copy = strdup(path);
+    if (!copy || !grow(writer, &items, &writer->dependency_capacity, writer->dependency_count + 1,
+                       sizeof(char*))) {
+        writer->failed = true;
+        free(copy);
+        return;
+    }
+    writer->dependencies = items;
+    writer->dependencies[writer->dependency_count++] = copy;
+}
+
+bool pch_writer_finish(PchWriter* writer, const char* path, uint64_t configuration, char* error,
+                       size_t error_size) {
+    uint64_t* dependencies = calloc(writer->dependency_count * 3 + 1, sizeof(uint64_t));
+    if (!dependencies) writer->failed = true;
+    for (size_t i = 0; i < writer->dependency_count && !writer->failed; i++) {
+        dependencies[i * 3] = pch_intern_string(writer, writer->dependencies[i]);
+        if (!hash_file(writer->dependencies[i], &dependencies[i * 3 + 1], &dependencies[i * 3 + 2])) {
+            snprintf(error, error_size, "Could not read '%s'", writer->dependencies[i]);
+            free(dependencies);
+            return false;
+        }
+    }
+    if (writer->failed) {
+        snprintf(error, error_size, "Out of memory");
+        free(dependencies);
+        return false;
+    }
+
+    PchFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PCH_MAGIC, sizeof(PCH_MAGIC));
+    header.version = PCH_VERSION;
+    header.byte_order = PCH_BYTE_ORDER;
+    header.configuration = configuration;
+    header.string_bytes = (writer->string_bytes + 7) & ~(size_t)7;
+    header.dependency_count = writer->dependency_count;
+    static const char padding[8];
+    struct iovec iov[4 + PCH_SECTION_COUNT] = {
+        { &header, sizeof(header) },
+        { writer->strings, writer->string_bytes },
+        { (void*)padding, header.string_bytes - writer->string_bytes },
+        { dependencies, writer->dependency_count * 3 * sizeof(uint64_t) },
+    };
+    for (size_t s = 0; s < PCH_SECTION_COUNT; s++) {
+        header.section_words[s] = writer->sections[s].count;
+        iov[4 + s].iov_base = writer->sections[s].items;
+        iov[4 + s].iov_len = writer->sections[s].count * sizeof(uint64_t);
+    }
+
+    // Written aside and renamed into place, so that a unit mapping the
+    // old snapshot never sees this one half written
+    size_t length = strlen(path);
+    char* temporary = malloc(length + 8);
+    int fd = -1;
+    if (temporary) {
+        memcpy(temporary, path, length);
+        memcpy(temporary + length, ".XXXXXX", 8);
+        fd = mkstemp(temporary);
+    }
+    bool ok = fd >= 0 && fchmod(fd, 0644) == 0 && output_writev(fd, iov, 4 + PCH_SECTION_COUNT);
+    if (fd >= 0) {
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(temporary, path) == 0;
+        if (!ok) unlink(temporary);
+    }
+    if (!ok) snprintf(error, error_size, "Could not write output file '%s'", path);
+    free(temporary);
+    free(dependencies);
+    return ok;
+}
+
+// A mapped snapshot, with where each section starts
+struct Pch {
+    const unsigned char* map;
+    size_t size;
+    const char* strings;
+    size_t string_bytes;
+    size_t string_count;
+    size_t dependency_count;
+    const uint64_t* sections[PCH_SECTION_COUNT];
+    size_t section_words[PCH_SECTION_COUNT];
+};
+
+void pch_close(Pch* pch) {
+    if (!pch) return;
+    munmap((void*)pch->map, pch->size);
+    free(pch);
+}
+
+// The layout the header describes, if it fits the file exactly
+static bool check_layout(Pch* pch, const PchFileHeader* header) {
+    size_t words = (pch->size - sizeof(PchFileHeader)) / sizeof(uint64_t);
+    if (memcmp(header->magic, PCH_MAGIC, sizeof(PCH_MAGIC)) != 0 || header->version != PCH_VERSION ||
+        header->byte_order != PCH_BYTE_ORDER || header->string_bytes % sizeof(uint64_t) != 0 ||
+        header->string_bytes / sizeof(uint64_t) > words) {
+        return false;
+    }
+    words -= header->string_bytes / sizeof(uint64_t);
+    if (header->dependency_count > words / 3) return false;
+    words -= header->dependency_count * 3;
+    for (size_t s = 0; s < PCH_SECTION_COUNT; s++) {
+        if (header->section_words[s] > words) return false;
+        words -= header->section_words[s];
+    }
+    if (words != 0 || (pch->size - sizeof(PchFileHeader)) % sizeof(uint64_t) != 0) return false;
+
+    pch->strings = (const char*)pch->map + sizeof(PchFileHeader);
+    pch->string_bytes = header->string_bytes;
+    if (pch->string_bytes > 0 && pch->strings[pch->string_bytes - 1] != '\0') return false;
+    for (size_t i = 0; i < pch->string_bytes; i++) {
+        if (pch->strings[i] == '\0' && (i == 0 || pch->strings[i - 1] != '\0')) pch->string_count++;
+    }
+    pch->dependency_count = header->dependency_count;
+    const uint64_t* next = (const uint64_t*)(pch->strings + pch->string_bytes) + pch->dependency_count * 3;
+    for (size_t s = 0; s < PCH_SECTION_COUNT; s++) {
+        pch->sections[s] = next;
+        pch->section_words[s] = header->section_words[s];
+        next += header->section_words[s];
+    }
+    return true;
+}
+
+Pch* pch_open(const char* path, uint64_t configuration, char* error, size_t error_size) {
+    Pch* pch = calloc(1, sizeof(Pch));
+    if (!pch) {
+        snprintf(error, error_size, "Out of memory");
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        snprintf(error, error_size, "Could not open precompiled header '%s'", path);
+        if (fd >= 0) close(fd);
+        free(pch);
+        return NULL;
+    }
+    pch->size = (size_t)st.st_size;
+    void* map = pch->size >= sizeof(PchFileHeader) ? mmap(NULL, pch->size, PROT_READ, MAP_PRIVATE, fd, 0)
+                                                    : MAP_FAILED;
+    close(fd);
+    const PchFileHeader* header = map != MAP_FAILED ? map : NULL;
+    pch->map = map;
+    if (!header || !check_layout(pch, header)) {
+        snprintf(error, error_size, "'%s' is not a precompiled header of this leancc", path);
+        if (header) munmap(map, pch->size);
+        free(pch);
+        return NULL;
+    }
+    if (header->configuration != configuration) {
+        snprintf(error, error_size, "Precompiled header '%s' was made with other -I or -D options", path);
+        pch_close(pch);
+        return NULL;
+    }
+
+    // Each file it was made from must be as it was
+    const uint64_t* dependencies = (const uint64_t*)(pch->strings + pch->string_bytes);
+    for (size_t i = 0; i < pch->dependency_count; i++) {
+        PchReader reader = { pch, dependencies + i * 3, 1, 0, false };
+        const char* dependency = pch_get_string(&reader);
+        uint64_t size;
+        uint64_t hash;
+        if (!dependency) {
+            snprintf(error, error_size, "'%s' is not a precompiled header of this leancc", path);
+            pch_close(pch);
+            return NULL;
+        }
+        if (!hash_file(dependency, &size, &hash) || size != dependencies[i * 3 + 1] ||
+            hash != dependencies[i * 3 + 2]) {
+            snprintf(error, error_size, "Precompiled header '%s' is out of date: '%s' has changed",
+                     path, dependency);
+            pch_close(pch);
+            return NULL;
+        }
+    }
+    return pch;
+}
+
+void pch_stats(const Pch* pch, PchStats* stats) {
+    stats->bytes = pch->size;
+    stats->strings = pch->string_count;
+    stats->dependencies = pch->dependency_count;
+}
+
+void pch_reader(const Pch* pch, PchSection section, PchReader* reader) {
+    reader->pch = pch;
+    reader->words = pch->sections[section];
+    reader->count = pch->section_words[section];
+    reader->index = 0;
+    reader->failed = false;
+}
+
+uint64_t pch_get(PchReader* reader) {
+    if (reader->index >= reader->count) {
+        reader->failed = true;
+        return 0;
+    }
+    return reader->words[reader->index++];
+}
+
+const char* pch_get_string(PchReader* reader) {
+    uint64_t word = pch_get(reader);
+    if (word == 0) return NULL;
+    if (word > reader->pch->string_bytes) {
+        reader->failed = true;
+        return NULL;
+    }
+    return reader->pch->strings + word - 1;
+}
@@ -0,0 +1,1548 @@
+#define _DEFAULT_SOURCE  // For realpath
+#include "preprocess.h"
+#include "arena.h"
+#include "pch.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Tokens flow from the lexer (the unit's own source) or from a cached
+// header's token array, through the directives, into a stack of macro
+// expansion contexts. A context holds the replacement of one invocation;
+// its macro is disabled until the context is used up, so a macro that
+// names itself is not expanded again, which C requires. Arguments are
+// expanded by themselves behind a barrier context, which ends the token
+// stream where the argument ends. Expanded tokens take the location of
+// the invocation, so errors point at the line that used the macro.
+//
+// Headers are cached per process, keyed by the path they were found at,
+// as the tokens the lexer made of them: what they expand to depends on
+// the macros of the unit that includes them. The cache also remembers
+// paths that were not found, and the include guard of each header, so a
+// guarded header whose macro is defined is skipped by looking up its path
+// in memory, without a system call.
+//
+// A precompiled header seeds the cache with the headers it was made from,
+// under their real paths and with their guards, so that units skip them
+// again without reading them. Once the cache holds such entries, a path
+// it has not seen is looked up under its real path too.
+
+#define MAX_INCLUDE_DEPTH 200
+#define PASTE (-2)                 // Macro body item that is '##'
+#define PLAIN (-1)                 // Macro body item that is an ordinary token
+
+// The header cache, shared by every unit of the process
+typedef struct Header {
+    const char* path;
+    uint64_t hash;
+    bool missing;                  // Nothing could be read there
+    bool deferred;                 // Known from a precompiled header, not read yet
+    const Token* tokens;           // Ending with TOKEN_EOF; read under cache_lock while deferred
+    const char* guard;             // X when the whole file is '#ifndef X ... #endif'
+    const struct Header* alias;    // The entry for the same file under its real path
+    struct Header* next;
+} Header;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static Arena cache_arena = { NULL, 256 * 1024 };   // Never freed: headers live as long as the process
+static Header** cache_buckets;
+static size_t cache_bucket_count;
+static size_t cache_count;
+static bool cache_seeded;          // Holds headers from a precompiled header, under their real paths
+
+static uint64_t hash_text(const char* text) {
+    uint64_t hash = 0xcbf29ce484222325ULL;   // FNV-1a
+    for (; *text; text++) hash = (hash ^ (unsigned char)*text) * 0x100000001b3ULL;
+    return hash;
+}
+
+// The name of a directive, or NULL if the token cannot be one. 'if' and
+// 'else' come from the lexer as keywords.
+static const char* directive_name(const Token* token) {
+    if (token->type == TOKEN_IDENTIFIER) return token->value.identifier;
+    if (token->type >= TOKEN_INT && token->type <= TOKEN_BREAK) return token_spelling(token->type);
+    return NULL;
+}
+
+static bool opens_conditional(const char* name) {
+    return strcmp(name, "if") == 0 || strcmp(name, "ifdef") == 0 || strcmp(name, "ifndef") == 0;
+}
+
+// The guard of a header whose every token is inside '#ifndef X' and its '#endif'
+static const char* find_guard(const Token* tokens) {
+    if (tokens[0].type != TOKEN_HASH || tokens[1].type != TOKEN_IDENTIFIER ||
+        (tokens[1].flags & TOKEN_LINE_START) || strcmp(tokens[1].value.identifier, "ifndef") != 0 ||
+        tokens[2].type != TOKEN_IDENTIFIER || (tokens[2].flags & TOKEN_LINE_START) ||
+        !(tokens[3].type == TOKEN_EOF || (tokens[3].flags & TOKEN_LINE_START))) {
+        return NULL;
+    }
+    size_t depth = 0;
+    for (size_t i = 3; tokens[i].type != TOKEN_EOF; i++) {
+        if (tokens[i].type != TOKEN_HASH || !(tokens[i].flags & TOKEN_LINE_START) ||
+            tokens[i + 1].type == TOKEN_EOF || (tokens[i + 1].flags & TOKEN_LINE_START)) {
+            continue;
+        }
+        const char* name = directive_name(&tokens[i + 1]);
+        if (!name) continue;
+        if (opens_conditional(name)) {
+            depth++;
+        } else if (strcmp(name, "endif") == 0 && depth > 0) {
+            depth--;
+        } else if (strcmp(name, "endif") == 0) {
+            // Only if nothing follows this line
+            size_t j = i + 2;
+            while (tokens[j].type != TOKEN_EOF && !(tokens[j].flags & TOKEN_LINE_START)) j++;
+            return tokens[j].type == TOKEN_EOF ? tokens[2].value.identifier : NULL;
+        } else if (depth == 0 && (strcmp(name, "elif") == 0 || strcmp(name, "else") == 0)) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// Contents of a regular file, NUL-terminated; NULL if there is none at path
+static char* read_header(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    char* text = NULL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) text = malloc((size_t)st.st_size + 1);
+    size_t length = 0;
+    while (text && length < (size_t)st.st_size) {
+        ssize_t n = read(fd, text + length, (size_t)st.st_size - length);
+        if (n <= 0) break;
+        length += (size_t)n;
+    }
+    close(fd);
+    if (text) text[length] = '\0';
+    *size = length;
+    return text;
+}
+
+// Lex a header into the cache arena. The caller holds cache_lock.
+static bool load_header(Header* header) {
+    size_t size;
+    char* text = read_header(header->path, &size);
+    if (!text) {
+        header->missing = true;
+        return true;
+    }
+    Lexer lexer;
+    lexer_init(&lexer, text, size, header->path, &cache_arena);
+    Token* tokens = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    bool ok = true;
+    for (;;) {
+        if (count + 4 > capacity) {
+            // Room for three EOFs past the end, which find_guard() reads
+            capacity = capacity ? capacity * 2 : 256;
+            Token* grown = realloc(tokens, capacity * sizeof(Token));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            tokens = grown;
+        }
+        tokens[count] = lex_token(&lexer);
+        if (tokens[count++].type == TOKEN_EOF) break;
+    }
+    free(text);
+    if (ok) {
+        tokens[count] = tokens[count + 1] = tokens[count + 2] = tokens[count - 1];
+        Token* kept = arena_alloc(&cache_arena, count * sizeof(Token));
+        ok = kept != NULL;
+        if (ok) {
+            memcpy(kept, tokens, count * sizeof(Token));
+            header->tokens = kept;
+            header->guard = find_guard(tokens);
+        }
+    }
+    free(tokens);
+    return ok;
+}
+
+// The caller holds cache_lock
+static Header* cache_find(const char* path, uint64_t hash) {
+    Header* header = NULL;
+    if (cache_bucket_count > 0) {
+        header = cache_buckets[hash & (cache_bucket_count - 1)];
+        while (header && (header->hash != hash || strcmp(header->path, path) != 0)) header = header->next;
+    }
+    return header;
+}
+
+// A new entry for path, which the caller fills in and then adds with
+// cache_add(). The caller holds cache_lock.
+static Header* cache_entry(const char* path, uint64_t hash) {
+    if (cache_count >= cache_bucket_count) {
+        size_t count = cache_bucket_count ? cache_bucket_count * 2 : 64;
+        Header** buckets = calloc(count, sizeof(Header*));
+        if (!buckets) return NULL;
+        for (size_t i = 0; i < cache_bucket_count; i++) {
+            for (Header* h = cache_buckets[i], *next; h; h = next) {
+                next = h->next;
+                h->next = buckets[h->hash & (count - 1)];
+                buckets[h->hash & (count - 1)] = h;
+            }
+        }
+        free(cache_buckets);
+        cache_buckets = buckets;
+        cache_bucket_count = count;
+    }
+    Header* header = arena_alloc(&cache_arena, sizeof(Header));
+    if (!header) return NULL;
+    header->path = arena_strdup(&cache_arena, path);
+    header->hash = hash;
+    return header->path ? header : NULL;
+}
+
+static void cache_add(Header* header) {
+    header->next = cache_buckets[header->hash & (cache_bucket_count - 1)];
+    cache_buckets[header->hash & (cache_bucket_count - 1)] = header;
+    cache_count++;
+}
+
+// The cache entry for path, read and lexed on first use; *fresh tells
+// whether this call did that. A path that leads to a header seeded from
+// a precompiled header gives that entry, which may still be deferred.
+// NULL when out of memory.
+static const Header* cache_lookup(const char* path, bool* fresh) {
+    uint64_t hash = hash_text(path);
+    *fresh = false;
+    pthread_mutex_lock(&cache_lock);
+    Header* header = cache_find(path, hash);
+    if (!header) {
+        header = cache_entry(path, hash);
+        if (!header) goto done;
+        if (cache_seeded) {
+            char* real = realpath(path, NULL);
+            if (real && strcmp(real, path) != 0) header->alias = cache_find(real, hash_text(real));
+            free(real);
+        }
+        if (!header->alias && !load_header(header)) {
+            header = NULL;
+            goto done;
+        }
+        cache_add(header);
+        *fresh = !header->missing && !header->alias;
+    }
+done:
+    pthread_mutex_unlock(&cache_lock);
+    return header && header->alias ? header->alias : header;
+}
+
+// An entry for the header at path, whose guard is known, to be read only
+// if a unit includes it while the guard is not defined. NULL when out of
+// memory.
+static const Header* cache_seed(const char* path, const char* guard) {
+    uint64_t hash = hash_text(path);
+    pthread_mutex_lock(&cache_lock);
+    Header* header = cache_find(path, hash);
+    if (!header) {
+        header = cache_entry(path, hash);
+        if (header && guard) header->guard = arena_strdup(&cache_arena, guard);
+        if (header && (!guard || header->guard)) {
+            header->deferred = true;
+            cache_add(header);
+        } else {
+            header = NULL;
+        }
+    }
+    cache_seeded = true;
+    pthread_mutex_unlock(&cache_lock);
+    return header && header->alias ? header->alias : header;
+}
+
+// The tokens of a header a unit enters, lexing a deferred one; *fresh is
+// set when this call did that. A file that has gone since its
+// precompiled header was checked reads as empty. NULL when out of memory.
+static const Token* header_tokens(const Header* header, bool* fresh) {
+    static const Token empty[4] = { { .type = TOKEN_EOF }, { .type = TOKEN_EOF }, { .type = TOKEN_EOF },
+                                    { .type = TOKEN_EOF } };
+    pthread_mutex_lock(&cache_lock);
+    Header* entry = (Header*)header;
+    if (entry->deferred) {
+        // Into a copy: other units read the guard and missing unlocked
+        Header loaded = *entry;
+        if (load_header(&loaded)) {
+            entry->tokens = loaded.missing ? empty : loaded.tokens;
+            entry->deferred = false;
+            *fresh = !loaded.missing;
+        }
+    }
+    const Token* tokens = entry->deferred ? NULL : entry->tokens;
+    pthread_mutex_unlock(&cache_lock);
+    return tokens;
+}
+
+// A macro of one unit, in its bucket of the unit's macro table
+typedef struct Macro {
+    const char* name;
+    uint64_t hash;
+    struct Macro* next;
+    bool function_like;
+    bool variadic;                 // Its last parameter is __VA_ARGS__
+    bool line;                     // __LINE__
+    const char** params;
+    size_t param_count;
+    Token* body;
+    int* items;                    // Per body token: parameter index, PLAIN or PASTE
+    size_t body_count;
+    int active;                    // Expansions of it still being read
+} Macro;
+
+typedef struct {
+    Token* items;
+    size_t count;
+    size_t capacity;
+} TokenList;
+
+typedef struct {
+    const Token* tokens;           // NULL for the single pushed-back token
+    Token token;
+    size_t count;
+    size_t index;
+    Macro* macro;                  // Disabled while this context lasts
+    bool owned;                    // tokens is freed with the context
+    bool barrier;                  // Ends the stream instead of giving way to what is below
+} Context;
+
+typedef struct {
+    const Header* header;          // NULL for the unit's own source
+    const Token* tokens;           // The header's
+    size_t index;                  // Into tokens
+    size_t conditional_base;       // Conditionals open when the file was entered
+    Token pending;                 // Read ahead at the end of a directive line
+    bool has_pending;
+} Source;
+
+typedef struct {
+    Token at;                      // The directive name that opened it
+    bool taken;                    // One of its groups was included
+    bool seen_else;
+} Conditional;
+
+struct Preprocessor {
+    struct Parser* parser;
+    Arena arena;                   // Macros and the unit's identifiers
+    Lexer lexer;                   // The unit's own source
+    const char* path;
+    const PreprocessOptions* options;
+    Macro** macros;
+    size_t macro_bucket_count;
+    size_t macro_count;
+    Source* sources;
+    size_t source_count;
+    size_t source_capacity;
+    Context* contexts;
+    size_t context_count;
+    size_t context_capacity;
+    Conditional* conditionals;
+    size_t conditional_count;
+    size_t conditional_capacity;
+    const Header** once;           // Headers that said #pragma once
+    size_t once_count;
+    size_t once_capacity;
+    TokenList line;                // The directive being run
+    bool skipping;                 // A group was rejected and has to be skipped
+    bool out_of_memory;
+    PreprocessStats stats;
+};
+
+static void pp_error(Preprocessor* pp, const Token* at, const char* format, ...) {
+    char message[sizeof(((ParseDiagnostic*)0)->message)];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    parser_report_in(pp->parser, at->file, at->line, at->column, false, "%s", message);
+}
+
+// Reported once; the unit ends there
+static void out_of_memory(Preprocessor* pp) {
+    if (!pp->out_of_memory) {
+        Token at = { .line = pp->lexer.line, .column = pp->lexer.column };
+        pp_error(pp, &at, "Out of memory");
+    }
+    pp->out_of_memory = true;
+}
+
+// Room for needed items in the growable array whose address is array
+static bool reserve(Preprocessor* pp, void* array, size_t* capacity, size_t needed, size_t size) {
+    if (needed <= *capacity) return true;
+    size_t grown = *capacity ? *capacity * 2 : 16;
+    while (grown < needed) grown *= 2;
+    void* items;
+    memcpy(&items, array, sizeof(items));
+    items = realloc(items, grown * size);
+    if (!items) {
+        out_of_memory(pp);
+        return false;
+    }
+    memcpy(array, &items, sizeof(items));
+    *capacity = grown;
+    return true;
+}
+
+static bool list_push(Preprocessor* pp, TokenList* list, const Token* token) {
+    if (!reserve(pp, &list->items, &list->capacity, list->count + 1, sizeof(Token))) return false;
+    list->items[list->count++] = *token;
+    return true;
+}
+
+// A token's text, for pasting and for #error
+static const char* spell(const Token* token, char* buffer, size_t size) {
+    switch (token->type) {
+        case TOKEN_IDENTIFIER:
+            return token->value.identifier;
+        case TOKEN_NUMBER:
+            // Negative only when a hexadecimal literal used all 64 bits
+            if (token->value.number < 0) snprintf(buffer, size, "0x%" PRIx64, (uint64_t)token->value.number);
+            else snprintf(buffer, size, "%" PRId64, token->value.number);
+            return buffer;
+        case TOKEN_HEADER_NAME:
+            return token->text;
+        case TOKEN_EOF:
+        case TOKEN_ERROR:
+            return "";
+        default:
+            return token_spelling(token->type) ? token_spelling(token->type) : "";
+    }
+}
+
+// The unit's definition of name, or NULL
+static Macro* find_macro(Preprocessor* pp, const char* name) {
+    uint64_t hash = hash_text(name);
+    Macro* macro = pp->macros[hash & (pp->macro_bucket_count - 1)];
+    while (macro && (macro->hash != hash || strcmp(macro->name, name) != 0)) macro = macro->next;
+    return macro;
+}
+
+static void remove_macro(Preprocessor* pp, const char* name) {
+    uint64_t hash = hash_text(name);
+    Macro** link = &pp->macros[hash & (pp->macro_bucket_count - 1)];
+    while (*link && ((*link)->hash != hash || strcmp((*link)->name, name) != 0)) link = &(*link)->next;
+    if (*link) {
+        *link = (*link)->next;
+        pp->macro_count--;
+    }
+}
+
+static void add_macro(Preprocessor* pp, Macro* macro) {
+    if (pp->macro_count >= pp->macro_bucket_count) {
+        size_t count = pp->macro_bucket_count * 2;
+        Macro** buckets = calloc(count, sizeof(Macro*));
+        if (buckets) {
+            for (size_t i = 0; i < pp->macro_bucket_count; i++) {
+                for (Macro* m = pp->macros[i], *next; m; m = next) {
+                    next = m->next;
+                    m->next = buckets[m->hash & (count - 1)];
+                    buckets[m->hash & (count - 1)] = m;
+                }
+            }
+            free(pp->macros);
+            pp->macros = buckets;
+            pp->macro_bucket_count = count;
+        }
+    }
+    macro->hash = hash_text(macro->name);
+    macro->next = pp->macros[macro->hash & (pp->macro_bucket_count - 1)];
+    pp->macros[macro->hash & (pp->macro_bucket_count - 1)] = macro;
+    pp->macro_count++;
+}
+
+// C allows a macro to be defined again only the same way
+static bool same_definition(const Macro* a, const Macro* b) {
+    if (a->function_like != b->function_like || a->variadic != b->variadic || a->line != b->line ||
+        a->param_count != b->param_count || a->body_count != b->body_count) {
+        return false;
+    }
+    for (size_t i = 0; i < a->param_count; i++) {
+        if (strcmp(a->params[i], b->params[i]) != 0) return false;
+    }
+    for (size_t i = 0; i < a->body_count; i++) {
+        const Token* x = &a->body[i];
+        const Token* y = &b->body[i];
+        if (x->type != y->type || a->items[i] != b->items[i]) return false;
+        if (i > 0 && (x->flags & TOKEN_SPACE_BEFORE) != (y->flags & TOKEN_SPACE_BEFORE)) return false;
+        if (x->type == TOKEN_IDENTIFIER && strcmp(x->value.identifier, y->value.identifier) != 0) return false;
+        if (x->type == TOKEN_NUMBER && x->value.number != y->value.number) return false;
+    }
+    return true;
+}
+
+// The first malformed token of a directive, reported; false if there is none
+static bool line_has_error(Preprocessor* pp, const Token* tokens, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (tokens[i].type == TOKEN_ERROR) {
+            pp_error(pp, &tokens[i], "%s", tokens[i].text);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Nothing may follow the first count tokens of a directive
+static bool extra_tokens(Preprocessor* pp, const Token* line, size_t n, size_t count) {
+    if (n <= count) return false;
+    pp_error(pp, &line[count], "Extra tokens after '#%s'", directive_name(&line[0]));
+    return true;
+}
+
+// #define; tokens are what follows the directive name
+static void define_macro(Preprocessor* pp, const Token* at, const Token* tokens, size_t n) {
+    if (line_has_error(pp, tokens, n)) return;
+    if (n == 0 || tokens[0].type != TOKEN_IDENTIFIER) {
+        pp_error(pp, n > 0 ? &tokens[0] : at, "Macro name must be an identifier");
+        return;
+    }
+    const char* name = tokens[0].value.identifier;
+    if (strcmp(name, "defined") == 0) {
+        pp_error(pp, &tokens[0], "'defined' cannot be a macro name");
+        return;
+    }
+
+    Macro* macro = arena_alloc(&pp->arena, sizeof(Macro));
+    const char** params = arena_alloc(&pp->arena, (n + 1) * sizeof(char*));
+    if (!macro || !params) {
+        out_of_memory(pp);
+        return;
+    }
+    macro->name = name;
+    macro->params = params;
+    size_t i = 1;
+    if (i < n && tokens[i].type == TOKEN_LPAREN && !(tokens[i].flags & TOKEN_SPACE_BEFORE)) {
+        // Parameters: '(' names ')', the last of them possibly '...'
+        macro->function_like = true;
+        i++;
+        if (i < n && tokens[i].type == TOKEN_RPAREN) {
+            i++;
+        } else {
+            for (;;) {
+                if (i < n && tokens[i].type == TOKEN_ELLIPSIS) {
+                    macro->variadic = true;
+                    params[macro->param_count++] = "__VA_ARGS__";
+                    i++;
+                } else if (i < n && tokens[i].type == TOKEN_IDENTIFIER) {
+                    const char* param = tokens[i].value.identifier;
+                    for (size_t p = 0; p < macro->param_count; p++) {
+                        if (strcmp(params[p], param) == 0) {
+                            pp_error(pp, &tokens[i], "Duplicate macro parameter '%s'", param);
+                            return;
+                        }
+                    }
+                    params[macro->param_count++] = param;
+                    i++;
+                } else {
+                    pp_error(pp, i < n ? &tokens[i] : &tokens[i - 1], "Expected parameter name in macro definition");
+                    return;
+                }
+                if (i < n && tokens[i].type == TOKEN_RPAREN) {
+                    i++;
+                    break;
+                }
+                if (macro->variadic || i >= n || tokens[i].type != TOKEN_COMMA) {
+                    pp_error(pp, i < n ? &tokens[i] : &tokens[i - 1], "Expected ',' or ')' in macro parameters");
+                    return;
+                }
+                i++;
+            }
+        }
+    }
+
+    // The body, each token classified once so expansion need not look up names
+    macro->body_count = n - i;
+    macro->body = arena_alloc(&pp->arena, (macro->body_count + 1) * sizeof(Token));
+    macro->items = arena_alloc(&pp->arena, (macro->body_count + 1) * sizeof(int));
+    if (!macro->body || !macro->items) {
+        out_of_memory(pp);
+        return;
+    }
+    for (size_t b = 0; b < macro->body_count; b++) {
+        const Token* token = &tokens[i + b];
+        macro->body[b] = *token;
+        macro->items[b] = PLAIN;
+        if (token->type == TOKEN_HASH_HASH) {
+            if (b == 0 || b + 1 == macro->body_count) {
+                pp_error(pp, token, "'##' cannot be at either end of a macro");
+                return;
+            }
+            macro->items[b] = PASTE;
+        } else if (token->type == TOKEN_HASH && macro->function_like) {
+            pp_error(pp, token, "Stringizing with '#' is not supported");
+            return;
+        } else if (token->type == TOKEN_IDENTIFIER) {
+            for (size_t p = 0; p < macro->param_count; p++) {
+                if (strcmp(params[p], token->value.identifier) == 0) macro->items[b] = (int)p;
+            }
+            if (macro->items[b] == PLAIN && !macro->variadic &&
+                strcmp(token->value.identifier, "__VA_ARGS__") == 0) {
+                pp_error(pp, token, "'__VA_ARGS__' can only appear in a variadic macro");
+                return;
+            }
+        }
+    }
+
+    Macro* old = find_macro(pp, name);
+    if (old) {
+        if (same_definition(old, macro)) return;
+        pp_error(pp, &tokens[0], "Macro '%s' redefined differently", name);
+        remove_macro(pp, name);
+    }
+    add_macro(pp, macro);
+}
+
+// The next token of a file being read: the unit itself, lexed, or a
+// cached header
+static Token source_next(Preprocessor* pp, Source* source) {
+    if (source->has_pending) {
+        source->has_pending = false;
+        return source->pending;
+    }
+    if (!source->header) return lex_token(&pp->lexer);
+    const Token* token = &source->tokens[source->index];
+    if (token->type != TOKEN_EOF) source->index++;
+    return *token;
+}
+
+static void pend(Source* source, const Token* token) {
+    source->pending = *token;
+    source->has_pending = true;
+}
+
+static Source* top_source(Preprocessor* pp) {
+    return &pp->sources[pp->source_count - 1];
+}
+
+static bool push_source(Preprocessor* pp, const Header* header, const Token* tokens) {
+    if (!reserve(pp, &pp->sources, &pp->source_capacity, pp->source_count + 1, sizeof(Source))) return false;
+    Source* source = &pp->sources[pp->source_count++];
+    memset(source, 0, sizeof(*source));
+    source->header = header;
+    source->tokens = tokens;
+    source->conditional_base = pp->conditional_count;
+    return true;
+}
+
+// The rest of a directive line, after its '#', into pp->line
+static size_t read_line(Preprocessor* pp) {
+    Source* source = top_source(pp);
+    pp->line.count = 0;
+    for (;;) {
+        Token token = source_next(pp, source);
+        if (token.type == TOKEN_EOF || (token.flags & TOKEN_LINE_START)) {
+            pend(source, &token);
+            break;
+        }
+        if (!list_push(pp, &pp->line, &token)) break;
+    }
+    return pp->line.count;
+}
+
+// Skip a group whose condition failed, up to the '#elif', '#else' or
+// '#endif' that ends it. That directive's name is left pending and true
+// returned; at the end of the file false.
+static bool skip_group(Preprocessor* pp) {
+    Source* source = top_source(pp);
+    size_t depth = 0;
+    for (;;) {
+        Token token = source_next(pp, source);
+        if (token.type == TOKEN_EOF) {
+            pend(source, &token);
+            return false;
+        }
+        if (token.type != TOKEN_HASH || !(token.flags & TOKEN_LINE_START)) continue;
+        Token name_token = source_next(pp, source);
+        if (name_token.type == TOKEN_EOF || (name_token.flags & TOKEN_LINE_START)) {
+            pend(source, &name_token);
+            continue;
+        }
+        const char* name = directive_name(&name_token);
+        if (!name) continue;
+        bool endif = strcmp(name, "endif") == 0;
+        if (opens_conditional(name)) {
+            depth++;
+        } else if (endif && depth > 0) {
+            depth--;
+        } else if (depth == 0 && (endif || strcmp(name, "elif") == 0 || strcmp(name, "else") == 0)) {
+            pend(source, &name_token);
+            return true;
+        }
+    }
+}
+
+// Read tokens next, ahead of what is left of the current context. An
+// owned array is freed with the context, or here on failure.
+static bool push_context(Preprocessor* pp, const Token* tokens, size_t count, Macro* macro, bool owned,
+                         bool barrier) {
+    if (!reserve(pp, &pp->contexts, &pp->context_capacity, pp->context_count + 1, sizeof(Context))) {
+        if (owned) free((void*)tokens);
+        return false;
+    }
+    Context* context = &pp->contexts[pp->context_count++];
+    memset(context, 0, sizeof(*context));
+    context->tokens = tokens;
+    context->count = count;
+    context->macro = macro;
+    context->owned = owned;
+    context->barrier = barrier;
+    if (macro) macro->active++;
+    return true;
+}
+
+// Read token again next
+static void push_back(Preprocessor* pp, const Token* token) {
+    if (push_context(pp, NULL, 1, NULL, false, false)) pp->contexts[pp->context_count - 1].token = *token;
+}
+
+static void pop_contexts(Preprocessor* pp, size_t base) {
+    while (pp->context_count > base) {
+        Context* context = &pp->contexts[--pp->context_count];
+        if (context->macro) context->macro->active--;
+        if (context->owned) free((void*)context->tokens);
+    }
+}
+
+static void directive(Preprocessor* pp);
+
+// The next token of the files, directives run
+static Token file_token(Preprocessor* pp) {
+    for (;;) {
+        if (pp->out_of_memory) return (Token){ .type = TOKEN_EOF };
+        if (pp->skipping) {
+            pp->skipping = false;
+            if (skip_group(pp)) {
+                directive(pp);
+                continue;
+            }
+        }
+        Source* source = top_source(pp);
+        Token token = source_next(pp, source);
+        if (token.type == TOKEN_HASH && (token.flags & TOKEN_LINE_START)) {
+            directive(pp);
+            continue;
+        }
+        if (token.type != TOKEN_EOF) return token;
+
+        // A file's conditionals end with it
+        while (pp->conditional_count > source->conditional_base) {
+            const Token* at = &pp->conditionals[--pp->conditional_count].at;
+            pp_error(pp, at, "Unterminated '#%s'", directive_name(at));
+        }
+        if (pp->source_count == 1) return token;
+        pp->source_count--;
+    }
+}
+
+// The next token before expansion: from the innermost context, or the files
+static Token raw_token(Preprocessor* pp) {
+    while (pp->context_count > 0) {
+        Context* context = &pp->contexts[pp->context_count - 1];
+        if (context->index < context->count) {
+            return context->tokens ? context->tokens[context->index++] : (context->index++, context->token);
+        }
+        if (context->barrier) return (Token){ .type = TOKEN_EOF };
+        pop_contexts(pp, pp->context_count - 1);
+    }
+    return file_token(pp);
+}
+
+static Token expand_token(Preprocessor* pp);
+
+// Expand tokens by themselves, as C does with macro arguments and #if
+// lines, appending the result to out
+static void expand_list(Preprocessor* pp, const Token* tokens, size_t count, TokenList* out) {
+    size_t base = pp->context_count;
+    if (!push_context(pp, tokens, count, NULL, false, true)) return;
+    for (;;) {
+        Token token = expand_token(pp);
+        if (token.type == TOKEN_EOF || !list_push(pp, out, &token)) break;
+    }
+    pop_contexts(pp, base);
+}
+
+typedef struct {
+    const Token* tokens;           // Every argument, one after another
+    size_t* ends;                  // Where each argument ends
+    size_t count;
+    TokenList* expanded;           // Each argument fully expanded, once needed
+    bool* done;
+} Arguments;
+
+static const Token* argument(const Arguments* args, size_t index, size_t* count) {
+    size_t start = index > 0 ? args->ends[index - 1] : 0;
+    *count = args->ends[index] - start;
+    return args->tokens + start;
+}
+
+// Paste two tokens by lexing their spellings as one, into left
+static void paste(Preprocessor* pp, Token* left, const Token* right, const Token* at, TokenList* out) {
+    char left_buffer[32];
+    char right_buffer[32];
+    const char* a = spell(left, left_buffer, sizeof(left_buffer));
+    const char* b = spell(right, right_buffer, sizeof(right_buffer));
+    size_t length = strlen(a) + strlen(b);
+    char* text = arena_alloc(&pp->arena, length + 1);
+    if (!text) {
+        out_of_memory(pp);
+        return;
+    }
+    snprintf(text, length + 1, "%s%s", a, b);
+    Lexer lexer;
+    lexer_init(&lexer, text, length, at->file, &pp->arena);
+    Token pasted = lex_token(&lexer);
+    if (pasted.type != TOKEN_ERROR && pasted.type != TOKEN_EOF && lex_token(&lexer).type == TOKEN_EOF) {
+        pasted.line = left->line;
+        pasted.column = left->column;
+        pasted.file = left->file;
+        pasted.flags = left->flags & TOKEN_SPACE_BEFORE;
+        *left = pasted;
+        return;
+    }
+    pp_error(pp, at, "Pasting '%s' and '%s' does not give a valid token", a, b);
+    list_push(pp, out, right);
+}
+
+// The replacement of one invocation of macro at at, as a token list
+static void substitute(Preprocessor* pp, const Macro* macro, Arguments* args, const Token* at, TokenList* out) {
+    bool left_empty = false;       // The operand left of a '##' produced no tokens
+    for (size_t i = 0; i < macro->body_count; i++) {
+        int item = macro->items[i];
+        if (item == PASTE) continue;
+        bool pasting = i > 0 && macro->items[i - 1] == PASTE;
+        const Token* tokens = &macro->body[i];
+        size_t count = 1;
+        if (item >= 0) {
+            // Operands of '##' are pasted as written, other arguments expanded first
+            if (pasting || (i + 1 < macro->body_count && macro->items[i + 1] == PASTE)) {
+                tokens = argument(args, (size_t)item, &count);
+            } else {
+                if (!args->done[item]) {
+                    size_t raw_count;
+                    const Token* raw = argument(args, (size_t)item, &raw_count);
+                    expand_list(pp, raw, raw_count, &args->expanded[item]);
+                    args->done[item] = true;
+                }
+                tokens = args->expanded[item].items;
+                count = args->expanded[item].count;
+            }
+        }
+
+        size_t first = out->count;
+        size_t from = 0;
+        if (pasting && !left_empty && count > 0) {
+            first = out->count - 1;
+            paste(pp, &out->items[first], &tokens[0], at, out);
+            from = 1;
+        }
+        for (size_t t = from; t < count; t++) {
+            if (!list_push(pp, out, &tokens[t])) return;
+        }
+        for (size_t t = first; t < out->count; t++) {
+            out->items[t].file = at->file;
+            out->items[t].line = at->line;
+            out->items[t].column = at->column;
+            out->items[t].flags &= (uint8_t)~TOKEN_LINE_START;
+        }
+        left_empty = count == 0 && (!pasting || left_empty);
+    }
+}
+
+// An invocation of a function-like macro, its name at at and its '(' read
+static void expand_call(Preprocessor* pp, Macro* macro, const Token* at) {
+    TokenList raw = { 0 };
+    size_t* ends = NULL;
+    size_t end_capacity = 0;
+    size_t count = 0;
+    size_t depth = 0;
+    for (;;) {
+        Token token = raw_token(pp);
+        if (token.type == TOKEN_EOF) {
+            pp_error(pp, at, "Unterminated argument list invoking macro '%s'", macro->name);
+            push_back(pp, &token);
+            goto done;
+        }
+        if (token.type == TOKEN_LPAREN) {
+            depth++;
+        } else if (token.type == TOKEN_RPAREN) {
+            if (depth == 0) break;
+            depth--;
+        } else if (token.type == TOKEN_COMMA && depth == 0 &&
+                   !(macro->variadic && count + 1 >= macro->param_count)) {
+            if (!reserve(pp, &ends, &end_capacity, count + 1, sizeof(size_t))) goto done;
+            ends[count++] = raw.count;
+            continue;
+        }
+        if (!list_push(pp, &raw, &token)) goto done;
+    }
+    if (!reserve(pp, &ends, &end_capacity, count + 2, sizeof(size_t))) goto done;
+    ends[count++] = raw.count;
+    if (macro->param_count == 0 && count == 1 && raw.count == 0) count = 0;
+    if (macro->variadic && count + 1 == macro->param_count) ends[count++] = raw.count;   // No variable arguments
+    if (count != macro->param_count) {
+        pp_error(pp, at, "Macro '%s' expects %zu argument%s, but %zu %s given", macro->name, macro->param_count,
+                 macro->param_count == 1 ? "" : "s", count, count == 1 ? "was" : "were");
+        goto done;
+    }
+
+    Arguments args = { raw.items, ends, count, calloc(count + 1, sizeof(TokenList)), calloc(count + 1, sizeof(bool)) };
+    TokenList out = { 0 };
+    if (args.expanded && args.done) {
+        substitute(pp, macro, &args, at, &out);
+        if (!pp->out_of_memory && push_context(pp, out.items, out.count, macro, true, false)) {
+            out.items = NULL;
+            pp->stats.expansions++;
+        }
+    } else {
+        out_of_memory(pp);
+    }
+    free(out.items);
+    for (size_t i = 0; args.expanded && i < count; i++) free(args.expanded[i].items);
+    free(args.expanded);
+    free(args.done);
+done:
+    free(raw.items);
+    free(ends);
+}
+
+// The next token with macros expanded
+static Token expand_token(Preprocessor* pp) {
+    for (;;) {
+        Token token = raw_token(pp);
+        if (token.type != TOKEN_IDENTIFIER || (token.flags & TOKEN_NO_EXPAND)) return token;
+        Macro* macro = find_macro(pp, token.value.identifier);
+        if (!macro) return token;
+        if (macro->active) {
+            // Named inside its own expansion: stays an identifier for good
+            token.flags |= TOKEN_NO_EXPAND;
+            return token;
+        }
+        if (macro->line) {
+            pp->stats.expansions++;
+            token.type = TOKEN_NUMBER;
+            token.value.number = token.line;
+            return token;
+        }
+        if (macro->function_like) {
+            Token next = raw_token(pp);
+            if (next.type != TOKEN_LPAREN) {
+                // Only the name: not an invocation
+                push_back(pp, &next);
+                return token;
+            }
+            expand_call(pp, macro, &token);
+            continue;
+        }
+        TokenList out = { 0 };
+        substitute(pp, macro, NULL, &token, &out);
+        if (!pp->out_of_memory && push_context(pp, out.items, out.count, macro, true, false)) {
+            out.items = NULL;
+            pp->stats.expansions++;
+        }
+        free(out.items);
+    }
+}
+
+// The state of evaluating one #if expression
+typedef struct {
+    Preprocessor* pp;
+    const Token* tokens;
+    size_t count;
+    size_t index;
+    const Token* at;               // The directive, for errors at the end of the line
+    int unevaluated;               // Inside the branch && || or ?: skips
+    bool failed;
+} Evaluation;
+
+// At the token at, or by default the next one
+static void eval_error(Evaluation* e, const Token* at, const char* message) {
+    if (e->failed) return;
+    e->failed = true;
+    if (!at) at = e->index < e->count ? &e->tokens[e->index] : e->at;
+    pp_error(e->pp, at, "%s in '#%s'", message, directive_name(e->at));
+}
+
+static TokenType eval_peek(Evaluation* e) {
+    return e->index < e->count ? e->tokens[e->index].type : TOKEN_EOF;
+}
+
+static int64_t eval_conditional(Evaluation* e);
+
+static int64_t eval_unary(Evaluation* e) {
+    if (e->failed) return 0;
+    TokenType type = eval_peek(e);
+    if (type == TOKEN_NUMBER) return e->tokens[e->index++].value.number;
+    if (type == TOKEN_IDENTIFIER || (type >= TOKEN_INT && type <= TOKEN_BREAK)) {
+        e->index++;                // Names left after expansion are 0
+        return 0;
+    }
+    if (type == TOKEN_LPAREN) {
+        e->index++;
+        int64_t value = eval_conditional(e);
+        if (eval_peek(e) != TOKEN_RPAREN) {
+            eval_error(e, NULL, "Missing ')'");
+            return 0;
+        }
+        e->index++;
+        return value;
+    }
+    if (type == TOKEN_PLUS || type == TOKEN_MINUS || type == TOKEN_TILDE || type == TOKEN_BANG) {
+        e->index++;
+        uint64_t value = (uint64_t)eval_unary(e);
+        switch (type) {
+            case TOKEN_MINUS: return (int64_t)(0 - value);
+            case TOKEN_TILDE: return (int64_t)~value;
+            case TOKEN_BANG:  return value == 0;
+            default:          return (int64_t)value;
+        }
+    }
+    if (type == TOKEN_ERROR) {
+        pp_error(e->pp, &e->tokens[e->index], "%s", e->tokens[e->index].text);
+        e->failed = true;
+        return 0;
+    }
+    eval_error(e, NULL, type == TOKEN_EOF ? "Expected a value" : "Unexpected token");
+    return 0;
+}
+
+static int binary_precedence(TokenType type) {
+    switch (type) {
+        case TOKEN_OR_OR:   return 1;
+        case TOKEN_AND_AND: return 2;
+        case TOKEN_PIPE:    return 3;
+        case TOKEN_CARET:   return 4;
+        case TOKEN_AMP:     return 5;
+        case TOKEN_EQ: case TOKEN_NEQ: return 6;
+        case TOKEN_LT: case TOKEN_GT: case TOKEN_LTE: case TOKEN_GTE: return 7;
+        case TOKEN_SHL: case TOKEN_SHR: return 8;
+        case TOKEN_PLUS: case TOKEN_MINUS: return 9;
+        case TOKEN_STAR: case TOKEN_SLASH: case TOKEN_PERCENT: return 10;
+        default:            return 0;
+    }
+}
+
+// Arithmetic wraps, as the unsigned values it is done in
+static int64_t eval_binary(Evaluation* e, int min_precedence) {
+    int64_t left = eval_unary(e);
+    for (;;) {
+        TokenType op = eval_peek(e);
+        int precedence = binary_precedence(op);
+        if (e->failed || precedence == 0 || precedence < min_precedence) return left;
+        const Token* at = &e->tokens[e->index++];
+        bool skips = (op == TOKEN_AND_AND && left == 0) || (op == TOKEN_OR_OR && left != 0);
+        e->unevaluated += skips;
+        int64_t right = eval_binary(e, precedence + 1);
+        e->unevaluated -= skips;
+        uint64_t a = (uint64_t)left;
+        uint64_t b = (uint64_t)right;
+        switch (op) {
+            case TOKEN_OR_OR:   left = left || right; break;
+            case TOKEN_AND_AND: left = left && right; break;
+            case TOKEN_PIPE:    left = (int64_t)(a | b); break;
+            case TOKEN_CARET:   left = (int64_t)(a ^ b); break;
+            case TOKEN_AMP:     left = (int64_t)(a & b); break;
+            case TOKEN_EQ:      left = left == right; break;
+            case TOKEN_NEQ:     left = left != right; break;
+            case TOKEN_LT:      left = left < right; break;
+            case TOKEN_GT:      left = left > right; break;
+            case TOKEN_LTE:     left = left <= right; break;
+            case TOKEN_GTE:     left = left >= right; break;
+            case TOKEN_SHL:     left = right < 0 || right > 63 ? 0 : (int64_t)(a << right); break;
+            case TOKEN_SHR:
+                left = right < 0 || right > 63 ? (left < 0 ? -1 : 0)
+                                               : (left < 0 ? (int64_t)~(~a >> right) : (int64_t)(a >> right));
+                break;
+            case TOKEN_PLUS:    left = (int64_t)(a + b); break;
+            case TOKEN_MINUS:   left = (int64_t)(a - b); break;
+            case TOKEN_STAR:    left = (int64_t)(a * b); break;
+            default:
+                if (right == 0) {
+                    if (!e->unevaluated) eval_error(e, at, "Division by zero");
+                    left = 0;
+                } else if (right == -1) {
+                    left = op == TOKEN_SLASH ? (int64_t)(0 - a) : 0;
+                } else {
+                    left = op == TOKEN_SLASH ? left / right : left % right;
+                }
+                break;
+        }
+    }
+}
+
+static int64_t eval_conditional(Evaluation* e) {
+    int64_t condition = eval_binary(e, 1);
+    if (e->failed || eval_peek(e) != TOKEN_QUESTION) return condition;
+    e->index++;
+    e->unevaluated += condition == 0;
+    int64_t then_value = eval_conditional(e);
+    e->unevaluated -= condition == 0;
+    if (eval_peek(e) != TOKEN_COLON) {
+        eval_error(e, NULL, "Missing ':'");
+        return 0;
+    }
+    e->index++;
+    e->unevaluated += condition != 0;
+    int64_t else_value = eval_conditional(e);
+    e->unevaluated -= condition != 0;
+    return condition ? then_value : else_value;
+}
+
+// The value of an #if or #elif line, whose directive name is line[0]
+static bool evaluate(Preprocessor* pp, const Token* line, size_t n) {
+    if (line_has_error(pp, line + 1, n - 1)) return false;
+    if (n == 1) {
+        pp_error(pp, &line[0], "'#%s' with no expression", directive_name(&line[0]));
+        return false;
+    }
+
+    // 'defined' goes first, before its operand could be expanded
+    TokenList resolved = { 0 };
+    bool ok = true;
+    for (size_t i = 1; i < n && ok; i++) {
+        Token token = line[i];
+        if (token.type == TOKEN_IDENTIFIER && strcmp(token.value.identifier, "defined") == 0) {
+            bool parenthesized = i + 1 < n && line[i + 1].type == TOKEN_LPAREN;
+            size_t name = i + 1 + parenthesized;
+            if (name >= n || line[name].type != TOKEN_IDENTIFIER ||
+                (parenthesized && (name + 1 >= n || line[name + 1].type != TOKEN_RPAREN))) {
+                pp_error(pp, &token, "Expected a macro name after 'defined'");
+                ok = false;
+                break;
+            }
+            token.type = TOKEN_NUMBER;
+            token.value.number = find_macro(pp, line[name].value.identifier) != NULL;
+            i = name + parenthesized;
+        }
+        ok = list_push(pp, &resolved, &token);
+    }
+
+    TokenList expanded = { 0 };
+    bool value = false;
+    if (ok) {
+        expand_list(pp, resolved.items, resolved.count, &expanded);
+        Evaluation e = { pp, expanded.items, expanded.count, 0, &line[0], 0, false };
+        value = eval_conditional(&e) != 0;
+        if (!e.failed && e.index < e.count) eval_error(&e, NULL, "Unexpected token");
+        if (e.failed) value = false;
+    }
+    free(resolved.items);
+    free(expanded.items);
+    return value;
+}
+
+// Enter an #if group, skipping it unless value holds
+static void open_conditional(Preprocessor* pp, const Token* at, bool value) {
+    if (!reserve(pp, &pp->conditionals, &pp->conditional_capacity, pp->conditional_count + 1,
+                 sizeof(Conditional))) {
+        return;
+    }
+    Conditional* conditional = &pp->conditionals[pp->conditional_count++];
+    conditional->at = *at;
+    conditional->taken = value;
+    conditional->seen_else = false;
+    pp->skipping = !value;
+}
+
+// The innermost conditional of the current file, or NULL
+static Conditional* current_conditional(Preprocessor* pp, const Token* at) {
+    if (pp->conditional_count > top_source(pp)->conditional_base) {
+        return &pp->conditionals[pp->conditional_count - 1];
+    }
+    pp_error(pp, at, "'#%s' without '#if'", directive_name(at));
+    return NULL;
+}
+
+// Where a header name leads: for "name", the includer's directory first;
+// then the -I directories in order
+static const Header* find_header(Preprocessor* pp, const char* name, size_t length, bool quoted, bool* fresh) {
+    const PreprocessOptions* options = pp->options;
+    size_t candidates = 1 + (options ? options->include_path_count : 0);
+    const Header* header = NULL;
+    for (size_t c = quoted ? 0 : 1; c < candidates && !header; c++) {
+        const char* directory;
+        size_t directory_length;
+        if (name[0] == '/') {
+            directory = "";
+            directory_length = 0;
+            c = candidates;        // Nowhere else to look
+        } else if (c == 0) {
+            const Header* includer = top_source(pp)->header;
+            directory = includer ? includer->path : pp->path;
+            const char* slash = directory ? strrchr(directory, '/') : NULL;
+            directory_length = slash ? (size_t)(slash - directory) + 1 : 0;
+        } else {
+            directory = options->include_paths[c - 1];
+            directory_length = strlen(directory);
+        }
+        bool separate = directory_length > 0 && directory[directory_length - 1] != '/';
+        char* path = malloc(directory_length + separate + length + 1);
+        if (!path) {
+            out_of_memory(pp);
+            return NULL;
+        }
+        memcpy(path, directory, directory_length);
+        if (separate) path[directory_length] = '/';
+        memcpy(path + directory_length + separate, name, length);
+        path[directory_length + separate + length] = '\0';
+        header = cache_lookup(path, fresh);
+        free(path);
+        if (!header) {
+            out_of_memory(pp);
+            return NULL;
+        }
+        if (header->missing) header = NULL;
+    }
+    return header;
+}
+
+static void include_header(Preprocessor* pp, const Token* line, size_t n) {
+    pp->stats.includes++;
+    if (line_has_error(pp, line + 1, n - 1)) return;
+    if (n < 2 || line[1].type != TOKEN_HEADER_NAME) {
+        pp_error(pp, n < 2 ? &line[0] : &line[1], "Expected \"file\" or <file> after '#include'");
+        return;
+    }
+    if (extra_tokens(pp, line, n, 2)) return;
+    const char* spelling = line[1].text;
+    const char* name = spelling + 1;
+    size_t length = strlen(name) - 1;
+    if (length == 0) {
+        pp_error(pp, &line[1], "Empty header name");
+        return;
+    }
+    if (pp->source_count > MAX_INCLUDE_DEPTH) {
+        pp_error(pp, &line[0], "'#include' nested too deeply");
+        return;
+    }
+
+    bool fresh = false;
+    const Header* header = find_header(pp, name, length, spelling[0] == '"', &fresh);
+    if (!header) {
+        if (!pp->out_of_memory) pp_error(pp, &line[1], "Could not find header %s", spelling);
+        return;
+    }
+    bool once = false;
+    for (size_t i = 0; i < pp->once_count && !once; i++) once = pp->once[i] == header;
+    if (once || (header->guard && find_macro(pp, header->guard))) {
+        pp->stats.skipped++;
+        return;
+    }
+    bool lexed = false;
+    const Token* tokens = header_tokens(header, &lexed);
+    if (!tokens) {
+        out_of_memory(pp);
+        return;
+    }
+    if (fresh || lexed) pp->stats.read++;
+    else pp->stats.cached++;
+    push_source(pp, header, tokens);
+}
+
+// Run the directive whose '#' was just read
+static void directive(Preprocessor* pp) {
+    size_t n = read_line(pp);
+    if (n == 0) return;            // The null directive
+    const Token* line = pp->line.items;
+    const char* name = directive_name(&line[0]);
+    if (!name) {
+        pp_error(pp, &line[0], "Invalid preprocessing directive");
+        return;
+    }
+
+    if (strcmp(name, "define") == 0) {
+        define_macro(pp, &line[0], line + 1, n - 1);
+    } else if (strcmp(name, "undef") == 0) {
+        if (n < 2 || line[1].type != TOKEN_IDENTIFIER) {
+            pp_error(pp, n < 2 ? &line[0] : &line[1], "Macro name must be an identifier");
+        } else if (!extra_tokens(pp, line, n, 2)) {
+            remove_macro(pp, line[1].value.identifier);
+        }
+    } else if (strcmp(name, "include") == 0) {
+        include_header(pp, line, n);
+    } else if (strcmp(name, "if") == 0) {
+        Token at = line[0];
+        open_conditional(pp, &at, evaluate(pp, line, n));
+    } else if (strcmp(name, "ifdef") == 0 || strcmp(name, "ifndef") == 0) {
+        bool value = false;
+        if (n < 2 || line[1].type != TOKEN_IDENTIFIER) {
+            pp_error(pp, n < 2 ? &line[0] : &line[1], "Macro name must be an identifier");
+        } else if (!extra_tokens(pp, line, n, 2)) {
+            value = (find_macro(pp, line[1].value.identifier) != NULL) == (name[2] == 'd');
+        }
+        open_conditional(pp, &line[0], value);
+    } else if (strcmp(name, "elif") == 0) {
+        Conditional* conditional = current_conditional(pp, &line[0]);
+        if (!conditional) return;
+        if (conditional->seen_else) {
+            pp_error(pp, &line[0], "'#elif' after '#else'");
+            pp->skipping = true;
+        } else if (conditional->taken) {
+            pp->skipping = true;
+        } else {
+            bool value = evaluate(pp, line, n);
+            conditional->taken = value;
+            pp->skipping = !value;
+        }
+    } else if (strcmp(name, "else") == 0) {
+        Conditional* conditional = current_conditional(pp, &line[0]);
+        if (!conditional || extra_tokens(pp, line, n, 1)) return;
+        if (conditional->seen_else) pp_error(pp, &line[0], "'#else' after '#else'");
+        conditional->seen_else = true;
+        pp->skipping = conditional->taken;
+        conditional->taken = true;
+    } else if (strcmp(name, "endif") == 0) {
+        if (current_conditional(pp, &line[0])) pp->conditional_count--;
+        extra_tokens(pp, line, n, 1);
+    } else if (strcmp(name, "error") == 0) {
+        char message[sizeof(((ParseDiagnostic*)0)->message)] = "#error";
+        size_t used = strlen(message);
+        for (size_t i = 1; i < n && used < sizeof(message) - 1; i++) {
+            char buffer[32];
+            used += (size_t)snprintf(message + used, sizeof(message) - used, " %s",
+                                     spell(&line[i], buffer, sizeof(buffer)));
+        }
+        pp_error(pp, &line[0], "%s", message);
+    } else if (strcmp(name, "pragma") == 0) {
+        // #pragma once; others are ignored, as C allows
+        const Header* header = top_source(pp)->header;
+        if (n == 2 && line[1].type == TOKEN_IDENTIFIER && strcmp(line[1].value.identifier, "once") == 0 &&
+            header && reserve(pp, &pp->once, &pp->once_capacity, pp->once_count + 1, sizeof(Header*))) {
+            pp->once[pp->once_count++] = header;
+        }
+    } else {
+        pp_error(pp, &line[0], "Unknown directive '#%s'", name);
+    }
+}
+
+// The PCH_MACROS section: the macro count, then per macro its name, kind,
+// parameter count and names, body length and two words per body token:
+// its kind and its value. Where a body token was written is not kept, as
+// expansion gives every token the location of the invocation. Then the
+// header count, and per header its real path, guard and whether it said
+// #pragma once.
+
+#define PCH_FUNCTION_LIKE 1
+#define PCH_VARIADIC 2
+
+static void save_macro(PchWriter* writer, const Macro* macro) {
+    pch_put_string(writer, PCH_MACROS, macro->name);
+    pch_put(writer, PCH_MACROS,
+            (macro->function_like ? PCH_FUNCTION_LIKE : 0) | (macro->variadic ? PCH_VARIADIC : 0));
+    pch_put(writer, PCH_MACROS, macro->param_count);
+    for (size_t i = 0; i < macro->param_count; i++) {
+        pch_put_string(writer, PCH_MACROS, macro->params[i]);
+    }
+    pch_put(writer, PCH_MACROS, macro->body_count);
+    for (size_t b = 0; b < macro->body_count; b++) {
+        const Token* token = &macro->body[b];
+        pch_put(writer, PCH_MACROS, (uint64_t)token->type | (uint64_t)token->flags << 16 |
+                                    (uint64_t)(uint32_t)macro->items[b] << 32);
+        if (token->type == TOKEN_IDENTIFIER) pch_put_string(writer, PCH_MACROS, token->value.identifier);
+        else pch_put(writer, PCH_MACROS, (uint64_t)token->value.number);
+    }
+}
+
+void preprocess_save(const Preprocessor* pp, PchWriter* writer) {
+    size_t count = 0;
+    for (size_t i = 0; i < pp->macro_bucket_count; i++) {
+        for (const Macro* m = pp->macros[i]; m; m = m->next) count += !m->line;
+    }
+    pch_put(writer, PCH_MACROS, count);
+    for (size_t i = 0; i < pp->macro_bucket_count; i++) {
+        for (const Macro* m = pp->macros[i]; m; m = m->next) {
+            if (!m->line) save_macro(writer, m);
+        }
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    count = 0;
+    for (size_t i = 0; i < cache_bucket_count; i++) {
+        for (const Header* h = cache_buckets[i]; h; h = h->next) count += !h->missing && !h->alias;
+    }
+    pch_put(writer, PCH_MACROS, count);
+    for (size_t i = 0; i < cache_bucket_count; i++) {
+        for (const Header* h = cache_buckets[i]; h; h = h->next) {
+            if (h->missing || h->alias) continue;
+            bool once = false;
+            for (size_t o = 0; o < pp->once_count && !once; o++) once = pp->once[o] == h;
+            char* real = realpath(h->path, NULL);
+            pch_put_string(writer, PCH_MACROS, real ? real : h->path);
+            pch_put_string(writer, PCH_MACROS, h->guard);
+            pch_put(writer, PCH_MACROS, once);
+            pch_add_dependency(writer, real ? real : h->path);
+            free(real);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// The macros a unit starts with, and the headers it need not read again
+static void load_pch(Preprocessor* pp, const Pch* pch) {
+    PchReader reader;
+    pch_reader(pch, PCH_MACROS, &reader);
+    size_t count = pch_get(&reader);
+    for (size_t i = 0; i < count && !reader.failed && !pp->out_of_memory; i++) {
+        Macro* macro = arena_alloc(&pp->arena, sizeof(Macro));
+        if (!macro) {
+            out_of_memory(pp);
+            break;
+        }
+        macro->name = pch_get_string(&reader);
+        uint64_t kind = pch_get(&reader);
+        macro->function_like = kind & PCH_FUNCTION_LIKE;
+        macro->variadic = kind & PCH_VARIADIC;
+        macro->param_count = pch_get(&reader);
+        if (!macro->name || macro->param_count > reader.count) {
+            reader.failed = true;
+            break;
+        }
+        macro->params = arena_alloc(&pp->arena, (macro->param_count + 1) * sizeof(char*));
+        if (!macro->params) {
+            out_of_memory(pp);
+            break;
+        }
+        for (size_t p = 0; p < macro->param_count; p++) {
+            macro->params[p] = pch_get_string(&reader);
+        }
+        macro->body_count = pch_get(&reader);
+        if (macro->body_count > reader.count) {
+            reader.failed = true;
+            break;
+        }
+        macro->body = arena_alloc(&pp->arena, (macro->body_count + 1) * sizeof(Token));
+        macro->items = arena_alloc(&pp->arena, (macro->body_count + 1) * sizeof(int));
+        if (!macro->body || !macro->items) {
+            out_of_memory(pp);
+            break;
+        }
+        for (size_t b = 0; b < macro->body_count; b++) {
+            Token* token = &macro->body[b];
+            uint64_t word = pch_get(&reader);
+            token->type = (TokenType)(word & 0xffff);
+            token->flags = (uint8_t)(word >> 16);
+            macro->items[b] = (int32_t)(uint32_t)(word >> 32);
+            if (token->type == TOKEN_IDENTIFIER) {
+                token->value.identifier = (char*)pch_get_string(&reader);
+                if (!token->value.identifier) reader.failed = true;
+            } else {
+                token->value.number = (int64_t)pch_get(&reader);
+            }
+            if (token->type >= TOKEN_TYPE_COUNT || token->type == TOKEN_ERROR ||
+                token->type == TOKEN_HEADER_NAME || macro->items[b] < PASTE ||
+                macro->items[b] >= (int)macro->param_count) {
+                reader.failed = true;
+            }
+        }
+        if (reader.failed) break;
+        remove_macro(pp, macro->name);
+        add_macro(pp, macro);
+        pp->stats.precompiled++;
+    }
+
+    count = reader.failed || pp->out_of_memory ? 0 : pch_get(&reader);
+    for (size_t i = 0; i < count && !reader.failed && !pp->out_of_memory; i++) {
+        const char* path = pch_get_string(&reader);
+        const char* guard = pch_get_string(&reader);
+        bool once = pch_get(&reader) != 0;
+        if (!path || reader.failed) break;
+        const Header* header = cache_seed(path, guard);
+        if (!header) {
+            out_of_memory(pp);
+        } else if (once && reserve(pp, &pp->once, &pp->once_capacity, pp->once_count + 1, sizeof(Header*))) {
+            pp->once[pp->once_count++] = header;
+        }
+    }
+    if (!pp->out_of_memory && (reader.failed || reader.index != reader.count)) {
+        Token at = { .line = 1, .column = 1 };
+        pp_error(pp, &at, "Precompiled header is corrupt");
+    }
+}
+
+// -D NAME or NAME=value, defined as '#define NAME value' would; value defaults to 1
+static void define_option(Preprocessor* pp, const char* option) {
+    size_t length = strlen(option);
+    char* text = arena_alloc(&pp->arena, length + 3);
+    if (!text) {
+        out_of_memory(pp);
+        return;
+    }
+    const char* equals = strchr(option, '=');
+    if (equals) {
+        memcpy(text, option, length);
+        text[equals - option] = ' ';
+    } else {
+        snprintf(text, length + 3, "%s 1", option);
+        length += 2;
+    }
+
+    Lexer lexer;
+    lexer_init(&lexer, text, length, "<command line>", &pp->arena);
+    TokenList tokens = { 0 };
+    for (;;) {
+        Token token = lex_token(&lexer);
+        if (token.type == TOKEN_EOF || !list_push(pp, &tokens, &token)) break;
+    }
+    Token at = { .file = "<command line>", .line = 1, .column = 1 };
+    define_macro(pp, &at, tokens.items, tokens.count);
+    free(tokens.items);
+}
+
+Preprocessor* preprocess_create(struct Parser* parser, const char* source, const char* path,
+                                const PreprocessOptions* options) {
+    Preprocessor* pp = calloc(1, sizeof(Preprocessor));
+    if (!pp) return NULL;
+    pp->parser = parser;
+    pp->path = path;
+    pp->options = options;
+    arena_init(&pp->arena, 0);
+    lexer_init(&pp->lexer, source, strlen(source), NULL, &pp->arena);
+    pp->macro_bucket_count = 64;
+    pp->macros = calloc(pp->macro_bucket_count, sizeof(Macro*));
+    Macro* line = arena_alloc(&pp->arena, sizeof(Macro));
+    if (!pp->macros || !line || !push_source(pp, NULL, NULL)) {
+        preprocess_destroy(pp);
+        return NULL;
+    }
+    line->name = "__LINE__";
+    line->line = true;
+    add_macro(pp, line);
+    if (options && options->pch) {
+        load_pch(pp, options->pch);
+    }
+    for (size_t i = 0; options && !options->pch && i < options->define_count; i++) {
+        define_option(pp, options->defines[i]);
+    }
+    if (pp->out_of_memory) {
+        preprocess_destroy(pp);
+        return NULL;
+    }
+    return pp;
+}
+
+Token preprocess_token(Preprocessor* pp) {
+    return expand_token(pp);
+}
+
+void preprocess_stats(const Preprocessor* pp, PreprocessStats* stats) {
+    *stats = pp->stats;
+}
+
+void preprocess_destroy(Preprocessor* pp) {
+    if (!pp) return;
+    pop_contexts(pp, 0);
+    free(pp->contexts);
+    free(pp->sources);
+    free(pp->conditionals);
+    free(pp->once);
+    free(pp->line.items);
+    free(pp->macros);
+    arena_free(&pp->arena);
+    free(pp);
+}
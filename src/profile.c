@@ -0,0 +1,108 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Profile lookups and profile-guided block layout. Blocks are chained
+// greedily from the entry: after each block comes its more frequent
+// unplaced successor, so the common path of every profiled branch falls
+// through and the rare one jumps away. When a chain ends, layout resumes
+// with the first unplaced block in the original order.
+
+// Calls by the address of their interned name, branches by position
+static int compare_calls(const void* x, const void* y) {
+    uintptr_t a = (uintptr_t)((const IRCallCount*)x)->function;
+    uintptr_t b = (uintptr_t)((const IRCallCount*)y)->function;
+    return (a > b) - (a < b);
+}
+
+static int compare_branches(const void* x, const void* y) {
+    const IRBranchCount* a = x;
+    const IRBranchCount* b = y;
+    if (a->line != b->line) return (a->line > b->line) - (a->line < b->line);
+    return (a->column > b->column) - (a->column < b->column);
+}
+
+void ir_profile_sort(IRProfile* profile) {
+    if (profile->call_count) qsort(profile->calls, profile->call_count, sizeof(IRCallCount), compare_calls);
+    if (profile->branch_count) {
+        qsort(profile->branches, profile->branch_count, sizeof(IRBranchCount), compare_branches);
+    }
+}
+
+uint64_t ir_profile_calls(const IRProfile* profile, const char* function) {
+    IRCallCount key = { function, 0 };
+    const IRCallCount* found = profile->call_count
+        ? bsearch(&key, profile->calls, profile->call_count, sizeof(IRCallCount), compare_calls)
+        : NULL;
+    return found ? found->calls : 0;
+}
+
+const IRBranchCount* ir_profile_branch(const IRProfile* profile, int line, int column) {
+    IRBranchCount key = { .line = line, .column = column };
+    return profile->branch_count
+        ? bsearch(&key, profile->branches, profile->branch_count, sizeof(IRBranchCount), compare_branches)
+        : NULL;
+}
+
+// Successors of block, the likelier first; the successors of a switch
+// keep their order
+static size_t ranked_successors(const IRBlock* block, const IRProfile* profile, IRBlock** succs,
+                                bool* profiled) {
+    size_t n = ir_successor_count(block);
+    for (size_t s = 0; s < n; s++) succs[s] = ir_successor(block, s);
+    *profiled = false;
+    const IRInstr* term = block->last;
+    if (n < 2 || term->op != IR_BRANCH) return n;
+    const IRBranchCount* counts = ir_profile_branch(profile, term->line, term->column);
+    if (!counts || counts->taken + counts->not_taken == 0) return n;
+    *profiled = true;
+    if (counts->not_taken > counts->taken) {
+        IRBlock* first = succs[0];
+        succs[0] = succs[1];
+        succs[1] = first;
+    }
+    return n;
+}
+
+bool ir_layout_blocks(IRFunction* fn, const IRProfile* profile, size_t* branches, size_t* likely) {
+    size_t count = fn->block_count;
+    bool* placed = calloc(fn->next_block_id + 1, sizeof(bool));
+    IRBlock** order = malloc((count + 1) * sizeof(IRBlock*));
+    IRBlock** succs = malloc((count + 1) * sizeof(IRBlock*));
+    if (!placed || !order || !succs) {
+        free(placed);
+        free(order);
+        free(succs);
+        return false;
+    }
+
+    size_t n = 0;
+    size_t resume = 0;
+    IRBlock* block = fn->blocks[0];
+    while (block) {
+        placed[block->id] = true;
+        order[n++] = block;
+
+        bool profiled;
+        size_t succ_count = ranked_successors(block, profile, succs, &profiled);
+        IRBlock* next = NULL;
+        for (size_t s = 0; s < succ_count && !next; s++) {
+            if (!placed[succs[s]->id]) next = succs[s];
+        }
+        if (profiled) {
+            (*branches)++;
+            if (next == succs[0]) (*likely)++;
+        }
+        while (!next && resume < count) {
+            if (!placed[fn->blocks[resume]->id]) next = fn->blocks[resume];
+            resume++;
+        }
+        block = next;
+    }
+
+    memcpy(fn->blocks, order, n * sizeof(IRBlock*));
+    free(placed);
+    free(order);
+    free(succs);
+    return true;
+}
@@ -0,0 +1,292 @@
+#include "optimize.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Interprocedural purity analysis and compile-time evaluation of calls.
+//
+// A function is pure when it writes no global, reads no global that any
+// function writes, and calls only pure functions defined in this program.
+// Purity is computed optimistically and refined to a fixed point, so
+// (mutually) recursive functions can be pure. A call to a pure function
+// whose arguments are all constants is evaluated by the tree-walking
+// evaluator and replaced by its result; calls that trap, or exceed the
+// step or depth budget, are left for run time.
+
+typedef struct {
+    const ASTNode* node;
+    bool pure;
+    int* calls;                // Callees, by REF_FUNCTION index
+    size_t call_count;
+    size_t call_capacity;
+    int* reads;                // Globals read, by REF_GLOBAL index
+    size_t read_count;
+    size_t read_capacity;
+} FunctionEffects;
+
+typedef struct {
+    const ASTNode* program;
+    FunctionEffects* functions;  // By REF_FUNCTION index
+    size_t function_count;
+    bool* written;             // By REF_GLOBAL index: assigned anywhere
+    bool ok;
+} PurityContext;
+
+static bool push_index(int** items, size_t* count, size_t* capacity, int item) {
+    if (*count >= *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 8;
+        int* new_items = realloc(*items, new_capacity * sizeof(int));
+        if (!new_items) return false;
+        *items = new_items;
+        *capacity = new_capacity;
+    }
+    (*items)[(*count)++] = item;
+    return true;
+}
+
+// Record what fn reads, writes and calls
+static void collect_effects(PurityContext* ctx, FunctionEffects* fn, const ASTNode* node) {
+    if (!node || !ctx->ok) return;
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (size_t i = 0; i < node->data.block.count; i++) {
+                collect_effects(ctx, fn, node->data.block.statements[i]);
+            }
+            break;
+        case NODE_RETURN:
+            collect_effects(ctx, fn, node->data.ret.expr);
+            break;
+        case NODE_IF_STMT:
+            collect_effects(ctx, fn, node->data.if_stmt_node.condition);
+            collect_effects(ctx, fn, node->data.if_stmt_node.then_branch);
+            collect_effects(ctx, fn, node->data.if_stmt_node.else_branch);
+            break;
+        case NODE_WHILE_STMT:
+            collect_effects(ctx, fn, node->data.while_stmt_node.condition);
+            collect_effects(ctx, fn, node->data.while_stmt_node.body);
+            break;
+        case NODE_SWITCH_STMT:
+            collect_effects(ctx, fn, node->data.switch_stmt_node.value);
+            collect_effects(ctx, fn, node->data.switch_stmt_node.body);
+            break;
+        case NODE_BINARY_OP:
+            if (node->data.binary.op == OP_ASSIGN) fn->pure = false;
+            collect_effects(ctx, fn, node->data.binary.left);
+            collect_effects(ctx, fn, node->data.binary.right);
+            break;
+        case NODE_CALL:
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                collect_effects(ctx, fn, node->data.call.args[i]);
+            }
+            // Functions of other units are unknown, so impure
+            if (node->data.call.ref.kind != REF_FUNCTION) {
+                fn->pure = false;
+            } else {
+                ctx->ok = push_index(&fn->calls, &fn->call_count, &fn->call_capacity,
+                                     node->data.call.ref.index);
+            }
+            break;
+        case NODE_VARIABLE:
+            if (node->data.variable.ref.kind == REF_GLOBAL) {
+                ctx->ok = push_index(&fn->reads, &fn->read_count, &fn->read_capacity,
+                                     node->data.variable.ref.index);
+            }
+            break;
+        case NODE_ASSIGNMENT:
+            collect_effects(ctx, fn, node->data.assignment.value);
+            if (node->data.assignment.ref.kind == REF_GLOBAL) {
+                fn->pure = false;
+                ctx->written[node->data.assignment.ref.index] = true;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static bool analyze(PurityContext* ctx) {
+    const ASTNode* program = ctx->program;
+    ctx->functions = calloc(program->data.block.count + 1, sizeof(FunctionEffects));
+    ctx->written = calloc(program->data.block.count + 1, sizeof(bool));
+    if (!ctx->functions || !ctx->written) return false;
+    ctx->ok = true;
+
+    for (size_t i = 0; i < program->data.block.count && ctx->ok; i++) {
+        const ASTNode* node = program->data.block.statements[i];
+        if (node->type != NODE_FUNCTION) continue;
+        FunctionEffects* fn = &ctx->functions[ctx->function_count++];
+        fn->node = node;
+        fn->pure = true;
+        collect_effects(ctx, fn, node->data.function.body);
+    }
+    if (!ctx->ok) return false;
+
+    // Reading a global some function writes makes a result state-dependent
+    for (size_t f = 0; f < ctx->function_count; f++) {
+        FunctionEffects* fn = &ctx->functions[f];
+        for (size_t r = 0; r < fn->read_count && fn->pure; r++) {
+            if (ctx->written[fn->reads[r]]) fn->pure = false;
+        }
+    }
+
+    // Calling an impure function is impure; iterate to a fixed point
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t f = 0; f < ctx->function_count; f++) {
+            FunctionEffects* fn = &ctx->functions[f];
+            if (!fn->pure) continue;
+            for (size_t c = 0; c < fn->call_count; c++) {
+                if (!ctx->functions[fn->calls[c]].pure) {
+                    fn->pure = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    PurityContext* purity;
+    Evaluator* evaluator;
+    EvalLimits limits;
+    size_t total_steps;
+    ConstEvalStats* stats;
+} RewriteContext;
+
+// Turn a call node into the literal it evaluates to
+static void replace_with_number(ASTNode* node, int64_t value) {
+    for (size_t i = 0; i < node->data.call.arg_count; i++) {
+        ast_destroy(node->data.call.args[i]);
+    }
+    free(node->data.call.args);
+    node->type = NODE_NUMBER;
+    memset(&node->data, 0, sizeof(node->data));
+    node->data.number.value = value;
+}
+
+static void try_evaluate_call(RewriteContext* ctx, ASTNode* node) {
+    if (node->data.call.ref.kind != REF_FUNCTION) return;
+    if (!ctx->purity->functions[node->data.call.ref.index].pure) return;
+
+    size_t count = node->data.call.arg_count;
+    int64_t* args = malloc((count + 1) * sizeof(int64_t));
+    if (!args) return;
+    for (size_t i = 0; i < count; i++) {
+        if (!ast_constant_value(node->data.call.args[i], &args[i])) {
+            free(args);
+            return;
+        }
+    }
+
+    if (ctx->total_steps >= ctx->limits.max_total_steps) {
+        ctx->stats->over_budget++;
+        free(args);
+        return;
+    }
+
+    int64_t result;
+    ctx->stats->attempted++;
+    EvalStatus status = evaluator_call(ctx->evaluator, node->data.call.name, args, count,
+                                       &ctx->limits, &result);
+    ctx->total_steps += evaluator_steps(ctx->evaluator);
+    free(args);
+
+    switch (status) {
+        case EVAL_OK:
+            replace_with_number(node, result);
+            ctx->stats->replaced++;
+            break;
+        case EVAL_STEP_LIMIT:
+        case EVAL_DEPTH_LIMIT:
+            ctx->stats->over_budget++;
+            break;
+        default:
+            break;
+    }
+}
+
+static void rewrite(RewriteContext* ctx, ASTNode* node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (size_t i = 0; i < node->data.block.count; i++) rewrite(ctx, node->data.block.statements[i]);
+            break;
+        case NODE_FUNCTION:
+            rewrite(ctx, node->data.function.body);
+            break;
+        case NODE_RETURN:
+            rewrite(ctx, node->data.ret.expr);
+            break;
+        case NODE_IF_STMT:
+            rewrite(ctx, node->data.if_stmt_node.condition);
+            rewrite(ctx, node->data.if_stmt_node.then_branch);
+            rewrite(ctx, node->data.if_stmt_node.else_branch);
+            break;
+        case NODE_WHILE_STMT:
+            rewrite(ctx, node->data.while_stmt_node.condition);
+            rewrite(ctx, node->data.while_stmt_node.body);
+            break;
+        case NODE_SWITCH_STMT:
+            rewrite(ctx, node->data.switch_stmt_node.value);
+            rewrite(ctx, node->data.switch_stmt_node.body);
+            break;
+        case NODE_BINARY_OP:
+            rewrite(ctx, node->data.binary.left);
+            rewrite(ctx, node->data.binary.right);
+            break;
+        case NODE_ASSIGNMENT:
+            rewrite(ctx, node->data.assignment.value);
+            break;
+        case NODE_CALL:
+            // Innermost calls first, so their results can feed outer ones
+            for (size_t i = 0; i < node->data.call.arg_count; i++) rewrite(ctx, node->data.call.args[i]);
+            try_evaluate_call(ctx, node);
+            break;
+        default:
+            break;
+    }
+}
+
+void const_eval_limits_init(EvalLimits* limits) {
+    limits->max_steps = 100000;
+    limits->max_depth = 128;
+    limits->max_total_steps = 10000000;
+}
+
+bool const_eval_program(ASTNode* program, const EvalLimits* limits, ConstEvalStats* stats) {
+    ConstEvalStats local;
+    if (!stats) stats = &local;
+    *stats = (ConstEvalStats){0};
+
+    PurityContext purity = { .program = program };
+    RewriteContext ctx = { .purity = &purity, .limits = *limits, .stats = stats };
+    bool ok = analyze(&purity);
+    if (ok) {
+        stats->functions = purity.function_count;
+        for (size_t i = 0; i < purity.function_count; i++) {
+            if (purity.functions[i].pure) stats->pure_functions++;
+        }
+        ctx.evaluator = evaluator_create(program);
+        ok = ctx.evaluator != NULL;
+    }
+    if (ok) {
+        // Global initializers are not rewritten: C requires them to be
+        // constant expressions, and calls are not
+        for (size_t i = 0; i < program->data.block.count; i++) {
+            ASTNode* node = program->data.block.statements[i];
+            if (node->type == NODE_FUNCTION) rewrite(&ctx, node);
+        }
+        stats->steps = ctx.total_steps;
+    }
+
+    evaluator_destroy(ctx.evaluator);
+    for (size_t i = 0; i < purity.function_count; i++) {
+        free(purity.functions[i].calls);
+        free(purity.functions[i].reads);
+    }
+    free(purity.functions);
+    free(purity.written);
+    return ok;
+}
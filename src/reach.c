@@ -0,0 +1,187 @@
+#include "optimize.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Reachability over the call graph of a whole program, built from the
+// NODE_CALL sites of every unit's AST. Calls are matched to definitions by
+// name, so a call into another unit counts like a local one. Runs right
+// after parsing, before resolution: the functions it drops are never
+// resolved, optimized, lowered or emitted.
+
+typedef struct {
+    const char* name;       // NULL for an empty slot
+    size_t first;           // Index of its first definition
+} NameSlot;
+
+typedef struct {
+    ASTNode* node;
+    size_t next;            // Next definition of the same name, or SIZE_MAX
+    bool reachable;
+} Definition;
+
+typedef struct {
+    NameSlot* slots;        // Open addressing, power-of-two capacity
+    size_t capacity;
+    Definition* definitions;
+    size_t count;
+    size_t* worklist;       // Definitions reached but not walked yet
+    size_t pending;
+    size_t reachable;
+} Reach;
+
+static size_t hash_name(const char* name) {
+    size_t h = 1469598103934665603ULL;
+    for (const char* c = name; *c; c++) {
+        h ^= (unsigned char)*c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static NameSlot* find_slot(const Reach* reach, const char* name) {
+    size_t mask = reach->capacity - 1;
+    size_t slot = hash_name(name) & mask;
+    while (reach->slots[slot].name && strcmp(reach->slots[slot].name, name) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return &reach->slots[slot];
+}
+
+// Mark every definition of name reachable, and queue it to be walked
+static void reach_name(Reach* reach, const char* name) {
+    const NameSlot* slot = find_slot(reach, name);
+    if (!slot->name) return;   // Defined elsewhere, or nowhere
+    for (size_t i = slot->first; i != SIZE_MAX; i = reach->definitions[i].next) {
+        Definition* definition = &reach->definitions[i];
+        if (definition->reachable) continue;
+        definition->reachable = true;
+        reach->reachable++;
+        reach->worklist[reach->pending++] = i;
+    }
+}
+
+static void reach_calls(Reach* reach, const ASTNode* node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (size_t i = 0; i < node->data.block.count; i++) reach_calls(reach, node->data.block.statements[i]);
+            break;
+        case NODE_RETURN:
+            reach_calls(reach, node->data.ret.expr);
+            break;
+        case NODE_IF_STMT:
+            reach_calls(reach, node->data.if_stmt_node.condition);
+            reach_calls(reach, node->data.if_stmt_node.then_branch);
+            reach_calls(reach, node->data.if_stmt_node.else_branch);
+            break;
+        case NODE_WHILE_STMT:
+            reach_calls(reach, node->data.while_stmt_node.condition);
+            reach_calls(reach, node->data.while_stmt_node.body);
+            break;
+        case NODE_SWITCH_STMT:
+            reach_calls(reach, node->data.switch_stmt_node.value);
+            reach_calls(reach, node->data.switch_stmt_node.body);
+            break;
+        case NODE_BINARY_OP:
+            reach_calls(reach, node->data.binary.left);
+            reach_calls(reach, node->data.binary.right);
+            break;
+        case NODE_ASSIGNMENT:
+            reach_calls(reach, node->data.assignment.value);
+            break;
+        case NODE_CALL:
+            for (size_t i = 0; i < node->data.call.arg_count; i++) reach_calls(reach, node->data.call.args[i]);
+            reach_name(reach, node->data.call.name);
+            break;
+        default:
+            break;
+    }
+}
+
+static void add_definition(Reach* reach, ASTNode* node) {
+    NameSlot* slot = find_slot(reach, node->data.function.name);
+    size_t index = reach->count++;
+    reach->definitions[index] = (Definition){ node, SIZE_MAX, false };
+    if (!slot->name) {
+        *slot = (NameSlot){ node->data.function.name, index };
+        return;
+    }
+    // Redefinitions stay together, for resolution to report
+    size_t last = slot->first;
+    while (reach->definitions[last].next != SIZE_MAX) last = reach->definitions[last].next;
+    reach->definitions[last].next = index;
+}
+
+bool prune_unreachable(ASTNode* const* programs, size_t count, const char* const* roots,
+                       size_t root_count, ReachStats* stats) {
+    ReachStats local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(*stats));
+
+    size_t functions = 0;
+    for (size_t u = 0; u < count; u++) {
+        const ASTNode* program = programs[u];
+        for (size_t i = 0; i < program->data.block.count; i++) {
+            if (program->data.block.statements[i]->type == NODE_FUNCTION) functions++;
+        }
+    }
+
+    Reach reach = {0};
+    reach.capacity = 16;
+    while (reach.capacity < functions * 2) reach.capacity *= 2;
+    reach.slots = calloc(reach.capacity, sizeof(NameSlot));
+    reach.definitions = malloc((functions + 1) * sizeof(Definition));
+    reach.worklist = malloc((functions + 1) * sizeof(size_t));
+    if (!reach.slots || !reach.definitions || !reach.worklist) {
+        free(reach.slots);
+        free(reach.definitions);
+        free(reach.worklist);
+        return false;
+    }
+
+    for (size_t u = 0; u < count; u++) {
+        const ASTNode* program = programs[u];
+        for (size_t i = 0; i < program->data.block.count; i++) {
+            ASTNode* node = program->data.block.statements[i];
+            if (node->type == NODE_FUNCTION) add_definition(&reach, node);
+        }
+    }
+
+    // Roots: the named functions, and whatever global initializers call
+    for (size_t i = 0; i < root_count; i++) reach_name(&reach, roots[i]);
+    for (size_t u = 0; u < count; u++) {
+        const ASTNode* program = programs[u];
+        for (size_t i = 0; i < program->data.block.count; i++) {
+            const ASTNode* node = program->data.block.statements[i];
+            if (node->type != NODE_FUNCTION) reach_calls(&reach, node);
+        }
+    }
+    while (reach.pending > 0) {
+        const ASTNode* function = reach.definitions[reach.worklist[--reach.pending]].node;
+        reach_calls(&reach, function->data.function.body);
+    }
+
+    // Drop the rest, keeping the order of what remains
+    size_t next = 0;
+    for (size_t u = 0; u < count; u++) {
+        ASTNode* program = programs[u];
+        size_t kept = 0;
+        for (size_t i = 0; i < program->data.block.count; i++) {
+            ASTNode* node = program->data.block.statements[i];
+            if (node->type == NODE_FUNCTION && !reach.definitions[next++].reachable) {
+                ast_destroy(node);
+                continue;
+            }
+            program->data.block.statements[kept++] = node;
+        }
+        program->data.block.count = kept;
+    }
+
+    stats->functions = functions;
+    stats->reachable = reach.reachable;
+    stats->skipped = functions - reach.reachable;
+    free(reach.slots);
+    free(reach.definitions);
+    free(reach.worklist);
+    return true;
+}
@@ -0,0 +1,328 @@
+#include "codegen.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+// Linear-scan register allocation (Poletto & Sarkar) over live intervals
+// computed from block-level liveness. Each vreg gets one interval spanning
+// every position where it is live; an interval lives either in a single
+// register or in a single stack slot for its whole lifetime.
+
+#define ALLOCATABLE (CALLEE_SAVED | CALLER_SAVED)
+
+typedef struct {
+    int vreg;
+    int start;
+    int end;
+    unsigned forbidden;     // Registers clobbered strictly inside the interval
+} Interval;
+
+typedef struct {
+    uint64_t* words;
+    size_t word_count;
+} BitSet;
+
+static bool bitset_init(BitSet* set, size_t bits) {
+    set->word_count = (bits + 63) / 64;
+    set->words = calloc(set->word_count ? set->word_count : 1, sizeof(uint64_t));
+    return set->words != NULL;
+}
+
+static void bitset_set(BitSet* set, int bit) {
+    set->words[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+static bool bitset_test(const BitSet* set, int bit) {
+    return (set->words[bit / 64] >> (bit % 64)) & 1;
+}
+
+// Number of vreg operands read by an instruction; fills uses[]
+static size_t instr_uses(const IRInstr* instr, int* uses, size_t max) {
+    size_t n = 0;
+    if (instr->op == IR_CALL) {
+        for (size_t i = 0; i < instr->arg_count && n < max; i++) uses[n++] = instr->args[i];
+        return n;
+    }
+    if (instr->a != IR_NO_VREG && n < max) uses[n++] = instr->a;
+    if (instr->b != IR_NO_VREG && n < max) uses[n++] = instr->b;
+    return n;
+}
+
+static int compare_intervals(const void* x, const void* y) {
+    const Interval* a = x;
+    const Interval* b = y;
+    if (a->start != b->start) return a->start < b->start ? -1 : 1;
+    return a->vreg - b->vreg;
+}
+
+static int pick_register(unsigned mask) {
+    for (int r = 0; r < REG_COUNT; r++) {
+        if (mask & REG_BIT(r)) return r;
+    }
+    return -1;
+}
+
+bool regalloc_run(const IRFunction* fn, bool spill_all, RegAllocResult* result) {
+    memset(result, 0, sizeof(*result));
+    int vregs = fn->vreg_count;
+    size_t block_count = fn->block_count;
+    bool ok = false;
+
+    result->locations = calloc(vregs ? vregs : 1, sizeof(Location));
+    int* def_count = calloc(vregs ? vregs : 1, sizeof(int));
+    const IRInstr** def_instr = calloc(vregs ? vregs : 1, sizeof(IRInstr*));
+    int* block_start = calloc(block_count + 1, sizeof(int));
+    int* block_end = calloc(block_count + 1, sizeof(int));
+    int* block_index = calloc(fn->next_block_id + 1, sizeof(int));
+    BitSet* live_in = calloc(block_count + 1, sizeof(BitSet));
+    BitSet* live_out = calloc(block_count + 1, sizeof(BitSet));
+    BitSet* use = calloc(block_count + 1, sizeof(BitSet));
+    BitSet* def = calloc(block_count + 1, sizeof(BitSet));
+    Interval* intervals = calloc(vregs ? vregs : 1, sizeof(Interval));
+    int* clobber_pos = NULL;
+    unsigned* clobber_mask = NULL;
+    size_t clobber_count = 0, clobber_capacity = 0;
+    Interval** active = calloc(vregs ? vregs : 1, sizeof(Interval*));
+
+    if (!result->locations || !def_count || !def_instr || !block_start || !block_end ||
+        !block_index || !live_in || !live_out || !use || !def || !intervals || !active) {
+        goto done;
+    }
+
+    // Count definitions; single-definition constants need no register
+    for (size_t b = 0; b < block_count; b++) {
+        for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->dst != IR_NO_VREG) {
+                def_count[instr->dst]++;
+                def_instr[instr->dst] = instr;
+            }
+        }
+    }
+    for (int v = 0; v < vregs; v++) {
+        if (def_count[v] == 1 && def_instr[v]->op == IR_CONST) {
+            result->locations[v].kind = LOC_CONST;
+            result->locations[v].imm = def_instr[v]->imm;
+        }
+    }
+
+    // Number instructions and record clobbering positions
+    int pos = 0;
+    for (size_t b = 0; b < block_count; b++) {
+        const IRBlock* block = fn->blocks[b];
+        block_index[block->id] = (int)b;
+        block_start[b] = pos;
+        for (const IRInstr* instr = block->first; instr; instr = instr->next) {
+            pos += 2;
+            unsigned mask = 0;
+            if (instr->op == IR_CALL) mask = CALLER_SAVED;
+            if (instr->op == IR_DIV) mask = REG_BIT(REG_RDX);
+            if ((instr->op == IR_SHL || instr->op == IR_SAR || instr->op == IR_SHR) &&
+                result->locations[instr->b].kind != LOC_CONST) {
+                mask = REG_BIT(REG_RCX);
+            }
+            if (mask) {
+                if (clobber_count >= clobber_capacity) {
+                    clobber_capacity = clobber_capacity ? clobber_capacity * 2 : 16;
+                    int* new_pos = realloc(clobber_pos, clobber_capacity * sizeof(int));
+                    if (!new_pos) goto done;
+                    clobber_pos = new_pos;
+                    unsigned* new_mask = realloc(clobber_mask, clobber_capacity * sizeof(unsigned));
+                    if (!new_mask) goto done;
+                    clobber_mask = new_mask;
+                }
+                clobber_pos[clobber_count] = pos;
+                clobber_mask[clobber_count] = mask;
+                clobber_count++;
+            }
+        }
+        block_end[b] = pos + 1;
+    }
+
+    // Local use/def sets
+    for (size_t b = 0; b < block_count; b++) {
+        if (!bitset_init(&live_in[b], vregs) || !bitset_init(&live_out[b], vregs) ||
+            !bitset_init(&use[b], vregs) || !bitset_init(&def[b], vregs)) {
+            goto done;
+        }
+        for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            int uses[64];
+            size_t n = instr_uses(instr, uses, 64);
+            for (size_t u = 0; u < n; u++) {
+                if (!bitset_test(&def[b], uses[u])) bitset_set(&use[b], uses[u]);
+            }
+            if (instr->op == IR_CALL && instr->arg_count > 64) {
+                for (size_t i = 64; i < instr->arg_count; i++) {
+                    if (!bitset_test(&def[b], instr->args[i])) bitset_set(&use[b], instr->args[i]);
+                }
+            }
+            if (instr->dst != IR_NO_VREG) bitset_set(&def[b], instr->dst);
+        }
+    }
+
+    // Global liveness, iterated to a fixed point in reverse block order
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = block_count; b > 0; b--) {
+            size_t i = b - 1;
+            size_t n = ir_successor_count(fn->blocks[i]);
+            for (size_t w = 0; w < live_out[i].word_count; w++) {
+                uint64_t out = 0;
+                for (size_t s = 0; s < n; s++) {
+                    out |= live_in[block_index[ir_successor(fn->blocks[i], s)->id]].words[w];
+                }
+                uint64_t in = use[i].words[w] | (out & ~def[i].words[w]);
+                if (out != live_out[i].words[w] || in != live_in[i].words[w]) {
+                    live_out[i].words[w] = out;
+                    live_in[i].words[w] = in;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Build one interval per vreg covering every live position
+    for (int v = 0; v < vregs; v++) {
+        intervals[v].vreg = v;
+        intervals[v].start = INT_MAX;
+        intervals[v].end = -1;
+    }
+    #define EXTEND(v, p) do { \
+        if ((p) < intervals[v].start) intervals[v].start = (p); \
+        if ((p) > intervals[v].end) intervals[v].end = (p); \
+    } while (0)
+
+    pos = 0;
+    for (size_t b = 0; b < block_count; b++) {
+        for (int v = 0; v < vregs; v++) {
+            if (bitset_test(&live_in[b], v)) EXTEND(v, block_start[b]);
+            if (bitset_test(&live_out[b], v)) EXTEND(v, block_end[b]);
+        }
+        for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            pos += 2;
+            if (instr->dst != IR_NO_VREG) EXTEND(instr->dst, pos);
+            // The prologue moves every parameter home at once, so they are
+            // all live from entry, unused ones included
+            if (instr->op == IR_PARAM) EXTEND(instr->dst, block_start[b]);
+            if (instr->op == IR_CALL) {
+                for (size_t i = 0; i < instr->arg_count; i++) EXTEND(instr->args[i], pos);
+            } else {
+                if (instr->a != IR_NO_VREG) EXTEND(instr->a, pos);
+                if (instr->b != IR_NO_VREG) EXTEND(instr->b, pos);
+            }
+        }
+    }
+    #undef EXTEND
+
+    // Keep only intervals that need a home, and note what they must avoid
+    size_t interval_count = 0;
+    for (int v = 0; v < vregs; v++) {
+        if (intervals[v].end < 0 || result->locations[v].kind == LOC_CONST) continue;
+        Interval it = intervals[v];
+        it.forbidden = 0;
+        for (size_t c = 0; c < clobber_count; c++) {
+            if (clobber_pos[c] > it.start && clobber_pos[c] < it.end) {
+                it.forbidden |= clobber_mask[c];
+            }
+        }
+        intervals[interval_count++] = it;
+    }
+    qsort(intervals, interval_count, sizeof(Interval), compare_intervals);
+    result->intervals = (int)interval_count;
+
+    // The scan proper
+    size_t active_count = 0;
+    unsigned free_regs = ALLOCATABLE;
+    for (size_t i = 0; i < interval_count; i++) {
+        Interval* current = &intervals[i];
+        Location* loc = &result->locations[current->vreg];
+
+        // Expire intervals that end before this one starts. An interval
+        // ending where another begins may share its register: operands are
+        // read before the result is written.
+        size_t kept = 0;
+        for (size_t a = 0; a < active_count; a++) {
+            if (active[a]->end <= current->start) {
+                free_regs |= REG_BIT(result->locations[active[a]->vreg].reg);
+            } else {
+                active[kept++] = active[a];
+            }
+        }
+        active_count = kept;
+
+        if (spill_all) {
+            loc->kind = LOC_STACK;
+            loc->slot = result->spill_slots++;
+            result->spilled++;
+            continue;
+        }
+
+        unsigned allowed = ALLOCATABLE & ~current->forbidden;
+        unsigned candidates = free_regs & allowed;
+        int reg;
+        if (candidates) {
+            // Prefer caller-saved registers: they cost nothing to preserve
+            reg = (candidates & CALLER_SAVED) ? pick_register(candidates & CALLER_SAVED)
+                                              : pick_register(candidates);
+        } else {
+            // Spill whichever conflicting interval ends furthest away
+            size_t victim = active_count;
+            for (size_t a = 0; a < active_count; a++) {
+                Reg r = result->locations[active[a]->vreg].reg;
+                if (!(allowed & REG_BIT(r))) continue;
+                if (victim == active_count || active[a]->end > active[victim]->end) victim = a;
+            }
+
+            if (victim == active_count || active[victim]->end <= current->end) {
+                loc->kind = LOC_STACK;
+                loc->slot = result->spill_slots++;
+                result->spilled++;
+                continue;
+            }
+
+            Location* victim_loc = &result->locations[active[victim]->vreg];
+            reg = victim_loc->reg;
+            victim_loc->kind = LOC_STACK;
+            victim_loc->slot = result->spill_slots++;
+            result->spilled++;
+            active[victim] = active[--active_count];
+            free_regs |= REG_BIT(reg);
+        }
+
+        loc->kind = LOC_REG;
+        loc->reg = (Reg)reg;
+        free_regs &= ~REG_BIT(reg);
+        if (CALLEE_SAVED & REG_BIT(reg)) result->used_callee_saved |= REG_BIT(reg);
+        active[active_count++] = current;
+    }
+
+    ok = true;
+
+done:
+    for (size_t b = 0; b < block_count; b++) {
+        if (live_in) free(live_in[b].words);
+        if (live_out) free(live_out[b].words);
+        if (use) free(use[b].words);
+        if (def) free(def[b].words);
+    }
+    free(live_in);
+    free(live_out);
+    free(use);
+    free(def);
+    free(def_count);
+    free(def_instr);
+    free(block_start);
+    free(block_end);
+    free(block_index);
+    free(intervals);
+    free(clobber_pos);
+    free(clobber_mask);
+    free(active);
+    if (!ok) regalloc_free(result);
+    return ok;
+}
+
+void regalloc_free(RegAllocResult* result) {
+    free(result->locations);
+    result->locations = NULL;
+}
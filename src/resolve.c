@@ -0,0 +1,297 @@
+#include "resolve.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Names are looked up in two hash tables: one for the unit's globals and
+// functions (and the external functions it calls), filled before any body
+// is walked, and one for the locals of the function being walked. Both map
+// a name to its current NameRef. The local table is emptied between
+// functions by bumping its generation, which turns every entry stale.
+
+typedef struct {
+    const char* name;        // NULL for an empty slot
+    NameRef ref;
+    size_t generation;       // Stale unless the table's current one
+} Binding;
+
+typedef struct {
+    Binding* entries;        // Open addressing
+    size_t capacity;
+    size_t count;            // Live entries
+    size_t generation;
+} NameTable;
+
+typedef struct {
+    NameTable unit;
+    NameTable locals;
+    const ASTNode** functions;   // By REF_FUNCTION index
+    size_t function_count;
+    size_t global_count;
+    size_t external_count;
+    size_t slot_count;           // Of the function being walked
+    ResolveStats* stats;
+    Error* error;
+} Resolver;
+
+static void resolve_error(Resolver* r, const ASTNode* node, const char* format, ...) {
+    if (r->error->code != ERROR_NONE) return;
+    r->error->code = ERROR_SEMANTIC;
+    r->error->line = node ? node->line : 0;
+    r->error->column = node ? node->column : 0;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(r->error->message, sizeof(r->error->message), format, args);
+    va_end(args);
+}
+
+static bool failed(const Resolver* r) {
+    return r->error->code != ERROR_NONE;
+}
+
+static size_t hash_name(const char* name) {
+    size_t h = 1469598103934665603ULL;
+    for (const char* c = name; *c; c++) {
+        h ^= (unsigned char)*c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static bool live(const NameTable* table, const Binding* entry) {
+    return entry->name && entry->generation == table->generation;
+}
+
+static Binding* lookup(const NameTable* table, const char* name) {
+    if (table->count == 0) return NULL;
+    size_t mask = table->capacity - 1;
+    size_t slot = hash_name(name) & mask;
+    while (live(table, &table->entries[slot])) {
+        if (strcmp(table->entries[slot].name, name) == 0) return &table->entries[slot];
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+static bool grow_table(NameTable* table) {
+    size_t capacity = table->capacity ? table->capacity * 2 : 64;
+    Binding* entries = calloc(capacity, sizeof(Binding));
+    if (!entries) return false;
+    for (size_t i = 0; i < table->capacity; i++) {
+        const Binding* entry = &table->entries[i];
+        if (!live(table, entry)) continue;
+        size_t slot = hash_name(entry->name) & (capacity - 1);
+        while (entries[slot].name) slot = (slot + 1) & (capacity - 1);
+        entries[slot] = *entry;
+    }
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+    return true;
+}
+
+// Bind name to ref, replacing the binding it had
+static bool bind(NameTable* table, const char* name, NameRef ref) {
+    Binding* entry = lookup(table, name);
+    if (entry) {
+        entry->ref = ref;
+        return true;
+    }
+    if ((table->count + 1) * 2 > table->capacity && !grow_table(table)) return false;
+    size_t mask = table->capacity - 1;
+    size_t slot = hash_name(name) & mask;
+    while (live(table, &table->entries[slot])) slot = (slot + 1) & mask;
+    table->entries[slot] = (Binding){ name, ref, table->generation };
+    table->count++;
+    return true;
+}
+
+static void declare_local(Resolver* r, const ASTNode* node, const char* name, NameRef* ref) {
+    *ref = (NameRef){ REF_LOCAL, (int)r->slot_count++ };
+    if (!bind(&r->locals, name, *ref)) resolve_error(r, node, "Out of memory");
+}
+
+// A variable read or assigned: the latest local of that name, or a global
+static void resolve_variable(Resolver* r, const ASTNode* node, const char* name, NameRef* ref) {
+    const Binding* binding = lookup(&r->locals, name);
+    if (!binding) {
+        binding = lookup(&r->unit, name);
+        if (binding && binding->ref.kind != REF_GLOBAL) binding = NULL;
+    }
+    if (!binding) {
+        resolve_error(r, node, "Undefined variable '%s'", name);
+        return;
+    }
+    *ref = binding->ref;
+    if (ref->kind == REF_LOCAL) r->stats->locals++;
+    else r->stats->global_refs++;
+}
+
+static void resolve_call(Resolver* r, ASTNode* node) {
+    const char* name = node->data.call.name;
+    const Binding* binding = lookup(&r->unit, name);
+    if (!binding) {
+        // Defined in another unit, or nowhere; the linker tells which
+        NameRef ref = { REF_EXTERNAL, (int)r->external_count++ };
+        if (!bind(&r->unit, name, ref)) {
+            resolve_error(r, node, "Out of memory");
+            return;
+        }
+        binding = lookup(&r->unit, name);
+    }
+
+    NameRef ref = binding->ref;
+    if (ref.kind == REF_GLOBAL) {
+        resolve_error(r, node, "Called object '%s' is not a function", name);
+        return;
+    }
+    if (ref.kind == REF_FUNCTION) {
+        size_t params = r->functions[ref.index]->data.function.param_count;
+        if (params != node->data.call.arg_count) {
+            resolve_error(r, node, "Function '%s' takes %zu arguments, called with %zu",
+                          name, params, node->data.call.arg_count);
+            return;
+        }
+        r->stats->calls++;
+    } else {
+        r->stats->external_calls++;
+    }
+    node->data.call.ref = ref;
+}
+
+// Walk in evaluation order, the order lowering sees declarations in
+static void resolve_node(Resolver* r, ASTNode* node) {
+    if (!node || failed(r)) return;
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (size_t i = 0; i < node->data.block.count; i++) resolve_node(r, node->data.block.statements[i]);
+            break;
+        case NODE_RETURN:
+            resolve_node(r, node->data.ret.expr);
+            break;
+        case NODE_IF_STMT:
+            resolve_node(r, node->data.if_stmt_node.condition);
+            resolve_node(r, node->data.if_stmt_node.then_branch);
+            resolve_node(r, node->data.if_stmt_node.else_branch);
+            break;
+        case NODE_WHILE_STMT:
+            resolve_node(r, node->data.while_stmt_node.condition);
+            resolve_node(r, node->data.while_stmt_node.body);
+            break;
+        case NODE_SWITCH_STMT:
+            resolve_node(r, node->data.switch_stmt_node.value);
+            resolve_node(r, node->data.switch_stmt_node.body);
+            break;
+        case NODE_BINARY_OP:
+            resolve_node(r, node->data.binary.left);
+            resolve_node(r, node->data.binary.right);
+            break;
+        case NODE_CALL:
+            for (size_t i = 0; i < node->data.call.arg_count; i++) resolve_node(r, node->data.call.args[i]);
+            resolve_call(r, node);
+            break;
+        case NODE_VARIABLE:
+            if (node->data.variable.is_declaration) {
+                declare_local(r, node, node->data.variable.name, &node->data.variable.ref);
+            } else {
+                resolve_variable(r, node, node->data.variable.name, &node->data.variable.ref);
+            }
+            break;
+        case NODE_ASSIGNMENT:
+            // The initializer still sees the binding the name had before
+            resolve_node(r, node->data.assignment.value);
+            if (failed(r)) break;
+            if (node->data.assignment.is_declaration) {
+                declare_local(r, node, node->data.assignment.name, &node->data.assignment.ref);
+            } else {
+                resolve_variable(r, node, node->data.assignment.name, &node->data.assignment.ref);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void new_function(Resolver* r) {
+    r->locals.generation++;
+    r->locals.count = 0;
+    r->slot_count = 0;
+}
+
+static void resolve_function(Resolver* r, ASTNode* node) {
+    new_function(r);
+    for (size_t i = 0; i < node->data.function.param_count && !failed(r); i++) {
+        const char* name = node->data.function.params[i];
+        if (lookup(&r->locals, name)) {
+            resolve_error(r, node, "Duplicate parameter '%s' of '%s'", name, node->data.function.name);
+            return;
+        }
+        NameRef ref;
+        declare_local(r, node, name, &ref);
+    }
+    resolve_node(r, node->data.function.body);
+    node->data.function.slot_count = r->slot_count;
+    r->stats->slots += r->slot_count;
+}
+
+// Number the unit's globals and functions, in the order they appear
+static void declare_unit(Resolver* r, ASTNode* node) {
+    bool function = node->type == NODE_FUNCTION;
+    const char* name = function ? node->data.function.name
+        : node->type == NODE_ASSIGNMENT ? node->data.assignment.name : node->data.variable.name;
+
+    const Binding* previous = lookup(&r->unit, name);
+    if (previous) {
+        if (function && previous->ref.kind == REF_FUNCTION) {
+            resolve_error(r, node, "Redefinition of function '%s'", name);
+        } else if (!function && previous->ref.kind == REF_GLOBAL) {
+            resolve_error(r, node, "Duplicate global '%s'", name);
+        } else {
+            resolve_error(r, node, "'%s' is both a function and a global", name);
+        }
+        return;
+    }
+
+    NameRef ref;
+    if (function) {
+        ref = (NameRef){ REF_FUNCTION, (int)r->function_count };
+        r->functions[r->function_count++] = node;
+    } else {
+        ref = (NameRef){ REF_GLOBAL, (int)r->global_count++ };
+        if (node->type == NODE_ASSIGNMENT) node->data.assignment.ref = ref;
+        else node->data.variable.ref = ref;
+    }
+    if (!bind(&r->unit, name, ref)) resolve_error(r, node, "Out of memory");
+}
+
+bool resolve_program(ASTNode* program, Error* error, ResolveStats* stats) {
+    ResolveStats local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(*stats));
+    size_t count = program->data.block.count;
+    Resolver r = { .stats = stats, .error = error };
+    r.functions = malloc((count + 1) * sizeof(ASTNode*));
+    if (!r.functions) resolve_error(&r, NULL, "Out of memory");
+
+    for (size_t i = 0; i < count && !failed(&r); i++) {
+        declare_unit(&r, program->data.block.statements[i]);
+    }
+    for (size_t i = 0; i < count && !failed(&r); i++) {
+        ASTNode* node = program->data.block.statements[i];
+        if (node->type == NODE_FUNCTION) {
+            resolve_function(&r, node);
+        } else if (node->type == NODE_ASSIGNMENT) {
+            // Only globals are in scope in an initializer
+            new_function(&r);
+            resolve_node(&r, node->data.assignment.value);
+        }
+    }
+    stats->functions = r.function_count;
+    stats->globals = r.global_count;
+
+    free(r.unit.entries);
+    free(r.locals.entries);
+    free(r.functions);
+    return !failed(&r);
+}
@@ -0,0 +1,377 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Sparse conditional constant propagation (Wegman and Zadeck). Every vreg
+// starts out unknown and every CFG edge unexecuted; values only fall from
+// unknown to a constant to overdefined, and a block is evaluated only
+// once an edge into it can execute. A branch on a constant marks just the
+// edge it takes, so a value assigned on a path that never runs does not
+// spoil the constant at a merge; a switch on a constant likewise marks
+// the one edge it takes. Constants then replace their definitions,
+// constant branches and switches become jumps, and blocks no edge reached
+// are deleted.
+
+typedef enum { LATTICE_UNKNOWN, LATTICE_CONST, LATTICE_OVERDEFINED } LatticeState;
+
+typedef struct {
+    LatticeState state;
+    int64_t value;
+} LatticeValue;
+
+// An instruction reading a vreg, and the index of its block
+typedef struct {
+    IRInstr* instr;
+    int block;
+} Use;
+
+typedef struct {
+    IRFunction* fn;
+    int vregs;
+    LatticeValue* values;
+    int* use_start;             // Uses of v: uses[use_start[v]..use_start[v+1])
+    Use* uses;
+    int* edge_start;            // Edge from preds[p] into b: edge_start[b] + p
+    int* edge_block;            // Edge -> block it enters
+    bool* executable;
+    bool* visited;
+    int* block_index;           // Block id -> index
+    int* edge_worklist;
+    size_t edge_top;
+    int* vreg_worklist;
+    size_t vreg_top;
+} SCCPContext;
+
+static LatticeValue value_of(const SCCPContext* ctx, int v) {
+    LatticeValue overdefined = { LATTICE_OVERDEFINED, 0 };
+    if (v < 0 || v >= ctx->vregs) return overdefined;
+    return ctx->values[v];
+}
+
+// Lower v to the meet of its value and the new one
+static void lower(SCCPContext* ctx, int v, LatticeValue value) {
+    LatticeValue* old = &ctx->values[v];
+    if (value.state == LATTICE_UNKNOWN || old->state == LATTICE_OVERDEFINED) return;
+    if (old->state == LATTICE_CONST) {
+        if (value.state == LATTICE_CONST && value.value == old->value) return;
+        value.state = LATTICE_OVERDEFINED;
+    }
+    *old = value;
+    ctx->vreg_worklist[ctx->vreg_top++] = v;
+}
+
+static bool fold(IROpcode op, int64_t a, int64_t b, int64_t* out) {
+    uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+    switch (op) {
+        case IR_ADD: *out = (int64_t)(ua + ub); return true;
+        case IR_SUB: *out = (int64_t)(ua - ub); return true;
+        case IR_MUL: *out = (int64_t)(ua * ub); return true;
+        case IR_DIV:
+            // Left to trap at run time
+            if (b == 0 || (a == INT64_MIN && b == -1)) return false;
+            *out = a / b;
+            return true;
+        // Counts are masked the way the hardware does
+        case IR_SHL: *out = (int64_t)(ua << (b & 63)); return true;
+        case IR_SAR: *out = a >> (b & 63); return true;
+        case IR_SHR: *out = (int64_t)(ua >> (b & 63)); return true;
+        case IR_EQ:  *out = a == b; return true;
+        case IR_NE:  *out = a != b; return true;
+        case IR_LT:  *out = a < b; return true;
+        case IR_GT:  *out = a > b; return true;
+        case IR_LE:  *out = a <= b; return true;
+        case IR_GE:  *out = a >= b; return true;
+        default:     return false;
+    }
+}
+
+static LatticeValue evaluate_binary(const SCCPContext* ctx, const IRInstr* instr) {
+    LatticeValue a = value_of(ctx, instr->a), b = value_of(ctx, instr->b);
+    LatticeValue result = { LATTICE_OVERDEFINED, 0 };
+    if (instr->op == IR_MUL && ((a.state == LATTICE_CONST && a.value == 0) ||
+                                (b.state == LATTICE_CONST && b.value == 0))) {
+        result.state = LATTICE_CONST;
+        return result;
+    }
+    if (a.state == LATTICE_OVERDEFINED || b.state == LATTICE_OVERDEFINED) return result;
+    if (a.state == LATTICE_UNKNOWN || b.state == LATTICE_UNKNOWN) {
+        result.state = LATTICE_UNKNOWN;
+        return result;
+    }
+    if (fold(instr->op, a.value, b.value, &result.value)) result.state = LATTICE_CONST;
+    return result;
+}
+
+// The meet of the operands on edges that can execute
+static LatticeValue evaluate_phi(const SCCPContext* ctx, const IRInstr* phi, int b) {
+    LatticeValue result = { LATTICE_UNKNOWN, 0 };
+    for (size_t p = 0; p < phi->arg_count; p++) {
+        if (!ctx->executable[ctx->edge_start[b] + (int)p]) continue;
+        LatticeValue arg = value_of(ctx, phi->args[p]);
+        if (arg.state == LATTICE_UNKNOWN) continue;
+        if (arg.state == LATTICE_OVERDEFINED ||
+            (result.state == LATTICE_CONST && result.value != arg.value)) {
+            result.state = LATTICE_OVERDEFINED;
+            return result;
+        }
+        result = arg;
+    }
+    return result;
+}
+
+static void mark_edges(SCCPContext* ctx, int from, const IRBlock* to) {
+    int b = ctx->block_index[to->id];
+    for (size_t p = 0; p < to->pred_count; p++) {
+        int edge = ctx->edge_start[b] + (int)p;
+        if (ctx->block_index[to->preds[p]->id] != from || ctx->executable[edge]) continue;
+        ctx->executable[edge] = true;
+        ctx->edge_worklist[ctx->edge_top++] = edge;
+    }
+}
+
+static void evaluate(SCCPContext* ctx, IRInstr* instr, int b) {
+    LatticeValue value = { LATTICE_OVERDEFINED, 0 };
+    switch (instr->op) {
+        case IR_CONST:
+            value.state = LATTICE_CONST;
+            value.value = instr->imm;
+            break;
+        case IR_COPY:
+            value = value_of(ctx, instr->a);
+            break;
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+        case IR_SHL:
+        case IR_SAR:
+        case IR_SHR:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+        case IR_LE:
+        case IR_GE:
+            value = evaluate_binary(ctx, instr);
+            break;
+        case IR_PHI:
+            value = evaluate_phi(ctx, instr, b);
+            break;
+        case IR_JUMP:
+            mark_edges(ctx, b, instr->target);
+            return;
+        case IR_BRANCH: {
+            LatticeValue cond = value_of(ctx, instr->a);
+            if (cond.state == LATTICE_UNKNOWN) return;
+            if (cond.state == LATTICE_OVERDEFINED || cond.value) mark_edges(ctx, b, instr->target);
+            if (cond.state == LATTICE_OVERDEFINED || !cond.value) mark_edges(ctx, b, instr->target_else);
+            return;
+        }
+        case IR_SWITCH: {
+            LatticeValue selector = value_of(ctx, instr->a);
+            if (selector.state == LATTICE_CONST) {
+                mark_edges(ctx, b, ir_switch_target(instr, selector.value));
+            } else if (selector.state == LATTICE_OVERDEFINED) {
+                for (size_t s = 0; s < instr->succ_count; s++) mark_edges(ctx, b, instr->succs[s]);
+            }
+            return;
+        }
+        default:
+            break;
+    }
+    if (instr->dst != IR_NO_VREG) lower(ctx, instr->dst, value);
+}
+
+static void propagate(SCCPContext* ctx) {
+    while (ctx->edge_top > 0 || ctx->vreg_top > 0) {
+        if (ctx->edge_top > 0) {
+            int b = ctx->edge_block[ctx->edge_worklist[--ctx->edge_top]];
+            IRBlock* block = ctx->fn->blocks[b];
+            // A block seen before only has new phi operands to look at
+            bool first = !ctx->visited[b];
+            ctx->visited[b] = true;
+            for (IRInstr* instr = block->first; instr; instr = instr->next) {
+                if (!first && instr->op != IR_PHI) break;
+                evaluate(ctx, instr, b);
+            }
+            continue;
+        }
+        int v = ctx->vreg_worklist[--ctx->vreg_top];
+        for (int u = ctx->use_start[v]; u < ctx->use_start[v + 1]; u++) {
+            if (ctx->visited[ctx->uses[u].block]) evaluate(ctx, ctx->uses[u].instr, ctx->uses[u].block);
+        }
+    }
+}
+
+static void add_use(SCCPContext* ctx, int v, IRInstr* instr, int b, bool fill) {
+    if (v < 0 || v >= ctx->vregs) return;
+    if (fill) {
+        ctx->uses[ctx->use_start[v + 1]++] = (Use){ instr, b };
+    } else {
+        ctx->use_start[v + 2]++;
+    }
+}
+
+// Counts uses per vreg on the first pass and fills them in on the second
+static bool build_uses(SCCPContext* ctx) {
+    IRFunction* fn = ctx->fn;
+    ctx->use_start = calloc(ctx->vregs + 2, sizeof(int));
+    if (!ctx->use_start) return false;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t b = 0; b < fn->block_count; b++) {
+            for (IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+                if (instr->op == IR_CALL || instr->op == IR_PHI) {
+                    for (size_t i = 0; i < instr->arg_count; i++) {
+                        add_use(ctx, instr->args[i], instr, (int)b, pass == 1);
+                    }
+                } else {
+                    add_use(ctx, instr->a, instr, (int)b, pass == 1);
+                    if (instr->b != instr->a) add_use(ctx, instr->b, instr, (int)b, pass == 1);
+                }
+            }
+        }
+        if (pass == 0) {
+            for (int v = 0; v < ctx->vregs; v++) ctx->use_start[v + 2] += ctx->use_start[v + 1];
+            ctx->uses = malloc(((size_t)ctx->use_start[ctx->vregs + 1] + 1) * sizeof(Use));
+            if (!ctx->uses) return false;
+        }
+    }
+    return true;
+}
+
+// Replace the definition of a constant vreg with the constant itself
+static void replace_with_const(IRBlock* block, IRInstr* instr, int64_t value) {
+    if (instr->op == IR_PHI) {
+        ir_remove(block, instr);
+        ir_insert_before(block, ir_first_non_phi(block), instr);
+    }
+    instr->op = IR_CONST;
+    instr->imm = value;
+    instr->a = IR_NO_VREG;
+    instr->b = IR_NO_VREG;
+    instr->args = NULL;
+    instr->arg_count = 0;
+}
+
+static void fold_branch(IRBlock* block, bool taken) {
+    IRInstr* branch = block->last;
+    IRBlock* target = taken ? branch->target : branch->target_else;
+    IRBlock* dead = taken ? branch->target_else : branch->target;
+    for (size_t p = 0; p < dead->pred_count; p++) {
+        if (dead->preds[p] == block) {
+            ir_remove_pred(dead, p);
+            break;
+        }
+    }
+    branch->op = IR_JUMP;
+    branch->a = IR_NO_VREG;
+    branch->target = target;
+    branch->target_else = NULL;
+}
+
+bool ir_sccp(IRFunction* fn, size_t* constants, size_t* branches, size_t* blocks) {
+    size_t count = fn->block_count;
+    SCCPContext ctx = { .fn = fn, .vregs = fn->vreg_count };
+    ctx.values = calloc(ctx.vregs + 1, sizeof(LatticeValue));
+    ctx.edge_start = malloc((count + 1) * sizeof(int));
+    ctx.visited = calloc(count + 1, sizeof(bool));
+    ctx.block_index = malloc((fn->next_block_id + 1) * sizeof(int));
+    ctx.vreg_worklist = malloc((2 * (size_t)ctx.vregs + 1) * sizeof(int));
+    bool ok = ctx.values && ctx.edge_start && ctx.visited && ctx.block_index &&
+              ctx.vreg_worklist && build_uses(&ctx);
+    if (!ok) goto done;
+
+    int edges = 0;
+    for (size_t b = 0; b < count; b++) {
+        ctx.block_index[fn->blocks[b]->id] = (int)b;
+        ctx.edge_start[b] = edges;
+        edges += (int)fn->blocks[b]->pred_count;
+    }
+    ctx.edge_start[count] = edges;
+    ctx.edge_block = malloc(((size_t)edges + 1) * sizeof(int));
+    ctx.executable = calloc((size_t)edges + 1, sizeof(bool));
+    ctx.edge_worklist = malloc(((size_t)edges + 1) * sizeof(int));
+    ok = ctx.edge_block && ctx.executable && ctx.edge_worklist;
+    if (!ok) goto done;
+    for (size_t b = 0; b < count; b++) {
+        for (int e = ctx.edge_start[b]; e < ctx.edge_start[b + 1]; e++) ctx.edge_block[e] = (int)b;
+    }
+
+    // Parameters, and vregs read without a definition, could be anything
+    bool* defined = calloc(ctx.vregs + 1, sizeof(bool));
+    if (!defined) {
+        ok = false;
+        goto done;
+    }
+    for (size_t b = 0; b < count; b++) {
+        for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->dst != IR_NO_VREG) defined[instr->dst] = true;
+        }
+    }
+    for (int v = 0; v < ctx.vregs; v++) {
+        if (!defined[v]) ctx.values[v].state = LATTICE_OVERDEFINED;
+    }
+    free(defined);
+
+    ctx.visited[0] = true;
+    for (IRInstr* instr = fn->blocks[0]->first; instr; instr = instr->next) evaluate(&ctx, instr, 0);
+    propagate(&ctx);
+
+    // A branch still on an unknown value only depends on values that are
+    // never defined; give it both ways rather than guess one
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = 0; b < count; b++) {
+            IRInstr* term = fn->blocks[b]->last;
+            if (!ctx.visited[b] || !ir_is_conditional(term->op)) continue;
+            if (value_of(&ctx, term->a).state != LATTICE_UNKNOWN) continue;
+            lower(&ctx, term->a, (LatticeValue){ LATTICE_OVERDEFINED, 0 });
+            propagate(&ctx);
+            changed = true;
+        }
+    }
+
+    for (size_t b = 0; b < count; b++) {
+        if (!ctx.visited[b]) continue;
+        IRBlock* block = fn->blocks[b];
+        IRInstr* instr = block->first;
+        while (instr) {
+            IRInstr* next = instr->next;
+            if (instr->dst != IR_NO_VREG && instr->op != IR_CONST &&
+                ctx.values[instr->dst].state == LATTICE_CONST) {
+                replace_with_const(block, instr, ctx.values[instr->dst].value);
+                (*constants)++;
+            }
+            instr = next;
+        }
+        IRInstr* term = block->last;
+        LatticeValue cond = value_of(&ctx, term->a);
+        if (term->op == IR_BRANCH && cond.state == LATTICE_CONST && term->target != term->target_else) {
+            fold_branch(block, cond.value != 0);
+            (*branches)++;
+        } else if (term->op == IR_SWITCH && cond.state == LATTICE_CONST) {
+            ok = ir_make_jump(fn, block, ir_switch_target(term, cond.value));
+            (*branches)++;
+            if (!ok) goto done;
+        }
+    }
+
+    // Blocks no executable edge reached are now unreachable
+    ir_remove_unreachable(fn);
+    *blocks += count - fn->block_count;
+    ir_remove_trivial_phis(fn);
+
+done:
+    free(ctx.values);
+    free(ctx.use_start);
+    free(ctx.uses);
+    free(ctx.edge_start);
+    free(ctx.edge_block);
+    free(ctx.executable);
+    free(ctx.visited);
+    free(ctx.block_index);
+    free(ctx.edge_worklist);
+    free(ctx.vreg_worklist);
+    return ok;
+}
@@ -0,0 +1,258 @@
+#define _POSIX_C_SOURCE 200809L  // For sysconf
+#include "schedule.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// The deques follow Chase and Lev ("Dynamic circular work-stealing deque",
+// SPAA 2005), with sequentially consistent operations on top and bottom in
+// place of explicit fences. Every task is pushed exactly once per run, so
+// a ring with room for all of them never fills and never has to grow.
+
+#define MAX_WORKERS 256
+#define STEAL_ROUNDS 64     // Passes over the other deques before sleeping
+
+typedef struct {
+    _Atomic ptrdiff_t top;      // Thieves take from here
+    char padding[64];           // Keeps it off the owner's cache line
+    _Atomic ptrdiff_t bottom;   // The owner pushes and takes here
+    _Atomic int* tasks;         // Ring of mask + 1 entries
+    size_t mask;
+} Deque;
+
+typedef struct Schedule Schedule;
+
+typedef struct {
+    Deque deque;
+    Schedule* schedule;
+    size_t index;
+    size_t steals;
+    pthread_t thread;
+} Worker;
+
+struct Schedule {
+    const TaskGraph* graph;
+    Worker* workers;
+    size_t worker_count;
+    _Atomic size_t active;      // Workers started, the calling thread included
+    _Atomic int* waits;         // Unfinished tasks each task still waits for
+    _Atomic size_t remaining;   // Tasks not finished yet
+    _Atomic bool stop;
+    _Atomic bool failed;
+    _Atomic size_t sleepers;
+    pthread_mutex_t lock;       // Guards sleeping, so no wakeup is lost
+    pthread_cond_t wake;
+};
+
+// Only the owner pushes
+static void deque_push(Deque* deque, int task) {
+    ptrdiff_t bottom = atomic_load(&deque->bottom);
+    atomic_store_explicit(&deque->tasks[(size_t)bottom & deque->mask], task, memory_order_relaxed);
+    atomic_store(&deque->bottom, bottom + 1);
+}
+
+// The owner's end; -1 when empty
+static int deque_take(Deque* deque) {
+    ptrdiff_t bottom = atomic_load(&deque->bottom) - 1;
+    atomic_store(&deque->bottom, bottom);
+    ptrdiff_t top = atomic_load(&deque->top);
+    if (top > bottom) {
+        atomic_store(&deque->bottom, bottom + 1);
+        return -1;
+    }
+    int task = atomic_load_explicit(&deque->tasks[(size_t)bottom & deque->mask], memory_order_relaxed);
+    if (top == bottom) {
+        // The last task: a thief may be after it too
+        if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1)) task = -1;
+        atomic_store(&deque->bottom, bottom + 1);
+    }
+    return task;
+}
+
+// Any other worker's end; -1 when empty or when another worker got there first
+static int deque_steal(Deque* deque) {
+    ptrdiff_t top = atomic_load(&deque->top);
+    ptrdiff_t bottom = atomic_load(&deque->bottom);
+    if (top >= bottom) return -1;
+    int task = atomic_load_explicit(&deque->tasks[(size_t)top & deque->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1)) return -1;
+    return task;
+}
+
+static bool deque_empty(Deque* deque) {
+    return atomic_load(&deque->top) >= atomic_load(&deque->bottom);
+}
+
+static void wake_all(Schedule* schedule) {
+    pthread_mutex_lock(&schedule->lock);
+    pthread_cond_broadcast(&schedule->wake);
+    pthread_mutex_unlock(&schedule->lock);
+}
+
+static void finish(Schedule* schedule, bool failed) {
+    if (failed) atomic_store(&schedule->failed, true);
+    atomic_store(&schedule->stop, true);
+    wake_all(schedule);
+}
+
+static int find_task(Worker* self) {
+    int task = deque_take(&self->deque);
+    if (task >= 0) return task;
+
+    Schedule* schedule = self->schedule;
+    for (size_t round = 0; round < STEAL_ROUNDS && schedule->worker_count > 1; round++) {
+        for (size_t i = 1; i < schedule->worker_count; i++) {
+            Worker* victim = &schedule->workers[(self->index + i) % schedule->worker_count];
+            task = deque_steal(&victim->deque);
+            if (task >= 0) {
+                self->steals++;
+                return task;
+            }
+        }
+        if (atomic_load(&schedule->stop)) break;
+        sched_yield();
+    }
+    return -1;
+}
+
+// Sleep until a task is pushed or the run ends. The sleeper count goes up
+// before the deques are checked, and a push is visible before the pusher
+// reads the count, so one of the two always sees the other.
+static void idle(Schedule* schedule) {
+    pthread_mutex_lock(&schedule->lock);
+    size_t sleepers = atomic_fetch_add(&schedule->sleepers, 1) + 1;
+    bool ready = false;
+    for (size_t i = 0; i < schedule->worker_count && !ready; i++) {
+        ready = !deque_empty(&schedule->workers[i].deque);
+    }
+    if (!ready && !atomic_load(&schedule->stop)) {
+        if (sleepers == atomic_load(&schedule->active)) {
+            // Nobody is running a task, so nothing can become ready
+            atomic_store(&schedule->failed, true);
+            atomic_store(&schedule->stop, true);
+            pthread_cond_broadcast(&schedule->wake);
+        } else {
+            pthread_cond_wait(&schedule->wake, &schedule->lock);
+        }
+    }
+    atomic_fetch_sub(&schedule->sleepers, 1);
+    pthread_mutex_unlock(&schedule->lock);
+}
+
+static void* work(void* arg) {
+    Worker* self = arg;
+    Schedule* schedule = self->schedule;
+    const TaskGraph* graph = schedule->graph;
+
+    while (!atomic_load(&schedule->stop)) {
+        int task = find_task(self);
+        if (task < 0) {
+            idle(schedule);
+            continue;
+        }
+        if (!graph->run(graph->context, (size_t)task, self->index)) {
+            finish(schedule, true);
+            break;
+        }
+
+        // Keep what this task released: its callers can use what is still in cache
+        int first = graph->next_start ? graph->next_start[task] : 0;
+        int last = graph->next_start ? graph->next_start[task + 1] : 0;
+        for (int e = first; e < last; e++) {
+            int next = graph->next[e];
+            if (atomic_fetch_sub(&schedule->waits[next], 1) != 1) continue;
+            deque_push(&self->deque, next);
+            if (atomic_load(&schedule->sleepers) > 0) {
+                pthread_mutex_lock(&schedule->lock);
+                pthread_cond_signal(&schedule->wake);
+                pthread_mutex_unlock(&schedule->lock);
+            }
+        }
+        if (atomic_fetch_sub(&schedule->remaining, 1) == 1) finish(schedule, false);
+    }
+    return NULL;
+}
+
+size_t schedule_default_threads(void) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online < 1) return 1;
+    return (size_t)online < MAX_WORKERS ? (size_t)online : MAX_WORKERS;
+}
+
+size_t schedule_workers(size_t threads, size_t count) {
+    size_t workers = threads ? threads : schedule_default_threads();
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+    if (workers > count) workers = count;
+    return workers ? workers : 1;
+}
+
+bool schedule_run(const TaskGraph* graph, size_t threads, ScheduleStats* stats) {
+    ScheduleStats local_stats;
+    if (!stats) stats = &local_stats;
+    stats->workers = 0;
+    stats->steals = 0;
+    if (graph->count == 0) return true;
+
+    Schedule schedule = { .graph = graph };
+    schedule.worker_count = schedule_workers(threads, graph->count);
+    size_t capacity = 1;
+    while (capacity < graph->count) capacity *= 2;
+    schedule.workers = calloc(schedule.worker_count, sizeof(Worker));
+    schedule.waits = malloc(graph->count * sizeof(*schedule.waits));
+    bool ok = schedule.workers && schedule.waits;
+    for (size_t w = 0; ok && w < schedule.worker_count; w++) {
+        Worker* worker = &schedule.workers[w];
+        worker->schedule = &schedule;
+        worker->index = w;
+        worker->deque.mask = capacity - 1;
+        worker->deque.tasks = malloc(capacity * sizeof(*worker->deque.tasks));
+        ok = worker->deque.tasks != NULL;
+    }
+    if (!ok) goto done;
+
+    // Deal out what is ready from the start; each worker begins with its
+    // lowest-numbered task
+    size_t ready = 0;
+    for (size_t t = 0; t < graph->count; t++) {
+        atomic_init(&schedule.waits[t], graph->waits ? graph->waits[t] : 0);
+        if (!graph->waits || graph->waits[t] == 0) ready++;
+    }
+    for (size_t t = graph->count; t-- > 0;) {
+        if (graph->waits && graph->waits[t] != 0) continue;
+        deque_push(&schedule.workers[--ready % schedule.worker_count].deque, (int)t);
+    }
+    atomic_init(&schedule.remaining, graph->count);
+    atomic_init(&schedule.active, 1);
+    pthread_mutex_init(&schedule.lock, NULL);
+    pthread_cond_init(&schedule.wake, NULL);
+
+    // A worker that cannot be started leaves its tasks for the others to steal
+    size_t started = 1;
+    for (size_t w = 1; w < schedule.worker_count; w++) {
+        atomic_fetch_add(&schedule.active, 1);
+        if (pthread_create(&schedule.workers[w].thread, NULL, work, &schedule.workers[w]) != 0) {
+            atomic_fetch_sub(&schedule.active, 1);
+            break;
+        }
+        started++;
+    }
+    work(&schedule.workers[0]);
+    for (size_t w = 1; w < started; w++) pthread_join(schedule.workers[w].thread, NULL);
+
+    stats->workers = started;
+    for (size_t w = 0; w < schedule.worker_count; w++) stats->steals += schedule.workers[w].steals;
+    ok = !atomic_load(&schedule.failed);
+    pthread_mutex_destroy(&schedule.lock);
+    pthread_cond_destroy(&schedule.wake);
+
+done:
+    for (size_t w = 0; schedule.workers && w < schedule.worker_count; w++) {
+        free(schedule.workers[w].deque.tasks);
+    }
+    free(schedule.workers);
+    free(schedule.waits);
+    return ok;
+}
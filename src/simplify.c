@@ -0,0 +1,164 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// CFG simplification. A block that does nothing but jump elsewhere is
+// bypassed: its predecessors jump straight to its target (jump threading).
+// A block entered only from a block that jumps to it is appended to that
+// block. A branch whose two edges now lead to the same place with the
+// same phi operands becomes a jump, as does a switch left with a single
+// successor. Each change can enable the others, so the rewrites repeat
+// until none applies.
+
+static size_t pred_index(const IRBlock* block, const IRBlock* pred) {
+    for (size_t p = 0; p < block->pred_count; p++) {
+        if (block->preds[p] == pred) return p;
+    }
+    return block->pred_count;
+}
+
+static bool same_phi_operands(const IRBlock* block, size_t p, size_t q) {
+    for (const IRInstr* phi = block->first; phi && phi->op == IR_PHI; phi = phi->next) {
+        if (phi->args[p] != phi->args[q]) return false;
+    }
+    return true;
+}
+
+// A branch to one block along both edges, or a switch to one block
+static bool fold_branch(IRFunction* fn, IRBlock* block) {
+    IRInstr* branch = block->last;
+    if (branch->op == IR_SWITCH && branch->succ_count == 1) return ir_make_jump(fn, block, branch->target);
+    if (branch->op != IR_BRANCH || branch->target != branch->target_else) return false;
+    IRBlock* target = branch->target;
+    size_t p = pred_index(target, block);
+    size_t q = p + 1;
+    while (q < target->pred_count && target->preds[q] != block) q++;
+    if (q >= target->pred_count || !same_phi_operands(target, p, q)) return false;
+
+    ir_remove_pred(target, q);
+    branch->op = IR_JUMP;
+    branch->a = IR_NO_VREG;
+    branch->target_else = NULL;
+    return true;
+}
+
+// Give phis of block an operand for a new last predecessor, copied from
+// the operand at index from
+static bool copy_phi_operands(IRFunction* fn, IRBlock* block, size_t from) {
+    for (IRInstr* phi = block->first; phi && phi->op == IR_PHI; phi = phi->next) {
+        int* args = arena_alloc(&fn->arena, (phi->arg_count + 1) * sizeof(int));
+        if (!args) return false;
+        memcpy(args, phi->args, phi->arg_count * sizeof(int));
+        args[phi->arg_count] = phi->args[from];
+        phi->args = args;
+        phi->arg_count++;
+    }
+    return true;
+}
+
+// Route the predecessors of the empty block through to its target. Values
+// reaching the target through it dominate it, and so every predecessor.
+static bool thread_jumps(IRFunction* fn, IRBlock* block, size_t* threaded) {
+    IRBlock* target = block->last->target;
+    size_t p = 0;
+    while (p < block->pred_count) {
+        IRBlock* pred = block->preds[p];
+        IRInstr* term = pred->last;
+        size_t via = pred_index(target, block);
+        size_t direct = pred_index(target, pred);
+        if (direct < target->pred_count) {
+            // Another edge of pred's branch or switch already enters the
+            // target; they merge into one when they carry the same values
+            if (!ir_is_conditional(term->op) || !same_phi_operands(target, via, direct)) {
+                p++;
+                continue;
+            }
+            if (term->op == IR_SWITCH) {
+                ir_retarget(term, block, target);
+            } else {
+                term->op = IR_JUMP;
+                term->a = IR_NO_VREG;
+                term->target = target;
+                term->target_else = NULL;
+            }
+        } else {
+            if (term->op == IR_BRANCH && term->target == term->target_else) {
+                p++;
+                continue;
+            }
+            if (!ir_add_pred(fn, target, pred) || !copy_phi_operands(fn, target, via)) return false;
+            ir_retarget(term, block, target);
+        }
+        ir_remove_pred(block, p);
+        (*threaded)++;
+    }
+    return true;
+}
+
+static bool is_forwarder(const IRFunction* fn, const IRBlock* block) {
+    return block != fn->blocks[0] && block->first == block->last && block->last->op == IR_JUMP &&
+           block->last->target != block;
+}
+
+// Append the single successor to block; its phis have one operand each
+static void merge_blocks(IRBlock* block, IRBlock* succ, int* forward) {
+    ir_remove(block, block->last);
+    while (succ->first) {
+        IRInstr* instr = succ->first;
+        ir_remove(succ, instr);
+        if (instr->op == IR_PHI) {
+            forward[instr->dst] = instr->args[0];
+            continue;
+        }
+        ir_append(block, instr);
+    }
+
+    size_t n = ir_successor_count(block);
+    for (size_t s = 0; s < n; s++) {
+        IRBlock* next = ir_successor(block, s);
+        for (size_t p = 0; p < next->pred_count; p++) {
+            if (next->preds[p] == succ) next->preds[p] = block;
+        }
+    }
+    succ->pred_count = 0;
+}
+
+bool ir_simplify_cfg(IRFunction* fn, size_t* merged, size_t* threaded) {
+    int* forward = malloc((fn->vreg_count + 1) * sizeof(int));
+    if (!forward) return false;
+    for (int v = 0; v < fn->vreg_count; v++) forward[v] = v;
+
+    bool ok = true;
+    bool changed = true;
+    while (changed && ok) {
+        changed = false;
+        for (size_t b = 0; b < fn->block_count && ok; b++) {
+            IRBlock* block = fn->blocks[b];
+            if (fold_branch(fn, block)) changed = true;
+            if (is_forwarder(fn, block) && block->pred_count > 0) {
+                size_t before = *threaded;
+                ok = thread_jumps(fn, block, threaded);
+                changed |= *threaded != before;
+            }
+        }
+
+        // Merged blocks are left without predecessors, so the walk from
+        // the entry drops them along with the bypassed ones
+        for (size_t b = 0; b < fn->block_count && ok; b++) {
+            IRBlock* block = fn->blocks[b];
+            if (block->pred_count == 0 && b != 0) continue;
+            while (block->last->op == IR_JUMP) {
+                IRBlock* succ = block->last->target;
+                if (succ == block || succ == fn->blocks[0] || succ->pred_count != 1) break;
+                merge_blocks(block, succ, forward);
+                (*merged)++;
+                changed = true;
+            }
+        }
+        ir_remove_unreachable(fn);
+    }
+
+    ir_replace_vregs(fn, forward);
+    free(forward);
+    return ok;
+}
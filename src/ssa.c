@@ -0,0 +1,461 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// SSA maintenance and destruction.
+//
+// Phis leave SSA form by coalescing: a phi and an operand that do not
+// interfere share one vreg, so the copy between them disappears. What
+// cannot be coalesced becomes a parallel copy at the end of the
+// predecessor, after critical edges have been split.
+
+size_t ir_remove_trivial_phis(IRFunction* fn) {
+    int* forward = malloc((fn->vreg_count + 1) * sizeof(int));
+    if (!forward) return 0;
+    for (int v = 0; v < fn->vreg_count; v++) forward[v] = v;
+
+    // A phi is trivial when it only merges one value with itself; removing
+    // one can make others trivial, so iterate
+    size_t removed = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = 0; b < fn->block_count; b++) {
+            IRBlock* block = fn->blocks[b];
+            IRInstr* phi = block->first;
+            while (phi && phi->op == IR_PHI) {
+                IRInstr* next = phi->next;
+                int same = IR_NO_VREG;
+                bool trivial = true;
+                for (size_t i = 0; i < phi->arg_count; i++) {
+                    int arg = ir_resolve_forward(forward, phi->args[i]);
+                    if (arg == phi->dst || arg == same) continue;
+                    if (same != IR_NO_VREG) {
+                        trivial = false;
+                        break;
+                    }
+                    same = arg;
+                }
+                if (trivial) {
+                    ir_remove(block, phi);
+                    if (same == IR_NO_VREG) {
+                        // Only ever merges itself: the value is undefined
+                        phi->op = IR_CONST;
+                        phi->imm = 0;
+                        phi->args = NULL;
+                        phi->arg_count = 0;
+                        ir_insert_before(block, ir_first_non_phi(block), phi);
+                    } else {
+                        forward[phi->dst] = same;
+                    }
+                    removed++;
+                    changed = true;
+                }
+                phi = next;
+            }
+        }
+    }
+
+    if (removed) ir_replace_vregs(fn, forward);
+    free(forward);
+    return removed;
+}
+
+typedef struct {
+    IRFunction* fn;
+    size_t words;               // 64-bit words in a set of vregs
+    uint64_t* live_in;          // One set per block, indexed like fn->blocks
+    uint64_t* live_out;
+    int* related;               // Vreg -> dense index among phi operands, or -1
+    int* related_vreg;          // Dense index -> vreg
+    size_t related_count;
+    size_t row_words;           // 64-bit words in an interference row
+    uint64_t* interfere;        // related_count rows; a class root's row
+                                // holds the union over its members
+    int* parent;                // Union-find over dense indices
+    int* next_member;           // Circular member list of each class
+} Destruct;
+
+static bool bit_test(const uint64_t* set, int bit) {
+    return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void bit_set(uint64_t* set, int bit) {
+    set[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+static void bit_clear(uint64_t* set, int bit) {
+    set[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+}
+
+// Add the operands of a non-phi instruction to a set, except those in skip
+static void add_uses(const IRInstr* instr, uint64_t* set, const uint64_t* skip) {
+    if (instr->op == IR_CALL) {
+        for (size_t i = 0; i < instr->arg_count; i++) {
+            if (!skip || !bit_test(skip, instr->args[i])) bit_set(set, instr->args[i]);
+        }
+        return;
+    }
+    if (instr->a != IR_NO_VREG && (!skip || !bit_test(skip, instr->a))) bit_set(set, instr->a);
+    if (instr->b != IR_NO_VREG && (!skip || !bit_test(skip, instr->b))) bit_set(set, instr->b);
+}
+
+static uint64_t* row(Destruct* d, int index) {
+    return &d->interfere[(size_t)index * d->row_words];
+}
+
+static void add_interference(Destruct* d, int x, int y) {
+    int a = d->related[x];
+    int b = d->related[y];
+    if (a < 0 || b < 0 || a == b) return;
+    bit_set(row(d, a), b);
+    bit_set(row(d, b), a);
+}
+
+// x interferes with every vreg in a live set
+static void interfere_with_set(Destruct* d, int x, const uint64_t* live) {
+    if (d->related[x] < 0) return;
+    for (size_t w = 0; w < d->words; w++) {
+        uint64_t bits = live[w];
+        while (bits) {
+            int bit = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            add_interference(d, x, (int)(w * 64) + bit);
+        }
+    }
+}
+
+// Give every edge into a phi block a block of its own, so the copies for
+// that edge have somewhere to go. The new block is placed right before its
+// target and falls through to it.
+static bool split_critical_edges(IRFunction* fn) {
+    for (size_t b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        if (!block->first || block->first->op != IR_PHI) continue;
+
+        for (size_t i = 0; i < block->pred_count; i++) {
+            IRBlock* pred = block->preds[i];
+            if (ir_successor_count(pred) < 2) continue;
+
+            IRBlock* edge = ir_block_create(fn);
+            IRInstr* jump = ir_instr_create(fn, IR_JUMP);
+            if (!edge || !jump || !ir_add_pred(fn, edge, pred)) return false;
+            jump->target = block;
+            ir_append(edge, jump);
+            // A branch with both edges into block is split one edge at a time
+            if (pred->last->op == IR_SWITCH) {
+                ir_retarget(pred->last, block, edge);
+            } else if (pred->last->target == block) {
+                pred->last->target = edge;
+            } else {
+                pred->last->target_else = edge;
+            }
+            block->preds[i] = edge;
+
+            memmove(&fn->blocks[b + 1], &fn->blocks[b], (fn->block_count - 1 - b) * sizeof(IRBlock*));
+            fn->blocks[b] = edge;
+            b++;
+        }
+    }
+    return true;
+}
+
+// Liveness where a phi operand is used at the end of its predecessor and a
+// phi result is defined at the top of its block
+static bool compute_liveness(Destruct* d, const int* index) {
+    IRFunction* fn = d->fn;
+    size_t words = d->words;
+    uint64_t* use = calloc(fn->block_count * words + 1, sizeof(uint64_t));
+    uint64_t* def = calloc(fn->block_count * words + 1, sizeof(uint64_t));
+    d->live_in = calloc(fn->block_count * words + 1, sizeof(uint64_t));
+    d->live_out = calloc(fn->block_count * words + 1, sizeof(uint64_t));
+    if (!use || !def || !d->live_in || !d->live_out) {
+        free(use);
+        free(def);
+        return false;
+    }
+
+    for (size_t b = 0; b < fn->block_count; b++) {
+        uint64_t* block_use = &use[b * words];
+        uint64_t* block_def = &def[b * words];
+        for (IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->op != IR_PHI) add_uses(instr, block_use, block_def);
+            if (instr->dst != IR_NO_VREG) bit_set(block_def, instr->dst);
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = fn->block_count; b > 0; b--) {
+            IRBlock* block = fn->blocks[b - 1];
+            uint64_t* out = &d->live_out[(b - 1) * words];
+            uint64_t* in = &d->live_in[(b - 1) * words];
+
+            size_t n = ir_successor_count(block);
+            for (size_t s = 0; s < n; s++) {
+                const IRBlock* succ = ir_successor(block, s);
+                const uint64_t* succ_in = &d->live_in[(size_t)index[succ->id] * words];
+                for (size_t w = 0; w < words; w++) out[w] |= succ_in[w];
+                for (size_t p = 0; p < succ->pred_count; p++) {
+                    if (succ->preds[p] != block) continue;
+                    for (IRInstr* phi = succ->first; phi && phi->op == IR_PHI; phi = phi->next) {
+                        bit_set(out, phi->args[p]);
+                    }
+                }
+            }
+
+            for (size_t w = 0; w < words; w++) {
+                uint64_t value = use[(b - 1) * words + w] | (out[w] & ~def[(b - 1) * words + w]);
+                if (value != in[w]) {
+                    in[w] = value;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    free(use);
+    free(def);
+    return true;
+}
+
+static bool build_interference(Destruct* d) {
+    IRFunction* fn = d->fn;
+    uint64_t* live = malloc((d->words + 1) * sizeof(uint64_t));
+    if (!live) return false;
+
+    for (size_t b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        memcpy(live, &d->live_out[b * d->words], d->words * sizeof(uint64_t));
+
+        // A definition interferes with everything live after it
+        IRInstr* instr = block->last;
+        for (; instr && instr->op != IR_PHI; instr = instr->prev) {
+            if (instr->dst != IR_NO_VREG) {
+                bit_clear(live, instr->dst);
+                interfere_with_set(d, instr->dst, live);
+            }
+            add_uses(instr, live, NULL);
+        }
+
+        IRInstr* first_phi = block->first;
+        if (!first_phi || first_phi->op != IR_PHI) continue;
+        for (IRInstr* phi = first_phi; phi && phi->op == IR_PHI; phi = phi->next) {
+            bit_clear(live, phi->dst);
+        }
+
+        // Phi results are written together, in effect at the end of each
+        // predecessor, where the operands of the other phis are still live
+        for (IRInstr* phi = first_phi; phi && phi->op == IR_PHI; phi = phi->next) {
+            interfere_with_set(d, phi->dst, live);
+            for (IRInstr* other = first_phi; other && other->op == IR_PHI; other = other->next) {
+                if (other == phi) continue;
+                add_interference(d, phi->dst, other->dst);
+                for (size_t i = 0; i < phi->arg_count; i++) {
+                    if (other->args[i] != phi->args[i]) add_interference(d, phi->dst, other->args[i]);
+                }
+            }
+        }
+    }
+
+    free(live);
+    return true;
+}
+
+static int find_class(Destruct* d, int index) {
+    while (d->parent[index] != index) {
+        d->parent[index] = d->parent[d->parent[index]];
+        index = d->parent[index];
+    }
+    return index;
+}
+
+static void try_coalesce(Destruct* d, int x, int y) {
+    if (d->related[x] < 0 || d->related[y] < 0) return;
+    int a = find_class(d, d->related[x]);
+    int b = find_class(d, d->related[y]);
+    if (a == b) return;
+
+    const uint64_t* b_row = row(d, b);
+    int member = a;
+    do {
+        if (bit_test(b_row, member)) return;
+        member = d->next_member[member];
+    } while (member != a);
+
+    d->parent[a] = b;
+    uint64_t* merged = row(d, b);
+    const uint64_t* a_row = row(d, a);
+    for (size_t w = 0; w < d->row_words; w++) merged[w] |= a_row[w];
+    int next = d->next_member[a];
+    d->next_member[a] = d->next_member[b];
+    d->next_member[b] = next;
+}
+
+static bool emit_copy(IRFunction* fn, IRBlock* block, int dst, int src) {
+    IRInstr* copy = ir_instr_create(fn, IR_COPY);
+    if (!copy) return false;
+    copy->dst = dst;
+    copy->a = src;
+    ir_insert_before(block, block->last, copy);
+    return true;
+}
+
+// Sequentialize the parallel copy dst[i] = src[i] at the end of a block.
+// Destinations are distinct; a cycle is broken through a temporary.
+static bool emit_parallel_copy(IRFunction* fn, IRBlock* block, int* dst, int* src, size_t count) {
+    while (count > 0) {
+        size_t ready = count;
+        for (size_t i = 0; i < count && ready == count; i++) {
+            bool needed = false;
+            for (size_t j = 0; j < count && !needed; j++) needed = src[j] == dst[i];
+            if (!needed) ready = i;
+        }
+
+        if (ready == count) {
+            int temp = ir_new_vreg(fn);
+            if (!emit_copy(fn, block, temp, dst[0])) return false;
+            for (size_t j = 0; j < count; j++) {
+                if (src[j] == dst[0]) src[j] = temp;
+            }
+            continue;
+        }
+
+        if (!emit_copy(fn, block, dst[ready], src[ready])) return false;
+        count--;
+        dst[ready] = dst[count];
+        src[ready] = src[count];
+    }
+    return true;
+}
+
+static bool lower_phis(IRFunction* fn) {
+    size_t capacity = 0;
+    int* dst = NULL;
+    int* src = NULL;
+    bool ok = true;
+
+    for (size_t b = 0; b < fn->block_count && ok; b++) {
+        IRBlock* block = fn->blocks[b];
+        size_t phis = 0;
+        for (IRInstr* phi = block->first; phi && phi->op == IR_PHI; phi = phi->next) phis++;
+        if (phis == 0) continue;
+        if (phis > capacity) {
+            capacity = phis;
+            free(dst);
+            free(src);
+            dst = malloc(capacity * sizeof(int));
+            src = malloc(capacity * sizeof(int));
+            if (!dst || !src) {
+                ok = false;
+                break;
+            }
+        }
+
+        for (size_t p = 0; p < block->pred_count && ok; p++) {
+            size_t count = 0;
+            for (IRInstr* phi = block->first; phi && phi->op == IR_PHI; phi = phi->next) {
+                if (phi->args[p] == phi->dst) continue;
+                dst[count] = phi->dst;
+                src[count] = phi->args[p];
+                count++;
+            }
+            ok = emit_parallel_copy(fn, block->preds[p], dst, src, count);
+        }
+
+        while (block->first && block->first->op == IR_PHI) ir_remove(block, block->first);
+    }
+
+    free(dst);
+    free(src);
+    return ok;
+}
+
+bool ir_destruct_ssa(IRFunction* fn) {
+    fn->out_of_ssa = true;
+    ir_remove_trivial_phis(fn);
+
+    bool has_phis = false;
+    for (size_t b = 0; b < fn->block_count && !has_phis; b++) {
+        has_phis = fn->blocks[b]->first && fn->blocks[b]->first->op == IR_PHI;
+    }
+    if (!has_phis) return true;
+    if (!split_critical_edges(fn)) return false;
+
+    Destruct d = { .fn = fn };
+    int vregs = fn->vreg_count;
+    d.words = ((size_t)vregs + 63) / 64;
+    int* index = calloc(fn->next_block_id + 1, sizeof(int));
+    const IRInstr** def = calloc(vregs + 1, sizeof(IRInstr*));
+    int* forward = malloc((vregs + 1) * sizeof(int));
+    d.related = malloc((vregs + 1) * sizeof(int));
+    d.related_vreg = malloc((vregs + 1) * sizeof(int));
+    bool ok = false;
+    if (!index || !def || !forward || !d.related || !d.related_vreg) goto done;
+
+    for (size_t b = 0; b < fn->block_count; b++) {
+        index[fn->blocks[b]->id] = (int)b;
+        for (const IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->dst != IR_NO_VREG) def[instr->dst] = instr;
+        }
+    }
+
+    // Only phi results and operands take part in coalescing. Constants stay
+    // out: a single-definition constant needs no register at all.
+    for (int v = 0; v < vregs; v++) d.related[v] = -1;
+    for (size_t b = 0; b < fn->block_count; b++) {
+        for (IRInstr* phi = fn->blocks[b]->first; phi && phi->op == IR_PHI; phi = phi->next) {
+            for (size_t i = 0; i <= phi->arg_count; i++) {
+                int v = i < phi->arg_count ? phi->args[i] : phi->dst;
+                if (d.related[v] >= 0 || (def[v] && def[v]->op == IR_CONST)) continue;
+                d.related[v] = (int)d.related_count;
+                d.related_vreg[d.related_count++] = v;
+            }
+        }
+    }
+
+    d.row_words = (d.related_count + 63) / 64;
+    d.interfere = calloc(d.related_count * d.row_words + 1, sizeof(uint64_t));
+    d.parent = malloc((d.related_count + 1) * sizeof(int));
+    d.next_member = malloc((d.related_count + 1) * sizeof(int));
+    if (!d.interfere || !d.parent || !d.next_member) goto done;
+    for (size_t i = 0; i < d.related_count; i++) {
+        d.parent[i] = (int)i;
+        d.next_member[i] = (int)i;
+    }
+
+    if (!compute_liveness(&d, index) || !build_interference(&d)) goto done;
+
+    for (size_t b = 0; b < fn->block_count; b++) {
+        for (IRInstr* phi = fn->blocks[b]->first; phi && phi->op == IR_PHI; phi = phi->next) {
+            for (size_t i = 0; i < phi->arg_count; i++) try_coalesce(&d, phi->dst, phi->args[i]);
+        }
+    }
+
+    // Rename every member of a class to one vreg
+    for (int v = 0; v < vregs; v++) {
+        forward[v] = d.related[v] < 0 ? v : d.related_vreg[find_class(&d, d.related[v])];
+    }
+    for (size_t b = 0; b < fn->block_count; b++) {
+        for (IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->dst != IR_NO_VREG) instr->dst = forward[instr->dst];
+        }
+    }
+    ir_replace_vregs(fn, forward);
+
+    ok = lower_phis(fn);
+
+done:
+    free(index);
+    free(def);
+    free(forward);
+    free(d.related);
+    free(d.related_vreg);
+    free(d.live_in);
+    free(d.live_out);
+    free(d.interfere);
+    free(d.parent);
+    free(d.next_member);
+    return ok;
+}
@@ -0,0 +1,325 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Strength reduction. A multiplication of a basic induction variable
+// (i = phi(i0, i + c) in a loop header) by a loop-invariant k becomes an
+// induction variable of its own: it starts at i0 * k in the preheader and
+// steps by c * k next to the increment of i. Multiplications and
+// divisions by powers of two become shifts everywhere.
+
+// The tables cover the vregs that existed when the pass started; the ones
+// it creates are never induction variables, nor known to be invariant
+typedef struct {
+    IRFunction* fn;
+    const LoopForest* forest;
+    int vregs;
+    IRInstr** def;              // Vreg -> defining instruction
+    int* def_block;             // Vreg -> index of its block
+    int* iv_step;               // Header phi -> its step c, or IR_NO_VREG
+    IRInstr** iv_increment;     // Header phi -> the instruction computing i + c
+    int* forward_from;          // Products replaced by the new variables
+    int* forward_to;
+    size_t forward_count;
+    size_t forward_capacity;
+} Reducer;
+
+static IRInstr* def_of(const Reducer* ctx, int v) {
+    return v >= 0 && v < ctx->vregs ? ctx->def[v] : NULL;
+}
+
+static bool is_const(const Reducer* ctx, int v, int64_t value) {
+    const IRInstr* def = def_of(ctx, v);
+    return def && def->op == IR_CONST && def->imm == value;
+}
+
+static bool is_induction_variable(const Reducer* ctx, int v) {
+    return v >= 0 && v < ctx->vregs && ctx->iv_step[v] != IR_NO_VREG;
+}
+
+static IRInstr* make_const(IRFunction* fn, IRBlock* block, IRInstr* before, int64_t value) {
+    IRInstr* instr = ir_instr_create(fn, IR_CONST);
+    if (!instr) return NULL;
+    instr->dst = ir_new_vreg(fn);
+    instr->imm = value;
+    ir_insert_before(block, before, instr);
+    return instr;
+}
+
+// a op b before the given instruction, skipping multiplications by 0 and 1
+static int make_binary(Reducer* ctx, IRBlock* block, IRInstr* before, IROpcode op, int a, int b) {
+    if (op == IR_MUL) {
+        if (is_const(ctx, a, 1)) return b;
+        if (is_const(ctx, b, 1)) return a;
+        if (is_const(ctx, a, 0) || is_const(ctx, b, 0)) {
+            IRInstr* zero = make_const(ctx->fn, block, before, 0);
+            return zero ? zero->dst : IR_NO_VREG;
+        }
+    }
+    IRInstr* instr = ir_instr_create(ctx->fn, op);
+    if (!instr) return IR_NO_VREG;
+    instr->dst = ir_new_vreg(ctx->fn);
+    instr->a = a;
+    instr->b = b;
+    ir_insert_before(block, before, instr);
+    return instr->dst;
+}
+
+static bool is_invariant(const Reducer* ctx, int loop, int v) {
+    return v >= 0 && v < ctx->vregs && ctx->def_block[v] >= 0 &&
+           !loop_contains(ctx->forest, loop, ctx->def_block[v]);
+}
+
+static bool add_forward(Reducer* ctx, int from, int to) {
+    if (ctx->forward_count >= ctx->forward_capacity) {
+        size_t new_capacity = ctx->forward_capacity ? ctx->forward_capacity * 2 : 16;
+        int* new_from = realloc(ctx->forward_from, new_capacity * sizeof(int));
+        if (!new_from) return false;
+        ctx->forward_from = new_from;
+        int* new_to = realloc(ctx->forward_to, new_capacity * sizeof(int));
+        if (!new_to) return false;
+        ctx->forward_to = new_to;
+        ctx->forward_capacity = new_capacity;
+    }
+    ctx->forward_from[ctx->forward_count] = from;
+    ctx->forward_to[ctx->forward_count] = to;
+    ctx->forward_count++;
+    return true;
+}
+
+// Record the basic induction variables of a loop with a preheader and a
+// single back edge
+static bool find_induction_variables(Reducer* ctx, int l, int* entry_pred) {
+    const Loop* loop = &ctx->forest->loops[l];
+    IRBlock* header = ctx->fn->blocks[loop->header];
+    IRBlock* preheader = ctx->fn->blocks[loop->preheader];
+    if (header->pred_count != 2) return false;
+    *entry_pred = header->preds[0] == preheader ? 0 : 1;
+
+    bool found = false;
+    for (IRInstr* phi = header->first; phi && phi->op == IR_PHI; phi = phi->next) {
+        IRInstr* next = def_of(ctx, phi->args[1 - *entry_pred]);
+        if (!next || (next->op != IR_ADD && next->op != IR_SUB)) continue;
+        int step = IR_NO_VREG;
+        if (next->a == phi->dst) {
+            step = next->b;
+        } else if (next->b == phi->dst && next->op == IR_ADD) {
+            step = next->a;
+        }
+        if (step == IR_NO_VREG || !is_invariant(ctx, l, step) || phi->dst >= ctx->vregs) continue;
+        ctx->iv_step[phi->dst] = step;
+        ctx->iv_increment[phi->dst] = next;
+        found = true;
+    }
+    return found;
+}
+
+// Replace mul = i * k by a new phi p = phi(i0 * k, p + c * k)
+static bool reduce_product(Reducer* ctx, int l, int entry_pred, IRInstr* phi, IRBlock* block,
+                           IRInstr* mul, int k) {
+    const Loop* loop = &ctx->forest->loops[l];
+    IRFunction* fn = ctx->fn;
+    IRBlock* header = fn->blocks[loop->header];
+    IRBlock* preheader = fn->blocks[loop->preheader];
+    IRInstr* increment = ctx->iv_increment[phi->dst];
+
+    int start = make_binary(ctx, preheader, preheader->last, IR_MUL, phi->args[entry_pred], k);
+    int step = make_binary(ctx, preheader, preheader->last, IR_MUL, ctx->iv_step[phi->dst], k);
+    IRInstr* product = ir_phi_create(fn, header);
+    IRInstr* next = ir_instr_create(fn, increment->op);
+    if (start == IR_NO_VREG || step == IR_NO_VREG || !product || !next) return false;
+    product->args = arena_alloc(&fn->arena, 2 * sizeof(int));
+    if (!product->args) return false;
+    product->arg_count = 2;
+
+    IRBlock* increment_block = fn->blocks[ctx->def_block[increment->dst]];
+    next->dst = ir_new_vreg(fn);
+    next->a = product->dst;
+    next->b = step;
+    ir_insert_before(increment_block, increment->next, next);
+    product->args[entry_pred] = start;
+    product->args[1 - entry_pred] = next->dst;
+
+    ir_remove(block, mul);
+    return add_forward(ctx, mul->dst, product->dst);
+}
+
+static bool reduce_loop(Reducer* ctx, int l, size_t* reduced) {
+    const Loop* loop = &ctx->forest->loops[l];
+    int entry_pred;
+    if (!find_induction_variables(ctx, l, &entry_pred)) return true;
+
+    IRBlock* header = ctx->fn->blocks[loop->header];
+    for (size_t i = 0; i < loop->block_count; i++) {
+        IRBlock* block = ctx->fn->blocks[loop->blocks[i]];
+        IRInstr* instr = block->first;
+        while (instr) {
+            IRInstr* next = instr->next;
+            if (instr->op == IR_MUL) {
+                int iv = IR_NO_VREG, k = IR_NO_VREG;
+                if (is_induction_variable(ctx, instr->a) && is_invariant(ctx, l, instr->b)) {
+                    iv = instr->a;
+                    k = instr->b;
+                } else if (is_induction_variable(ctx, instr->b) && is_invariant(ctx, l, instr->a)) {
+                    iv = instr->b;
+                    k = instr->a;
+                }
+                if (iv != IR_NO_VREG) {
+                    if (!reduce_product(ctx, l, entry_pred, ctx->def[iv], block, instr, k)) return false;
+                    (*reduced)++;
+                }
+            }
+            instr = next;
+        }
+    }
+
+    for (IRInstr* phi = header->first; phi && phi->op == IR_PHI; phi = phi->next) {
+        if (phi->dst < ctx->vregs) ctx->iv_step[phi->dst] = IR_NO_VREG;
+    }
+    return true;
+}
+
+// The k with value == 2^k, or -1
+static int log2_exact(int64_t value) {
+    if (value <= 0 || (value & (value - 1)) != 0) return -1;
+    int k = 0;
+    while (value > 1) {
+        value >>= 1;
+        k++;
+    }
+    return k;
+}
+
+// Rewrite instr in place as dst = a op b
+static void rewrite(IRInstr* instr, IROpcode op, int a, int b) {
+    instr->op = op;
+    instr->a = a;
+    instr->b = b;
+}
+
+static bool shift_instruction(Reducer* ctx, IRBlock* block, IRInstr* instr, size_t* shifts) {
+    IRFunction* fn = ctx->fn;
+    const IRInstr* right = def_of(ctx, instr->b);
+    const IRInstr* left = def_of(ctx, instr->a);
+
+    if (instr->op == IR_MUL) {
+        int x = instr->a;
+        int k = right && right->op == IR_CONST ? log2_exact(right->imm) : -1;
+        if (k < 1 && left && left->op == IR_CONST) {
+            x = instr->b;
+            k = log2_exact(left->imm);
+        }
+        if (k < 1) return true;
+        IRInstr* amount = make_const(fn, block, instr, k);
+        if (!amount) return false;
+        rewrite(instr, IR_SHL, x, amount->dst);
+        (*shifts)++;
+        return true;
+    }
+
+    // Signed division truncates toward zero, so negative dividends are
+    // biased by 2^k - 1 before the arithmetic shift
+    if (!right || right->op != IR_CONST || right->imm == INT64_MIN) return true;
+    int64_t divisor = right->imm < 0 ? -right->imm : right->imm;
+    int k = log2_exact(divisor);
+    if (k < 1) return true;
+    bool negate = right->imm < 0;
+    int x = instr->a;
+
+    int sign;
+    if (k == 1) {
+        IRInstr* top = make_const(fn, block, instr, 63);
+        if (!top) return false;
+        sign = make_binary(ctx, block, instr, IR_SHR, x, top->dst);
+    } else {
+        IRInstr* top = make_const(fn, block, instr, 63);
+        IRInstr* width = make_const(fn, block, instr, 64 - k);
+        if (!top || !width) return false;
+        int mask = make_binary(ctx, block, instr, IR_SAR, x, top->dst);
+        if (mask == IR_NO_VREG) return false;
+        sign = make_binary(ctx, block, instr, IR_SHR, mask, width->dst);
+    }
+    if (sign == IR_NO_VREG) return false;
+    int biased = make_binary(ctx, block, instr, IR_ADD, x, sign);
+    IRInstr* amount = make_const(fn, block, instr, k);
+    if (biased == IR_NO_VREG || !amount) return false;
+    if (!negate) {
+        rewrite(instr, IR_SAR, biased, amount->dst);
+    } else {
+        int quotient = make_binary(ctx, block, instr, IR_SAR, biased, amount->dst);
+        IRInstr* zero = make_const(fn, block, instr, 0);
+        if (quotient == IR_NO_VREG || !zero) return false;
+        rewrite(instr, IR_SUB, zero->dst, quotient);
+    }
+    (*shifts)++;
+    return true;
+}
+
+bool ir_reduce_strength(IRFunction* fn, size_t* reduced, size_t* shifts) {
+    DomTree dom;
+    LoopForest forest;
+    if (!ir_dominators(fn, &dom)) return false;
+    if (!ir_find_loops(fn, &dom, &forest)) {
+        dom_tree_free(&dom);
+        return false;
+    }
+
+    int vregs = fn->vreg_count;
+    Reducer ctx = { .fn = fn, .forest = &forest, .vregs = vregs };
+    ctx.def = calloc(vregs + 1, sizeof(IRInstr*));
+    ctx.def_block = malloc((vregs + 1) * sizeof(int));
+    ctx.iv_step = malloc((vregs + 1) * sizeof(int));
+    ctx.iv_increment = calloc(vregs + 1, sizeof(IRInstr*));
+    int* forward = NULL;
+    bool ok = ctx.def && ctx.def_block && ctx.iv_step && ctx.iv_increment;
+    if (!ok) goto done;
+
+    for (int v = 0; v < vregs; v++) {
+        ctx.def_block[v] = -1;
+        ctx.iv_step[v] = IR_NO_VREG;
+    }
+    for (size_t b = 0; b < fn->block_count; b++) {
+        for (IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->dst == IR_NO_VREG) continue;
+            ctx.def[instr->dst] = instr;
+            ctx.def_block[instr->dst] = (int)b;
+        }
+    }
+
+    // Nested loops follow the loops that contain them
+    for (size_t l = forest.count; l > 0 && ok; l--) {
+        if (forest.loops[l - 1].preheader < 0) continue;
+        ok = reduce_loop(&ctx, (int)(l - 1), reduced);
+    }
+    if (!ok) goto done;
+
+    forward = malloc((fn->vreg_count + 1) * sizeof(int));
+    if (!forward) {
+        ok = false;
+        goto done;
+    }
+    for (int v = 0; v < fn->vreg_count; v++) forward[v] = v;
+    for (size_t i = 0; i < ctx.forward_count; i++) forward[ctx.forward_from[i]] = ctx.forward_to[i];
+    ir_replace_vregs(fn, forward);
+
+    for (size_t b = 0; b < fn->block_count && ok; b++) {
+        IRBlock* block = fn->blocks[b];
+        for (IRInstr* instr = block->first; instr && ok; instr = instr->next) {
+            if (instr->op == IR_MUL || instr->op == IR_DIV) {
+                ok = shift_instruction(&ctx, block, instr, shifts);
+            }
+        }
+    }
+
+done:
+    free(ctx.def);
+    free(ctx.def_block);
+    free(ctx.iv_step);
+    free(ctx.iv_increment);
+    free(ctx.forward_from);
+    free(ctx.forward_to);
+    free(forward);
+    loop_forest_free(&forest);
+    dom_tree_free(&dom);
+    return ok;
+}
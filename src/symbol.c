@@ -1,5 +1,5 @@
-#define _POSIX_C_SOURCE 200809L  // For strdup
 #include "parser.h"
+#include "intern.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -21,7 +21,6 @@ void destroy_scope(Scope* scope) {
     Symbol* current = scope->symbols;
     while (current) {
         Symbol* next = current->next;
-        free(current->name);
         free(current);
         current = next;
     }
@@ -34,7 +33,7 @@ Symbol* create_symbol(const char* name, SymbolType type) {
     Symbol* symbol = malloc(sizeof(Symbol));
     if (!symbol) return NULL;
     
-    symbol->name = strdup(name);
+    symbol->name = intern(name);
     if (!symbol->name) {
         free(symbol);
         return NULL;
@@ -0,0 +1,249 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Tail recursion elimination. A self call whose value is returned as is
+// becomes a jump back to the top of the function, where phis take the
+// call's arguments in place of the parameters.
+//
+// A return of `x op f(...)` with op associative and commutative (add or
+// mul) gets the same treatment through accumulator introduction: x is
+// folded into an accumulator that starts at op's identity, and every
+// return that is left combines its value with the accumulator. Either
+// way the recursion runs in constant stack space.
+
+typedef struct {
+    IRBlock* block;
+    IRInstr* call;
+    IRInstr* combine;       // x op call, or NULL for a plain tail call
+    int operand;            // x
+} TailSite;
+
+static bool is_self_call(const IRFunction* fn, const IRInstr* instr) {
+    return instr->op == IR_CALL && instr->arg_count == fn->param_count &&
+           strcmp(instr->symbol, fn->name) == 0;
+}
+
+// Instructions that may sit between the call and the return: they
+// neither touch memory nor trap, so they can run before the jump instead
+static bool is_movable(IROpcode op) {
+    switch (op) {
+        case IR_CONST:
+        case IR_COPY:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_SHL:
+        case IR_SAR:
+        case IR_SHR:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+        case IR_LE:
+        case IR_GE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Match `return f(...)` or `return x op f(...)` at the end of block
+static bool match_site(const IRFunction* fn, IRBlock* block, const int* uses, TailSite* site) {
+    const IRInstr* ret = block->last;
+    if (ret->op != IR_RET || ret->a == IR_NO_VREG) return false;
+    site->block = block;
+    site->combine = NULL;
+    site->operand = IR_NO_VREG;
+
+    for (IRInstr* instr = ret->prev; instr; instr = instr->prev) {
+        if (is_self_call(fn, instr)) {
+            if (uses[instr->dst] != 1) return false;
+            site->call = instr;
+            if (instr->dst == ret->a) return true;
+            IRInstr* combine = site->combine;
+            if (!combine || (combine->a != instr->dst && combine->b != instr->dst)) return false;
+            site->operand = combine->a == instr->dst ? combine->b : combine->a;
+            return true;
+        }
+        if (instr->dst == ret->a && (instr->op == IR_ADD || instr->op == IR_MUL) &&
+            uses[instr->dst] == 1) {
+            site->combine = instr;
+            continue;
+        }
+        if (!is_movable(instr->op)) return false;
+    }
+    return false;
+}
+
+// Move the parameters into a new entry block, so the old entry can
+// become the loop header
+static IRBlock* split_entry(IRFunction* fn) {
+    IRBlock* header = fn->blocks[0];
+    IRBlock* entry = ir_block_create(fn);
+    IRInstr* jump = ir_instr_create(fn, IR_JUMP);
+    if (!entry || !jump || !ir_add_pred(fn, header, entry)) return NULL;
+    memmove(&fn->blocks[1], &fn->blocks[0], (fn->block_count - 1) * sizeof(IRBlock*));
+    fn->blocks[0] = entry;
+
+    IRInstr* instr = header->first;
+    while (instr) {
+        IRInstr* next = instr->next;
+        if (instr->op == IR_PARAM) {
+            ir_remove(header, instr);
+            ir_append(entry, instr);
+        }
+        instr = next;
+    }
+    jump->target = header;
+    ir_append(entry, jump);
+    return entry;
+}
+
+static bool transform(IRFunction* fn, TailSite* sites, size_t site_count, IROpcode accumulate) {
+    IRBlock* header = fn->blocks[0];
+    IRBlock* entry = split_entry(fn);
+    if (!entry) return false;
+
+    // One phi per parameter, then the accumulator. Each starts out with
+    // the value it has on entry.
+    size_t count = 1;
+    for (IRInstr* instr = entry->first; instr; instr = instr->next) {
+        if (instr->op == IR_PARAM) count++;
+    }
+    IRInstr** phis = malloc(count * sizeof(IRInstr*));
+    size_t* param = malloc(count * sizeof(size_t));
+    int* forward = NULL;
+    bool ok = false;
+    if (!phis || !param) goto done;
+
+    size_t phi_count = 0;
+    for (IRInstr* instr = entry->first; instr; instr = instr->next) {
+        if (instr->op != IR_PARAM) continue;
+        IRInstr* phi = ir_phi_create(fn, header);
+        if (!phi) goto done;
+        phi->args = arena_alloc(&fn->arena, (site_count + 1) * sizeof(int));
+        if (!phi->args) goto done;
+        phi->args[phi->arg_count++] = instr->dst;
+        param[phi_count] = (size_t)instr->imm;
+        phis[phi_count++] = phi;
+    }
+    IRInstr* acc = NULL;
+    if (accumulate != IR_CONST) {
+        IRInstr* identity = ir_instr_create(fn, IR_CONST);
+        acc = ir_phi_create(fn, header);
+        if (!identity || !acc) goto done;
+        acc->args = arena_alloc(&fn->arena, (site_count + 1) * sizeof(int));
+        if (!acc->args) goto done;
+        identity->dst = ir_new_vreg(fn);
+        identity->imm = accumulate == IR_MUL ? 1 : 0;
+        ir_insert_before(entry, entry->last, identity);
+        acc->args[acc->arg_count++] = identity->dst;
+    }
+
+    // Past the header the parameters are the phis. The phis themselves
+    // are filled in afterwards, so they keep their entry values.
+    forward = malloc((fn->vreg_count + 1) * sizeof(int));
+    if (!forward) goto done;
+    for (int v = 0; v < fn->vreg_count; v++) forward[v] = v;
+    for (size_t i = 0; i < phi_count; i++) forward[phis[i]->args[0]] = phis[i]->dst;
+    for (size_t i = 0; i < phi_count; i++) phis[i]->arg_count = 0;
+    ir_replace_vregs(fn, forward);
+    for (size_t i = 0; i < phi_count; i++) phis[i]->arg_count = 1;
+
+    for (size_t s = 0; s < site_count; s++) {
+        TailSite* site = &sites[s];
+        IRBlock* block = site->block;
+        IRInstr* call = site->call;
+        ir_remove(block, block->last);
+        ir_remove(block, call);
+        int acc_next = acc ? acc->dst : IR_NO_VREG;
+        if (site->combine) {
+            IRInstr* combine = site->combine;
+            ir_remove(block, combine);
+            combine->a = acc->dst;
+            combine->b = ir_resolve_forward(forward, site->operand);
+            ir_append(block, combine);
+            acc_next = combine->dst;
+        }
+        IRInstr* jump = ir_instr_create(fn, IR_JUMP);
+        if (!jump || !ir_add_pred(fn, header, block)) goto done;
+        jump->target = header;
+        ir_append(block, jump);
+        for (size_t i = 0; i < phi_count; i++) {
+            phis[i]->args[phis[i]->arg_count++] = call->args[param[i]];
+        }
+        if (acc) acc->args[acc->arg_count++] = acc_next;
+    }
+
+    // The returns that are left still owe the operands gathered so far
+    for (size_t b = 0; b < fn->block_count && acc; b++) {
+        IRBlock* block = fn->blocks[b];
+        IRInstr* ret = block->last;
+        if (ret->op != IR_RET || ret->a == IR_NO_VREG) continue;
+        IRInstr* combine = ir_instr_create(fn, accumulate);
+        if (!combine) goto done;
+        combine->dst = ir_new_vreg(fn);
+        combine->a = acc->dst;
+        combine->b = ret->a;
+        ir_insert_before(block, ret, combine);
+        ret->a = combine->dst;
+    }
+    ok = true;
+
+done:
+    free(phis);
+    free(param);
+    free(forward);
+    return ok;
+}
+
+bool ir_eliminate_tail_calls(IRFunction* fn, size_t* self_calls, size_t* eliminated,
+                             size_t* accumulated) {
+    int* uses = calloc(fn->vreg_count + 1, sizeof(int));
+    TailSite* sites = malloc((fn->block_count + 1) * sizeof(TailSite));
+    bool ok = false;
+    if (!uses || !sites) goto done;
+
+    for (size_t b = 0; b < fn->block_count; b++) {
+        for (IRInstr* instr = fn->blocks[b]->first; instr; instr = instr->next) {
+            if (instr->op == IR_CALL || instr->op == IR_PHI) {
+                for (size_t i = 0; i < instr->arg_count; i++) uses[instr->args[i]]++;
+            } else {
+                if (instr->a != IR_NO_VREG) uses[instr->a]++;
+                if (instr->b != IR_NO_VREG) uses[instr->b]++;
+            }
+            if (is_self_call(fn, instr)) (*self_calls)++;
+        }
+    }
+
+    // All accumulating returns must agree on the operator
+    IROpcode accumulate = IR_CONST;
+    size_t site_count = 0;
+    for (size_t b = 0; b < fn->block_count; b++) {
+        TailSite* site = &sites[site_count];
+        if (!match_site(fn, fn->blocks[b], uses, site)) continue;
+        if (site->combine) {
+            if (accumulate == IR_CONST) accumulate = site->combine->op;
+            if (site->combine->op != accumulate) continue;
+        }
+        site_count++;
+    }
+
+    // A function whose entry is already a loop header is left alone
+    ok = true;
+    if (site_count == 0 || fn->blocks[0]->pred_count > 0) goto done;
+    ok = transform(fn, sites, site_count, accumulate);
+    if (!ok) goto done;
+    ir_remove_trivial_phis(fn);
+
+    *eliminated += site_count;
+    for (size_t s = 0; s < site_count; s++) {
+        if (sites[s].combine) (*accumulated)++;
+    }
+
+done:
+    free(uses);
+    free(sites);
+    return ok;
+}
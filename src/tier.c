@@ -0,0 +1,282 @@
+#define _POSIX_C_SOURCE 200809L  // For clock_gettime
+#include "tier.h"
+#include "jit.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The interpreter reaches back into the engine through VMTier, the first
+// member of Tier. Every unit is lowered on the first promotion and takes
+// the profile as it stands then; the JIT optimizes each function with it
+// when compiling it.
+
+struct Tier {
+    VMTier hooks;                 // First, so the hooks can cast back
+    TierOptions options;
+    BCProgram* program;
+    VM* vm;
+    const ASTNode** units;
+    const char** names;
+    size_t unit_count;
+    size_t unit_capacity;
+    VMProfile* profiles;          // One per bytecode function, after linking
+    uint64_t* counts;             // Backs every profile's taken and not_taken
+    int64_t* globals;             // The interpreter's until native code exists
+    JIT* jit;                     // NULL until the first promotion
+    IRProfile* unit_profiles;     // Per unit, from the first promotion
+    int* native;                  // JIT function of each bytecode function
+    Error* error;                 // Of the running tier_run()
+    TierStats stats;
+};
+
+static bool tier_error(Error* error, const char* format, ...) {
+    error->code = ERROR_SEMANTIC;
+    error->line = 0;
+    error->column = 0;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+    return false;
+}
+
+static double elapsed_us(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1e6 + (double)(now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+Tier* tier_create(const TierOptions* options) {
+    Tier* tier = calloc(1, sizeof(Tier));
+    if (!tier) return NULL;
+    tier->options = *options;
+    tier->program = bytecode_create();
+    tier->vm = vm_create();
+    if (!tier->program || !tier->vm) {
+        tier_destroy(tier);
+        return NULL;
+    }
+    return tier;
+}
+
+void tier_destroy(Tier* tier) {
+    if (!tier) return;
+    jit_destroy(tier->jit);
+    for (size_t i = 0; tier->unit_profiles && i < tier->unit_count; i++) {
+        free(tier->unit_profiles[i].calls);
+        free(tier->unit_profiles[i].branches);
+    }
+    free(tier->unit_profiles);
+    vm_destroy(tier->vm);
+    bytecode_destroy(tier->program);
+    free(tier->units);
+    free(tier->names);
+    free(tier->profiles);
+    free(tier->counts);
+    free(tier->globals);
+    free(tier->native);
+    free(tier);
+}
+
+bool tier_add_unit(Tier* tier, const ASTNode* unit, const char* name, Error* error) {
+    if (tier->unit_count >= tier->unit_capacity) {
+        size_t capacity = tier->unit_capacity ? tier->unit_capacity * 2 : 4;
+        const ASTNode** units = realloc(tier->units, capacity * sizeof(ASTNode*));
+        if (units) tier->units = units;
+        const char** names = realloc(tier->names, capacity * sizeof(char*));
+        if (names) tier->names = names;
+        if (!units || !names) return tier_error(error, "Out of memory");
+        tier->unit_capacity = capacity;
+    }
+    if (!bytecode_add_unit(tier->program, unit, error)) return false;
+    tier->units[tier->unit_count] = unit;
+    tier->names[tier->unit_count] = name;
+    tier->unit_count++;
+    return true;
+}
+
+bool tier_link(Tier* tier, Error* error, size_t* unit) {
+    if (!bytecode_link(tier->program, error, unit)) return false;
+
+    const BCProgram* program = tier->program;
+    size_t instructions = 0;
+    for (size_t i = 0; i < program->function_count; i++) {
+        instructions += program->functions[i].code_count;
+    }
+    tier->profiles = calloc(program->function_count + 1, sizeof(VMProfile));
+    tier->counts = calloc(2 * instructions + 1, sizeof(uint64_t));
+    tier->native = malloc((program->function_count + 1) * sizeof(int));
+    if (!tier->profiles || !tier->counts || !tier->native) return tier_error(error, "Out of memory");
+    uint64_t* counts = tier->counts;
+    for (size_t i = 0; i < program->function_count; i++) {
+        size_t n = program->functions[i].code_count;
+        tier->profiles[i].taken = counts;
+        tier->profiles[i].not_taken = counts + n;
+        counts += 2 * n;
+        tier->native[i] = -1;
+    }
+    tier->stats.functions = program->function_count;
+    return true;
+}
+
+// Counts from the interpreter for one unit: calls to every function, and
+// the outcomes of this unit's if and while conditions
+static bool collect_profile(const Tier* tier, size_t unit, IRProfile* profile) {
+    const BCProgram* program = tier->program;
+    size_t branches = 0;
+    for (size_t i = 0; i < program->function_count; i++) {
+        if (program->functions[i].unit == unit) branches += program->functions[i].branch_count;
+    }
+    profile->calls = malloc((program->function_count + 1) * sizeof(IRCallCount));
+    profile->branches = malloc((branches + 1) * sizeof(IRBranchCount));
+    if (!profile->calls || !profile->branches) return false;
+    profile->call_count = 0;
+    profile->branch_count = 0;
+    profile->hot_calls = tier->hooks.threshold;
+
+    for (size_t i = 0; i < program->function_count; i++) {
+        const BCFunction* fn = &program->functions[i];
+        const VMProfile* counts = &tier->profiles[i];
+        profile->calls[profile->call_count++] = (IRCallCount){ fn->name, counts->calls };
+        if (fn->unit != unit) continue;
+        for (size_t b = 0; b < fn->branch_count; b++) {
+            const BCBranch* branch = &fn->branches[b];
+            uint64_t taken = counts->taken[branch->pc];
+            uint64_t not_taken = counts->not_taken[branch->pc];
+            IRBranchCount* out = &profile->branches[profile->branch_count++];
+            out->line = branch->line;
+            out->column = branch->column;
+            out->taken = branch->jumps_if_true ? taken : not_taken;
+            out->not_taken = branch->jumps_if_true ? not_taken : taken;
+        }
+    }
+    ir_profile_sort(profile);
+    return true;
+}
+
+// Lower every unit, to be optimized with the profile so far as it is
+// compiled, and link them in memory, then move the globals to where native
+// code expects them
+static bool build_native(Tier* tier) {
+    Error* error = tier->error;
+    tier->jit = jit_create(&tier->options.codegen);
+    tier->unit_profiles = calloc(tier->unit_count + 1, sizeof(IRProfile));
+    if (!tier->jit || !tier->unit_profiles) return tier_error(error, "Out of memory");
+
+    for (size_t u = 0; u < tier->unit_count; u++) {
+        IRProfile* profile = &tier->unit_profiles[u];
+        if (!collect_profile(tier, u, profile)) return tier_error(error, "Out of memory");
+        IR* ir = ir_lower(tier->units[u], error);
+        if (!ir) {
+            if (error->code == ERROR_NONE) tier_error(error, "Out of memory");
+            return false;
+        }
+        IROptOptions options = tier->options.optimize;
+        options.unit = tier->names[u];
+        options.profile = profile;
+        if (!jit_add_unit(tier->jit, ir, &options, error)) return false;
+    }
+    size_t unit;
+    if (!jit_link(tier->jit, error, &unit)) return false;
+
+    size_t count;
+    int64_t* globals = jit_globals(tier->jit, &count);
+    if (count != tier->program->global_count) {
+        return tier_error(error, "Native code has %zu globals, bytecode %zu", count,
+                          tier->program->global_count);
+    }
+    if (count) memcpy(globals, tier->hooks.globals, count * sizeof(int64_t));
+    tier->hooks.globals = globals;
+    return true;
+}
+
+static bool promote(VMTier* hooks, size_t function) {
+    Tier* tier = (Tier*)hooks;
+    const BCFunction* fn = &tier->program->functions[function];
+    VMProfile* profile = &hooks->profiles[function];
+    if (fn->param_count > JIT_MAX_ARGS) {
+        profile->pinned = true;
+        return true;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!tier->jit && !build_native(tier)) return false;
+    int index = jit_find(tier->jit, fn->name);
+    if (index < 0 || jit_param_count(tier->jit, index) != fn->param_count) {
+        return tier_error(tier->error, "No native code for '%s'", fn->name);
+    }
+    if (!jit_compile(tier->jit, index, tier->error)) return false;
+    double us = elapsed_us(&start);
+
+    tier->native[function] = index;
+    profile->native = true;
+    tier->stats.promoted++;
+    tier->stats.compile_us += us;
+    if (tier->options.log) {
+        fprintf(tier->options.log, "%s: tier: '%s' promoted after %llu calls, %llu loop iterations "
+                "(%.1f us)\n", tier->names[fn->unit], fn->name, (unsigned long long)profile->calls,
+                (unsigned long long)profile->back_edges, us);
+    }
+    return true;
+}
+
+static bool call(VMTier* hooks, size_t function, const int64_t* args, int64_t* result) {
+    Tier* tier = (Tier*)hooks;
+    JITStats before, after;
+    jit_stats(tier->jit, &before);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = jit_call(tier->jit, tier->native[function], args, result, tier->error);
+    double us = elapsed_us(&start);
+
+    // Callees compiled on their first call count as compiling
+    jit_stats(tier->jit, &after);
+    double compile_us = after.compile_us - before.compile_us;
+    tier->stats.compile_us += compile_us;
+    tier->stats.native_us += us - compile_us;
+    return ok;
+}
+
+VMStatus tier_run(Tier* tier, const char* name, int64_t* result, VMStats* stats, Error* error) {
+    const BCProgram* program = tier->program;
+    stats->calls = 0;
+    stats->function = name;
+    const BCFunction* entry = bytecode_find_function(program, name);
+    if (!entry || entry->param_count != 0) {
+        tier_error(error, "No %s() without parameters to run", name);
+        return VM_NATIVE_FAILED;
+    }
+
+    free(tier->globals);
+    tier->globals = malloc((program->global_count + 1) * sizeof(int64_t));
+    if (!tier->globals) return VM_NO_MEMORY;
+    if (program->global_count) {
+        memcpy(tier->globals, program->globals, program->global_count * sizeof(int64_t));
+    }
+    tier->hooks.profiles = tier->profiles;
+    tier->hooks.threshold = tier->options.threshold;
+    tier->hooks.globals = tier->globals;
+    tier->hooks.promote = promote;
+    tier->hooks.call = call;
+    tier->error = error;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    VMStatus status = vm_run(tier->vm, program, entry, &tier->hooks, result, stats);
+    double us = elapsed_us(&start);
+
+    tier->stats.calls = stats->calls;
+    tier->stats.interpreter_us = us - tier->stats.compile_us - tier->stats.native_us;
+    if (tier->jit) {
+        JITStats jit;
+        jit_stats(tier->jit, &jit);
+        tier->stats.compiled = jit.compiled;
+    }
+    return status;
+}
+
+void tier_stats(const Tier* tier, TierStats* stats) {
+    *stats = tier->stats;
+}
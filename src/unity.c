@@ -0,0 +1,197 @@
+#include "optimize.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Unity builds. Each unit has been resolved alone, so every call it makes
+// to a function it does not define is REF_EXTERNAL, and nothing else in it
+// names another unit. Merging therefore only has to check those calls, and
+// that no name is defined twice, against a table of the top-level names of
+// every unit; resolving the merged program then binds the calls to the
+// definitions. AST names are interned, so the table hashes and compares
+// the pointers.
+
+typedef struct {
+    const char* name;       // NULL for an empty slot
+    const ASTNode* node;    // Its definition: a function, or a global
+    size_t unit;
+} TopLevel;
+
+typedef struct {
+    TopLevel* slots;        // Open addressing, power-of-two capacity
+    size_t capacity;
+    const char* const* names;
+    Error* error;
+    size_t* unit;
+    UnityStats* stats;
+} Unity;
+
+static const char* top_level_name(const ASTNode* node) {
+    switch (node->type) {
+        case NODE_FUNCTION: return node->data.function.name;
+        case NODE_ASSIGNMENT: return node->data.assignment.name;
+        case NODE_VARIABLE: return node->data.variable.name;
+        default: return NULL;
+    }
+}
+
+static TopLevel* find_slot(const Unity* unity, const char* name) {
+    size_t mask = unity->capacity - 1;
+    size_t slot = (size_t)(((uint64_t)(uintptr_t)name * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+    while (unity->slots[slot].name && unity->slots[slot].name != name) {
+        slot = (slot + 1) & mask;
+    }
+    return &unity->slots[slot];
+}
+
+static bool failed(const Unity* unity) {
+    return unity->error->code != ERROR_NONE;
+}
+
+static void unity_error(Unity* unity, size_t unit, const ASTNode* node, const char* format, ...) {
+    if (failed(unity)) return;
+    unity->error->code = ERROR_SEMANTIC;
+    unity->error->line = node->line;
+    unity->error->column = node->column;
+    *unity->unit = unit;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(unity->error->message, sizeof(unity->error->message), format, args);
+    va_end(args);
+}
+
+static void declare(Unity* unity, size_t unit, const ASTNode* node) {
+    const char* name = top_level_name(node);
+    if (!name) return;
+    TopLevel* slot = find_slot(unity, name);
+    if (slot->name) {
+        unity_error(unity, unit, node, "Multiple definition of '%s', also defined in %s",
+                    name, unity->names[slot->unit]);
+        return;
+    }
+    *slot = (TopLevel){ name, node, unit };
+    if (node->type == NODE_FUNCTION) unity->stats->functions++;
+    else unity->stats->globals++;
+}
+
+// What resolution would have said of a call into another unit, had the
+// two been one
+static void check_call(Unity* unity, size_t unit, const ASTNode* node) {
+    const char* name = node->data.call.name;
+    const TopLevel* slot = find_slot(unity, name);
+    if (!slot->name) return;   // Left to the linker
+    if (slot->node->type != NODE_FUNCTION) {
+        unity_error(unity, unit, node, "Called object '%s' is not a function", name);
+        return;
+    }
+    size_t params = slot->node->data.function.param_count;
+    if (params != node->data.call.arg_count) {
+        unity_error(unity, unit, node, "Function '%s' takes %zu arguments, called with %zu",
+                    name, params, node->data.call.arg_count);
+        return;
+    }
+    unity->stats->external_calls++;
+}
+
+static void check_calls(Unity* unity, size_t unit, const ASTNode* node) {
+    if (!node || failed(unity)) return;
+    switch (node->type) {
+        case NODE_FUNCTION:
+            check_calls(unity, unit, node->data.function.body);
+            break;
+        case NODE_BLOCK:
+            for (size_t i = 0; i < node->data.block.count; i++) {
+                check_calls(unity, unit, node->data.block.statements[i]);
+            }
+            break;
+        case NODE_RETURN:
+            check_calls(unity, unit, node->data.ret.expr);
+            break;
+        case NODE_IF_STMT:
+            check_calls(unity, unit, node->data.if_stmt_node.condition);
+            check_calls(unity, unit, node->data.if_stmt_node.then_branch);
+            check_calls(unity, unit, node->data.if_stmt_node.else_branch);
+            break;
+        case NODE_WHILE_STMT:
+            check_calls(unity, unit, node->data.while_stmt_node.condition);
+            check_calls(unity, unit, node->data.while_stmt_node.body);
+            break;
+        case NODE_SWITCH_STMT:
+            check_calls(unity, unit, node->data.switch_stmt_node.value);
+            check_calls(unity, unit, node->data.switch_stmt_node.body);
+            break;
+        case NODE_BINARY_OP:
+            check_calls(unity, unit, node->data.binary.left);
+            check_calls(unity, unit, node->data.binary.right);
+            break;
+        case NODE_ASSIGNMENT:
+            check_calls(unity, unit, node->data.assignment.value);
+            break;
+        case NODE_CALL:
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                check_calls(unity, unit, node->data.call.args[i]);
+            }
+            if (node->data.call.ref.kind == REF_EXTERNAL) check_call(unity, unit, node);
+            break;
+        default:
+            break;
+    }
+}
+
+ASTNode* unity_merge(ASTNode* const* programs, size_t count, const char* const* names, Error* error,
+                     size_t* unit, UnityStats* stats) {
+    UnityStats local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(*stats));
+    stats->units = count;
+
+    size_t total = 0;
+    for (size_t u = 0; u < count; u++) total += programs[u]->data.block.count;
+    Unity unity = { .names = names, .error = error, .unit = unit, .stats = stats };
+    unity.capacity = 16;
+    while (unity.capacity < total * 2) unity.capacity *= 2;
+    unity.slots = calloc(unity.capacity, sizeof(TopLevel));
+    ASTNode* merged = calloc(1, sizeof(ASTNode));
+    ASTNode** statements = malloc((total ? total : 1) * sizeof(ASTNode*));
+    if (!unity.slots || !merged || !statements) {
+        free(unity.slots);
+        free(merged);
+        free(statements);
+        return NULL;
+    }
+
+    for (size_t u = 0; u < count && !failed(&unity); u++) {
+        const ASTNode* program = programs[u];
+        for (size_t i = 0; i < program->data.block.count && !failed(&unity); i++) {
+            declare(&unity, u, program->data.block.statements[i]);
+        }
+    }
+    for (size_t u = 0; u < count && !failed(&unity); u++) {
+        const ASTNode* program = programs[u];
+        for (size_t i = 0; i < program->data.block.count; i++) {
+            check_calls(&unity, u, program->data.block.statements[i]);
+        }
+    }
+    free(unity.slots);
+    if (failed(&unity)) {
+        free(merged);
+        free(statements);
+        return NULL;
+    }
+
+    merged->type = NODE_PROGRAM;
+    merged->data.block.statements = statements;
+    merged->data.block.capacity = total ? total : 1;
+    for (size_t u = 0; u < count; u++) {
+        ASTNode* program = programs[u];
+        for (size_t i = 0; i < program->data.block.count; i++) {
+            ASTNode* node = program->data.block.statements[i];
+            if (node->type == NODE_FUNCTION) node->data.function.file = names[u];
+            statements[merged->data.block.count++] = node;
+        }
+        program->data.block.count = 0;
+    }
+    return merged;
+}
@@ -0,0 +1,301 @@
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Bytecode interpreter. With GCC or Clang each handler jumps straight to
+// the next one through a table of label addresses (computed goto), so
+// every opcode gets its own indirect branch for the predictor to learn;
+// other compilers fall back to a switch in a loop. Registers and call
+// frames live on two stacks allocated up front, not per call. With a tier,
+// conditional jumps and calls also update the running function's profile.
+
+#define VM_REGISTERS (4u << 20)
+#define VM_FRAMES (1u << 20)
+
+typedef struct {
+    const BCInstr* return_pc;     // Instruction after the call
+    int64_t* base;                // Caller's registers
+    const BCFunction* fn;
+} VMFrame;
+
+struct VM {
+    int64_t* registers;
+    VMFrame* frames;
+};
+
+VM* vm_create(void) {
+    VM* vm = calloc(1, sizeof(VM));
+    if (!vm) return NULL;
+    vm->registers = malloc(VM_REGISTERS * sizeof(int64_t));
+    vm->frames = malloc(VM_FRAMES * sizeof(VMFrame));
+    if (!vm->registers || !vm->frames) {
+        vm_destroy(vm);
+        return NULL;
+    }
+    return vm;
+}
+
+void vm_destroy(VM* vm) {
+    if (!vm) return;
+    free(vm->registers);
+    free(vm->frames);
+    free(vm);
+}
+
+// Count a call and promote the callee once it is hot. *native is whether
+// the call goes to native code.
+static bool enter(VMTier* tier, size_t function, bool* native) {
+    VMProfile* profile = &tier->profiles[function];
+    profile->calls++;
+    if (!profile->native && !profile->pinned &&
+        profile->calls + profile->back_edges >= tier->threshold) {
+        if (!tier->promote(tier, function)) return false;
+    }
+    *native = profile->native;
+    return true;
+}
+
+static inline void count_jump(VMProfile* profile, const BCInstr* in, const BCInstr* code,
+                              bool taken) {
+    size_t at = (size_t)(in - code);
+    if (!taken) {
+        profile->not_taken[at]++;
+        return;
+    }
+    profile->taken[at]++;
+    // A jump back to an earlier instruction closes a loop iteration
+    if ((size_t)in->c <= at) profile->back_edges++;
+}
+
+VMStatus vm_run(VM* vm, const BCProgram* program, const BCFunction* entry, VMTier* tier,
+                int64_t* result, VMStats* stats) {
+    stats->calls = 0;
+    stats->function = entry->name;
+
+    // Each run starts from the initial values of the globals
+    int64_t* owned = NULL;
+    int64_t* globals;
+    if (tier) {
+        globals = tier->globals;
+    } else {
+        owned = malloc((program->global_count + 1) * sizeof(int64_t));
+        if (!owned) return VM_NO_MEMORY;
+        if (program->global_count) {
+            memcpy(owned, program->globals, program->global_count * sizeof(int64_t));
+        }
+        globals = owned;
+    }
+
+    int64_t* registers = vm->registers;
+    VMFrame* frames = vm->frames;
+    const BCFunction* functions = program->functions;
+    const int64_t* limit = registers + VM_REGISTERS;
+    const VMFrame* frame_limit = frames + VM_FRAMES;
+    VMFrame* frame = frames;
+    const BCFunction* fn = entry;
+    int64_t* r = registers;
+    const BCInstr* pc = fn->code;
+    const BCInstr* in;
+    size_t calls = 0;
+    VMStatus status = VM_OK;
+    int64_t value;
+    VMProfile* profile = NULL;
+    bool native;
+
+    if (r + fn->frame_size > limit) {
+        status = VM_STACK_OVERFLOW;
+        goto done;
+    }
+    if (tier) {
+        size_t index = (size_t)(fn - functions);
+        if (!enter(tier, index, &native)) goto native_failed;
+        globals = tier->globals;
+        if (native) {
+            if (!tier->call(tier, index, r, result)) goto native_failed;
+            goto done;
+        }
+        profile = &tier->profiles[index];
+    }
+
+#if defined(__GNUC__)
+    static const void* const labels[BC_OPCODE_COUNT] = {
+        &&op_BC_MOV, &&op_BC_LOADK, &&op_BC_LOADG, &&op_BC_STOREG,
+        &&op_BC_ADD, &&op_BC_SUB, &&op_BC_MUL, &&op_BC_DIV,
+        &&op_BC_EQ, &&op_BC_NE, &&op_BC_LT, &&op_BC_GT, &&op_BC_LE, &&op_BC_GE,
+        &&op_BC_ADDK, &&op_BC_SUBK, &&op_BC_MULK, &&op_BC_DIVK,
+        &&op_BC_EQK, &&op_BC_NEK, &&op_BC_LTK, &&op_BC_GTK, &&op_BC_LEK, &&op_BC_GEK,
+        &&op_BC_JMP, &&op_BC_JZ, &&op_BC_JNZ,
+        &&op_BC_JEQ, &&op_BC_JNE, &&op_BC_JLT, &&op_BC_JGT, &&op_BC_JLE, &&op_BC_JGE,
+        &&op_BC_JEQK, &&op_BC_JNEK, &&op_BC_JLTK, &&op_BC_JGTK, &&op_BC_JLEK, &&op_BC_JGEK,
+        &&op_BC_SWITCH,
+        &&op_BC_CALL, &&op_BC_TAILCALL, &&op_BC_RET, &&op_BC_RETK
+    };
+#define VM_CASE(op) op_##op:
+#define NEXT() do { in = pc++; goto *labels[in->op]; } while (0)
+#define DISPATCH() NEXT();
+#define END_DISPATCH()
+#else
+#define VM_CASE(op) case op:
+#define NEXT() goto dispatch
+#define DISPATCH() dispatch: in = pc++; switch (in->op) {
+#define END_DISPATCH() default: goto trap; }
+#endif
+
+// Wrapping arithmetic, as in compiled code
+#define WRAP(op, x, y) ((int64_t)((uint64_t)(x) op (uint64_t)(y)))
+#define BINARY(op, expr) VM_CASE(op) r[in->a] = (expr); NEXT();
+#define JUMP_IF(op, cond) VM_CASE(op) \
+    if (cond) { \
+        if (profile) count_jump(profile, in, fn->code, true); \
+        pc = fn->code + in->c; \
+    } else if (profile) { \
+        count_jump(profile, in, fn->code, false); \
+    } \
+    NEXT();
+
+    DISPATCH()
+
+    VM_CASE(BC_MOV) r[in->a] = r[in->b]; NEXT();
+    VM_CASE(BC_LOADK) r[in->a] = in->k; NEXT();
+    VM_CASE(BC_LOADG) r[in->a] = globals[in->b]; NEXT();
+    VM_CASE(BC_STOREG) globals[in->a] = r[in->b]; NEXT();
+
+    BINARY(BC_ADD, WRAP(+, r[in->b], r[in->c]))
+    BINARY(BC_SUB, WRAP(-, r[in->b], r[in->c]))
+    BINARY(BC_MUL, WRAP(*, r[in->b], r[in->c]))
+    VM_CASE(BC_DIV)
+        if (r[in->c] == 0 || (r[in->b] == INT64_MIN && r[in->c] == -1)) goto trap;
+        r[in->a] = r[in->b] / r[in->c];
+        NEXT();
+    BINARY(BC_EQ, r[in->b] == r[in->c])
+    BINARY(BC_NE, r[in->b] != r[in->c])
+    BINARY(BC_LT, r[in->b] < r[in->c])
+    BINARY(BC_GT, r[in->b] > r[in->c])
+    BINARY(BC_LE, r[in->b] <= r[in->c])
+    BINARY(BC_GE, r[in->b] >= r[in->c])
+
+    BINARY(BC_ADDK, WRAP(+, r[in->b], in->k))
+    BINARY(BC_SUBK, WRAP(-, r[in->b], in->k))
+    BINARY(BC_MULK, WRAP(*, r[in->b], in->k))
+    VM_CASE(BC_DIVK)
+        if (in->k == 0 || (r[in->b] == INT64_MIN && in->k == -1)) goto trap;
+        r[in->a] = r[in->b] / in->k;
+        NEXT();
+    BINARY(BC_EQK, r[in->b] == in->k)
+    BINARY(BC_NEK, r[in->b] != in->k)
+    BINARY(BC_LTK, r[in->b] < in->k)
+    BINARY(BC_GTK, r[in->b] > in->k)
+    BINARY(BC_LEK, r[in->b] <= in->k)
+    BINARY(BC_GEK, r[in->b] >= in->k)
+
+    VM_CASE(BC_JMP)
+        if (profile && in->c <= in - fn->code) profile->back_edges++;
+        pc = fn->code + in->c;
+        NEXT();
+    JUMP_IF(BC_JZ, r[in->a] == 0)
+    JUMP_IF(BC_JNZ, r[in->a] != 0)
+    JUMP_IF(BC_JEQ, r[in->a] == r[in->b])
+    JUMP_IF(BC_JNE, r[in->a] != r[in->b])
+    JUMP_IF(BC_JLT, r[in->a] < r[in->b])
+    JUMP_IF(BC_JGT, r[in->a] > r[in->b])
+    JUMP_IF(BC_JLE, r[in->a] <= r[in->b])
+    JUMP_IF(BC_JGE, r[in->a] >= r[in->b])
+    JUMP_IF(BC_JEQK, r[in->a] == in->k)
+    JUMP_IF(BC_JNEK, r[in->a] != in->k)
+    JUMP_IF(BC_JLTK, r[in->a] < in->k)
+    JUMP_IF(BC_JGTK, r[in->a] > in->k)
+    JUMP_IF(BC_JLEK, r[in->a] <= in->k)
+    JUMP_IF(BC_JGEK, r[in->a] >= in->k)
+    VM_CASE(BC_SWITCH) {
+        // Only the targets of the table's jumps are read, never run
+        uint64_t index = (uint64_t)r[in->a] - (uint64_t)in->k;
+        pc = fn->code + (index < (uint64_t)in->b ? in[1 + index].c : in->c);
+        NEXT();
+    }
+
+    VM_CASE(BC_CALL) {
+        // The arguments already sit where the callee's parameters go
+        const BCFunction* callee = &functions[in->b];
+        int64_t* base = r + in->c;
+        if (tier) {
+            if (!enter(tier, (size_t)in->b, &native)) goto native_failed;
+            globals = tier->globals;
+            if (native) {
+                if (!tier->call(tier, (size_t)in->b, base, &value)) goto native_failed;
+                r[in->a] = value;
+                NEXT();
+            }
+            profile = &tier->profiles[in->b];
+        }
+        if (frame + 1 >= frame_limit || base + callee->frame_size > limit) goto overflow;
+        frame->return_pc = pc;
+        frame->base = r;
+        frame->fn = fn;
+        frame++;
+        calls++;
+        fn = callee;
+        r = base;
+        pc = fn->code;
+        NEXT();
+    }
+
+    VM_CASE(BC_TAILCALL) {
+        const BCFunction* callee = &functions[in->b];
+        if (tier) {
+            if (!enter(tier, (size_t)in->b, &native)) goto native_failed;
+            globals = tier->globals;
+            if (native) {
+                if (!tier->call(tier, (size_t)in->b, r + in->c, &value)) goto native_failed;
+                goto leave;
+            }
+            profile = &tier->profiles[in->b];
+        }
+        if (r + callee->frame_size > limit) goto overflow;
+        memmove(r, r + in->c, (size_t)in->k * sizeof(int64_t));
+        calls++;
+        fn = callee;
+        pc = fn->code;
+        NEXT();
+    }
+
+    VM_CASE(BC_RET)
+        value = r[in->a];
+        goto leave;
+    VM_CASE(BC_RETK)
+        value = in->k;
+        goto leave;
+
+    END_DISPATCH()
+
+leave:
+    if (frame == frames) {
+        *result = value;
+        goto done;
+    }
+    frame--;
+    pc = frame->return_pc;
+    r = frame->base;
+    fn = frame->fn;
+    if (profile) profile = &tier->profiles[fn - functions];
+    r[pc[-1].a] = value;
+    NEXT();
+
+trap:
+    status = VM_TRAP;
+    stats->function = fn->name;
+    goto done;
+
+overflow:
+    status = VM_STACK_OVERFLOW;
+    stats->function = fn->name;
+    goto done;
+
+native_failed:
+    status = VM_NATIVE_FAILED;
+    stats->function = fn->name;
+
+done:
+    stats->calls = calls;
+    free(owned);
+    return status;
+}
@@ -0,0 +1,35 @@
+// Several independent syntax errors. Each is reported once, in source
+// order, and the parser resumes at the next statement or declaration
+// without reporting the knock-on errors of the one before.
+
+int missing_semicolon() {
+    int x = 1
+    return x;
+}
+
+int bad_operand(int a) {
+    int y = a + * 2;
+    return y;
+}
+
+int unbalanced(int a) {
+    if (a > 1 {
+        return 2;
+    }
+    return a;
+}
+
+int unknown_operator(int a) {
+    return a[1];
+}
+
+int = 5;
+
+int fine(int a) {
+    return a + 1;
+}
+
+int main() {
+    int z = fine(1)) ;
+    return z;
+}
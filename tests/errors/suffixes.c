@@ -0,0 +1,16 @@
+// Integer suffixes other than u, l and ll, in either order and case, and
+// literals too large for 64 bits, each reported once
+
+int main() {
+    int a = 1uu;
+    int b = 1lul;
+    int c = 1uuu;
+    int d = 1lL;
+    int e = 0x10uLu;
+    int f = 12abc;
+    int g = 9223372036854775808;
+    int h = 0x10000000000000000;
+    int i = 02000000000000000000000;
+    int ok = 1ull + 2LLU + 3lu + 0xFFFFFFFFFFFFFFFF + 9223372036854775807;
+    return a + b + c + d + e + f + g + h + i + ok;
+}
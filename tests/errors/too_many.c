@@ -0,0 +1,63 @@
+// More errors than are reported: the first 50, then a note that the
+// parser stopped
+
+int f0() { return 1 +; }
+int f1() { return 1 +; }
+int f2() { return 1 +; }
+int f3() { return 1 +; }
+int f4() { return 1 +; }
+int f5() { return 1 +; }
+int f6() { return 1 +; }
+int f7() { return 1 +; }
+int f8() { return 1 +; }
+int f9() { return 1 +; }
+int f10() { return 1 +; }
+int f11() { return 1 +; }
+int f12() { return 1 +; }
+int f13() { return 1 +; }
+int f14() { return 1 +; }
+int f15() { return 1 +; }
+int f16() { return 1 +; }
+int f17() { return 1 +; }
+int f18() { return 1 +; }
+int f19() { return 1 +; }
+int f20() { return 1 +; }
+int f21() { return 1 +; }
+int f22() { return 1 +; }
+int f23() { return 1 +; }
+int f24() { return 1 +; }
+int f25() { return 1 +; }
+int f26() { return 1 +; }
+int f27() { return 1 +; }
+int f28() { return 1 +; }
+int f29() { return 1 +; }
+int f30() { return 1 +; }
+int f31() { return 1 +; }
+int f32() { return 1 +; }
+int f33() { return 1 +; }
+int f34() { return 1 +; }
+int f35() { return 1 +; }
+int f36() { return 1 +; }
+int f37() { return 1 +; }
+int f38() { return 1 +; }
+int f39() { return 1 +; }
+int f40() { return 1 +; }
+int f41() { return 1 +; }
+int f42() { return 1 +; }
+int f43() { return 1 +; }
+int f44() { return 1 +; }
+int f45() { return 1 +; }
+int f46() { return 1 +; }
+int f47() { return 1 +; }
+int f48() { return 1 +; }
+int f49() { return 1 +; }
+int f50() { return 1 +; }
+int f51() { return 1 +; }
+int f52() { return 1 +; }
+int f53() { return 1 +; }
+int f54() { return 1 +; }
+int f55() { return 1 +; }
+int f56() { return 1 +; }
+int f57() { return 1 +; }
+int f58() { return 1 +; }
+int f59() { return 1 +; }
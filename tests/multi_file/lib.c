@@ -0,0 +1,28 @@
+// Helpers with their own global state
+
+int counter = 0;
+
+int square(int x) {
+    return x * x;
+}
+
+int bump(int by) {
+    counter = counter + by;
+    return counter;
+}
+
+int counter_value() {
+    return counter;
+}
+
+int clamp(int x) {
+    if (x > 100) {
+        return 100;
+    }
+    return x;
+}
+
+// Reached only after clamp() has run, so the JIT compiles clamp() first
+int clamp_pair(int x) {
+    return clamp(x) + clamp(x + 50);
+}
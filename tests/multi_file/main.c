@@ -0,0 +1,13 @@
+// Calls across translation units, resolved by the builtin linker
+
+int total = 5;
+
+int main() {
+    int i = 0;
+    while (i < 10) {
+        total = total + square(i);
+        i = i + 1;
+    }
+    bump(7);
+    return total - counter_value() * 4 + clamp(300) - clamp_pair(60);
+}
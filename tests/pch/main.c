@@ -0,0 +1,13 @@
+// Macros, a global and a function from a precompiled header
+#include "prelude.h"
+#include "ops.h"
+
+int main() {
+    int total = 0;
+    int i = 0;
+    while (i < 10) {
+        total = total + APPLY(CLAMP, TWICE(i), STEP * 4);
+        i = i + 1;
+    }
+    return total + calls;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+#define TWICE(x) ((x) * 2)
+#define APPLY(f, ...) f(__VA_ARGS__)
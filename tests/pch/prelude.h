@@ -0,0 +1,21 @@
+// The header tests/run_tests.sh precompiles for this program. main.c
+// includes it as well, for cc; leancc skips that by its guard.
+#ifndef PRELUDE_H
+#define PRELUDE_H
+
+#include "ops.h"
+
+#define STEP 3
+#define CLAMP(x, hi) clamp(x, hi)
+
+int calls = 0;
+
+int clamp(int x, int hi) {
+    calls = calls + 1;
+    if (x > hi) {
+        return hi;
+    }
+    return x;
+}
+
+#endif // PRELUDE_H
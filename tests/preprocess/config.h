@@ -0,0 +1,14 @@
+// Guarded, and included more than once by main.c and by util.c
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "inc/limits.h"
+
+#define LEVEL 2
+#define SCALE 3
+#define SQUARE(x) ((x) * (x))
+#define MAX(a, b) max2(a, b)
+#define CAT(a, b) a ## b
+#define SUM(...) sum3(__VA_ARGS__)
+
+#endif // CONFIG_H
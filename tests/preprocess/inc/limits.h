@@ -0,0 +1,6 @@
+#pragma once
+
+// Found relative to this header; config.h is skipped by its guard
+#include "../config.h"
+
+#define LIMIT 40
@@ -0,0 +1,43 @@
+// Macros, conditional compilation and headers
+#include "config.h"
+#include "config.h"
+#include "inc/limits.h"
+
+int offset = 5;
+
+// Refers to itself, which expands only once
+#define offset (offset + 2)
+#define APPLY SQUARE
+
+#if LEVEL > 1 && defined(SCALE) && (7 % 4 == 3 ? 1 : 0)
+int mode = 2;
+#elif LEVEL == 1
+int mode = 1;
+#else
+int mode = 0;
+#endif
+
+#ifdef NOT_DEFINED
+this is not C @
+#if 1
+#endif
+#endif
+
+#define TEMP 9
+#undef TEMP
+#ifndef TEMP
+int temp = 1;
+#endif
+
+int line = __LINE__;
+
+int main() {
+    int value = 4;
+    int r = SQUARE(value + 1);
+    r = r + CAT(val, ue) * CAT(1, 2);
+    r = r + SUM(1, 2, 3);
+    r = r + MAX(SQUARE(2), 3) + APPLY(3);
+    r = r + offset + mode * 10 + temp;
+    r = r + scaled(2) - LIMIT;
+    return r + line / 10;
+}
@@ -0,0 +1,17 @@
+// Functions the macros of config.h expand to calls of
+#include "config.h"
+
+int max2(int a, int b) {
+    if (a > b) {
+        return a;
+    }
+    return b;
+}
+
+int sum3(int a, int b, int c) {
+    return a + b + c;
+}
+
+int scaled(int x) {
+    return x * SCALE + LIMIT;
+}
@@ -0,0 +1,160 @@
+#!/bin/sh
+# Compile every test program with leancc and with the system C compiler,
+# run both, and compare exit codes. Programs without main() are only
+# compiled to assembly. Each subdirectory of tests/ is one program built
+# from all of its .c files, and from its prelude.h precompiled if it has one,
+# except errors/: its programs must fail to compile, with the diagnostics in
+# their .expected files.
+#
+# Usage: tests/run_tests.sh <leancc> [-c | -S | --run | --jit] [extra leancc flags...]
+#
+# With -c or -S leancc writes an object or assembly file per source (one
+# for them all with -funity); a multi-file program is given to leancc as
+# its directory and gets them all from one run. leancc links several
+# objects itself, and the system C driver links anything else. With --run,
+# --jit or --tiered leancc runs each program in-process instead, and its
+# own exit code is compared.
+
+LEANCC=${1:-build/leancc}
+[ $# -gt 0 ] && shift
+LEANCC=$(cd "$(dirname "$LEANCC")" && pwd)/$(basename "$LEANCC")
+MODE=
+case "$1" in
+    -c) MODE=o; shift ;;
+    -S) MODE=s; shift ;;
+    --run|--jit|--tiered) MODE=run; RUN=$1; shift ;;
+esac
+TMP=${TMPDIR:-/tmp}/leancc-tests.$$
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+
+pass=0
+fail=0
+
+# build_with_leancc <name> <source... | directory>
+build_with_leancc() {
+    name=$1
+    shift
+    if [ -z "$MODE" ]; then
+        "$LEANCC" $FLAGS "$@" -o "$TMP/$name"
+        return
+    fi
+
+    flag=-c
+    [ "$MODE" = s ] && flag=-S
+    outputs=
+    if [ -d "$1" ]; then
+        # Outputs are named after the sources, in the current directory
+        program=$(cd "$1" && pwd)
+        mkdir -p "$TMP/$name.d"
+        (cd "$TMP/$name.d" && "$LEANCC" $FLAGS $flag "$program") || return 1
+        outputs=$(ls "$TMP/$name.d"/*.$MODE)
+    else
+        for src in "$@"; do
+            out="$TMP/$name.$(basename "$src" .c).$MODE"
+            "$LEANCC" $FLAGS $flag "$src" -o "$out" || return 1
+            outputs="$outputs $out"
+        done
+    fi
+    set -- $outputs
+    if [ "$MODE" = o ] && [ $# -gt 1 ]; then
+        "$LEANCC" $outputs -o "$TMP/$name"
+    else
+        cc -o "$TMP/$name" $outputs
+    fi
+}
+
+# run_test <name> <sources...>; leancc gets $PROGRAM_DIR instead when set
+run_test() {
+    name=$1
+    shift
+    cc -w -o "$TMP/$name.ref" "$@" || { echo "FAIL: $name (reference build)"; fail=$((fail + 1)); return; }
+    "$TMP/$name.ref"
+    expected=$?
+    [ -n "$PROGRAM_DIR" ] && set -- "$PROGRAM_DIR"
+
+    if [ "$MODE" = run ]; then
+        "$LEANCC" $FLAGS $RUN "$@"
+        actual=$?
+    elif ! build_with_leancc "$name" "$@"; then
+        echo "FAIL: $name (compile)"
+        fail=$((fail + 1))
+        return
+    else
+        "$TMP/$name"
+        actual=$?
+    fi
+
+    if [ "$actual" -eq "$expected" ]; then
+        pass=$((pass + 1))
+    else
+        echo "FAIL: $name (exit $actual, expected $expected)"
+        fail=$((fail + 1))
+    fi
+}
+
+FLAGS="$*"
+dir=$(dirname "$0")
+for src in "$dir"/*.c; do
+    name=$(basename "$src" .c)
+    if ! grep -q "main *(" "$src"; then
+        if "$LEANCC" $FLAGS -S "$src" -o "$TMP/$name.s"; then
+            pass=$((pass + 1))
+        else
+            echo "FAIL: $name (compile)"
+            fail=$((fail + 1))
+        fi
+        continue
+    fi
+    run_test "$name" "$src"
+done
+
+for program in "$dir"/*/; do
+    [ -d "$program" ] || continue
+    [ "$program" = "$dir/errors/" ] && continue
+    PROGRAM_DIR=$program
+    # A program with a prelude.h is built from it precompiled; its sources
+    # include it too, which cc needs
+    program_flags=$FLAGS
+    if [ -f "$program"prelude.h ]; then
+        pch="$TMP/$(basename "$program").pch"
+        if ! "$LEANCC" --emit-pch "$program"prelude.h -o "$pch"; then
+            echo "FAIL: $(basename "$program") (precompiled header)"
+            fail=$((fail + 1))
+            continue
+        fi
+        FLAGS="$FLAGS --include-pch $pch"
+    fi
+    run_test "$(basename "$program")" "$program"*.c
+    FLAGS=$program_flags
+    PROGRAM_DIR=
+done
+
+# Links to directories are not followed, so a program whose directory
+# links back to itself builds as if the links were not there
+linked="$TMP/linked.src"
+mkdir -p "$linked"
+cp "$dir"/multi_file/*.c "$linked"
+ln -s . "$linked/self"
+ln -s "$linked" "$linked/back"
+PROGRAM_DIR=$linked/
+run_test linked "$linked"/*.c
+PROGRAM_DIR=
+
+# Run from the directory so that diagnostics name the file as .expected does
+for src in "$dir"/errors/*.c; do
+    [ -f "$src" ] || continue
+    name=$(basename "$src" .c)
+    if (cd "$dir/errors" && "$LEANCC" $FLAGS -S "$name.c" -o "$TMP/$name.s") 2> "$TMP/$name.err"; then
+        echo "FAIL: errors/$name (compiled)"
+        fail=$((fail + 1))
+    elif ! diff -u "$dir/errors/$name.expected" "$TMP/$name.err"; then
+        echo "FAIL: errors/$name (diagnostics)"
+        fail=$((fail + 1))
+    else
+        pass=$((pass + 1))
+    fi
+done
+
+echo "$pass passed, $fail failed"
+[ "$fail" -eq 0 ]
@@ -0,0 +1,29 @@
+// Test calls with stack arguments, globals and division
+int counter = 3;
+
+int sum8(int a, int b, int c, int d, int e, int f, int g, int h) {
+    return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6 + g * 7 + h * 8;
+}
+
+int rotate(int a, int b, int c) {
+    // Arguments are passed on in a different order
+    return sum8(c, a, b, c, a, b, c, a) - sum8(a, b, c, a, b, c, a, b);
+}
+
+int bump(int n) {
+    counter = counter + n;
+    return counter;
+}
+
+int main() {
+    int x = 100;
+    int y = 7;
+    int q = x / y;
+    int r = x - q * y;
+    int big = 3000000000 / 1000;
+    
+    bump(q);
+    bump(r);
+    
+    return (rotate(1, 2, 3) + counter + big / 1000000) / 2;
+}
@@ -0,0 +1,76 @@
+// Compile-time evaluation of pure calls with constant arguments
+
+int scale = 3;
+int hits = 0;
+
+int triangle(int n) {
+    int sum = 0;
+    int i = 1;
+    while (i <= n) {
+        sum = sum + i;
+        i = i + 1;
+    }
+    return sum;
+}
+
+int gcd(int a, int b) {
+    while (b != 0) {
+        int t = b;
+        b = a - (a / b) * b;
+        a = t;
+    }
+    return a;
+}
+
+int is_even(int n) {
+    if (n == 0) {
+        return 1;
+    }
+    return is_odd(n - 1);
+}
+
+int is_odd(int n) {
+    if (n == 0) {
+        return 0;
+    }
+    return is_even(n - 1);
+}
+
+int depth(int n) {
+    if (n == 0) {
+        return 0;
+    }
+    return 1 + depth(n - 1);
+}
+
+int spin(int n) {
+    while (n > 0) {
+        n = n + 1;
+    }
+    return n;
+}
+
+int quotient(int a, int b) {
+    return a / b;
+}
+
+int scaled(int x) {
+    return x * scale;
+}
+
+int counted(int x) {
+    hits = hits + 1;
+    return x;
+}
+
+int main() {
+    int r = triangle(10) + gcd(84, 36) + is_even(7) + is_odd(7);
+    r = r + depth(5000) - 5000;
+    r = r + scaled(2) + counted(4) + hits;
+    scale = 1;
+    r = r + scaled(2);
+    if (r < 0) {
+        r = spin(1) + quotient(1, 0);
+    }
+    return r;
+}
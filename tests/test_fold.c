@@ -0,0 +1,30 @@
+// Constant folding and algebraic identities
+
+int calls = 0;
+
+int touch() {
+    calls = calls + 1;
+    return 7;
+}
+
+int scale(int x) {
+    return 2 * 3 + x * 1 - 0;
+}
+
+int main() {
+    int x = 5;
+    int a = scale(x);
+    int b = (x + 1) + 2 - 3;
+    int c = 4 * (x * 2) * 3;
+    int d = touch() * 0;
+    int e = x * 0 + x / 1 + 0 * x;
+    int f = 1 - 1 + (10 - 20) * 2;
+    int g = 0;
+    if (0) {
+        g = 1 / 0;
+    }
+    if (100 / 7 == 14) {
+        g = g + 3;
+    }
+    return a + b + c + d + e + f + g + calls;
+}
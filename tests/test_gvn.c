@@ -0,0 +1,68 @@
+// SSA construction, value numbering and dead code elimination
+
+int seed = 0;
+
+// Loop-carried values that swap every iteration
+int rotate(int n) {
+    int a = 1;
+    int b = 2;
+    int c = 3;
+    int i = 0;
+    while (i < n) {
+        int t = a;
+        a = b;
+        b = c;
+        c = t;
+        i = i + 1;
+    }
+    return a * 100 + b * 10 + c;
+}
+
+// The old value of x is still needed after the loop
+int last_before(int n) {
+    int x = 0;
+    int y = 0;
+    while (x < n) {
+        y = x;
+        x = x + 1;
+    }
+    return y * 10 + x;
+}
+
+// Redundant arithmetic and dead work in a hot loop
+int redundant(int n) {
+    int s = 0;
+    int i = 0;
+    while (i < n) {
+        int k = n * 4 + seed;
+        int j = seed + n * 4;
+        int unused = k * j - 7;
+        if (unused > 100) {
+            unused = unused / 3;
+        }
+        s = s + k - j + i;
+        i = i + 1;
+    }
+    return s;
+}
+
+// Phis at joins with and without an else branch
+int pick(int c) {
+    int x = 5;
+    int y = 0;
+    if (c > 2) {
+        x = 7;
+    }
+    if (c > 10) {
+        x = x + 1;
+        y = x;
+    } else {
+        x = x - 1;
+    }
+    return x * 10 + y;
+}
+
+int main() {
+    seed = 2;
+    return rotate(4) - 200 + last_before(3) + redundant(5) + pick(1) + pick(3) + pick(11);
+}
@@ -0,0 +1,67 @@
+// Hash-consing: identical subexpressions share one node, and must still
+// be evaluated again wherever their operands may have changed
+
+int g = 5;
+
+int bump() {
+    g = g + 1;
+    return g;
+}
+
+// Repeated subexpressions in one stretch of code
+int repeated(int a, int b) {
+    int x = (a + b) * (a + b) - (a - 1) * (a - 1);
+    int y = (a + b) * 3 + (a - 1);
+    return x + y + (a + b);
+}
+
+// Each assignment ends the sharing of reads before it
+int reassigned(int a) {
+    int t = a * 2 + 1;
+    a = a + 1;
+    int u = a * 2 + 1;
+    a = a * 2 + 1;
+    int v = a * 2 + 1;
+    return t * 10000 + u * 100 + v;
+}
+
+// A call may change a global between two reads of it
+int across_calls() {
+    int before = g * 2;
+    int bumped = bump();
+    int middle = bumped + g * 2;
+    int after = g * 2;
+    return before * 10000 + middle * 100 + after;
+}
+
+// A later declaration shadows the global from there on
+int shadowed() {
+    int first = g + 7;
+    int g = 100;
+    int second = g + 7;
+    return first * 1000 + second;
+}
+
+// Sharing does not cross control flow
+int branches(int a) {
+    int r = a + 3;
+    if (a > 2) {
+        a = a + 10;
+    }
+    r = r + (a + 3);
+    int i = 0;
+    while (i < a + 3) {
+        r = r + (i + 1) * (i + 1);
+        i = i + 1;
+    }
+    return r;
+}
+
+int main() {
+    int total = repeated(3, 4) + repeated(10, 0 - 2);
+    total = total + reassigned(6);
+    total = total + across_calls();
+    total = total + shadowed();
+    total = total + branches(1) + branches(5);
+    return total - (total / 256) * 256;
+}
@@ -0,0 +1,63 @@
+// Inlining of small callees, including ones with several returns and loops
+
+int bias = 0;
+
+int add(int a, int b) {
+    return a + b;
+}
+
+int clamp(int x, int lo, int hi) {
+    if (x < lo) {
+        return lo;
+    }
+    if (x > hi) {
+        return hi;
+    }
+    return x + bias;
+}
+
+int sum_to(int n) {
+    int s = 0;
+    while (n > 0) {
+        s = s + n;
+        n = n - 1;
+    }
+    return s;
+}
+
+int twice(int x) {
+    return add(x, x);
+}
+
+// Recursive and mutually recursive functions stay calls
+int factorial(int n) {
+    if (n <= 1) {
+        return 1;
+    }
+    return n * factorial(n - 1);
+}
+
+int is_even(int n) {
+    if (n == 0) {
+        return 1;
+    }
+    return is_odd(n - 1);
+}
+
+int is_odd(int n) {
+    if (n == 0) {
+        return 0;
+    }
+    return is_even(n - 1);
+}
+
+int main() {
+    bias = 1;
+    int total = 0;
+    int i = 0;
+    while (i < 10) {
+        total = add(total, clamp(i * 3, 4, 20));
+        i = i + 1;
+    }
+    return total + twice(sum_to(4)) + factorial(4) + is_even(7) + add(add(1, 2), add(3, 4));
+}
@@ -0,0 +1,32 @@
+/* Integer literals in every base, suffixes, long digit runs and
+   block comments; the lexer converts eight digits at a time */
+
+int hex() {
+    int a = 0x7f + 0XFF + 0xaBcD;
+    int b = 0x0000000000000000000000012345678 / 0x100000;
+    int c = 0x7EDCBA9876543210 / 0x1000000000000000;
+    return a + b + c;
+}
+
+int octal() {
+    return 0 + 07 + 010 + 0777 + 000000000000000000000000000000012;
+}
+
+int decimal() {
+    int a = 1234567890123456789 / 100000000000000000;
+    int b = 98765432109876 / 1000000000;
+    int c = 0000000001 + 12345678 + 87654321 - 99999999;
+    return a + b + c;
+}
+
+int suffixes() {
+    return 1u + 2U + 3l + 4L + 5ul + 6LL + 7ull;
+}
+
+int main() {
+    /* A comment
+       over several lines */
+    int total = hex() + octal() + decimal(); // and one to the end of the line
+    total = total + suffixes() /* between */ * 3;
+    return total - (total / 256) * 256;
+}
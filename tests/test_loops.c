@@ -0,0 +1,86 @@
+// Loop-invariant code motion, induction variable strength reduction and
+// shifts for powers of two
+
+int limit = 0;
+int factor = 0;
+int ticks = 0;
+
+int tick() {
+    ticks = ticks + 1;
+    return 1;
+}
+
+// Invariant loads and arithmetic, and a product of the counter
+int invariants(int n) {
+    int s = 0;
+    int i = 0;
+    while (i < n) {
+        s = s + limit * factor + i * factor + i * 4;
+        i = i + 1;
+    }
+    return s;
+}
+
+// A load that must stay in the loop: the global is stored in it
+int stored(int n) {
+    int s = 0;
+    int i = 0;
+    while (i < n) {
+        s = s + limit;
+        limit = limit + 1;
+        i = i + 1;
+    }
+    return s;
+}
+
+// A load that must stay in the loop: the call may store to it
+int called(int n) {
+    int s = 0;
+    while (n > 0) {
+        s = s + ticks + tick();
+        n = n - 2;
+    }
+    return s;
+}
+
+// Counting down, with the product on the other side
+int downward(int n) {
+    int s = 0;
+    while (n > 0) {
+        s = s + 3 * n;
+        n = n - 3;
+    }
+    return s;
+}
+
+// Division by powers of two rounds toward zero for negative dividends
+int halves(int n) {
+    int s = 0;
+    int i = 0 - n;
+    while (i < n) {
+        s = s + i / 2 + i / 8 * 3 + i / (0 - 4) + i * 16 / 1024;
+        i = i + 1;
+    }
+    return s;
+}
+
+int nested(int rows, int cols) {
+    int s = 0;
+    int r = 0;
+    while (r < rows) {
+        int c = 0;
+        while (c < cols) {
+            s = s + r * cols + c + (r + factor) * (c + 1);
+            c = c + 1;
+        }
+        r = r + 1;
+    }
+    return s;
+}
+
+int main() {
+    limit = 5;
+    factor = 3;
+    int total = invariants(10) + stored(4) + called(7) + downward(10);
+    return total + halves(37) + nested(6, 7);
+}
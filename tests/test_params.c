@@ -0,0 +1,46 @@
+// Test parameters that are never read, and more than fit in a register
+// or a 64-entry move set
+
+// b is never read, so its home must not be shared with a or c. The
+// loop keeps pick from being inlined, where the bug would not show.
+int pick(int a, int b, int c) {
+    int s = 0;
+    int k = 0;
+    while (k < 3) {
+        if (k == 0) { s = s + c * 3 - a * 2; }
+        if (k == 1) { s = s - c * 2 + a * 5; }
+        if (k == 2) { s = s - c * 4 + a * 9; }
+        if (s > 1000) { s = s - c * 7 + a; }
+        if (s < 0 - 1000) { s = s + c * 6 - a; }
+        k = k + 1;
+    }
+    return s + c * 4 - a * 13;
+}
+
+int first_last(int a, int b, int c, int d, int e, int f, int g, int h) {
+    return h * 2 + a;
+}
+
+int last_of_many(int p0, int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10, int p11, int p12, int p13, int p14, int p15, int p16, int p17, int p18, int p19, int p20, int p21, int p22, int p23, int p24, int p25, int p26, int p27, int p28, int p29, int p30, int p31, int p32, int p33, int p34, int p35, int p36, int p37, int p38, int p39, int p40, int p41, int p42, int p43, int p44, int p45, int p46, int p47, int p48, int p49, int p50, int p51, int p52, int p53, int p54, int p55, int p56, int p57, int p58, int p59, int p60, int p61, int p62, int p63, int p64, int p65, int p66, int p67, int p68, int p69) {
+    int s = 0;
+    int k = 0;
+    while (k < 3) {
+        if (k == 0) { s = s + p69 * 3 - p0 * 2; }
+        if (k == 1) { s = s - p64 * 2 + p1 * 5; }
+        if (k == 2) { s = s - p66 * 4 + p0 * 9; }
+        if (s > 1000) { s = s - p69 * 7 + p65; }
+        if (s < 0 - 1000) { s = s + p67 * 6 - p68; }
+        k = k + 1;
+    }
+    return s + p69 * 4 - p64 * 3;
+}
+
+int main() {
+    int total = pick(1, 2, 30);
+    int i = 0;
+    while (i < 3) {
+        total = total + pick(i, 100, i * 4) + first_last(i, 9, 9, 9, 9, 9, 9, 5);
+        i = i + 1;
+    }
+    return total + last_of_many(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70);
+}
@@ -0,0 +1,59 @@
+// Only the functions main() reaches are compiled into the executable:
+// chains of calls, mutual recursion and functions defined after their
+// callers are kept, while the unused ones below are dropped unprocessed
+
+int counter = 0;
+
+int unused_leaf(int x) {
+    return x * 3;
+}
+
+// An unreachable cycle
+int unused_ping(int n) {
+    if (n == 0) {
+        return unused_leaf(1);
+    }
+    return unused_pong(n - 1);
+}
+
+int unused_pong(int n) {
+    return unused_ping(n);
+}
+
+int bump(int amount) {
+    counter = counter + amount;
+    return counter;
+}
+
+int even(int n) {
+    if (n == 0) {
+        return 1;
+    }
+    return odd(n - 1);
+}
+
+int odd(int n) {
+    if (n == 0) {
+        return 0;
+    }
+    return even(n - 1);
+}
+
+int step(int n) {
+    bump(n);
+    return later(n) + even(n);
+}
+
+int main() {
+    int total = 0;
+    int i = 0;
+    while (i < 6) {
+        total = total + step(i);
+        i = i + 1;
+    }
+    return total + counter;
+}
+
+int later(int n) {
+    return n * n;
+}
@@ -0,0 +1,62 @@
+// Name resolution: locals shadowing globals, globals shared between
+// functions, calls to functions defined further down, and frames with
+// many slots
+
+int total = 0;
+int scale = 3;
+
+int add(int amount) {
+    total = total + amount * scale;
+    return total;
+}
+
+// A local of the same name hides the global in this function only
+int shadow(int x) {
+    int scale = 10;
+    int total = x * scale;
+    return total + scale;
+}
+
+// Called before their definitions
+int is_even(int n) {
+    if (n == 0) {
+        return 1;
+    }
+    return is_odd(n - 1);
+}
+
+int is_odd(int n) {
+    if (n == 0) {
+        return 0;
+    }
+    return is_even(n - 1);
+}
+
+// Parameters and locals in one frame, each in its own slot
+int many(int a, int b, int c) {
+    int d = a + b;
+    int e = b + c;
+    int f = c + a;
+    int g = d * e;
+    int h = e * f;
+    int i = f * d;
+    int j = g - h + i;
+    int k = 0;
+    while (k < 3) {
+        int m = k * 2;
+        j = j + m;
+        k = k + 1;
+    }
+    return j - a - b - c;
+}
+
+int main() {
+    add(2);
+    add(5);
+    scale = 1;
+    add(shadow(4));
+    int r = total;
+    r = r + is_even(10) * 100 + is_odd(7) * 200 + is_even(3) * 400;
+    r = r + many(1, 2, 3);
+    return r - (r / 256) * 256;
+}
@@ -0,0 +1,76 @@
+// Sparse conditional constant propagation: conditions that are constant
+// only once values are followed through assignments, branches and loops
+
+int g = 0;
+
+int mode() {
+    int debug = 0;
+    int level = debug * 10 + 2;
+    if (level > 5) {
+        g = g + 100;
+        return 1;
+    }
+    return 2;
+}
+
+// The assignment in the dead arm must not spoil the constant at the merge
+int merge(int x) {
+    int k = 4;
+    if (k == 3) {
+        k = x;
+    }
+    int limit = k * 2;
+    int total = 0;
+    int i = 0;
+    while (i < limit) {
+        total = total + i + x;
+        i = i + 1;
+    }
+    return total;
+}
+
+// A value that stays constant around a loop
+int loop_invariant(int n) {
+    int flag = 1;
+    int sum = 0;
+    int i = 0;
+    while (i < n) {
+        if (flag == 1) {
+            sum = sum + i;
+        } else {
+            sum = sum - 1000;
+            flag = 0;
+        }
+        i = i + 1;
+    }
+    return sum;
+}
+
+// A loop whose condition is false on entry never runs
+int never(int x) {
+    int n = 0;
+    while (n > 0) {
+        x = x / n;
+        n = n - 1;
+    }
+    return x + n;
+}
+
+// Division by a constant zero on a dead path must not be folded away
+// into a trap, and one on a live path is left for run time
+int guarded(int x) {
+    int d = 0;
+    if (d != 0) {
+        return x / d;
+    }
+    return x + 1;
+}
+
+int main() {
+    int a = mode();
+    int b = merge(3);
+    int c = loop_invariant(10);
+    int d = never(7);
+    int e = guarded(41);
+    return a + b + c + d + e + g;
+}
@@ -0,0 +1,122 @@
+// Switch statements: dense runs that become jump tables, sparse cases
+// found by compares, fallthrough, defaults anywhere, and break
+
+// Dense 0..9 with holes that go to the default
+int dense(int x) {
+    int r = 0;
+    switch (x) {
+        case 0: r = 3; break;
+        case 1: r = 5; break;
+        case 2: r = 7; break;
+        case 4: r = 11; break;
+        case 5: r = 13; break;
+        case 6: r = 17; break;
+        case 8: r = 19; break;
+        case 9: r = 23; break;
+        default: r = 1; break;
+    }
+    return r;
+}
+
+// Far apart, at the ends of 32 bits and below zero; no default
+int sparse(int x) {
+    int r = 2;
+    switch (x) {
+        case 0 - 70000: r = 41; break;
+        case 0 - 3: r = 43; break;
+        case 12: r = 47; break;
+        case 900: r = 53; break;
+        case 77777: r = 59; break;
+        case 2147483646: r = 61; break;
+        case 2147483647: r = 67; break;
+    }
+    return r;
+}
+
+// A table in the middle of sparse cases, with fallthrough between labels
+int mixed(int x) {
+    int r = 0;
+    switch (x * 2) {
+        case 0 - 1000: r = 1;
+        case 100: r = r + 2; break;
+        case 200: r = 4;
+        case 202: r = r + 8;
+        case 204: r = r + 16; break;
+        case 206: return 32;
+        case 208: r = 64; break;
+        default: r = 128;
+        case 100000: r = r + 256; break;
+    }
+    return r;
+}
+
+// A default first, and break inside a loop inside a switch
+int nested(int a, int b) {
+    int r = 0;
+    int i = 0;
+    switch (a) {
+        default:
+            r = 1000;
+            break;
+        case 1:
+            i = 0;
+            while (i < 100) {
+                switch (b) {
+                    case 0: r = r + 1; break;
+                    case 1: r = r + 2; break;
+                    case 2: r = r + 3; break;
+                    case 3: r = r + 4; break;
+                }
+                if (i == b + 5) {
+                    break;
+                }
+                i = i + 1;
+            }
+            r = r + i;
+            break;
+        case 2:
+            r = 500;
+    }
+    return r;
+}
+
+// A switch whose value is known after inlining and constant propagation
+int fixed() {
+    int mode = 3;
+    switch (mode) {
+        case 1: return 10;
+        case 3: return 30;
+        case 5: return 50;
+        case 7: return 70;
+        case 9: return 90;
+    }
+    return 0;
+}
+
+int main() {
+    int total = 0;
+    int i = 0;
+    while (i < 12) {
+        total = total + dense(i) * (i + 1);
+        i = i + 1;
+    }
+    total = total + sparse(0 - 70000) + sparse(0 - 3) + sparse(12) + sparse(900);
+    total = total + sparse(77777) + sparse(2147483646) + sparse(2147483647) + sparse(13);
+    i = 0 - 600;
+    while (i < 51000) {
+        total = total + mixed(i);
+        i = i + 1;
+    }
+    total = total + nested(0, 0) + nested(1, 0) + nested(1, 2) + nested(1, 7) + nested(2, 1);
+    total = total + fixed();
+    while (1) {
+        switch (total) {
+            case 0: total = 1; break;
+            default: total = total + 1;
+        }
+        if (total > 0) {
+            break;
+        }
+    }
+    return total - (total / 251) * 251;
+}
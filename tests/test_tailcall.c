@@ -0,0 +1,68 @@
+// Self tail calls turned into loops, with and without an accumulator
+
+int calls = 0;
+
+int gcd(int a, int b) {
+    if (b == 0) {
+        return a;
+    }
+    int q = a / b;
+    return gcd(b, a - q * b);
+}
+
+int factorial(int n) {
+    if (n <= 1) {
+        return 1;
+    }
+    return n * factorial(n - 1);
+}
+
+// Deep enough to need constant stack space in small stacks
+int sum_to(int n) {
+    if (n == 0) {
+        return 0;
+    }
+    return sum_to(n - 1) + n;
+}
+
+// Only the second call is in tail position
+int fib(int n) {
+    if (n < 2) {
+        return n;
+    }
+    return fib(n - 1) + fib(n - 2);
+}
+
+int count(int n) {
+    calls = calls + 1;
+    return n;
+}
+
+// The operand has side effects that must happen in order
+int tally(int n) {
+    if (n == 0) {
+        return calls;
+    }
+    return count(n) + tally(n - 1);
+}
+
+// Returns with different operators: only one kind gets the accumulator
+int mixed(int n, int k) {
+    if (n < 1) {
+        return k;
+    }
+    if (k > 50) {
+        return 2 * mixed(n - 1, k - 40);
+    }
+    if (k > 20) {
+        return mixed(n - 1, k + 3) + 1;
+    }
+    return mixed(n - 1, k + 7);
+}
+
+int main() {
+    calls = 1;
+    int total = gcd(calls * 1071, 462) + factorial(calls + 5) + fib(calls + 9);
+    total = total + sum_to(calls * 60000) / 1000000 + tally(calls + 9) + mixed(calls + 11, 2);
+    return total;
+}
@@ -0,0 +1,20 @@
+// Called only from main.c
+
+int twice(int x) {
+    return x * 2;
+}
+
+int offset(int x) {
+    return x + 4;
+}
+
+int is_even(int n) {
+    if (n == 0) {
+        return 1;
+    }
+    return is_odd(n - 1);
+}
+
+int never_called(int x) {
+    return x * 5;
+}
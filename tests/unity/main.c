@@ -0,0 +1,21 @@
+// Calls both ways between two units: helpers small enough to inline
+// into the other file, and recursion that goes back and forth between them
+
+int scale = 3;
+
+int is_odd(int n) {
+    if (n == 0) {
+        return 0;
+    }
+    return is_even(n - 1);
+}
+
+int main() {
+    int total = 0;
+    int i = 0;
+    while (i < 9) {
+        total = total + twice(i) + is_even(i);
+        i = i + 1;
+    }
+    return total + offset(scale) + is_odd(7);
+}